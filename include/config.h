@@ -232,6 +232,73 @@
 #define SPAMFILTER_DETECTSLOW
 #endif
 
+/* Password hashes (argon2, bcrypt and crypt) are verified by a small
+ * pool of auth threads, so a burst of connects to a password protected
+ * allow block or a couple of /OPER's will not freeze the main loop.
+ * AUTH_THREADS is the number of threads in that pool.
+ * Results are remembered in a small cache of AUTH_CACHE_SIZE entries:
+ * correct passwords for AUTH_CACHE_TTL seconds and incorrect ones for
+ * AUTH_CACHE_NEGATIVE_TTL seconds. Only a keyed SHA256 digest of the
+ * password is stored in the cache, never the password itself.
+ */
+#define AUTH_THREADS			4
+#define AUTH_CACHE_SIZE			1024
+#define AUTH_CACHE_TTL			3600
+#define AUTH_CACHE_NEGATIVE_TTL		60
+
+/* Number of threads that run regex spamfilters when
+ * set::spamfilter::async is enabled.
+ */
+#define SPAMFILTER_THREADS		4
+
+/* I/O scheduling: to keep one busy connection (eg: a server link that is
+ * bursting, or a flooding client) from stalling everyone else, each
+ * connection may only read IO_READ_BUDGET_* bytes and have IO_LINE_BUDGET_*
+ * lines parsed in one go. Whatever is left is processed in the next
+ * round, with server links first, then opers, users and unknown
+ * connections. Users are normally limited much earlier by fake lag.
+ */
+#define IO_READ_BUDGET_SERVER		131072
+#define IO_READ_BUDGET_OPER		32768
+#define IO_READ_BUDGET_USER		16384
+#define IO_READ_BUDGET_UNKNOWN		8192
+#define IO_LINE_BUDGET_SERVER		1000
+#define IO_LINE_BUDGET_OPER		200
+#define IO_LINE_BUDGET_USER		50
+#define IO_LINE_BUDGET_UNKNOWN		20
+
+/* Memory budget (set::memory-budget): a pressure level is only left
+ * once usage is MEMORY_BUDGET_HYSTERESIS percent below its threshold.
+ * Under pressure, channel history is shrunk by a factor of
+ * MEMORY_PRESSURE_HISTORY_DIVISOR, and unknown clients and users with
+ * a reputation score below MEMORY_PRESSURE_LOW_REPUTATION may only
+ * have MEMORY_PRESSURE_SENDQ bytes in their sendq.
+ */
+#define MEMORY_BUDGET_HYSTERESIS	5
+#define MEMORY_PRESSURE_HISTORY_DIVISOR	4
+#define MEMORY_PRESSURE_SENDQ		16384
+#define MEMORY_PRESSURE_LOW_REPUTATION	10
+
+/* Snomask aggregation (set::snomask-aggregation): number of different
+ * networks (/16 for IPv4, /32 for IPv6) that are listed in a summary,
+ * the rest is shown as "other".
+ */
+#define SNOMASK_AGGREGATION_NETWORKS	5
+
+/* Latency tracing (set::latency-sample-rate): number of histogram
+ * buckets, these go up by a factor 10 starting at 10 microseconds.
+ * A trace is abandoned if not all copies of the message have been
+ * written within LATENCY_TRACE_TIMEOUT seconds.
+ */
+#define LATENCY_BUCKETS			7
+#define LATENCY_TRACE_TIMEOUT		10
+
+/* PROXY protocol (listen::options::proxy): maximum size of the
+ * version 2 header, including the address and all TLV's.
+ * Connections that send a bigger header are refused.
+ */
+#define PROXY_HEADER_MAX		1024
+
 /* Maximum number of ModData objects that may be attached to an object */
 /* UnrealIRCd 4.0.0 - 4.0.13:  8,    8, 4, 4
  * UnrealIRCd 4.0.14+       : 12,    8, 4, 4
@@ -140,6 +140,13 @@ struct Configuration {
 	long spamfilter_detectslow_warn;
 	long spamfilter_detectslow_fatal;
 	int spamfilter_stop_on_first_match;
+	int spamfilter_async;
+	long spamfilter_async_timeout;
+	long long memory_budget;
+	int memory_budget_threshold[MEMORY_PRESSURE_LEVELS];
+	int snomask_aggregation_threshold;
+	long snomask_aggregation_interval;
+	int latency_sample_rate;
 	int maxbans;
 	int maxbanlength;
 	int watch_away_notification;
@@ -269,6 +276,12 @@ extern MODVAR int ipv6_disabled;
 #define SPAMFILTER_DETECTSLOW_WARN	iConf.spamfilter_detectslow_warn
 #define SPAMFILTER_DETECTSLOW_FATAL	iConf.spamfilter_detectslow_fatal
 #define SPAMFILTER_STOP_ON_FIRST_MATCH	iConf.spamfilter_stop_on_first_match
+#define SPAMFILTER_ASYNC		iConf.spamfilter_async
+#define SPAMFILTER_ASYNC_TIMEOUT	iConf.spamfilter_async_timeout
+#define MEMORY_BUDGET			iConf.memory_budget
+#define SNOMASK_AGGREGATION_THRESHOLD	iConf.snomask_aggregation_threshold
+#define SNOMASK_AGGREGATION_INTERVAL	iConf.snomask_aggregation_interval
+#define LATENCY_SAMPLE_RATE		iConf.latency_sample_rate
 
 #define CHECK_TARGET_NICK_BANS	iConf.check_target_nick_bans
 
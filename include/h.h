@@ -35,9 +35,9 @@ extern char *getreply(int);
 #define rpl_str(x) getreply(x)
 #define err_str(x) getreply(x)
 extern MODVAR Member *freemember;
-extern MODVAR Membership *freemembership;
 extern MODVAR Client me;
 extern MODVAR Channel *channels;
+extern MODVAR unsigned int channel_visibility_version;
 extern MODVAR ModData local_variable_moddata[MODDATA_MAX_LOCAL_VARIABLE];
 extern MODVAR ModData global_variable_moddata[MODDATA_MAX_GLOBAL_VARIABLE];
 extern MODVAR IRCStatistics ircstats;
@@ -48,6 +48,8 @@ extern MODVAR char cmodestring[512];
 extern MODVAR char umodestring[UMODETABLESZ+1];
 /* newconf */
 #define get_sendq(x) ((x)->local->class ? (x)->local->class->sendq : DEFAULT_SENDQ)
+#define IsLossyClass(x) ((x)->local->class && ((x)->local->class->options & CLASS_OPT_LOSSY))
+#define get_soft_sendq(x) ((x)->local->class->soft_sendq ? (x)->local->class->soft_sendq : (x)->local->class->sendq / 2)
 /* get_recvq is only called in send.c for local connections */
 #define get_recvq(x) ((x)->local->class->recvq ? (x)->local->class->recvq : DEFAULT_RECVQ)
 
@@ -124,7 +126,7 @@ extern ConfigItem_oper		*find_oper(char *name);
 extern ConfigItem_operclass	*find_operclass(char *name);
 extern ConfigItem_listen *find_listen(char *ipmask, int port, int ipv6);
 extern ConfigItem_sni *find_sni(char *name);
-extern ConfigItem_ulines	*find_uline(char *host);
+extern ConfigItem_ulines	*find_uline(const char *host);
 extern ConfigItem_except	*find_except(Client *, short type);
 extern ConfigItem_tld		*find_tld(Client *cptr);
 extern ConfigItem_link		*find_link(char *servername, Client *acptr);
@@ -132,6 +134,12 @@ extern ConfigItem_ban 		*find_ban(Client *, char *host, short type);
 extern ConfigItem_ban 		*find_banEx(Client *,char *host, short type, short type2);
 extern ConfigItem_vhost	*find_vhost(char *name);
 extern ConfigItem_deny_channel *find_channel_allowed(Client *cptr, char *name);
+extern ConfigItem_deny_channel *find_channel_allowed_ex(Client *client, char *name, Channel *channel);
+extern void build_channel_rules(void);
+extern void free_channel_rules(void);
+extern ConfigItem_allow	**find_allow_candidates(Client *client, const char *username, char *sockhost);
+extern void build_allow_index(void);
+extern void free_allow_index(void);
 extern ConfigItem_alias	*find_alias(char *name);
 extern ConfigItem_help 	*find_Help(char *command);
 
@@ -187,14 +195,39 @@ extern Ban *is_banned(Client *, Channel *, int, char **, char **);
 extern Ban *is_banned_with_nick(Client *, Channel *, int, char *, char **, char **);
 
 extern void ircd_log(int, FORMAT_STRING(const char *), ...) __attribute__((format(printf,2,3)));
-extern Client *find_client(char *, Client *);
+extern Client *find_client(const char *, Client *);
 extern Client *find_name(char *, Client *);
 extern Client *find_nickserv(char *, Client *);
 extern Client *find_person(char *, Client *);
-extern Client *find_server(char *, Client *);
+extern Client *find_server(const char *, Client *);
 extern Client *find_service(char *, Client *);
 #define find_server_quick(x) find_server(x, NULL)
-extern char *find_or_add(char *);
+extern const char *find_or_add(const char *name);
+extern const char *scache_add(const char *str);
+extern const char *scache_addn(const char *str, size_t len);
+extern void scache_del(const char *str);
+/** Set 'dst' to a shared copy of 'str' (see scache_add()), releasing the old value */
+#define scache_set(dst,str) do { const char *scache_tmp_ = (str) ? scache_add(str) : NULL; if (dst) scache_del(dst); dst = scache_tmp_; } while(0)
+/** Same as scache_set() but 'str' is cut off after 'len' characters */
+#define scache_setn(dst,str,len) do { const char *scache_tmp_ = scache_addn(str, len); if (dst) scache_del(dst); dst = scache_tmp_; } while(0)
+/** Release a string from scache_add() and set the pointer to NULL */
+#define scache_free(x) do { if (x) scache_del(x); x = NULL; } while(0)
+/* zip.c: compressed server links */
+/** Version of the preset dictionary, sent as PROTOCTL ZIP=<version>.
+ * Both sides must use the exact same dictionary, so bump this
+ * whenever the dictionary in zip.c changes.
+ */
+#define ZIP_DICTIONARY_VERSION	1
+extern int zip_start_output(Client *client);
+extern int zip_start_input(Client *client);
+extern void zip_output(Client *client, char *msg, int len);
+extern void zip_flush(Client *client);
+extern int zip_input(Client *client, char *buf, int len);
+extern void zip_free(Client *client);
+extern ZipStats *zip_get_stats(Client *client);
+/* proxy.c: PROXY protocol (listen::options::proxy) */
+extern void proxy_start(Client *client);
+extern void proxy_free(Client *client);
 extern void inittoken();
 extern void reset_help();
 
@@ -238,6 +271,36 @@ extern void server_reboot(char *);
 extern void terminate(), write_pidfile();
 extern void *safe_alloc(size_t size);
 extern void set_socket_buffers(int fd, int rcvbuf, int sndbuf);
+extern MODVAR int io_backlog;
+extern MODVAR MemoryPressure memory_pressure;
+extern MODVAR long long memory_accounted[MEMORY_ACCOUNTS];
+extern MODVAR long memory_objects[MEMORY_ACCOUNTS];
+extern void memory_account(MemoryAccount type, long long bytes);
+extern void module_memory_account(Module *module, long long bytes);
+extern ModuleMemory *module_memory_find(char *name);
+extern long long moddata_memory_usage(Module *module);
+extern char *memory_pressure_name(MemoryPressure level);
+extern char *memory_account_name(MemoryAccount type);
+extern long long memory_budget_usage(void);
+extern int memory_budget_percentage(void);
+extern int memory_pressure_history_lines(int max_lines);
+extern int memory_pressure_drop_snomask(long snomask);
+extern MODVAR long snomask_subscribed;
+extern int snomask_aggregate(long snomask, const char *ip);
+extern int memory_pressure_sendq_exceeded(Client *client);
+extern int memory_pressure_refuse_connection(void);
+extern MODVAR int latency_tracing;
+extern MODVAR LatencyHistogram latency_histogram[LATENCY_STAGES];
+extern MODVAR long latency_traces;
+extern MODVAR long latency_traces_abandoned;
+extern char *latency_stage_name(LatencyStage stage);
+extern void latency_trace_start(Client *client);
+extern void latency_trace_mark(LatencyStage stage);
+extern void latency_trace_enqueue(Client *to);
+extern void latency_trace_end(void);
+extern void latency_trace_written(Client *to, int bytes);
+extern int get_io_line_budget(Client *client);
+extern void io_runqueue_add(Client *client);
 extern int send_queued(Client *);
 extern void send_queued_cb(int fd, int revents, void *data);
 extern void sendto_connectnotice(Client *client, int disconnect, char *comment);
@@ -287,10 +350,12 @@ extern char *myctime(time_t);
 extern char *short_date(time_t, char *buf);
 extern char *long_date(time_t);
 extern void exit_client(Client *client, MessageTag *recv_mtags, char *comment);
+extern void exit_client_bulk_start(void);
+extern void exit_client_bulk_end(void);
 extern void initstats(), tstats(Client *, char *);
 extern char *check_string(char *);
-extern char *make_nick_user_host(char *, char *, char *);
-extern char *make_nick_user_host_r(char *namebuf, char *nick, char *name, char *host);
+extern char *make_nick_user_host(const char *, const char *, const char *);
+extern char *make_nick_user_host_r(char *namebuf, const char *nick, const char *name, const char *host);
 extern char *make_user_host(char *, char *);
 extern void parse(Client *cptr, char *buffer, int length);
 extern int hunt_server(Client *, MessageTag *, char *, int, int, char **);
@@ -344,6 +409,7 @@ extern uint64_t siphash_nocase(const char *in, const char *k);
 extern void siphash_generate_key(char *k);
 extern void init_hash(void);
 uint64_t hash_whowas_name(const char *name);
+extern uint64_t hash_tkl_name(const char *name);
 extern int add_to_client_hash_table(char *, Client *);
 extern int del_from_client_hash_table(char *, Client *);
 extern int add_to_id_hash_table(char *, Client *);
@@ -447,10 +513,18 @@ extern AuthenticationType Auth_FindType(char *hash, char *type);
 extern AuthConfig	*AuthBlockToAuthConfig(ConfigEntry *ce);
 extern void		Auth_FreeAuthConfig(AuthConfig *as);
 extern int		Auth_Check(Client *cptr, AuthConfig *as, char *para);
+extern int		Auth_CheckAsync(Client *client, AuthConfig *as, char *para, char *cmd, MessageTag *mtags, int parc, char *parv[]);
+extern void		Auth_CancelAsync(Client *client);
+extern int spamfilter_async_park(Client *client, char *cmd, MessageTag *mtags, int parc, char *parv[]);
+extern char *spamfilter_async_verdict(Client *client, char *str);
+extern void spamfilter_async_invalidate(void);
+extern void spamfilter_async_check_timeouts(void);
+extern void spamfilter_async_cancel(Client *client);
 extern char   		*Auth_Hash(int type, char *para);
 extern int   		Auth_CheckError(ConfigEntry *ce);
 
-extern void make_cloakedhost(Client *client, char *curr, char *buf, size_t buflen);
+extern void make_cloakedhost(Client *client, const char *curr, char *buf, size_t buflen);
+extern void update_cloakedhost(Client *client);
 extern int  channel_canjoin(Client *client, char *name);
 extern char *collapse(char *pattern);
 extern void dcc_sync(Client *client);
@@ -551,6 +625,7 @@ extern char *our_strdup(const char *str);
 extern char *our_strldup(const char *str, size_t max);
 
 extern MODFUNC char  *tls_get_cipher(SSL *ssl);
+extern char *tls_get_client_cipher(Client *client);
 extern TLSOptions *get_tls_options_for_client(Client *acptr);
 extern int outdated_tls_client(Client *acptr);
 extern char *outdated_tls_client_build_string(char *pattern, Client *acptr);
@@ -601,6 +676,7 @@ extern int unreal_copyfileex(const char *src, const char *dest, int tryhardlink)
 extern time_t unreal_getfilemodtime(const char *filename);
 extern void unreal_setfilemodtime(const char *filename, time_t mtime);
 extern void DeleteTempModules(void);
+extern MODVAR Module *Modules;
 extern MODVAR Extban *extbaninfo;
 extern Extban *findmod_by_bantype(char c);
 extern Extban *ExtbanAdd(Module *reserved, ExtbanInfo req);
@@ -624,6 +700,8 @@ extern Channel *get_channel(Client *cptr, char *chname, int flag);
 extern MODVAR char backupbuf[];
 extern void add_invite(Client *, Client *, Channel *, MessageTag *);
 extern void channel_modes(Client *cptr, char *mbuf, char *pbuf, size_t mbuf_size, size_t pbuf_size, Channel *channel);
+extern void channel_modes_changed(Channel *channel);
+extern void membership_changed(Client *client);
 extern MODVAR char modebuf[BUFSIZE], parabuf[BUFSIZE];
 extern int op_can_override(char *acl, Client *client,Channel *channel,void* extra);
 extern Client *find_chasing(Client *client, char *user, int *chasing);
@@ -643,8 +721,14 @@ extern int callbacks_check(void);
 extern void callbacks_switchover(void);
 extern int efunctions_check(void);
 extern void efunctions_switchover(void);
-extern char *encode_ip(char *);
+extern char *encode_ip(const char *);
 extern char *decode_ip(char *);
+extern int ip_to_raw(const char *ip, unsigned char *raw);
+extern int raw_ip_is_ipv4(const unsigned char *raw);
+extern void raw_ip_prefix(unsigned char *dst, const unsigned char *raw, int bits);
+extern int raw_ip_match(const unsigned char *a, const unsigned char *b, int bits);
+extern uint64_t hash_raw_ip(const unsigned char *raw, int bits, const char *key);
+extern void set_client_ip(Client *client, const char *ip);
 extern void sendto_fconnectnotice(Client *client, int disconnect, char *comment);
 extern void sendto_one_nickcmd(Client *server, Client *client, char *umodes);
 extern int on_dccallow_list(Client *to, Client *from);
@@ -657,7 +741,9 @@ extern void isupport_init(void);
 extern void clicap_init(void);
 extern void efunctions_init(void);
 extern void do_cmd(Client *client, MessageTag *mtags, char *cmd, int parc, char *parv[]);
-extern MODVAR char *me_hash;
+extern void do_cmd_resume(Client *client, MessageTag *mtags, char *cmd, int parc, char *parv[]);
+extern int command_lookup_flags(Client *client);
+extern MODVAR const char *me_hash;
 extern MODVAR int dontspread;
 extern MODVAR int labeled_response_inhibit;
 extern MODVAR int labeled_response_inhibit_end;
@@ -671,7 +757,7 @@ extern MODVAR void (*do_mode)(Channel *channel, Client *client, MessageTag *mtag
 extern MODVAR void (*set_mode)(Channel *channel, Client *cptr, int parc, char *parv[], u_int *pcount,
     char pvar[MAXMODEPARAMS][MODEBUFLEN + 3], int bounce);
 extern MODVAR void (*cmd_umode)(Client *, MessageTag *, int, char **);
-extern MODVAR int (*register_user)(Client *client, char *nick, char *username, char *umode, char *virthost, char *ip);
+extern MODVAR int (*register_user)(Client *client, char *nick, const char *username, char *umode, char *virthost, char *ip);
 extern MODVAR int (*tkl_hash)(unsigned int c);
 extern MODVAR char (*tkl_typetochar)(int type);
 extern MODVAR int (*tkl_chartotype)(char c);
@@ -701,6 +787,7 @@ extern MODVAR int (*find_spamfilter_user)(Client *client, int flags);
 extern MODVAR TKL *(*find_qline)(Client *cptr, char *nick, int *ishold);
 extern MODVAR TKL *(*find_tkline_match_zap)(Client *cptr);
 extern MODVAR void (*tkl_stats)(Client *cptr, int type, char *para);
+extern MODVAR int (*tkl_stats_ex)(Client *client, int type, char *para, TKLStatsCursor *cursor, int max);
 extern MODVAR void (*tkl_sync)(Client *client);
 extern MODVAR void (*cmd_tkl)(Client *client, MessageTag *recv_mtags, int parc, char *parv[]);
 extern MODVAR int (*place_host_ban)(Client *client, BanAction action, char *reason, long duration);
@@ -740,7 +827,7 @@ extern MODVAR char *(*mtags_to_string)(MessageTag *m, Client *acptr);
 extern MODVAR int (*can_send_to_channel)(Client *cptr, Channel *channel, char **msgtext, char **errmsg, int notice);
 extern MODVAR void (*broadcast_md_globalvar)(ModDataInfo *mdi, ModData *md);
 extern MODVAR void (*broadcast_md_globalvar_cmd)(Client *except, Client *sender, char *varname, char *value);
-extern MODVAR int (*tkl_ip_hash)(char *ip);
+extern MODVAR int (*tkl_ip_hash)(const char *ip);
 extern MODVAR int (*tkl_ip_hash_type)(int type);
 extern MODVAR int (*find_tkl_exception)(int ban_type, Client *cptr);
 extern MODVAR int (*del_silence)(Client *client, const char *mask);
@@ -772,7 +859,11 @@ extern int find_invex(Channel *channel, Client *client);
 extern void DoMD5(char *mdout, const char *src, unsigned long n);
 extern char *md5hash(char *dst, const char *src, unsigned long n);
 extern MODVAR TKL *tklines[TKLISTLEN];
+extern MODVAR TKLStatsCursor *tkl_stats_cursors;
+extern void tkl_stats_cursor_end(TKLStatsCursor *cursor);
 extern MODVAR TKL *tklines_ip_hash[TKLIPHASHLEN1][TKLIPHASHLEN2];
+extern MODVAR TKL *tklines_name_hash[TKLNAMEHASHLEN];
+extern MODVAR TKL *tklines_name_wild[2];
 extern char *cmdname_by_spamftarget(int target);
 extern void unrealdns_delreq_bycptr(Client *cptr);
 extern void sendtxtnumeric(Client *to, FORMAT_STRING(const char *pattern), ...) __attribute__((format(printf,2,3)));
@@ -780,10 +871,10 @@ extern void unrealdns_gethostbyname_link(char *name, ConfigItem_link *conf, int
 extern void unrealdns_delasyncconnects(void);
 extern int is_autojoin_chan(char *chname);
 extern void unreal_free_hostent(struct hostent *he);
-extern struct hostent *unreal_create_hostent(char *name, char *ip);
+extern struct hostent *unreal_create_hostent(char *name, const char *ip);
 extern char *unreal_time_sync_error(void);
 extern int unreal_time_synch(int timeout);
-extern char *getcloak(Client *client);
+extern const char *getcloak(Client *client);
 extern MODVAR unsigned char param_to_slot_mapping[256];
 extern char *cm_getparameter(Channel *channel, char mode);
 extern void cm_putparameter(Channel *channel, char mode, char *str);
@@ -839,17 +930,20 @@ extern void modulemanager(int argc, char *argv[]);
 extern int inet_pton4(const char *src, unsigned char *dst);
 extern int inet_pton6(const char *src, unsigned char *dst);
 extern int unreal_bind(int fd, char *ip, int port, int ipv6);
-extern int unreal_connect(int fd, char *ip, int port, int ipv6);
-extern int is_valid_ip(char *str);
+extern int unreal_connect(int fd, const char *ip, int port, int ipv6);
+extern int is_valid_ip(const char *str);
 extern int ipv6_capable(void);
 extern MODVAR Client *remote_rehash_client;
 extern MODVAR int debugfd;
 extern void convert_to_absolute_path(char **path, char *reldir);
 extern int has_user_mode(Client *acptr, char mode);
+/** Check if user has user mode 'mode' set, without a function call (see has_user_mode) */
+#define HasUserMode(client, mode)	((client)->umodes & Usermode_bits[(unsigned char)(mode)])
 extern int has_channel_mode(Channel *channel, char mode);
 extern Cmode_t get_extmode_bitbychar(char m);
 extern long get_mode_bitbychar(char m);
 extern long find_user_mode(char mode);
+extern void make_umode_bits(void);
 extern void start_listeners(void);
 extern void buildvarstring(const char *inbuf, char *outbuf, size_t len, const char *name[], const char *value[]);
 extern void reinit_ssl(Client *);
@@ -882,6 +976,9 @@ extern char policy_valtochar(Policy policy);
 extern int verify_certificate(SSL *ssl, char *hostname, char **errstr);
 extern char *certificate_name(SSL *ssl);
 extern void start_of_normal_client_handshake(Client *acptr);
+extern int start_of_client_handshake(Client *client);
+extern int check_too_many_unknown_connections(Client *client);
+extern int is_loopback_ip(const char *ip);
 extern void clicap_pre_rehash(void);
 extern void clicap_post_rehash(void);
 extern void send_cap_notify(int add, char *token);
@@ -893,7 +990,7 @@ extern int is_module_loaded(char *name);
 extern void close_std_descriptors(void);
 extern void banned_client(Client *acptr, char *bantype, char *reason, int global, int noexit);
 extern char *mystpcpy(char *dst, const char *src);
-extern size_t add_sjsby(char *buf, char *setby, time_t seton);
+extern size_t add_sjsby(char *buf, const char *setby, time_t seton);
 extern MaxTarget *findmaxtarget(char *cmd);
 extern void setmaxtargets(char *cmd, int limit);
 extern void freemaxtargets(void);
@@ -920,6 +1017,7 @@ extern void new_message_special(Client *sender, MessageTag *recv_mtags, MessageT
 extern void generate_batch_id(char *str);
 extern MessageTag *find_mtag(MessageTag *mtags, const char *token);
 extern MessageTag *duplicate_mtag(MessageTag *mtag);
+extern MessageTag *duplicate_mtags(MessageTag *mtags);
 extern void free_message_tags(MessageTag *m);
 extern time_t server_time_to_unix_time(const char *tbuf);
 extern int history_add(char *object, MessageTag *mtags, char *line);
@@ -933,7 +1031,7 @@ extern int read_int64(FILE *fd, uint64_t *t);
 extern int read_int32(FILE *fd, uint32_t *t);
 extern int read_data(FILE *fd, void *buf, size_t len);
 extern int write_data(FILE *fd, const void *buf, size_t len);
-extern int write_str(FILE *fd, char *x);
+extern int write_str(FILE *fd, const char *x);
 extern int read_str(FILE *fd, char **x);
 extern int char_to_channelflag(char c);
 extern void _free_entire_name_list(NameList *n);
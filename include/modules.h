@@ -157,7 +157,7 @@ struct ModDataInfo {
 #define moddata_local_client(acptr, md)    acptr->local->moddata[md->slot]
 #define moddata_channel(channel, md)   channel->moddata[md->slot]
 #define moddata_member(m, md)        m->moddata[md->slot]
-#define moddata_membership(m, md)    m->moddata[md->slot]
+#define moddata_membership(m, md)    m->moddata[MODDATA_MAX_MEMBER+md->slot]
 #define moddata_local_variable(md)         local_variable_moddata[md->slot]
 #define moddata_global_variable(md)        global_variable_moddata[md->slot]
 
@@ -880,7 +880,6 @@ extern void moddata_free_client(Client *acptr);
 extern void moddata_free_local_client(Client *acptr);
 extern void moddata_free_channel(Channel *channel);
 extern void moddata_free_member(Member *m);
-extern void moddata_free_membership(Membership *m);
 extern ModDataInfo *findmoddata_byname(char *name, ModDataType type);
 extern int moddata_client_set(Client *acptr, char *varname, char *value);
 extern char *moddata_client_get(Client *acptr, char *varname);
@@ -1005,6 +1004,9 @@ extern void SavePersistentLongX(ModuleInfo *modinfo, char *varshortname, long va
 #define HOOKTYPE_CONFIGRUN_EX 104
 #define HOOKTYPE_CAN_SEND_TO_USER 105
 #define HOOKTYPE_SERVER_SYNC 106
+#define HOOKTYPE_CHANNEL_TRAFFIC 107
+#define HOOKTYPE_LISTMODE_ADD 108
+#define HOOKTYPE_LISTMODE_DEL 109
 
 /* Adding a new hook here?
  * 1) Add the #define HOOKTYPE_.... with a new number
@@ -1018,6 +1020,9 @@ int hooktype_local_connect(Client *client);
 int hooktype_remote_connect(Client *client);
 int hooktype_server_connect(Client *client);
 int hooktype_server_sync(Client *client);
+int hooktype_channel_traffic(Channel *channel, Client *from, int lines, int bytes);
+int hooktype_listmode_add(Channel *channel, Ban **list, Ban *ban);
+int hooktype_listmode_del(Channel *channel, Ban **list, Ban *ban);
 int hooktype_post_server_connect(Client *client);
 char *hooktype_pre_local_quit(Client *client, char *comment);
 int hooktype_local_quit(Client *client, MessageTag *mtags, char *comment);
@@ -1098,6 +1103,7 @@ int hooktype_channel_synced(Channel *channel, int merge, int removetheirs, int n
 int hooktype_can_sajoin(Client *target, Channel *channel, Client *client);
 int hooktype_check_init(Client *cptr, char *sockname, size_t size);
 int hooktype_mode_deop(Client *client, Client *victim, Channel *channel, u_int what, int modechar, long my_access, char **badmode);
+/* 'client' is NULL when rendering the channels shown to users not on any of them (see whois.c) */
 int hooktype_see_channel_in_whois(Client *client, Client *target, Channel *channel);
 int hooktype_dcc_denied(Client *client, char *target, char *realfile, char *displayfile, ConfigItem_deny_dcc *denydcc);
 int hooktype_server_handshake_out(Client *client);
@@ -1134,6 +1140,9 @@ _UNREAL_ERROR(_hook_error_incompatible, "Incompatible hook function. Check argum
         ((hooktype == HOOKTYPE_PRE_LOCAL_QUIT) && !ValidateHook(hooktype_pre_local_quit, func)) || \
         ((hooktype == HOOKTYPE_SERVER_CONNECT) && !ValidateHook(hooktype_server_connect, func)) || \
         ((hooktype == HOOKTYPE_SERVER_SYNC) && !ValidateHook(hooktype_server_sync, func)) || \
+        ((hooktype == HOOKTYPE_CHANNEL_TRAFFIC) && !ValidateHook(hooktype_channel_traffic, func)) || \
+        ((hooktype == HOOKTYPE_LISTMODE_ADD) && !ValidateHook(hooktype_listmode_add, func)) || \
+        ((hooktype == HOOKTYPE_LISTMODE_DEL) && !ValidateHook(hooktype_listmode_del, func)) || \
         ((hooktype == HOOKTYPE_SERVER_QUIT) && !ValidateHook(hooktype_server_quit, func)) || \
         ((hooktype == HOOKTYPE_STATS) && !ValidateHook(hooktype_stats, func)) || \
         ((hooktype == HOOKTYPE_LOCAL_JOIN) && !ValidateHook(hooktype_local_join, func)) || \
@@ -1332,6 +1341,7 @@ enum EfunctionType {
 	EFUNC_LABELED_RESPONSE_SET_CONTEXT,
 	EFUNC_LABELED_RESPONSE_FORCE_END,
 	EFUNC_KICK_USER,
+	EFUNC_TKL_STATS_EX,
 };
 
 /* Module flags */
@@ -42,6 +42,12 @@ extern EVENT(check_pings);
 extern EVENT(handshake_timeout);
 extern EVENT(check_deadsockets);
 extern EVENT(try_connections);
+/* membudget.c */
+extern EVENT(memory_budget_check);
+/* latency.c */
+extern EVENT(latency_trace_check);
+/* send.c */
+extern EVENT(snomask_aggregation_check);
 /* support.c */
 extern char *my_itoa(int i);
 
@@ -62,6 +62,7 @@
 
 typedef struct LoopStruct LoopStruct;
 typedef struct TKL TKL;
+typedef struct TKLStatsCursor TKLStatsCursor;
 typedef struct Spamfilter Spamfilter;
 typedef struct ServerBan ServerBan;
 typedef struct BanException BanException;
@@ -118,6 +119,8 @@ typedef struct ListStructPrio ListStructPrio;
 typedef struct Watch Watch;
 typedef struct Client Client;
 typedef struct LocalClient LocalClient;
+typedef struct ZipLink ZipLink;
+typedef struct ProxyHeader ProxyHeader;
 typedef struct Channel Channel;
 typedef struct User ClientUser;
 typedef struct Server Server;
@@ -134,7 +137,10 @@ typedef struct MOTDDownload MOTDDownload; /* used to coordinate download of a re
 typedef struct RealCommand RealCommand;
 typedef struct CommandOverride CommandOverride;
 typedef struct Member Member;
-typedef struct Membership Membership;
+typedef struct Member Membership;
+typedef struct AsyncAuthRequest AsyncAuthRequest;
+typedef struct AsyncAuthResult AsyncAuthResult;
+typedef struct SpamfilterRequest SpamfilterRequest;
 
 typedef enum OperClassEntryType { OPERCLASSENTRY_ALLOW=1, OPERCLASSENTRY_DENY=2} OperClassEntryType;
 
@@ -314,6 +320,9 @@ typedef enum ClientStatus {
 #define CLIENT_FLAG_DCCBLOCK		0x04000000	/**< Block all DCC send requests */
 #define CLIENT_FLAG_MAP			0x08000000	/**< Show this entry in /MAP (only used in map module) */
 #define CLIENT_FLAG_PINGWARN		0x10000000	/**< Server ping warning (remote server slow with responding to PINGs) */
+#define CLIENT_FLAG_AUTHPENDING		0x20000000	/**< Waiting for an auth thread to verify a password hash */
+#define CLIENT_FLAG_ZIPOUT		0x40000000	/**< Server link: outgoing traffic is compressed */
+#define CLIENT_FLAG_ZIPIN		0x80000000	/**< Server link: incoming traffic is compressed */
 /** @} */
 
 #define SNO_DEFOPER "+kscfvGqobS"
@@ -336,6 +345,8 @@ typedef enum ClientStatus {
 #define PROTO_EXTSWHOIS 0x004000	/* extended SWHOIS support */
 #define PROTO_SJSBY	0x008000	/* SJOIN setby information (TS and nick) */
 #define PROTO_MTAGS	0x010000	/* Support message tags and big buffers */
+#define PROTO_ZIP	0x020000	/* Supports compressed links with the same dictionary (ZIP=<version>) */
+#define PROTO_BQUIT	0x040000	/* Supports BQUIT (one QUIT for many users) */
 
 /* For client capabilities: */
 /** HasCapabilityFast() checks for a token if you know exactly which bit to check */
@@ -417,10 +428,14 @@ typedef enum ClientStatus {
 #define IsShunned(x)			((x)->flags & CLIENT_FLAG_SHUNNED)
 #define IsSQuit(x)			((x)->flags & CLIENT_FLAG_SQUIT)
 #define IsTLS(x)			((x)->flags & CLIENT_FLAG_TLS)
-#define IsSecure(x)			((x)->flags & CLIENT_FLAG_TLS)
+#define IsSecure(x)			(((x)->flags & CLIENT_FLAG_TLS) || IsProxyTLS(x))
+#define IsProxyTLS(x)			((x)->local && (x)->local->proxy_tls_cipher)
 #define IsULine(x)			((x)->flags & CLIENT_FLAG_ULINE)
 #define IsVirus(x)			((x)->flags & CLIENT_FLAG_VIRUS)
 #define IsIdentLookupSent(x)		((x)->flags & CLIENT_FLAG_IDENTLOOKUPSENT)
+#define IsAuthPending(x)		((x)->flags & CLIENT_FLAG_AUTHPENDING)
+#define IsZipOut(x)			((x)->flags & CLIENT_FLAG_ZIPOUT)
+#define IsZipIn(x)			((x)->flags & CLIENT_FLAG_ZIPIN)
 #define SetIdentLookup(x)		do { (x)->flags |= CLIENT_FLAG_IDENTLOOKUP; } while(0)
 #define SetClosing(x)			do { (x)->flags |= CLIENT_FLAG_CLOSING; } while(0)
 #define SetDCCBlock(x)			do { (x)->flags |= CLIENT_FLAG_DCCBLOCK; } while(0)
@@ -450,6 +465,9 @@ typedef enum ClientStatus {
 #define SetULine(x)			do { (x)->flags |= CLIENT_FLAG_ULINE; } while(0)
 #define SetVirus(x)			do { (x)->flags |= CLIENT_FLAG_VIRUS; } while(0)
 #define SetIdentLookupSent(x)		do { (x)->flags |= CLIENT_FLAG_IDENTLOOKUPSENT; } while(0)
+#define SetAuthPending(x)		do { (x)->flags |= CLIENT_FLAG_AUTHPENDING; } while(0)
+#define SetZipOut(x)			do { (x)->flags |= CLIENT_FLAG_ZIPOUT; } while(0)
+#define SetZipIn(x)			do { (x)->flags |= CLIENT_FLAG_ZIPIN; } while(0)
 #define ClearIdentLookup(x)		do { (x)->flags &= ~CLIENT_FLAG_IDENTLOOKUP; } while(0)
 #define ClearClosing(x)			do { (x)->flags &= ~CLIENT_FLAG_CLOSING; } while(0)
 #define ClearDCCBlock(x)		do { (x)->flags &= ~CLIENT_FLAG_DCCBLOCK; } while(0)
@@ -479,6 +497,9 @@ typedef enum ClientStatus {
 #define ClearULine(x)			do { (x)->flags &= ~CLIENT_FLAG_ULINE; } while(0)
 #define ClearVirus(x)			do { (x)->flags &= ~CLIENT_FLAG_VIRUS; } while(0)
 #define ClearIdentLookupSent(x)		do { (x)->flags &= ~CLIENT_FLAG_IDENTLOOKUPSENT; } while(0)
+#define ClearAuthPending(x)		do { (x)->flags &= ~CLIENT_FLAG_AUTHPENDING; } while(0)
+#define ClearZipOut(x)			do { (x)->flags &= ~CLIENT_FLAG_ZIPOUT; } while(0)
+#define ClearZipIn(x)			do { (x)->flags &= ~CLIENT_FLAG_ZIPIN; } while(0)
 /* @} */
 
 
@@ -486,6 +507,10 @@ typedef enum ClientStatus {
 #define	IsNotSpoof(x)	((x)->local->nospoof == 0)
 #define GetHost(x)	(IsHidden(x) ? (x)->user->virthost : (x)->user->realhost)
 #define GetIP(x)	(x->ip ? x->ip : "255.255.255.255")
+/** Size of a binary IP address, such as client->rawip.
+ * IPv4 addresses are stored as IPv4-mapped IPv6 addresses (::ffff:a.b.c.d).
+ */
+#define RAWIPLEN	16
 #define IsLoggedIn(x)	(IsRegNick(x) || (x->user && (*x->user->svid != '*') && !isdigit(*x->user->svid))) /* registered nick (+r) or just logged into services (may be -r) */
 #define IsSynched(x)	(x->serv->flags.synced)
 #define IsServerSent(x) (x->serv && x->serv->flags.server_sent)
@@ -502,12 +527,16 @@ typedef enum ClientStatus {
 #define SupportVHP(x)		(CHECKSERVERPROTO(x, PROTO_VHP))
 #define SupportCLK(x)		(CHECKSERVERPROTO(x, PROTO_CLK))
 #define SupportMTAGS(x)		(CHECKSERVERPROTO(x, PROTO_MTAGS))
+#define SupportZIP(x)		(CHECKSERVERPROTO(x, PROTO_ZIP))
+#define SupportBQUIT(x)		(CHECKSERVERPROTO(x, PROTO_BQUIT))
 
 #define SetVL(x)		((x)->local->proto |= PROTO_VL)
 #define SetSJSBY(x)		((x)->local->proto |= PROTO_SJSBY)
 #define SetVHP(x)		((x)->local->proto |= PROTO_VHP)
 #define SetCLK(x)		((x)->local->proto |= PROTO_CLK)
 #define SetMTAGS(x)		((x)->local->proto |= PROTO_MTAGS)
+#define SetZIP(x)		((x)->local->proto |= PROTO_ZIP)
+#define SetBQUIT(x)		((x)->local->proto |= PROTO_BQUIT)
 
 /*
  * defined debugging levels
@@ -764,8 +793,8 @@ typedef struct Whowas {
 	char *name;
 	char *username;
 	char *hostname;
-	char *virthost;
-	char *servername;
+	const char *virthost;
+	const char *servername;
 	char *realname;
 	long umodes;
 	time_t   logoff;
@@ -964,6 +993,7 @@ struct BanException {
 /** A TKL entry, such as a KLINE, GLINE, Spamfilter, QLINE, Exception, .. */
 struct TKL {
 	TKL *prev, *next;
+	TKL *hnext; /**< Next entry in tklines_name_hash or tklines_name_wild (name bans only) */
 	unsigned int type; /**< TKL type. One of TKL_*, such as TKL_KILL|TKL_GLOBAL for gline */
 	unsigned short flags; /**< One of TKL_FLAG_*, such as TKL_FLAG_CONFIG */
 	char *set_by; /**< By who was this entry added */
@@ -977,6 +1007,18 @@ struct TKL {
 	} ptr;
 };
 
+/** Position in a TKL listing that is sent in parts (see tkl_stats_ex).
+ * While a listing is in progress its cursor is on the tkl_stats_cursors
+ * list, so tkl_del_line() can move it past an entry that is removed.
+ */
+struct TKLStatsCursor {
+	TKLStatsCursor *prev, *next;
+	int active; /**< Set while on the tkl_stats_cursors list */
+	int phase; /**< 0 for the IP hashed entries, 1 for the normal entries */
+	int bucket; /**< Index in tklines_ip_hash or tklines */
+	TKL *tkl; /**< Next entry to look at in this bucket, or NULL for the start of the bucket */
+};
+
 /** A spamfilter except entry */
 struct SpamExcept {
 	SpamExcept *prev, *next;
@@ -1033,6 +1075,7 @@ struct CommandOverride {
 
 extern MODVAR Umode *Usermode_Table;
 extern MODVAR short	 Usermode_highest;
+extern MODVAR long Usermode_bits[256];
 
 extern MODVAR Snomask *Snomask_Table;
 extern MODVAR short Snomask_highest;
@@ -1060,11 +1103,13 @@ extern void unload_all_unused_moddata(void);
 #define LISTENER_TLS		0x000010
 #define LISTENER_BOUND		0x000020
 #define LISTENER_DEFER_ACCEPT	0x000040
+#define LISTENER_PROXY		0x000080
+#define LISTENER_UNIX		0x000100
 
 #define IsServersOnlyListener(x)	((x) && ((x)->options & LISTENER_SERVERSONLY))
 
 #define CONNECT_TLS		0x000001
-//0x000002 unused (was ziplinks)
+#define CONNECT_ZIP		0x000002
 #define CONNECT_AUTO		0x000004
 #define CONNECT_QUARANTINE	0x000008
 #define CONNECT_NODNSCACHE	0x000010
@@ -1086,6 +1131,7 @@ struct Client {
 	struct list_head client_node;		/**< For global client list (client_list) */
 	struct list_head lclient_node;		/**< For local client list (lclient_list) */
 	struct list_head special_node;		/**< For special lists (server || unknown || oper) */
+	struct list_head runq_node;		/**< For the I/O run queues, if data is waiting in the recvQ (see process_clients()) */
 	LocalClient *local;			/**< Additional information regarding locally connected clients */
 	ClientUser *user;			/**< Additional information, if this client is a user */
 	Server *serv;				/**< Additional information, if this is a server */
@@ -1104,10 +1150,72 @@ struct Client {
 	char id[IDLEN + 1];			/**< Unique ID: SID or UID */
 	struct list_head id_hash;		/**< For UID/SID hash table (idTable) */
 	Client *srvptr;				/**< Server on where this client is connected to (can be &me) */
-	char *ip;				/**< IP address of user or server (never NULL) */
+	const char *ip;			/**< IP address of user or server (never NULL), a shared string from scache_add() */
+	unsigned char rawip[RAWIPLEN];		/**< Same IP address in binary form, see set_client_ip() */
 	ModData moddata[MODDATA_MAX_CLIENT];	/**< Client attached module data, used by the ModData system */
 };
 
+/** Statistics of a compressed server link, see zip_get_stats() */
+typedef struct ZipStats {
+	unsigned long long in_bytes;		/**< Bytes received after decompression */
+	unsigned long long in_zipped;		/**< Bytes received on the wire (compressed) */
+	unsigned long long out_bytes;		/**< Bytes sent before compression */
+	unsigned long long out_zipped;		/**< Bytes sent on the wire (compressed) */
+	long long in_usec;			/**< Time spent decompressing (microseconds) */
+	long long out_usec;			/**< Time spent compressing (microseconds) */
+} ZipStats;
+
+/** Memory pressure levels, see set::memory-budget.
+ * Each level also takes the actions of the levels below it.
+ */
+typedef enum MemoryPressure {
+	MEMORY_PRESSURE_NONE=0,			/**< Below all thresholds */
+	MEMORY_PRESSURE_SHRINK_HISTORY=1,	/**< Keep less channel history */
+	MEMORY_PRESSURE_DROP_NOTICES=2,		/**< Drop high volume server notices */
+	MEMORY_PRESSURE_TIGHTEN_SENDQ=3,	/**< Lower sendq for unknown and low reputation clients */
+	MEMORY_PRESSURE_REFUSE_CONNECTIONS=4,	/**< Refuse new client connections */
+} MemoryPressure;
+#define MEMORY_PRESSURE_LEVELS	5
+
+/** Memory that is accounted for by its users, see memory_account() */
+typedef enum MemoryAccount {
+	MEMORY_ACCOUNT_DBUF=0,			/**< Send and receive queues */
+	MEMORY_ACCOUNT_HISTORY=1,		/**< Channel history */
+	MEMORY_ACCOUNT_TKL=2,			/**< Server bans, spamfilters, etc. */
+	MEMORY_ACCOUNT_REGEX=3,			/**< Compiled regular expressions (spamfilter, badwords, ..) */
+} MemoryAccount;
+#define MEMORY_ACCOUNTS		4
+
+/** Memory that a module accounted for, see module_memory_account() */
+typedef struct ModuleMemory ModuleMemory;
+struct ModuleMemory {
+	ModuleMemory *prev, *next;
+	char *name;				/**< Module name (this survives a module reload) */
+	long long bytes;			/**< Bytes in use */
+	long objects;				/**< Number of objects (allocations) */
+};
+
+/** Stages of a sampled message in the server, see set::latency-sample-rate */
+typedef enum LatencyStage {
+	LATENCY_STAGE_RECEIVE=0,		/**< The data was read from the socket */
+	LATENCY_STAGE_PARSE=1,			/**< Parsing of the line started */
+	LATENCY_STAGE_DISPATCH=2,		/**< The command handler was called */
+	LATENCY_STAGE_FANOUT=3,			/**< The first copy was added to a send queue */
+	LATENCY_STAGE_ENQUEUE=4,		/**< The last copy was added to a send queue */
+	LATENCY_STAGE_FLUSH=5,			/**< The last copy was written to the socket */
+} LatencyStage;
+#define LATENCY_STAGES		6
+
+/** Latency histogram of a stage (the time since the previous stage),
+ * or for LATENCY_STAGE_RECEIVE the total time.
+ */
+typedef struct LatencyHistogram {
+	long count;				/**< Number of samples */
+	long long usec;				/**< Sum of all samples (microseconds) */
+	long long max_usec;			/**< Highest sample (microseconds) */
+	long buckets[LATENCY_BUCKETS];		/**< <10us, <100us, .. , <1s, and 1s or more */
+} LatencyHistogram;
+
 /** Local client information, use client->local to access these (see also @link Client @endlink).
  */
 struct LocalClient {
@@ -1118,6 +1226,8 @@ struct LocalClient {
 	time_t lasttime;		/**< Last time any message was received */
 	dbuf sendQ;			/**< Outgoing send queue (data to be sent) */
 	dbuf recvQ;			/**< Incoming receive queue (incoming data yet to be parsed) */
+	ZipLink *zip;			/**< Compression state for compressed server links (link::options::compression), otherwise NULL */
+	ProxyHeader *proxy;		/**< PROXY protocol header that is still being read (listen::options::proxy), otherwise NULL */
 	ConfigItem_class *class;	/**< The class { } block associated to this client */
 	int proto;			/**< PROTOCTL options */
 	long caps;			/**< User: enabled capabilities (via CAP command) */
@@ -1125,12 +1235,17 @@ struct LocalClient {
 	u_char targets[MAXCCUSERS];	/**< Hash values of targets for target limiting */
 	ConfigItem_listen *listener;	/**< If this client IsListening() then this is the listener configuration attached to it */
 	long serial;			/**< Current serial number for send.c functions (to avoid sending duplicate messages) */
+	long bulk_exit_serial;		/**< Serial number of the last bulk exit for which a BATCH was opened (see exit_client_bulk_start) */
 	time_t nextnick;		/**< Time the next nick change will be allowed */
 	time_t last;			/**< Last time a RESETIDLE message was received (PRIVMSG) */
 	long sendM;			/**< Statistics: protocol messages send */
 	long sendK;			/**< Statistics: total k-bytes send */
 	long receiveM;			/**< Statistics: protocol messages received */
 	long receiveK;			/**< Statistics: total k-bytes received */
+	long lossy_drops;		/**< Statistics: low priority messages dropped (class::options::lossy) */
+	struct timeval read_tv;		/**< Time of the last read from the socket (for latency tracing) */
+	int latency_trace_serial;	/**< Serial number of the latency trace that queued data for us */
+	long latency_trace_bytes;	/**< Bytes to be written before the traced message is sent, 0 if none */
 	u_short sendB;			/**< Statistics: counters to count upto 1-k lots of bytes */
 	u_short receiveB;		/**< Statistics: sent and received (???) */
 	short lastsq;			/**< # of 2k blocks when sendqueued called last */
@@ -1146,6 +1261,7 @@ struct LocalClient {
 	unsigned char sasl_complete;	/**< SASL: >0 if SASL authentication was successful */
 	time_t sasl_sent_time;		/**< SASL: 0 or the time that the (last) AUTHENTICATE command has been sent */
 	char *sni_servername;		/**< Servername as sent by client via SNI (Server Name Indication) in SSL/TLS, otherwise NULL */
+	char *proxy_tls_cipher;		/**< TLS protocol and cipher if TLS was terminated by a proxy (listen::options::proxy), otherwise NULL */
 	int cap_protocol;		/**< CAP protocol in use. At least 300 for any CAP capable client. 302 for 3.2, etc.. */
 	uint32_t nospoof;		/**< Anti-spoofing random number (used in user handshake PING/PONG) */
 	char *passwd;			/**< Password used during connect, if any (freed once connected and set to NULL) */
@@ -1154,6 +1270,9 @@ struct LocalClient {
 	struct hostent *hostp;		/**< Host record for this client (used by DNS code) */
 	char sockhost[HOSTLEN + 1];	/**< Hostname from the socket */
 	u_short port;			/**< Remote TCP port of client */
+	AsyncAuthRequest *auth_request;	/**< Password verification in progress in an auth thread (see Auth_CheckAsync) */
+	AsyncAuthResult *auth_results;	/**< Results from the auth threads, kept until the command or registration is done */
+	SpamfilterRequest *spamfilter_request;	/**< Command parked until a spamfilter thread has run the regexes (see spamfilter_async_park) */
 };
 
 /** User information (persons, not servers), you use client->user to access these (see also @link Client @endlink).
@@ -1163,13 +1282,14 @@ struct User {
 	Link *invited;			/**< Channels has the user been invited to (linked list) */
 	Link *dccallow;			/**< DCCALLOW list (linked list) */
 	char *away;			/**< AWAY message, or NULL if not away */
-	char svid[SVIDLEN + 1];		/**< Unique value assigned by services (SVID) */
+	const char *svid;		/**< Unique value assigned by services (SVID), shared string (never NULL) */
 	unsigned short joined;		/**< Number of channels joined */
-	char username[USERLEN + 1];	/**< Username, the user portion in nick!user@host. */
-	char realhost[HOSTLEN + 1];	/**< Realhost, the real host of the user (IP or hostname) - usually this is not shown to other users */
-	char cloakedhost[HOSTLEN + 1];	/**< Cloaked host - generated by cloaking algorithm */
-	char *virthost;			/**< Virtual host - when user has user mode +x this is the active host */
-	char *server;			/**< Server name the user is on (?) */
+	unsigned int channels_version;	/**< Bumped when the user joins, parts or gets a prefix changed, see membership_changed() */
+	const char *username;		/**< Username, the user portion in nick!user@host, shared string (never NULL) */
+	const char *realhost;		/**< Realhost, the real host of the user (IP or hostname) - usually this is not shown to other users, shared string (never NULL) */
+	const char *cloakedhost;	/**< Cloaked host - generated by cloaking algorithm, shared string (never NULL) */
+	const char *virthost;		/**< Virtual host - when user has user mode +x this is the active host */
+	const char *server;		/**< Server name the user is on, see find_or_add() */
 	SWhois *swhois;			/**< Special "additional" WHOIS entries such as "a Network Administrator" */
 	aWhowas *whowas;		/**< Something for whowas :D :D */
 	int snomask;			/**< Server Notice Mask (snomask) - only for IRCOps */
@@ -1190,7 +1310,7 @@ struct User {
 /** Server information (local servers and remote servers), you use client->serv to access these (see also @link Client @endlink).
  */
 struct Server {
-	char *up;			/**< Name of uplink for this server */
+	const char *up;			/**< Name of uplink for this server, see find_or_add() */
 	char by[NICKLEN + 1];		/**< Uhhhh - who activated this connection - AGAIN? */
 	ConfigItem_link *conf;		/**< link { } block associated with this server, or NULL */
 	time_t timestamp;		/**< Remotely determined connect try time */
@@ -1258,6 +1378,12 @@ struct AuthConfig {
 	char			*data; /**< Data associated with this record */
 };
 
+/** Returned by Auth_CheckAsync() when the password hash is being
+ * verified by an auth thread. The command (or registration) is
+ * re-run automatically once the result is in.
+ */
+#define AUTH_CHECK_PENDING	-1
+
 #ifndef HAVE_CRYPT
 #define crypt DES_crypt
 #endif
@@ -1355,12 +1481,14 @@ struct ConfigItem_admin {
 };
 
 #define CLASS_OPT_NOFAKELAG		0x1
+#define CLASS_OPT_LOSSY			0x2	/**< Drop low priority traffic above class::soft-sendq */
 
 struct ConfigItem_class {
 	ConfigItem_class *prev, *next;
 	ConfigFlag flag;
 	char	   *name;
 	int	   pingfreq, connfreq, maxclients, sendq, recvq, clients;
+	int	   soft_sendq;	/**< For class::options::lossy, 0 means half of 'sendq' */
 	int xrefcount; /* EXTRA reference count, 'clients' also acts as a reference count but
 	                * link blocks also refer to classes so a 2nd ref. count was needed.
 	                */
@@ -1505,7 +1633,7 @@ struct ConfigItem_tld {
 struct ConfigItem_listen {
 	ConfigItem_listen *prev, *next;
 	ConfigFlag flag;
-	char *ip;
+	char *ip;		/**< IP address to listen on, or the path of the UNIX socket (LISTENER_UNIX) */
 	int port;
 	int options, clients;
 	int fd;
@@ -1747,6 +1875,7 @@ struct IRCStatistics {
 	unsigned int is_abad;	/* bad auth requests */
 	unsigned int is_udp;	/* packets recv'd on udp port */
 	unsigned int is_loc;	/* local connections made */
+	unsigned int is_lossy;	/* messages dropped for lossy classes */
 };
 
 typedef struct MemoryInfo {
@@ -1774,6 +1903,20 @@ struct Mode {
 	char key[KEYLEN + 1];			/**< The +k key in effect (eg: secret), if any - otherwise NULL */
 };
 
+/** Cached rendering of the modes of a channel, see channel_modes().
+ * Members and non-members see the same mode letters, only members
+ * see the parameters, so one rendering serves both variants.
+ */
+typedef struct ChannelModeCache ChannelModeCache;
+struct ChannelModeCache {
+	unsigned int version;			/**< Channel::mode_version at the time of rendering */
+	long mode;				/**< Copy of Mode::mode at the time of rendering */
+	Cmode_t extmode;			/**< Copy of Mode::extmode at the time of rendering */
+	int limit;				/**< Copy of Mode::limit at the time of rendering */
+	char *modes;				/**< The mode letters (eg: +ntlk), NULL if never rendered */
+	char *params;				/**< The parameters (eg: 10 secret), only shown to members */
+};
+
 /* Used for notify-hash buckets... -Donwulff */
 
 struct Watch {
@@ -1818,39 +1961,40 @@ struct Channel {
 	time_t topic_time;			/**< Time at which the topic was last set */
 	int users;				/**< Number of users in the channel */
 	Member *members;			/**< List of channel members (users in the channel) */
+	Member *local_members;			/**< List of channel members that are locally connected (subset of 'members') */
+	Link *member_directions;		/**< Server links behind which there are channel members, 'flags' is the member count */
 	Link *invites;				/**< List of outstanding /INVITE's from ops */
 	Ban *banlist;				/**< List of bans (+b) */
 	Ban *exlist;				/**< List of ban exceptions (+e) */
 	Ban *invexlist;				/**< List of invite exceptions (+I) */
 	char *mode_lock;			/**< Mode lock (MLOCK) applied to channel - usually by Services */
+	unsigned int deny_channel_version;	/**< Config version of the cached deny channel { } verdict below */
+	unsigned char deny_channel_state;	/**< Whether the cached verdict applies to all clients */
+	ConfigItem_deny_channel *deny_channel_verdict;	/**< Cached deny channel { } verdict, see find_channel_allowed_ex() */
+	unsigned int mode_version;		/**< Bumped on every mode change, see channel_modes_changed() */
+	ChannelModeCache mode_cache;		/**< Cached rendering of the channel modes, see channel_modes() */
 	ModData moddata[MODDATA_MAX_CHANNEL];	/**< Channel attached module data, used by the ModData system */
 	char chname[1];				/**< Channel name */
 };
 
-/** user/channel member struct (channel->members).
- * This is Member which is used in the linked list channel->members for each channel.
- * There is also Membership which is used in client->user->channels (see Membership for that).
- * Both must be kept synchronized 100% at all times.
+/** user/channel membership struct.
+ * There is one Member for each user in each channel. The same struct is
+ * linked into both channel->members (via 'next_member') and into
+ * client->user->channel (via 'next_channel'). The latter is usually
+ * referred to as a Membership, which is simply another name for a Member.
+ * There is deliberately no plain 'next' field: code that walks either
+ * list with 'next' does not compile, rather than silently walking the
+ * wrong list.
  */
 struct Member
 {
-	struct Member *next;				/**< Next entry in list */
+	struct Member *next_member;			/**< Next member of this channel (channel->members) */
+	struct Member *next_channel;			/**< Next channel of this user (client->user->channel) */
+	struct Member *next_local;			/**< Next local member of this channel (channel->local_members), only for local users */
 	Client	      *client;				/**< The client */
+	Channel	      *channel;				/**< The channel */
 	int		flags;				/**< The access of the user on this channel (one or more of CHFL_*) */
-	ModData moddata[MODDATA_MAX_MEMBER];		/** Member attached module data, used by the ModData system */
-};
-
-/** user/channel membership struct (client->user->channels).
- * This is Membership which is used in the linked list client->user->channels for each user.
- * There is also Member which is used in channel->members (see Member for that).
- * Both must be kept synchronized 100% at all times.
- */
-struct Membership
-{
-	struct Membership 	*next;			/**< Next entry in list */
-	struct Channel		*channel;			/**< The channel */
-	int			flags;			/**< The access of the user on this channel (one or more of CHFL_*) */
-	ModData moddata[MODDATA_MAX_MEMBERSHIP];	/**< Membership attached module data, used by the ModData system */
+	ModData moddata[MODDATA_MAX_MEMBER+MODDATA_MAX_MEMBERSHIP];	/**< Attached module data, both MODDATATYPE_MEMBER and MODDATATYPE_MEMBERSHIP */
 };
 
 /** @} */
@@ -1859,7 +2003,7 @@ struct Membership
 struct Ban {
 	struct Ban *next;	/**< Next entry in list */
 	char *banstr;		/**< The string (eg: *!*@*.example.org) */
-	char *who;		/**< Person or server who set the entry (eg: Nick) */
+	const char *who;	/**< Person or server who set the entry (eg: Nick), a shared string from scache_add() */
 	time_t when;		/**< When the entry was added */
 };
 
@@ -2025,7 +2169,7 @@ extern SSL_CTX *init_ctx(TLSOptions *tlsoptions, int server);
 struct ThrottlingBucket
 {
 	struct ThrottlingBucket *prev, *next;
-	char *ip;
+	unsigned char rawip[RAWIPLEN];
 	time_t since;
 	char count;
 };
@@ -2094,6 +2238,7 @@ struct MaxTarget {
 #define TKLISTLEN		26
 #define TKLIPHASHLEN1		4
 #define TKLIPHASHLEN2		1021
+#define TKLNAMEHASHLEN		4099
 
 #define MATCH_CHECK_IP              0x0001
 #define MATCH_CHECK_REAL_HOST       0x0002
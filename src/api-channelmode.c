@@ -419,6 +419,7 @@ char *cm_getparameter(Channel *channel, char mode)
 void cm_putparameter(Channel *channel, char mode, char *str)
 {
 	GETPARASTRUCT(channel, mode) = GETPARAMHANDLERBYLETTER(mode)->put_param(GETPARASTRUCT(channel, mode), str);
+	channel_modes_changed(channel);
 }
 
 /** Free a channel mode parameter.
@@ -429,6 +430,7 @@ void cm_freeparameter(Channel *channel, char mode)
 {
 	GETPARAMHANDLERBYLETTER(mode)->free_param(GETPARASTRUCT(channel, mode));
 	GETPARASTRUCT(channel, mode) = NULL;
+	channel_modes_changed(channel);
 }
 
 /** Get parameter for a channel mode - special version for SJOIN.
@@ -207,6 +207,44 @@ void do_cmd(Client *client, MessageTag *mtags, char *cmd, int parc, char *parv[]
 	}
 }
 
+/** Run a command that a local client sent earlier but that was held back,
+ * for example while waiting for an auth or spamfilter thread.
+ * Unlike do_cmd() this works exactly like parse() would have done:
+ * the command is looked up again with the current status of the client
+ * (which may have been shunned in the meantime), and command overrides
+ * are called.
+ * @param client	Client that is the source.
+ * @param mtags		Message tags for this command (or NULL).
+ * @param cmd		Command to run, eg "PRIVMSG".
+ * @param parc		Parameter count plus 1.
+ * @param parv		Parameter array.
+ * @note The same notes as for do_cmd() apply.
+ */
+void do_cmd_resume(Client *client, MessageTag *mtags, char *cmd, int parc, char *parv[])
+{
+	RealCommand *cmptr;
+	int gen_mtags;
+
+	cmptr = find_command(cmd, command_lookup_flags(client));
+	if (!cmptr || (cmptr->flags & CMD_ALIAS))
+		return;
+	if ((cmptr->flags & CMD_OPER) && IsUser(client) && !IsOper(client))
+	{
+		sendnumeric(client, ERR_NOPRIVILEGES);
+		return;
+	}
+
+	gen_mtags = (mtags == NULL) ? 1 : 0;
+	if (gen_mtags)
+		new_message(client, NULL, &mtags);
+	if (cmptr->overriders)
+		(*cmptr->overriders->func) (cmptr->overriders, client, mtags, parc, parv);
+	else
+		(*cmptr->func) (client, mtags, parc, parv);
+	if (gen_mtags)
+		free_message_tags(mtags);
+}
+
 /** @} */
 
 /**** This is the "real command" API *****
@@ -41,7 +41,7 @@ void (*do_mode)(Channel *channel, Client *client, MessageTag *mtags, int parc, c
 void (*set_mode)(Channel *channel, Client *client, int parc, char *parv[], u_int *pcount,
     char pvar[MAXMODEPARAMS][MODEBUFLEN + 3], int bounce);
 void (*cmd_umode)(Client *client, MessageTag *mtags, int parc, char *parv[]);
-int (*register_user)(Client *client, char *nick, char *username, char *umode, char *virthost, char *ip);
+int (*register_user)(Client *client, char *nick, const char *username, char *umode, char *virthost, char *ip);
 int (*tkl_hash)(unsigned int c);
 char (*tkl_typetochar)(int type);
 int (*tkl_chartotype)(char c);
@@ -64,6 +64,7 @@ int(*find_spamfilter_user)(Client *client, int flags);
 TKL *(*find_qline)(Client *client, char *nick, int *ishold);
 TKL *(*find_tkline_match_zap)(Client *client);
 void (*tkl_stats)(Client *client, int type, char *para);
+int (*tkl_stats_ex)(Client *client, int type, char *para, TKLStatsCursor *cursor, int max);
 void (*tkl_sync)(Client *client);
 void (*cmd_tkl)(Client *client, MessageTag *mtags, int parc, char *parv[]);
 int (*place_host_ban)(Client *client, BanAction action, char *reason, long duration);
@@ -103,7 +104,7 @@ char *(*mtags_to_string)(MessageTag *m, Client *client);
 int (*can_send_to_channel)(Client *client, Channel *channel, char **msgtext, char **errmsg, int notice);
 void (*broadcast_md_globalvar)(ModDataInfo *mdi, ModData *md);
 void (*broadcast_md_globalvar_cmd)(Client *except, Client *sender, char *varname, char *value);
-int (*tkl_ip_hash)(char *ip);
+int (*tkl_ip_hash)(const char *ip);
 int (*tkl_ip_hash_type)(int type);
 void (*sendnotice_tkl_del)(char *removed_by, TKL *tkl);
 void (*sendnotice_tkl_add)(TKL *tkl);
@@ -363,4 +364,5 @@ void efunctions_init(void)
 	efunc_init_function(EFUNC_LABELED_RESPONSE_SET_CONTEXT, labeled_response_set_context, labeled_response_set_context_default_handler);
 	efunc_init_function(EFUNC_LABELED_RESPONSE_FORCE_END, labeled_response_force_end, labeled_response_force_end_default_handler);
 	efunc_init_function(EFUNC_KICK_USER, kick_user, NULL);
+	efunc_init_function(EFUNC_TKL_STATS_EX, tkl_stats_ex, NULL);
 }
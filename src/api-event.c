@@ -208,4 +208,7 @@ void SetupEvents(void)
 	EventAdd(NULL, "check_deadsockets", check_deadsockets, NULL, 1000, 0);
 	EventAdd(NULL, "handshake_timeout", handshake_timeout, NULL, 1000, 0);
 	EventAdd(NULL, "try_connections", try_connections, NULL, 2000, 0);
+	EventAdd(NULL, "memory_budget_check", memory_budget_check, NULL, 1000, 0);
+	EventAdd(NULL, "latency_trace_check", latency_trace_check, NULL, 1000, 0);
+	EventAdd(NULL, "snomask_aggregation_check", snomask_aggregation_check, NULL, 1000, 0);
 }
@@ -169,6 +169,9 @@ int history_del(char *object, int max_lines, long max_time)
 {
 	HistoryBackend *hb;
 
+	/* Keep less history when the server is low on memory */
+	max_lines = memory_pressure_history_lines(max_lines);
+
 	for (hb = historybackends; hb; hb=hb->next)
 		hb->history_del(object, max_lines, max_time);
 
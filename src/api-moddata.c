@@ -140,30 +140,26 @@ void moddata_free_channel(Channel *channel)
 	memset(channel->moddata, 0, sizeof(channel->moddata));
 }
 
+/** Free the ModData of a Member, this frees both the
+ * MODDATATYPE_MEMBER and MODDATATYPE_MEMBERSHIP entries.
+ */
 void moddata_free_member(Member *m)
 {
 	ModDataInfo *md;
 
 	for (md = MDInfo; md; md = md->next)
+	{
 		if (md->type == MODDATATYPE_MEMBER)
 		{
 			if (md->free && moddata_member(m, md).ptr)
 				md->free(&moddata_member(m, md));
-		}
-
-	memset(m->moddata, 0, sizeof(m->moddata));
-}
-
-void moddata_free_membership(Membership *m)
-{
-ModDataInfo *md;
-
-	for (md = MDInfo; md; md = md->next)
+		} else
 		if (md->type == MODDATATYPE_MEMBERSHIP)
 		{
 			if (md->free && moddata_membership(m, md).ptr)
 				md->free(&moddata_membership(m, md));
 		}
+	}
 
 	memset(m->moddata, 0, sizeof(m->moddata));
 }
@@ -222,7 +218,7 @@ void unload_moddata_commit(ModDataInfo *md)
 			Member *m;
 			for (channel = channels; channel; channel=channel->nextch)
 			{
-				for (m = channel->members; m; m = m->next)
+				for (m = channel->members; m; m = m->next_member)
 				{
 					if (md->free && moddata_member(m, md).ptr)
 						md->free(&moddata_member(m, md));
@@ -239,7 +235,7 @@ void unload_moddata_commit(ModDataInfo *md)
 			{
 				if (!client->user)
 					continue;
-				for (m = client->user->channel; m; m = m->next)
+				for (m = client->user->channel; m; m = m->next_channel)
 				{
 					if (md->free && moddata_membership(m, md).ptr)
 						md->free(&moddata_membership(m, md));
@@ -313,6 +309,62 @@ int module_has_moddata(Module *mod)
 	return 0;
 }
 
+/** Size of a ModData object, as far as we can tell from the serialized value */
+static long moddata_size(ModDataInfo *md, ModData *m)
+{
+	char *str;
+
+	if (!m->ptr)
+		return 0;
+	str = md->serialize(m);
+	return str ? strlen(str) + 1 : 0;
+}
+
+/** Estimated memory used by the ModData of 'module', for /STATS memory.
+ * This is based on the serialized values, so it is only an estimate
+ * and ModData without a serialize function is not counted at all.
+ * Member and membership ModData is not counted either.
+ * This walks all clients and channels, so never call it often.
+ */
+long long moddata_memory_usage(Module *module)
+{
+	ModDataInfo *md;
+	Client *client;
+	Channel *channel;
+	long long total = 0;
+
+	for (md = MDInfo; md; md = md->next)
+	{
+		if ((md->owner != module) || !md->serialize)
+			continue;
+		switch (md->type)
+		{
+			case MODDATATYPE_CLIENT:
+				list_for_each_entry(client, &client_list, client_node)
+					total += moddata_size(md, &moddata_client(client, md));
+				break;
+			case MODDATATYPE_LOCAL_CLIENT:
+				list_for_each_entry(client, &lclient_list, lclient_node)
+					total += moddata_size(md, &moddata_local_client(client, md));
+				break;
+			case MODDATATYPE_CHANNEL:
+				for (channel = channels; channel; channel = channel->nextch)
+					total += moddata_size(md, &moddata_channel(channel, md));
+				break;
+			case MODDATATYPE_LOCAL_VARIABLE:
+				total += moddata_size(md, &moddata_local_variable(md));
+				break;
+			case MODDATATYPE_GLOBAL_VARIABLE:
+				total += moddata_size(md, &moddata_global_variable(md));
+				break;
+			default:
+				break;
+		}
+	}
+
+	return total;
+}
+
 /** Set ModData for client (via variable name, string value) */
 int moddata_client_set(Client *client, char *varname, char *value)
 {
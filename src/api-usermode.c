@@ -27,6 +27,9 @@ char umodestring[UMODETABLESZ+1];
 Umode *Usermode_Table = NULL;
 short	 Usermode_highest = 0;
 
+/** User mode bit by user mode character, see make_umode_bits() */
+long Usermode_bits[256];
+
 Snomask *Snomask_Table = NULL;
 short	 Snomask_highest = 0;
 
@@ -124,6 +127,22 @@ void make_umodestr(void)
 	*m = '\0';
 }
 
+/** Rebuild Usermode_bits[] from Usermode_Table.
+ * Called whenever a user mode is added, unloaded or removed,
+ * so find_user_mode() and HasUserMode() need no table scan.
+ */
+void make_umode_bits(void)
+{
+	int i;
+
+	memset(Usermode_bits, 0, sizeof(Usermode_bits));
+	for (i = 0; i < UMODETABLESZ; i++)
+	{
+		if (Usermode_Table[i].flag && !Usermode_Table[i].unloaded)
+			Usermode_bits[(unsigned char)Usermode_Table[i].flag] = Usermode_Table[i].mode;
+	}
+}
+
 static char previous_umodestring[256];
 
 void umodes_check_for_changes(void)
@@ -194,6 +213,7 @@ Umode *UmodeAdd(Module *module, char ch, int global, int unset_on_deoper, int (*
 				if (i > Usermode_highest)
 					Usermode_highest = i;
 		make_umodestr();
+		make_umode_bits();
 		AllUmodes |= Usermode_Table[i].mode;
 		if (global)
 			SendUmodes |= Usermode_Table[i].mode;
@@ -241,6 +261,7 @@ void UmodeDel(Umode *umode)
 		SendUmodes &= ~(umode->mode);
 		make_umodestr();
 	}
+	make_umode_bits();
 
 	if (umode->owner) {
 		ModuleObject *umodeobj;
@@ -411,6 +432,7 @@ void unload_all_unused_umodes(void)
 		}
 	}
 	make_umodestr();
+	make_umode_bits();
 }
 
 void unload_all_unused_snomasks(void)
@@ -485,22 +507,15 @@ void remove_oper_privileges(Client *client, int broadcast_mode_change)
 /** Return long integer mode for a user mode character (eg: 'x' -> 0x10) */
 long find_user_mode(char flag)
 {
-	int i;
-
-	for (i = 0; i < UMODETABLESZ; i++)
-	{
-		if ((Usermode_Table[i].flag == flag) && !(Usermode_Table[i].unloaded))
-			return Usermode_Table[i].mode;
-	}
-	return 0;
+	return Usermode_bits[(unsigned char)flag];
 }
 
-/** Returns 1 if user has this user mode set and 0 if not */
+/** Returns 1 if user has this user mode set and 0 if not.
+ * See also HasUserMode(), the inlined version of this.
+ */
 int has_user_mode(Client *client, char mode)
 {
-	long m = find_user_mode(mode);
-
-	if (client->umodes & m)
+	if (HasUserMode(client, mode))
 		return 1; /* Yes, user has this mode */
 
 	return 0; /* Mode does not exist or not set */
@@ -21,6 +21,9 @@
 #include "unrealircd.h"
 #include "crypt_blowfish.h"
 #include <argon2.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 typedef struct AuthTypeList AuthTypeList;
 struct AuthTypeList {
@@ -365,7 +368,7 @@ static int authcheck_tls_clientcert_fingerprint(Client *client, AuthConfig *as,
 	char hexcolon[EVP_MAX_MD_SIZE * 3 + 1];
 	char *fp;
 
-	if (!client->local->ssl)
+	if (!client->local->ssl && !IsProxyTLS(client))
 		return 0;
 
 	fp = moddata_client_get(client, "certfp");
@@ -403,6 +406,146 @@ static int authcheck_spkifp(Client *client, AuthConfig *as, char *para)
 	return 1; /* SUCCESS */
 }
 
+#ifdef HAVE_PTHREAD
+/** crypt() uses a static buffer, so only one thread may call it at a time */
+static pthread_mutex_t crypt_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int authcheck_unixcrypt(Client *client, AuthConfig *as, char *para)
+{
+	extern char *crypt();
+	char *res;
+	int ret = 0;
+
+	if (!para)
+		return 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&crypt_lock);
+#endif
+	res = crypt(para, as->data);
+	if (res && !strcmp(res, as->data))
+		ret = 1; /* MATCH */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&crypt_lock);
+#endif
+
+	return ret;
+}
+
+/** Is this an authentication type that involves (slow) password hashing? */
+static int authtype_is_hash(AuthenticationType type)
+{
+	return ((type == AUTHTYPE_ARGON2) || (type == AUTHTYPE_BCRYPT) || (type == AUTHTYPE_UNIXCRYPT));
+}
+
+/** Verify a password against a password hash (argon2, bcrypt or crypt).
+ * This is the slow part of authentication. It does not touch any
+ * client or global state, so it is safe to call from auth threads.
+ */
+static int authcheck_hash(AuthConfig *as, char *para)
+{
+	switch (as->type)
+	{
+		case AUTHTYPE_ARGON2:
+			return authcheck_argon2(NULL, as, para);
+		case AUTHTYPE_BCRYPT:
+			return authcheck_bcrypt(NULL, as, para);
+		case AUTHTYPE_UNIXCRYPT:
+			return authcheck_unixcrypt(NULL, as, para);
+		default:
+			return 0;
+	}
+}
+
+/*** The verified-credential cache ***/
+
+typedef struct AuthCacheEntry AuthCacheEntry;
+/** An entry in the verified-credential cache */
+struct AuthCacheEntry {
+	unsigned char digest[SHA256_DIGEST_LENGTH];	/**< Keyed digest of password hash + password */
+	time_t expires;					/**< Entry is valid until this time, 0 for unused */
+	int result;					/**< Result of the check: 1 if OK, 0 if incorrect password */
+};
+
+static AuthCacheEntry authcache[AUTH_CACHE_SIZE];
+static unsigned char authcache_key[32];
+static int authcache_key_initialized = 0;
+
+/** Calculate the cache digest for password 'para' against the hash in 'as'.
+ * A random key that is generated on first use is mixed in, so the cache
+ * contents are worthless outside this process.
+ */
+static void authcache_digest(AuthConfig *as, char *para, unsigned char *digest)
+{
+	SHA256_CTX hash;
+	int i;
+
+	if (!authcache_key_initialized)
+	{
+		for (i = 0; i < sizeof(authcache_key); i++)
+			authcache_key[i] = getrandom8();
+		authcache_key_initialized = 1;
+	}
+
+	SHA256_Init(&hash);
+	SHA256_Update(&hash, authcache_key, sizeof(authcache_key));
+	SHA256_Update(&hash, as->data, strlen(as->data) + 1); /* including the NUL as a separator */
+	SHA256_Update(&hash, para, strlen(para));
+	SHA256_Final(digest, &hash);
+}
+
+/** Find the cache slot for 'digest' (a simple direct-mapped cache) */
+static AuthCacheEntry *authcache_slot(unsigned char *digest)
+{
+	unsigned int n;
+
+	memcpy(&n, digest, sizeof(n));
+	return &authcache[n % AUTH_CACHE_SIZE];
+}
+
+/** Look up 'digest' in the verified-credential cache.
+ * @returns 1 (correct password), 0 (incorrect password) or -1 (not found).
+ */
+static int authcache_find(unsigned char *digest)
+{
+	AuthCacheEntry *e = authcache_slot(digest);
+
+	if ((e->expires > TStime()) && !memcmp(e->digest, digest, SHA256_DIGEST_LENGTH))
+		return e->result;
+
+	return -1;
+}
+
+/** Add the result of a password check to the verified-credential cache */
+static void authcache_add(unsigned char *digest, int result)
+{
+	AuthCacheEntry *e = authcache_slot(digest);
+
+	memcpy(e->digest, digest, SHA256_DIGEST_LENGTH);
+	e->result = result;
+	e->expires = TStime() + (result ? AUTH_CACHE_TTL : AUTH_CACHE_NEGATIVE_TTL);
+}
+
+/** Verify a password hash, using the verified-credential cache if possible */
+static int authcheck_hash_cached(AuthConfig *as, char *para)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	int n;
+
+	if (!para)
+		return 0;
+
+	authcache_digest(as, para, digest);
+	n = authcache_find(digest);
+	if (n != -1)
+		return n;
+
+	n = authcheck_hash(as, para);
+	authcache_add(digest, n);
+	return n;
+}
+
 
 /*
  * client MUST be a local client
@@ -423,9 +566,6 @@ static int authcheck_spkifp(Client *client, AuthConfig *as, char *para)
  */
 int Auth_Check(Client *client, AuthConfig *as, char *para)
 {
-	extern char *crypt();
-	char *res;
-
 	if (!as || !as->data)
 		return 0; /* Should not happen, but better be safe.. */
 
@@ -446,18 +586,9 @@ int Auth_Check(Client *client, AuthConfig *as, char *para)
 			return 0;
 
 		case AUTHTYPE_ARGON2:
-			return authcheck_argon2(client, as, para);
-
 		case AUTHTYPE_BCRYPT:
-			return authcheck_bcrypt(client, as, para);
-
 		case AUTHTYPE_UNIXCRYPT:
-			if (!para)
-				return 0;
-			res = crypt(para, as->data);
-			if (res && !strcmp(res, as->data))
-				return 1;
-			return 0;
+			return authcheck_hash_cached(as, para);
 
 		case AUTHTYPE_TLS_CLIENTCERT:
 			return authcheck_tls_clientcert(client, as, para);
@@ -474,6 +605,345 @@ int Auth_Check(Client *client, AuthConfig *as, char *para)
 	return 0;
 }
 
+/*** Asynchronous authentication (auth threads) ***/
+
+/** A password hash verification that is handed off to an auth thread */
+struct AsyncAuthRequest {
+	AsyncAuthRequest *next;
+	Client *client;		/**< The client, or NULL if the client was freed in the meantime */
+	AuthConfig as;		/**< Copy of the authentication config (type and hash) */
+	char *para;		/**< Copy of the password */
+	unsigned char digest[SHA256_DIGEST_LENGTH];	/**< Cache digest of hash + password */
+	int result;		/**< Result, filled in by the auth thread */
+	char *cmd;		/**< Command to re-run once the result is in, or NULL to continue registration */
+	MessageTag *mtags;	/**< Message tags of 'cmd' (copies) */
+	void *lr_context;	/**< Labeled response context of 'cmd' (or of the registration) */
+	int parc;		/**< Parameter count for 'cmd' */
+	char *parv[MAXPARA+2];	/**< Parameters for 'cmd' (copies) */
+};
+
+/** The result of a verification in an auth thread, kept for the client.
+ * Registration may check several allow blocks, each with its own password
+ * hash. Since every check is resumed by running the whole registration
+ * again, all results are kept until the client is registered. The
+ * authcache cannot be relied on for this, as entries may be evicted.
+ */
+struct AsyncAuthResult {
+	AsyncAuthResult *next;
+	unsigned char digest[SHA256_DIGEST_LENGTH];	/**< Cache digest of hash + password */
+	int result;		/**< 1 if passed, 0 if incorrect */
+};
+
+#ifdef HAVE_PTHREAD
+
+static int auth_threads_started = 0;
+static int auth_wakeup_pipe[2] = { -1, -1 };
+static pthread_mutex_t auth_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t auth_queue_cond = PTHREAD_COND_INITIALIZER;
+static AsyncAuthRequest *auth_queue = NULL, *auth_queue_tail = NULL; /**< Waiting for an auth thread */
+static AsyncAuthRequest *auth_done = NULL, *auth_done_tail = NULL; /**< Finished, waiting for the main thread */
+
+static void auth_async_resume(AsyncAuthRequest *r);
+
+/** Append a request to a queue. Caller must hold auth_queue_lock. */
+static void auth_queue_append(AsyncAuthRequest **head, AsyncAuthRequest **tail, AsyncAuthRequest *r)
+{
+	r->next = NULL;
+	if (*tail)
+		(*tail)->next = r;
+	else
+		*head = r;
+	*tail = r;
+}
+
+/** Main function of each auth thread: verify password hashes, forever. */
+static void *auth_thread(void *arg)
+{
+	AsyncAuthRequest *r;
+
+	while (1)
+	{
+		pthread_mutex_lock(&auth_queue_lock);
+		while (!auth_queue)
+			pthread_cond_wait(&auth_queue_cond, &auth_queue_lock);
+		r = auth_queue;
+		auth_queue = r->next;
+		if (!auth_queue)
+			auth_queue_tail = NULL;
+		pthread_mutex_unlock(&auth_queue_lock);
+
+		r->result = authcheck_hash(&r->as, r->para);
+
+		pthread_mutex_lock(&auth_queue_lock);
+		auth_queue_append(&auth_done, &auth_done_tail, r);
+		pthread_mutex_unlock(&auth_queue_lock);
+
+		/* Wake up the main loop. If the pipe is full then a wakeup
+		 * is already pending anyway, so the result can be ignored.
+		 */
+		if (write(auth_wakeup_pipe[1], "x", 1) < 0)
+			;
+	}
+	return NULL;
+}
+
+/** Called from the main loop when one or more auth threads have finished */
+static void auth_async_wakeup(int fd, int revents, void *data)
+{
+	char buf[128];
+	AsyncAuthRequest *r, *r_next;
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&auth_queue_lock);
+	r = auth_done;
+	auth_done = auth_done_tail = NULL;
+	pthread_mutex_unlock(&auth_queue_lock);
+
+	for (; r; r = r_next)
+	{
+		r_next = r->next;
+		auth_async_resume(r);
+	}
+}
+
+/** Start the auth threads, if not done already.
+ * This is done on first use rather than on boot, since threads
+ * do not survive the fork() to the background.
+ * @returns 1 if the auth threads are running, 0 on failure.
+ */
+static int auth_threads_start(void)
+{
+	pthread_t thread;
+	sigset_t newset, oldset;
+	int i, started = 0;
+
+	if (auth_threads_started)
+		return 1;
+
+	if (pipe(auth_wakeup_pipe) < 0)
+	{
+		ircd_log(LOG_ERROR, "Could not create pipe for auth threads: %s", strerror(errno));
+		return 0;
+	}
+	fcntl(auth_wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(auth_wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+	if (fd_open(auth_wakeup_pipe[0], "Auth threads wakeup pipe") < 0)
+	{
+		close(auth_wakeup_pipe[0]);
+		close(auth_wakeup_pipe[1]);
+		return 0;
+	}
+	fd_setselect(auth_wakeup_pipe[0], FD_SELECT_READ, auth_async_wakeup, NULL);
+
+	/* Signals should only ever be delivered to the main thread */
+	sigfillset(&newset);
+	pthread_sigmask(SIG_BLOCK, &newset, &oldset);
+	for (i = 0; i < AUTH_THREADS; i++)
+	{
+		if (pthread_create(&thread, NULL, auth_thread, NULL) == 0)
+		{
+			pthread_detach(thread);
+			started++;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (!started)
+	{
+		ircd_log(LOG_ERROR, "Could not create any auth threads, password hashes will be verified in the main thread.");
+		fd_close(auth_wakeup_pipe[0]);
+		close(auth_wakeup_pipe[1]);
+		return 0;
+	}
+
+	auth_threads_started = 1;
+	return 1;
+}
+
+/** Forget the kept results of a client */
+static void auth_async_free_results(Client *client)
+{
+	AsyncAuthResult *res, *res_next;
+
+	for (res = client->local->auth_results; res; res = res_next)
+	{
+		res_next = res->next;
+		safe_free(res);
+	}
+	client->local->auth_results = NULL;
+}
+
+static void auth_async_free(AsyncAuthRequest *r)
+{
+	int i;
+
+	safe_free(r->as.data);
+	safe_free(r->para);
+	safe_free(r->cmd);
+	free_message_tags(r->mtags);
+	safe_free(r->lr_context);
+	for (i = 1; i < r->parc; i++)
+		safe_free(r->parv[i]);
+	safe_free(r);
+}
+
+/** Continue where we left off, now that the auth thread has the result.
+ * The result is put in the cache, and the command that triggered the
+ * check is run again (or registration is continued). This time
+ * Auth_CheckAsync() will return the result immediately.
+ * Afterwards any data that was queued for the client in the meantime
+ * is processed.
+ */
+static void auth_async_resume(AsyncAuthRequest *r)
+{
+	Client *client = r->client;
+
+	authcache_add(r->digest, r->result);
+
+	if (client)
+	{
+		AsyncAuthResult *res = safe_alloc(sizeof(AsyncAuthResult));
+
+		memcpy(res->digest, r->digest, SHA256_DIGEST_LENGTH);
+		res->result = r->result;
+		res->next = client->local->auth_results;
+		client->local->auth_results = res;
+
+		client->local->auth_request = NULL;
+		ClearAuthPending(client);
+		if (!IsDead(client))
+		{
+			/* Reply with the label of the original command, see Auth_CheckAsync() */
+			void *current = labeled_response_save_context();
+
+			labeled_response_set_context(r->lr_context);
+			if (r->cmd)
+				do_cmd_resume(client, r->mtags, r->cmd, r->parc, r->parv);
+			else if (!IsRegistered(client) && client->user && is_handshake_finished(client))
+				register_user(client, client->name, client->user->username, NULL, NULL, NULL);
+			if (!IsDead(client))
+				labeled_response_force_end();
+			labeled_response_set_context(current);
+			safe_free(current);
+		}
+		/* Keep the results only while registration still needs them */
+		if (!IsAuthPending(client) && (r->cmd || IsRegistered(client)))
+			auth_async_free_results(client);
+		if (!IsDead(client) && !IsAuthPending(client))
+			parse_client_queued(client);
+	}
+
+	auth_async_free(r);
+}
+#endif
+
+/** Check authentication, like Auth_Check(), but verify slow password
+ * hashes (argon2, bcrypt, crypt) in an auth thread.
+ * If AUTH_CHECK_PENDING is returned then the caller should simply return:
+ * no further data from the client is processed until the result is in.
+ * At that point the command 'cmd' is executed again with the same
+ * parameters, or, if 'cmd' is NULL, registration of the client is
+ * continued via register_user(). On that second run this function
+ * returns the actual result.
+ * @param client  The client (must be a local client).
+ * @param as      The authentication config.
+ * @param para    The provided parameter (NULL allowed)
+ * @param cmd     The command to re-run, or NULL for user registration.
+ * @param mtags   Message tags of 'cmd', these are used again on re-run.
+ * @param parc    Parameter count of 'cmd'.
+ * @param parv    Parameters of 'cmd'.
+ * @returns 1 if passed, 0 if incorrect, AUTH_CHECK_PENDING if the
+ *          verification was handed off to an auth thread.
+ * @note Everything the caller did before calling this function will
+ *       be done again when the command is re-run, so it should not
+ *       have any side effects that cannot be repeated.
+ * @note When AUTH_CHECK_PENDING is returned, the labeled-response
+ *       context is moved to the request, so the caller should not
+ *       send anything anymore for the current command.
+ */
+int Auth_CheckAsync(Client *client, AuthConfig *as, char *para, char *cmd, MessageTag *mtags, int parc, char *parv[])
+{
+#ifdef HAVE_PTHREAD
+	AsyncAuthRequest *r;
+	AsyncAuthResult *res;
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	int i, n;
+
+	if (!as || !as->data || !para || !authtype_is_hash(as->type) ||
+	    !MyConnect(client) || (client->local->fd < 0) || IsAuthPending(client) ||
+	    !loop.ircd_booted)
+	{
+		return Auth_Check(client, as, para);
+	}
+
+	authcache_digest(as, para, digest);
+
+	/* Are we re-running the command (or registration) for which
+	 * we already got the result?
+	 */
+	for (res = client->local->auth_results; res; res = res->next)
+		if (!memcmp(res->digest, digest, SHA256_DIGEST_LENGTH))
+			return res->result;
+
+	n = authcache_find(digest);
+	if (n != -1)
+		return n;
+
+	if (!auth_threads_start())
+		return Auth_Check(client, as, para);
+
+	r = safe_alloc(sizeof(AsyncAuthRequest));
+	r->client = client;
+	r->as.type = as->type;
+	safe_strdup(r->as.data, as->data);
+	safe_strdup(r->para, para);
+	memcpy(r->digest, digest, SHA256_DIGEST_LENGTH);
+	r->lr_context = labeled_response_save_context();
+	labeled_response_set_context(NULL);
+	if (cmd)
+	{
+		safe_strdup(r->cmd, cmd);
+		r->mtags = duplicate_mtags(mtags);
+		r->parc = MIN(parc, MAXPARA);
+		/* parv[0] is never used (and may be poisoned), start at 1 */
+		for (i = 1; i < r->parc; i++)
+			safe_strdup(r->parv[i], parv[i]);
+		r->parv[r->parc] = NULL;
+	}
+
+	client->local->auth_request = r;
+	SetAuthPending(client);
+
+	pthread_mutex_lock(&auth_queue_lock);
+	auth_queue_append(&auth_queue, &auth_queue_tail, r);
+	pthread_cond_signal(&auth_queue_cond);
+	pthread_mutex_unlock(&auth_queue_lock);
+
+	return AUTH_CHECK_PENDING;
+#else
+	return Auth_Check(client, as, para);
+#endif
+}
+
+/** The client is being freed, forget about any auth thread request.
+ * The request itself is still finished by the auth thread and freed
+ * afterwards, the result still ends up in the cache.
+ */
+void Auth_CancelAsync(Client *client)
+{
+	if (client->local->auth_request)
+	{
+		client->local->auth_request->client = NULL;
+		client->local->auth_request = NULL;
+	}
+	ClearAuthPending(client);
+#ifdef HAVE_PTHREAD
+	auth_async_free_results(client);
+#endif
+}
+
 #define UNREALIRCD_ARGON2_DEFAULT_TIME_COST             3
 #define UNREALIRCD_ARGON2_DEFAULT_MEMORY_COST           8192
 #define UNREALIRCD_ARGON2_DEFAULT_PARALLELISM_COST      2
@@ -30,6 +30,10 @@ long opermode = 0;
 long sajoinmode = 0;
 /** List of all channels on the server */
 Channel *channels = NULL;
+/** Bumped when a channel becomes secret/private or public again,
+ * so the cached /WHOIS channel lists are rendered again.
+ */
+MODVAR unsigned int channel_visibility_version = 0;
 
 /* some buffers for rebuilding channel/nick lists with comma's */
 static char buf[BUFSIZE];
@@ -117,7 +121,7 @@ Member *find_member_link(Member *lp, Client *ptr)
 		{
 			if (lp->client == ptr)
 				return (lp);
-			lp = lp->next;
+			lp = lp->next_member;
 		}
 	}
 	return NULL;
@@ -131,7 +135,7 @@ Membership *find_membership_link(Membership *lp, Channel *ptr)
 		{
 			if (lp->channel == ptr)
 				return (lp);
-			lp = lp->next;
+			lp = lp->next_channel;
 		}
 	return NULL;
 }
@@ -147,15 +151,13 @@ static Member *make_member(void)
 		for (i = 1; i <= (4072/sizeof(Member)); ++i)
 		{
 			lp = safe_alloc(sizeof(Member));
-			lp->client = NULL;
-			lp->flags = 0;
-			lp->next = freemember;
+			lp->next_member = freemember;
 			freemember = lp;
 		}
 	}
 	lp = freemember;
-	freemember = freemember->next;
-	lp->next = NULL;
+	freemember = freemember->next_member;
+	memset(lp, 0, sizeof(Member));
 	return lp;
 }
 
@@ -166,50 +168,10 @@ static void free_member(Member *lp)
 		return;
 	moddata_free_member(lp);
 	memset(lp, 0, sizeof(Member));
-	lp->next = freemember;
-	lp->client = NULL;
-	lp->flags = 0;
+	lp->next_member = freemember;
 	freemember = lp;
 }
 
-/** Allocate and return an empty Membership struct */
-static Membership *make_membership(void)
-{
-	Membership *m = NULL;
-	unsigned int	i;
-
-	if (freemembership == NULL)
-	{
-		for (i = 1; i <= (4072/sizeof(Membership)); i++)
-		{
-			m = safe_alloc(sizeof(Membership));
-			m->next = freemembership;
-			freemembership = m;
-		}
-		m = freemembership;
-		freemembership = m->next;
-	}
-	else
-	{
-		m = freemembership;
-		freemembership = freemembership->next;
-	}
-	memset(m, 0, sizeof(Membership));
-	return m;
-}
-
-/** Free a Membership struct */
-static void free_membership(Membership *m)
-{
-	if (m)
-	{
-		moddata_free_membership(m);
-		memset(m, 0, sizeof(Membership));
-		m->next = freemembership;
-		freemembership = m;
-	}
-}
-
 /** Find a client by nickname, hunt for older nick names if not found.
  * This can be handy, for example for /KILL nick, if 'nick' keeps
  * nick-changing and you are slow with typing.
@@ -328,8 +290,9 @@ int add_listmode_ex(Ban **list, Client *client, Channel *channel, char *banid, c
 
 	/* Update/set if this ban is new or older than existing one */
 	safe_strdup(ban->banstr, banid); /* cAsE may differ, use oldest version of it */
-	safe_strdup(ban->who, setby);
+	scache_set(ban->who, setby);
 	ban->when = seton;
+	RunHook3(HOOKTYPE_LISTMODE_ADD, channel, list, ban);
 	return 0;
 }
 
@@ -361,9 +324,10 @@ int del_listmode(Ban **list, Channel *channel, char *banid)
 		if (identical_ban(banid, (*ban)->banstr))
 		{
 			tmp = *ban;
+			RunHook3(HOOKTYPE_LISTMODE_DEL, channel, list, tmp);
 			*ban = tmp->next;
 			safe_free(tmp->banstr);
-			safe_free(tmp->who);
+			scache_free(tmp->who);
 			free_ban(tmp);
 			return 0;
 		}
@@ -485,31 +449,85 @@ Ban *is_banned_with_nick(Client *client, Channel *channel, int type, char *nick,
 	return ban;
 }
 
+/** Count a remote member behind server link 'direction' in channel->member_directions */
+static void add_member_direction(Channel *channel, Client *direction)
+{
+	Link *lp;
+
+	for (lp = channel->member_directions; lp; lp = lp->next)
+	{
+		if (lp->value.client == direction)
+		{
+			lp->flags++;
+			return;
+		}
+	}
+	lp = make_link();
+	lp->value.client = direction;
+	lp->flags = 1;
+	lp->next = channel->member_directions;
+	channel->member_directions = lp;
+}
+
+/** Uncount a remote member behind server link 'direction' in channel->member_directions */
+static void del_member_direction(Channel *channel, Client *direction)
+{
+	Link **lp, *tmp;
+
+	for (lp = &channel->member_directions; (tmp = *lp); lp = &tmp->next)
+	{
+		if (tmp->value.client == direction)
+		{
+			if (--tmp->flags == 0)
+			{
+				*lp = tmp->next;
+				free_link(tmp);
+			}
+			return;
+		}
+	}
+}
+
+/** Mark the channel memberships of a user as changed, this is
+ * needed after a join, part, kick or a change of the access
+ * (eg: +o) of the user in a channel. Used by the /WHOIS cache.
+ */
+void membership_changed(Client *client)
+{
+	if (client->user)
+		client->user->channels_version++;
+}
+
 /** Add user to the channel.
- * This adds both the Member struct to the channel->members linked list
- * and also the Membership struct to the client->user->channel linked list.
+ * This allocates a Member struct and adds it to both the channel->members
+ * linked list and the client->user->channel linked list.
  * @note This does NOT send the JOIN, it only does the linked list stuff.
  */
 void add_user_to_channel(Channel *channel, Client *who, int flags)
 {
 	Member *m;
-	Membership *mb;
 
 	if (who->user)
 	{
 		m = make_member();
 		m->client = who;
+		m->channel = channel;
 		m->flags = flags;
-		m->next = channel->members;
+		m->next_member = channel->members;
 		channel->members = m;
 		channel->users++;
+		if (MyConnect(who))
+		{
+			m->next_local = channel->local_members;
+			channel->local_members = m;
+		} else {
+			add_member_direction(channel, who->direction);
+		}
 
-		mb = make_membership();
-		mb->channel = channel;
-		mb->next = who->user->channel;
-		mb->flags = flags;
-		who->user->channel = mb;
+		m->next_channel = who->user->channel;
+		who->user->channel = m;
 		who->user->joined++;
+		membership_changed(who);
 		RunHook2(HOOKTYPE_JOIN_DATA, who, channel);
 	}
 }
@@ -523,34 +541,49 @@ void add_user_to_channel(Channel *channel, Client *who, int flags)
 int remove_user_from_channel(Client *client, Channel *channel)
 {
 	Member **m;
-	Member *m2;
+	Member *m2 = NULL;
 	Membership **mb;
-	Membership *mb2;
 
-	/* Update channel->members list */
-	for (m = &channel->members; (m2 = *m); m = &m2->next)
+	/* Update client->user->channel list */
+	for (mb = &client->user->channel; (m2 = *mb); mb = &m2->next_channel)
 	{
-		if (m2->client == client)
+		if (m2->channel == channel)
 		{
-			*m = m2->next;
-			free_member(m2);
+			*mb = m2->next_channel;
 			break;
 		}
 	}
 
-	/* Update client->user->channel list */
-	for (mb = &client->user->channel; (mb2 = *mb); mb = &mb2->next)
+	/* Update channel->members list */
+	if (m2)
 	{
-		if (mb2->channel == channel)
+		for (m = &channel->members; *m; m = &(*m)->next_member)
 		{
-			*mb = mb2->next;
-			free_membership(mb2);
-			break;
+			if (*m == m2)
+			{
+				*m = m2->next_member;
+				break;
+			}
+		}
+		if (MyConnect(client))
+		{
+			for (m = &channel->local_members; *m; m = &(*m)->next_local)
+			{
+				if (*m == m2)
+				{
+					*m = m2->next_local;
+					break;
+				}
+			}
+		} else {
+			del_member_direction(channel, client->direction);
 		}
+		free_member(m2);
 	}
 
 	/* Update user record to reflect 1 less joined */
 	client->user->joined--;
+	membership_changed(client);
 
 	/* Now sub1_from_channel() will deal with the channel record
 	 * and destroy the channel if needed.
@@ -632,19 +665,16 @@ long get_mode_bitbychar(char m)
 	return 0;
 }
 
-/** Write the "simple" list of channel modes for channel channel onto buffer mbuf with the parameters in pbuf.
+/** Render the "simple" list of channel modes for channel channel onto buffer mbuf with the parameters in pbuf.
+ * This is the uncached version, used by channel_modes().
  */
 /* TODO: this function has many security issues and needs an audit, maybe even a recode */
-void channel_modes(Client *client, char *mbuf, char *pbuf, size_t mbuf_size, size_t pbuf_size, Channel *channel)
+static void channel_modes_render(Channel *channel, char *mbuf, char *pbuf, size_t mbuf_size, size_t pbuf_size)
 {
 	CoreChannelModeTable *tab = &corechannelmodetable[0];
-	int ismember;
+	int ismember = 1;
 	int i;
 
-	if (!(mbuf_size && pbuf_size)) return;
-
-	ismember = (IsMember(client, channel) || IsServer(client) || IsMe(client) || IsULine(client)) ? 1 : 0;
-
 	*pbuf = '\0';
 
 	*mbuf++ = '+';
@@ -719,6 +749,56 @@ void channel_modes(Client *client, char *mbuf, char *pbuf, size_t mbuf_size, siz
 	return;
 }
 
+/** Mark the modes of a channel as changed, so the cached rendering
+ * of channel_modes() is no longer used. Changes to the mode letters
+ * and the limit are noticed automatically, this is needed for
+ * changes to the key and other mode parameters.
+ */
+void channel_modes_changed(Channel *channel)
+{
+	channel->mode_version++;
+}
+
+/** Write the "simple" list of channel modes for channel channel onto buffer mbuf with the parameters in pbuf.
+ * The parameters are only shown to members of the channel, servers and U-Lines.
+ * The result is cached in the channel until the modes change, since
+ * this is called for every channel in LIST and in a server burst.
+ */
+void channel_modes(Client *client, char *mbuf, char *pbuf, size_t mbuf_size, size_t pbuf_size, Channel *channel)
+{
+	ChannelModeCache *cache = &channel->mode_cache;
+	char modes[BUFSIZE], params[BUFSIZE];
+	int ismember;
+
+	if (!(mbuf_size && pbuf_size)) return;
+
+	ismember = (IsMember(client, channel) || IsServer(client) || IsMe(client) || IsULine(client)) ? 1 : 0;
+
+	/* The mode letters and limit are compared as well, since
+	 * some modules change these directly without a version bump.
+	 */
+	if (!cache->modes ||
+	    (cache->version != channel->mode_version) ||
+	    (cache->mode != channel->mode.mode) ||
+	    (cache->extmode != channel->mode.extmode) ||
+	    (cache->limit != channel->mode.limit))
+	{
+		channel_modes_render(channel, modes, params, sizeof(modes), sizeof(params));
+		safe_strdup(cache->modes, modes);
+		safe_strdup(cache->params, params);
+		cache->version = channel->mode_version;
+		cache->mode = channel->mode.mode;
+		cache->extmode = channel->mode.extmode;
+		cache->limit = channel->mode.limit;
+	}
+
+	strlcpy(mbuf, cache->modes, mbuf_size);
+	if (ismember)
+		strlcpy(pbuf, cache->params, pbuf_size);
+	else
+		*pbuf = '\0';
+}
+
 /** Make a pretty mask from the input string - only used by SILENCE
  */
 char *pretty_mask(char *mask)
@@ -1063,25 +1143,28 @@ int sub1_from_channel(Channel *channel)
 	while (channel->banlist)
 	{
 		ban = channel->banlist;
+		RunHook3(HOOKTYPE_LISTMODE_DEL, channel, &channel->banlist, ban);
 		channel->banlist = ban->next;
 		safe_free(ban->banstr);
-		safe_free(ban->who);
+		scache_free(ban->who);
 		free_ban(ban);
 	}
 	while (channel->exlist)
 	{
 		ban = channel->exlist;
+		RunHook3(HOOKTYPE_LISTMODE_DEL, channel, &channel->exlist, ban);
 		channel->exlist = ban->next;
 		safe_free(ban->banstr);
-		safe_free(ban->who);
+		scache_free(ban->who);
 		free_ban(ban);
 	}
 	while (channel->invexlist)
 	{
 		ban = channel->invexlist;
+		RunHook3(HOOKTYPE_LISTMODE_DEL, channel, &channel->invexlist, ban);
 		channel->invexlist = ban->next;
 		safe_free(ban->banstr);
-		safe_free(ban->who);
+		scache_free(ban->who);
 		free_ban(ban);
 	}
 
@@ -1091,6 +1174,8 @@ int sub1_from_channel(Channel *channel)
 	safe_free(channel->mode_lock);
 	safe_free(channel->topic);
 	safe_free(channel->topic_nick);
+	safe_free(channel->mode_cache.modes);
+	safe_free(channel->mode_cache.params);
 
 	if (channel->prevch)
 		channel->prevch->nextch = channel->nextch;
@@ -1266,7 +1351,7 @@ int has_common_channels(Client *c1, Client *c2)
 {
 	Membership *lp;
 
-	for (lp = c1->user->channel; lp; lp = lp->next)
+	for (lp = c1->user->channel; lp; lp = lp->next_channel)
 	{
 		if (IsMember(c2, lp->channel) && user_can_see_member(c1, c2, lp->channel))
 			return 1;
@@ -137,6 +137,7 @@ static ConfigCommand _ConfigCommands[] = {
 static NameValue _ListenerFlags[] = {
 	{ LISTENER_CLIENTSONLY,  "clientsonly"},
 	{ LISTENER_DEFER_ACCEPT, "defer-accept"},
+	{ LISTENER_PROXY,	 "proxy"},
 	{ LISTENER_SERVERSONLY,  "serversonly"},
 	{ LISTENER_TLS, 	 "ssl"},
 	{ LISTENER_NORMAL, 	 "standard"},
@@ -146,6 +147,7 @@ static NameValue _ListenerFlags[] = {
 /* This MUST be alphabetized */
 static NameValue _LinkFlags[] = {
 	{ CONNECT_AUTO,	"autoconnect" },
+	{ CONNECT_ZIP,	"compression" },
 	{ CONNECT_INSECURE,	"insecure" },
 	{ CONNECT_QUARANTINE, "quarantine"},
 	{ CONNECT_TLS, "ssl" },
@@ -394,7 +396,7 @@ long config_checkval(char *orig, unsigned short flags) {
 					if (!isdigit(*sz))
 						break;
 				}
-				ret += atoi(sz+1)*mfactor;
+				ret += (long)atoi(sz+1)*mfactor;
 				if (*text == '\0') {
 					text++;
 					break;
@@ -410,7 +412,7 @@ long config_checkval(char *orig, unsigned short flags) {
 			if (!isdigit(*sz))
 				break;
 		}
-		ret += atoi(sz+1)*mfactor;
+		ret += (long)atoi(sz+1)*mfactor;
 	}
 	else if (flags == CFG_TIME) {
 		int mfactor = 1;
@@ -1638,6 +1640,7 @@ void config_setdefaultsettings(Configuration *i)
 	i->spamfilter_detectslow_warn = 250;
 	i->spamfilter_detectslow_fatal = 500;
 	i->spamfilter_stop_on_first_match = 1;
+	i->spamfilter_async_timeout = 250;
 	i->maxchannelsperuser = 10;
 	i->maxdccallow = 10;
 	safe_strdup(i->channel_command_prefix, "`!.");
@@ -1663,6 +1666,13 @@ void config_setdefaultsettings(Configuration *i)
 		DISABLE_IPV6 = 1;
 	safe_strdup(i->network.x_prefix_quit, "Quit");
 	i->max_unknown_connections_per_ip = 3;
+	i->memory_budget_threshold[MEMORY_PRESSURE_SHRINK_HISTORY] = 60;
+	i->memory_budget_threshold[MEMORY_PRESSURE_DROP_NOTICES] = 75;
+	i->memory_budget_threshold[MEMORY_PRESSURE_TIGHTEN_SENDQ] = 85;
+	i->memory_budget_threshold[MEMORY_PRESSURE_REFUSE_CONNECTIONS] = 95;
+	i->snomask_aggregation_threshold = 50;
+	i->snomask_aggregation_interval = 5;
+	i->latency_sample_rate = 1000;
 	i->handshake_timeout = 30;
 	i->sasl_timeout = 15;
 	i->handshake_delay = -1;
@@ -2383,6 +2393,7 @@ void	config_rehash()
 		DelListItem(uline_ptr, conf_ulines);
 		safe_free(uline_ptr);
 	}
+	free_allow_index();
 	for (allow_ptr = conf_allow; allow_ptr; allow_ptr = (ConfigItem_allow *) next)
 	{
 		next = (ListStruct *)allow_ptr->next;
@@ -2473,6 +2484,7 @@ void	config_rehash()
 		DelListItem(deny_version_ptr, conf_deny_version);
 		safe_free(deny_version_ptr);
 	}
+	free_channel_rules();
 	for (deny_channel_ptr = conf_deny_channel; deny_channel_ptr; deny_channel_ptr = (ConfigItem_deny_channel *) next)
 	{
 		next = (ListStruct *)deny_channel_ptr->next;
@@ -2723,6 +2735,9 @@ int	config_run()
 	 *     and remove it here.
 	 */
 
+	build_allow_index();
+	build_channel_rules();
+
 	close_unbound_listeners();
 	listen_cleanup();
 	close_unbound_listeners();
@@ -2966,7 +2981,7 @@ ConfigItem_sni *find_sni(char *name)
 	return NULL;
 }
 
-ConfigItem_ulines *find_uline(char *host)
+ConfigItem_ulines *find_uline(const char *host)
 {
 	ConfigItem_ulines *ulines;
 
@@ -3092,44 +3107,631 @@ ConfigItem_vhost *find_vhost(char *name)
 }
 
 
-/** returns NULL if allowed and struct if denied */
-ConfigItem_deny_channel *find_channel_allowed(Client *client, char *name)
+/*** Compiled allow { } blocks ***
+ * On every rehash the allow blocks are compiled into an index so we
+ * don't have to match each connecting client against every block:
+ * - allow::ip masks that are an IP, a CIDR mask or something like
+ *   1.2.3.* go into a binary trie, using the same format as client->rawip,
+ * - allow::hostname masks that are an exact host or *.some.domain
+ *   go into hash tables,
+ * - anything else (wildcards in odd places, extended masks, etc.)
+ *   is always considered a candidate.
+ * find_allow_candidates() returns the blocks that could possibly match,
+ * in config order, and AllowClient() then does the full matching.
+ * This keeps the first-match semantics of the linear walk.
+ */
+
+#define ALLOW_HOST_HASH_TABLE_SIZE	1024
+
+typedef struct AllowIndexLink AllowIndexLink;
+struct AllowIndexLink {
+	AllowIndexLink *next;
+	int block;
+};
+
+typedef struct AllowTrieNode AllowTrieNode;
+struct AllowTrieNode {
+	AllowTrieNode *child[2];
+	AllowIndexLink *blocks;
+};
+
+typedef struct AllowHostEntry AllowHostEntry;
+struct AllowHostEntry {
+	AllowHostEntry *next;
+	char *host;
+	AllowIndexLink *blocks;
+};
+
+typedef struct AllowIndex AllowIndex;
+struct AllowIndex {
+	ConfigItem_allow **blocks;	/**< All allow blocks, in the order they are matched */
+	int numblocks;
+	AllowTrieNode *iptrie;		/**< allow::ip masks with an IP or CIDR */
+	AllowHostEntry *exacthost[ALLOW_HOST_HASH_TABLE_SIZE];	/**< allow::hostname with an exact host */
+	AllowHostEntry *suffixhost[ALLOW_HOST_HASH_TABLE_SIZE];	/**< allow::hostname *.domain, stored as .domain */
+	AllowIndexLink *fallback;	/**< Always a candidate */
+	AllowIndexLink *hostfallback;	/**< Candidate if the client has a resolved hostname */
+	ConfigItem_allow **candidates;	/**< Result of find_allow_candidates() */
+	int *found;			/**< Scratch space for find_allow_candidates() */
+	unsigned int *seen;		/**< Per block: generation when it was last found */
+	unsigned int generation;
+};
+
+static AllowIndex *allow_index = NULL;
+static char siphashkey_allow_index[SIPHASH_KEY_LENGTH];
+
+static void allow_index_add_link(AllowIndexLink **list, int block)
+{
+	AllowIndexLink *l = safe_alloc(sizeof(AllowIndexLink));
+	l->block = block;
+	l->next = *list;
+	*list = l;
+}
+
+static void allow_index_free_links(AllowIndexLink *l)
+{
+	AllowIndexLink *l_next;
+
+	for (; l; l = l_next)
+	{
+		l_next = l->next;
+		safe_free(l);
+	}
+}
+
+static void allow_trie_free(AllowTrieNode *node)
+{
+	if (!node)
+		return;
+	allow_trie_free(node->child[0]);
+	allow_trie_free(node->child[1]);
+	allow_index_free_links(node->blocks);
+	safe_free(node);
+}
+
+/** Parse IPv4 masks such as 192.168.* into a prefix.
+ * @returns 1 on success, 0 if it's in a format we can't index.
+ */
+static int allow_index_ipv4_wildcard(const char *mask, unsigned char *addr, int *bits)
 {
-	ConfigItem_deny_channel *dchannel;
-	ConfigItem_allow_channel *achannel;
+	const char *p = mask;
+	int octets = 0;
+	int v, digits;
 
-	for (dchannel = conf_deny_channel; dchannel; dchannel = dchannel->next)
+	memset(addr, 0, 16);
+	addr[10] = addr[11] = 0xff;
+	while (octets < 3)
 	{
-		if (match_simple(dchannel->channel, name))
+		for (v = 0, digits = 0; isdigit(*p); p++, digits++)
+			v = v * 10 + (*p - '0');
+		if ((digits == 0) || (digits > 3) || (v > 255) || (*p != '.'))
+			return 0;
+		addr[12 + octets++] = v;
+		p++;
+		if (!strcmp(p, "*"))
 		{
-			if (dchannel->class && strcmp(client->local->class->name, dchannel->class))
-				continue;
-			if (dchannel->mask && !unreal_mask_match(client, dchannel->mask))
-				continue;
-			break; /* MATCH deny channel { } */
+			*bits = 96 + octets * 8;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** Turn the host part of an allow::ip mask into a prefix for the trie.
+ * The full mask is still checked afterwards, so any user@ part is ignored here.
+ * @returns 1 on success, 0 if the mask can't be indexed.
+ */
+static int allow_index_ipmask(const char *mask, unsigned char *addr, int *bits)
+{
+	char buf[HOSTLEN+1];
+	const char *host;
+	char *p;
+	int cidr = -1;
+
+	if (strchr(mask, '!'))
+		return 0;
+	host = strchr(mask, '@');
+	host = host ? host + 1 : mask;
+	strlcpy(buf, host, sizeof(buf));
+
+	if ((p = strchr(buf, '/')))
+	{
+		*p++ = '\0';
+		cidr = atoi(p);
+		if (cidr <= 0)
+			return 0;
+	}
+
+	if (strchr(buf, '*') || strchr(buf, '?'))
+	{
+		if ((cidr >= 0) || strchr(buf, ':'))
+			return 0;
+		return allow_index_ipv4_wildcard(buf, addr, bits);
+	}
+
+	if (!ip_to_raw(buf, addr))
+		return 0;
+	if (strchr(buf, ':'))
+	{
+		if (cidr > 128)
+			return 0;
+		*bits = (cidr < 0) ? 128 : cidr;
+	} else {
+		if (cidr > 32)
+			return 0;
+		*bits = 96 + ((cidr < 0) ? 32 : cidr);
+	}
+	return 1;
+}
+
+/** Get the key for the host part of an allow::hostname mask.
+ * @returns 1 for an exact host, 2 for a *.domain mask (key is .domain),
+ *          0 if the mask can't be indexed.
+ */
+static int allow_index_hostmask(const char *mask, char *key, size_t keylen)
+{
+	const char *host;
+	int type = 1;
+
+	host = strchr(mask, '@');
+	if (host)
+	{
+		if (strchr(host + 1, '@'))
+			return 0;
+		host++;
+	} else {
+		host = mask;
+	}
+
+	if ((host[0] == '*') && (host[1] == '.'))
+	{
+		host++;
+		type = 2;
+	}
+
+	/* '_' matches a space in match_simple() */
+	if (!*host || strpbrk(host, "*?_") || (strlen(host) >= keylen))
+		return 0;
+
+	strlcpy(key, host, keylen);
+	return type;
+}
+
+static AllowHostEntry *allow_index_find_host(AllowHostEntry **table, const char *host)
+{
+	AllowHostEntry *e;
+
+	for (e = table[siphash_nocase(host, siphashkey_allow_index) % ALLOW_HOST_HASH_TABLE_SIZE]; e; e = e->next)
+		if (!strcasecmp(e->host, host))
+			return e;
+	return NULL;
+}
+
+static void allow_index_add_host(AllowHostEntry **table, const char *host, int block)
+{
+	AllowHostEntry *e;
+	unsigned int hashv;
+
+	e = allow_index_find_host(table, host);
+	if (!e)
+	{
+		hashv = siphash_nocase(host, siphashkey_allow_index) % ALLOW_HOST_HASH_TABLE_SIZE;
+		e = safe_alloc(sizeof(AllowHostEntry));
+		safe_strdup(e->host, host);
+		e->next = table[hashv];
+		table[hashv] = e;
+	}
+	allow_index_add_link(&e->blocks, block);
+}
+
+static void allow_index_free_hosts(AllowHostEntry **table)
+{
+	AllowHostEntry *e, *e_next;
+	int i;
+
+	for (i = 0; i < ALLOW_HOST_HASH_TABLE_SIZE; i++)
+	{
+		for (e = table[i]; e; e = e_next)
+		{
+			e_next = e->next;
+			safe_free(e->host);
+			allow_index_free_links(e->blocks);
+			safe_free(e);
 		}
 	}
+}
+
+/** Free the compiled allow { } blocks, called before conf_allow is freed. */
+void free_allow_index(void)
+{
+	if (!allow_index)
+		return;
+	allow_trie_free(allow_index->iptrie);
+	allow_index_free_hosts(allow_index->exacthost);
+	allow_index_free_hosts(allow_index->suffixhost);
+	allow_index_free_links(allow_index->fallback);
+	allow_index_free_links(allow_index->hostfallback);
+	safe_free(allow_index->blocks);
+	safe_free(allow_index->candidates);
+	safe_free(allow_index->found);
+	safe_free(allow_index->seen);
+	safe_free(allow_index);
+}
+
+/** Compile the allow { } blocks, see find_allow_candidates(). */
+void build_allow_index(void)
+{
+	ConfigItem_allow *aconf;
+	AllowTrieNode **node;
+	unsigned char addr[16];
+	char key[HOSTLEN+1];
+	int bits, i, n, type;
 
-	if (dchannel)
+	free_allow_index();
+	siphash_generate_key(siphashkey_allow_index);
+	allow_index = safe_alloc(sizeof(AllowIndex));
+
+	for (aconf = conf_allow; aconf; aconf = aconf->next)
+		allow_index->numblocks++;
+	allow_index->blocks = safe_alloc(sizeof(ConfigItem_allow *) * (allow_index->numblocks + 1));
+	allow_index->candidates = safe_alloc(sizeof(ConfigItem_allow *) * (allow_index->numblocks + 1));
+	allow_index->found = safe_alloc(sizeof(int) * (allow_index->numblocks + 1));
+	allow_index->seen = safe_alloc(sizeof(unsigned int) * (allow_index->numblocks + 1));
+
+	for (aconf = conf_allow, n = 0; aconf; aconf = aconf->next, n++)
 	{
-		/* Check exceptions... ('allow channel') */
-		for (achannel = conf_allow_channel; achannel; achannel = achannel->next)
+		allow_index->blocks[n] = aconf;
+
+		if (!aconf->hostname || !aconf->ip || !allow_index_ipmask(aconf->ip, addr, &bits))
 		{
-			if (match_simple(achannel->channel, name))
-			{
-				if (achannel->class && strcmp(client->local->class->name, achannel->class))
-					continue;
-				if (achannel->mask && !unreal_mask_match(client, achannel->mask))
-					continue;
-				break; /* MATCH allow channel { } */
-			}
+			allow_index_add_link(&allow_index->fallback, n);
+			continue;
 		}
-		if (achannel)
-			return NULL; /* Matches an 'allow channel' - so not forbidden */
+
+		node = &allow_index->iptrie;
+		for (i = 0; ; i++)
+		{
+			if (!*node)
+				*node = safe_alloc(sizeof(AllowTrieNode));
+			if (i == bits)
+				break;
+			node = &(*node)->child[(addr[i / 8] >> (7 - (i % 8))) & 1];
+		}
+		allow_index_add_link(&(*node)->blocks, n);
+
+		type = allow_index_hostmask(aconf->hostname, key, sizeof(key));
+		if (type == 1)
+			allow_index_add_host(allow_index->exacthost, key, n);
+		else if (type == 2)
+			allow_index_add_host(allow_index->suffixhost, key, n);
 		else
-			return dchannel;
+			allow_index_add_link(&allow_index->hostfallback, n);
 	}
-	return NULL;
+}
+
+static void allow_index_collect(AllowIndexLink *l, int *cnt)
+{
+	for (; l; l = l->next)
+	{
+		if (allow_index->seen[l->block] == allow_index->generation)
+			continue;
+		allow_index->seen[l->block] = allow_index->generation;
+		allow_index->found[(*cnt)++] = l->block;
+	}
+}
+
+static int allow_index_compare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/** Find the allow { } blocks that may match this client.
+ * @param client    The client (local)
+ * @param username  Username, as passed to AllowClient()
+ * @param sockhost  The host from check_init()
+ * @returns A NULL-terminated list of allow blocks, in the order they
+ *          should be tried. Only valid until the next call.
+ * @note The caller must still do the full allow block matching,
+ *       this function may return blocks that don't match.
+ */
+ConfigItem_allow **find_allow_candidates(Client *client, const char *username, char *sockhost)
+{
+	struct hostent *hp = client->local->hostp;
+	AllowTrieNode *node;
+	AllowHostEntry *e;
+	unsigned char *addr = client->rawip;
+	char fullname[HOSTLEN+1];
+	char *p;
+	int cnt = 0;
+	int i;
+
+	if (!allow_index)
+		build_allow_index();
+
+	/* These cases are rare and don't fit the index, simply try all blocks */
+	if (!strcmp(sockhost, "localhost") ||
+	    !client->ip ||
+	    (username && strchr(username, '@')) ||
+	    (client->ident && strchr(client->ident, '@')))
+	{
+		return allow_index->blocks;
+	}
+
+	if (++allow_index->generation == 0)
+	{
+		memset(allow_index->seen, 0, sizeof(unsigned int) * (allow_index->numblocks + 1));
+		allow_index->generation = 1;
+	}
+
+	allow_index_collect(allow_index->fallback, &cnt);
+
+	for (node = allow_index->iptrie, i = 0; node; i++)
+	{
+		allow_index_collect(node->blocks, &cnt);
+		if (i == 128)
+			break;
+		node = node->child[(addr[i / 8] >> (7 - (i % 8))) & 1];
+	}
+
+	if (hp && hp->h_name)
+	{
+		allow_index_collect(allow_index->hostfallback, &cnt);
+		strlcpy(fullname, hp->h_name, sizeof(fullname));
+		if ((e = allow_index_find_host(allow_index->exacthost, fullname)))
+			allow_index_collect(e->blocks, &cnt);
+		for (p = fullname; (p = strchr(p, '.')); p++)
+			if ((e = allow_index_find_host(allow_index->suffixhost, p)))
+				allow_index_collect(e->blocks, &cnt);
+	}
+
+	qsort(allow_index->found, cnt, sizeof(int), allow_index_compare);
+	for (i = 0; i < cnt; i++)
+		allow_index->candidates[i] = allow_index->blocks[allow_index->found[i]];
+	allow_index->candidates[cnt] = NULL;
+
+	return allow_index->candidates;
+}
+
+/*** Compiled deny channel { } and allow channel { } rules ***
+ * On every rehash both rule lists are compiled into a hash table for
+ * the channel masks without wildcards and an ordered list of the
+ * wildcard masks, each with its literal begin and end so most of them
+ * can be rejected without calling match_simple().
+ * For existing channels the result of the name matching is also cached
+ * in the channel itself (until the next rehash), so for example
+ * set::hide-list does not need to match all rules for every channel.
+ */
+
+#define CHANNEL_RULES_HASH_TABLE_SIZE	1024
+
+typedef struct ChannelRule ChannelRule;
+struct ChannelRule {
+	ChannelRule *next;		/**< Next rule in this hash bucket or in the wildcard list */
+	int index;			/**< Position in the original list, lower goes first */
+	char *channel;			/**< Channel mask */
+	int prefixlen;			/**< Literal characters at the start of the mask */
+	char *suffix;			/**< Literal characters after the last '*', or NULL */
+	int suffixlen;
+	char *class;			/**< Class condition, or NULL */
+	ConfigItem_mask *mask;		/**< Mask condition, or NULL */
+	void *item;			/**< The ConfigItem_deny_channel or ConfigItem_allow_channel */
+};
+
+typedef struct ChannelRuleSet ChannelRuleSet;
+struct ChannelRuleSet {
+	ChannelRule *exact[CHANNEL_RULES_HASH_TABLE_SIZE];
+	ChannelRule *wild;		/**< Wildcard rules, ordered by index */
+	ChannelRule *wild_last;		/**< Last entry of 'wild' */
+};
+
+static ChannelRuleSet deny_channel_rules;
+static ChannelRuleSet allow_channel_rules;
+static unsigned int channel_rules_version = 0;
+static char siphashkey_channel_rules[SIPHASH_KEY_LENGTH];
+
+#define CHANNEL_RULES_CACHED	1	/**< channel->deny_channel_verdict applies to all clients */
+#define CHANNEL_RULES_DYNAMIC	2	/**< Depends on the client: evaluate the rules every time */
+
+static void channel_rules_add(ChannelRuleSet *set, int index, char *channel, char *class, ConfigItem_mask *mask, void *item)
+{
+	ChannelRule *r = safe_alloc(sizeof(ChannelRule));
+	unsigned int hashv;
+	char *p;
+
+	r->index = index;
+	r->channel = channel;
+	r->class = class;
+	r->mask = mask;
+	r->item = item;
+
+	if (!strpbrk(channel, "*?"))
+	{
+		hashv = siphash_nocase(channel, siphashkey_channel_rules) % CHANNEL_RULES_HASH_TABLE_SIZE;
+		r->next = set->exact[hashv];
+		set->exact[hashv] = r;
+		return;
+	}
+
+	/* '_' is special in match_simple(), so it ends the literal part as well */
+	r->prefixlen = strcspn(channel, "*?_");
+	p = strrchr(channel, '*');
+	if (p && !strpbrk(p + 1, "?_"))
+	{
+		r->suffix = p + 1;
+		r->suffixlen = strlen(r->suffix);
+	}
+
+	/* Append, to keep the wildcard list in the original order */
+	if (set->wild_last)
+		set->wild_last->next = r;
+	else
+		set->wild = r;
+	set->wild_last = r;
+}
+
+static void channel_rules_free(ChannelRuleSet *set)
+{
+	ChannelRule *r, *r_next;
+	int i;
+
+	for (i = 0; i < CHANNEL_RULES_HASH_TABLE_SIZE; i++)
+	{
+		for (r = set->exact[i]; r; r = r_next)
+		{
+			r_next = r->next;
+			safe_free(r);
+		}
+	}
+	for (r = set->wild; r; r = r_next)
+	{
+		r_next = r->next;
+		safe_free(r);
+	}
+	memset(set, 0, sizeof(ChannelRuleSet));
+}
+
+/** Free the compiled deny channel / allow channel rules, called before the lists are freed. */
+void free_channel_rules(void)
+{
+	channel_rules_free(&deny_channel_rules);
+	channel_rules_free(&allow_channel_rules);
+	/* Invalidates the verdicts cached in all channels */
+	if (++channel_rules_version == 0)
+		channel_rules_version = 1;
+}
+
+/** Compile the deny channel { } and allow channel { } rules, see find_channel_allowed(). */
+void build_channel_rules(void)
+{
+	ConfigItem_deny_channel *d;
+	ConfigItem_allow_channel *a;
+	int n;
+
+	free_channel_rules();
+	siphash_generate_key(siphashkey_channel_rules);
+
+	for (d = conf_deny_channel, n = 0; d; d = d->next, n++)
+		channel_rules_add(&deny_channel_rules, n, d->channel, d->class, d->mask, d);
+
+	for (a = conf_allow_channel, n = 0; a; a = a->next, n++)
+		channel_rules_add(&allow_channel_rules, n, a->channel, a->class, a->mask, a);
+}
+
+static int channel_rule_match_name(ChannelRule *r, char *name, int namelen)
+{
+	int i;
+
+	for (i = 0; i < r->prefixlen; i++)
+		if (tolower(r->channel[i]) != tolower(name[i]))
+			return 0;
+	if (r->suffix)
+	{
+		if (namelen < r->prefixlen + r->suffixlen)
+			return 0;
+		for (i = 0; i < r->suffixlen; i++)
+			if (tolower(r->suffix[i]) != tolower(name[namelen - r->suffixlen + i]))
+				return 0;
+	}
+	return match_simple(r->channel, name);
+}
+
+static int channel_rule_applies(ChannelRule *r, Client *client)
+{
+	if (r->class && strcmp(client->local->class->name, r->class))
+		return 0;
+	if (r->mask && !unreal_mask_match(client, r->mask))
+		return 0;
+	return 1;
+}
+
+/** Find the first rule in 'set' that matches the channel name.
+ * @param set     The rule set
+ * @param client  The client to check class/mask conditions for,
+ *                or NULL to check only the channel name.
+ * @param name    The channel name
+ * @param conditional  If not NULL, this is set to 1 if any rule that
+ *                matched the name has a class or mask condition.
+ *                In that case all rules are checked.
+ * @returns The matching rule, or NULL if none matched.
+ */
+static ChannelRule *channel_rules_find(ChannelRuleSet *set, Client *client, char *name, int *conditional)
+{
+	ChannelRule *r, *best = NULL;
+	int namelen = strlen(name);
+
+	for (r = set->exact[siphash_nocase(name, siphashkey_channel_rules) % CHANNEL_RULES_HASH_TABLE_SIZE]; r; r = r->next)
+	{
+		if (strcasecmp(r->channel, name))
+			continue;
+		if (conditional && (r->class || r->mask))
+			*conditional = 1;
+		if ((!best || (r->index < best->index)) && (!client || channel_rule_applies(r, client)))
+			best = r;
+	}
+
+	for (r = set->wild; r; r = r->next)
+	{
+		if (best && (r->index > best->index) && !conditional)
+			break;
+		if (!channel_rule_match_name(r, name, namelen))
+			continue;
+		if (conditional && (r->class || r->mask))
+			*conditional = 1;
+		if ((!best || (r->index < best->index)) && (!client || channel_rule_applies(r, client)))
+			best = r;
+	}
+
+	return best;
+}
+
+/** Check deny channel { } and allow channel { } rules.
+ * @param client   The client (local)
+ * @param name     The channel name
+ * @param channel  The channel, if it exists (can be NULL).
+ *                 This is used to cache the result.
+ * @returns NULL if allowed and the deny channel { } block if denied.
+ */
+ConfigItem_deny_channel *find_channel_allowed_ex(Client *client, char *name, Channel *channel)
+{
+	ChannelRule *d, *a = NULL;
+	int conditional = 0;
+
+	if (channel && (channel->deny_channel_version == channel_rules_version))
+	{
+		if (channel->deny_channel_state == CHANNEL_RULES_CACHED)
+			return channel->deny_channel_verdict;
+	}
+	else if (channel)
+	{
+		/* Cache the outcome if it does not depend on the client */
+		channel->deny_channel_version = channel_rules_version;
+		d = channel_rules_find(&deny_channel_rules, NULL, name, &conditional);
+		if (d)
+			a = channel_rules_find(&allow_channel_rules, NULL, name, &conditional);
+		if (!d || !conditional)
+		{
+			channel->deny_channel_state = CHANNEL_RULES_CACHED;
+			channel->deny_channel_verdict = (d && !a) ? (ConfigItem_deny_channel *)d->item : NULL;
+			return channel->deny_channel_verdict;
+		}
+		channel->deny_channel_state = CHANNEL_RULES_DYNAMIC;
+	}
+
+	d = channel_rules_find(&deny_channel_rules, client, name, NULL);
+	if (!d)
+		return NULL;
+
+	/* Check exceptions... ('allow channel') */
+	if (channel_rules_find(&allow_channel_rules, client, name, NULL))
+		return NULL; /* Matches an 'allow channel' - so not forbidden */
+
+	return (ConfigItem_deny_channel *)d->item;
+}
+
+/** returns NULL if allowed and struct if denied */
+ConfigItem_deny_channel *find_channel_allowed(Client *client, char *name)
+{
+	return find_channel_allowed_ex(client, name, find_channel(name, NULL));
 }
 
 void init_dynconf(void)
@@ -4248,6 +4850,7 @@ int	_conf_class(ConfigFile *conf, ConfigEntry *ce)
 		isnew = 0;
 		class->flag.temporary = 0;
 		class->options = 0; /* RESET OPTIONS */
+		class->soft_sendq = 0;
 	}
 	safe_strdup(class->name, ce->ce_vardata);
 
@@ -4265,11 +4868,17 @@ int	_conf_class(ConfigFile *conf, ConfigEntry *ce)
 			class->sendq = config_checkval(cep->ce_vardata,CFG_SIZE);
 		else if (!strcmp(cep->ce_varname, "recvq"))
 			class->recvq = config_checkval(cep->ce_vardata,CFG_SIZE);
+		else if (!strcmp(cep->ce_varname, "soft-sendq"))
+			class->soft_sendq = config_checkval(cep->ce_vardata,CFG_SIZE);
 		else if (!strcmp(cep->ce_varname, "options"))
 		{
 			for (cep2 = cep->ce_entries; cep2; cep2 = cep2->ce_next)
+			{
 				if (!strcmp(cep2->ce_varname, "nofakelag"))
 					class->options |= CLASS_OPT_NOFAKELAG;
+				else if (!strcmp(cep2->ce_varname, "lossy"))
+					class->options |= CLASS_OPT_LOSSY;
+			}
 		}
 	}
 	if (isnew)
@@ -4282,7 +4891,8 @@ int	_test_class(ConfigFile *conf, ConfigEntry *ce)
 	ConfigEntry 	*cep, *cep2;
 	int		errors = 0;
 	char has_pingfreq = 0, has_connfreq = 0, has_maxclients = 0, has_sendq = 0;
-	char has_recvq = 0;
+	char has_recvq = 0, has_soft_sendq = 0;
+	long sendq = 0, soft_sendq = 0;
 
 	if (!ce->ce_vardata)
 	{
@@ -4307,6 +4917,9 @@ int	_test_class(ConfigFile *conf, ConfigEntry *ce)
 					;
 				else
 #endif
+				if (!strcmp(cep2->ce_varname, "lossy"))
+					;
+				else
 				{
 					config_error("%s:%d: Unknown option '%s' in class::options",
 						cep2->ce_fileptr->cf_filename, cep2->ce_varlinenum, cep2->ce_varname);
@@ -4394,6 +5007,27 @@ int	_test_class(ConfigFile *conf, ConfigEntry *ce)
 					cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
 				errors++;
 			}
+			sendq = l;
+		}
+		/* class::soft-sendq */
+		else if (!strcmp(cep->ce_varname, "soft-sendq"))
+		{
+			long l;
+			if (has_soft_sendq)
+			{
+				config_warn_duplicate(cep->ce_fileptr->cf_filename,
+					cep->ce_varlinenum, "class::soft-sendq");
+				continue;
+			}
+			has_soft_sendq = 1;
+			l = config_checkval(cep->ce_vardata,CFG_SIZE);
+			if ((l <= 0) || (l > 2000000000))
+			{
+				config_error("%s:%i: class::soft-sendq with illegal value",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+				errors++;
+			}
+			soft_sendq = l;
 		}
 		/* class::recvq */
 		else if (!strcmp(cep->ce_varname, "recvq"))
@@ -4441,6 +5075,12 @@ int	_test_class(ConfigFile *conf, ConfigEntry *ce)
 			"class::sendq");
 		errors++;
 	}
+	if (sendq && soft_sendq && (soft_sendq > sendq))
+	{
+		config_error("%s:%i: class::soft-sendq may not be higher than class::sendq",
+			ce->ce_fileptr->cf_filename, ce->ce_varlinenum);
+		errors++;
+	}
 
 	return errors;
 }
@@ -4801,14 +5441,99 @@ int     _test_tld(ConfigFile *conf, ConfigEntry *ce)
 	return errors;
 }
 
+/** Create or update the listener for one ip/port (or UNIX socket) of a listen block */
+static void conf_listen_configure(ConfigFile *conf, ConfigEntry *ce, ConfigEntry *tlsconfig, char *ip, int port, int ipv6, int flags)
+{
+	ConfigEntry *cep;
+	ConfigEntry *cepp;
+	ConfigItem_listen *listen;
+	int isnew;
+	Hook *h;
+
+	if (!(listen = find_listen(ip, port, ipv6)))
+	{
+		listen = safe_alloc(sizeof(ConfigItem_listen));
+		safe_strdup(listen->ip, ip);
+		listen->port = port;
+		listen->fd = -1;
+		listen->ipv6 = ipv6;
+		isnew = 1;
+	} else
+		isnew = 0;
+
+	if (listen->options & LISTENER_BOUND)
+		flags |= LISTENER_BOUND;
+
+	listen->options = flags;
+	if (isnew)
+		AddListItem(listen, conf_listen);
+	listen->flag.temporary = 0;
+
+	if (listen->ssl_ctx)
+	{
+		SSL_CTX_free(listen->ssl_ctx);
+		listen->ssl_ctx = NULL;
+	}
+
+	if (listen->tls_options)
+	{
+		free_tls_options(listen->tls_options);
+		listen->tls_options = NULL;
+	}
+
+	if (tlsconfig)
+	{
+		listen->tls_options = safe_alloc(sizeof(TLSOptions));
+		conf_tlsblock(conf, tlsconfig, listen->tls_options);
+		listen->ssl_ctx = init_ctx(listen->tls_options, 1);
+	}
+
+	/* For modules that hook CONFIG_LISTEN and CONFIG_LISTEN_OPTIONS */
+	for (cep = ce->ce_entries; cep; cep = cep->ce_next)
+	{
+		if (!strcmp(cep->ce_varname, "ip"))
+			;
+		else if (!strcmp(cep->ce_varname, "port"))
+			;
+		else if (!strcmp(cep->ce_varname, "file"))
+			;
+		else if (!strcmp(cep->ce_varname, "options"))
+		{
+			for (cepp = cep->ce_entries; cepp; cepp = cepp->ce_next)
+			{
+				if (!config_binary_flags_search(_ListenerFlags, cepp->ce_varname, ARRAY_SIZEOF(_ListenerFlags)))
+				{
+					for (h = Hooks[HOOKTYPE_CONFIGRUN_EX]; h; h = h->next)
+					{
+						int value = (*(h->func.intfunc))(conf, cepp, CONFIG_LISTEN_OPTIONS, listen);
+						if (value == 1)
+							break;
+					}
+				}
+			}
+		} else
+		if (!strcmp(cep->ce_varname, "ssl-options") || !strcmp(cep->ce_varname, "tls-options"))
+			;
+		else
+		{
+			for (h = Hooks[HOOKTYPE_CONFIGRUN_EX]; h; h = h->next)
+			{
+				int value = (*(h->func.intfunc))(conf, cep, CONFIG_LISTEN, listen);
+				if (value == 1)
+					break;
+			}
+		}
+	}
+}
+
 int	_conf_listen(ConfigFile *conf, ConfigEntry *ce)
 {
 	ConfigEntry *cep;
 	ConfigEntry *cepp;
 	ConfigEntry *tlsconfig = NULL;
-	ConfigItem_listen *listen = NULL;
 	char *ip = NULL;
-	int start=0, end=0, port, isnew;
+	char *file = NULL;
+	int start=0, end=0, port;
 	int tmpflags =0;
 	Hook *h;
 
@@ -4824,6 +5549,10 @@ int	_conf_listen(ConfigFile *conf, ConfigEntry *ce)
 			if ((start < 0) || (start > 65535) || (end < 0) || (end > 65535))
 				return -1; /* this is already validated in _test_listen, but okay.. */
 		} else
+		if (!strcmp(cep->ce_varname, "file"))
+		{
+			file = cep->ce_vardata;
+		} else
 		if (!strcmp(cep->ce_varname, "options"))
 		{
 			for (cepp = cep->ce_entries; cepp; cepp = cepp->ce_next)
@@ -4855,169 +5584,25 @@ int	_conf_listen(ConfigFile *conf, ConfigEntry *ce)
 			}
 		}
 	}
+
+	/* A UNIX socket: the path is stored in listen::ip, with port 0 */
+	if (file)
+	{
+		conf_listen_configure(conf, ce, tlsconfig, file, 0, 0, tmpflags|LISTENER_UNIX);
+		return 1;
+	}
+
 	for (port = start; port <= end; port++)
 	{
 		/* First deal with IPv4 */
 		if (!strchr(ip, ':'))
-		{
-			if (!(listen = find_listen(ip, port, 0)))
-			{
-				listen = safe_alloc(sizeof(ConfigItem_listen));
-				safe_strdup(listen->ip, ip);
-				listen->port = port;
-				listen->fd = -1;
-				listen->ipv6 = 0;
-				isnew = 1;
-			} else
-				isnew = 0;
-
-			if (listen->options & LISTENER_BOUND)
-				tmpflags |= LISTENER_BOUND;
-
-			listen->options = tmpflags;
-			if (isnew)
-				AddListItem(listen, conf_listen);
-			listen->flag.temporary = 0;
-
-			if (listen->ssl_ctx)
-			{
-				SSL_CTX_free(listen->ssl_ctx);
-				listen->ssl_ctx = NULL;
-			}
-
-			if (listen->tls_options)
-			{
-				free_tls_options(listen->tls_options);
-				listen->tls_options = NULL;
-			}
-
-			if (tlsconfig)
-			{
-				listen->tls_options = safe_alloc(sizeof(TLSOptions));
-				conf_tlsblock(conf, tlsconfig, listen->tls_options);
-				listen->ssl_ctx = init_ctx(listen->tls_options, 1);
-			}
-
-			/* For modules that hook CONFIG_LISTEN and CONFIG_LISTEN_OPTIONS.
-			 * Yeah, ugly we have this here..
-			 * and again about 100 lines down too.
-			 */
-			for (cep = ce->ce_entries; cep; cep = cep->ce_next)
-			{
-				if (!strcmp(cep->ce_varname, "ip"))
-					;
-				else if (!strcmp(cep->ce_varname, "port"))
-					;
-				else if (!strcmp(cep->ce_varname, "options"))
-				{
-					for (cepp = cep->ce_entries; cepp; cepp = cepp->ce_next)
-					{
-						NameValue *ofp;
-						if (!config_binary_flags_search(_ListenerFlags, cepp->ce_varname, ARRAY_SIZEOF(_ListenerFlags)))
-						{
-							for (h = Hooks[HOOKTYPE_CONFIGRUN_EX]; h; h = h->next)
-							{
-								int value = (*(h->func.intfunc))(conf, cepp, CONFIG_LISTEN_OPTIONS, listen);
-								if (value == 1)
-									break;
-							}
-						}
-					}
-				} else
-				if (!strcmp(cep->ce_varname, "ssl-options") || !strcmp(cep->ce_varname, "tls-options"))
-					;
-				else
-				{
-					for (h = Hooks[HOOKTYPE_CONFIGRUN_EX]; h; h = h->next)
-					{
-						int value = (*(h->func.intfunc))(conf, cep, CONFIG_LISTEN, listen);
-						if (value == 1)
-							break;
-					}
-				}
-			}
-		}
+			conf_listen_configure(conf, ce, tlsconfig, ip, port, 0, tmpflags);
 
 		/* Then deal with IPv6 (if available/enabled) */
 		if (!DISABLE_IPV6)
 		{
 			if (strchr(ip, ':') || (*ip == '*'))
-			{
-				if (!(listen = find_listen(ip, port, 1)))
-				{
-					listen = safe_alloc(sizeof(ConfigItem_listen));
-					safe_strdup(listen->ip, ip);
-					listen->port = port;
-					listen->fd = -1;
-					listen->ipv6 = 1;
-					isnew = 1;
-				} else
-					isnew = 0;
-
-				if (listen->options & LISTENER_BOUND)
-					tmpflags |= LISTENER_BOUND;
-
-				listen->options = tmpflags;
-				if (isnew)
-					AddListItem(listen, conf_listen);
-				listen->flag.temporary = 0;
-
-				if (listen->ssl_ctx)
-				{
-					SSL_CTX_free(listen->ssl_ctx);
-					listen->ssl_ctx = NULL;
-				}
-
-				if (listen->tls_options)
-				{
-					free_tls_options(listen->tls_options);
-					listen->tls_options = NULL;
-				}
-
-				if (tlsconfig)
-				{
-					listen->tls_options = safe_alloc(sizeof(TLSOptions));
-					conf_tlsblock(conf, tlsconfig, listen->tls_options);
-					listen->ssl_ctx = init_ctx(listen->tls_options, 1);
-				}
-				/* For modules that hook CONFIG_LISTEN and CONFIG_LISTEN_OPTIONS.
-				 * Yeah, ugly we have this here..
-				 */
-				for (cep = ce->ce_entries; cep; cep = cep->ce_next)
-				{
-					if (!strcmp(cep->ce_varname, "ip"))
-						;
-					else if (!strcmp(cep->ce_varname, "port"))
-						;
-					else if (!strcmp(cep->ce_varname, "options"))
-					{
-						for (cepp = cep->ce_entries; cepp; cepp = cepp->ce_next)
-						{
-							NameValue *ofp;
-							if (!config_binary_flags_search(_ListenerFlags, cepp->ce_varname, ARRAY_SIZEOF(_ListenerFlags)))
-							{
-								for (h = Hooks[HOOKTYPE_CONFIGRUN_EX]; h; h = h->next)
-								{
-									int value = (*(h->func.intfunc))(conf, cepp, CONFIG_LISTEN_OPTIONS, listen);
-									if (value == 1)
-										break;
-								}
-							}
-						}
-					} else
-					if (!strcmp(cep->ce_varname, "ssl-options") || !strcmp(cep->ce_varname, "tls-options"))
-						;
-					else
-					{
-						for (h = Hooks[HOOKTYPE_CONFIGRUN_EX]; h; h = h->next)
-						{
-							int value = (*(h->func.intfunc))(conf, cep, CONFIG_LISTEN, listen);
-							if (value == 1)
-								break;
-						}
-					}
-				}
-			}
+				conf_listen_configure(conf, ce, tlsconfig, ip, port, 1, tmpflags);
 		}
 	}
 	return 1;
@@ -5028,7 +5613,7 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 	ConfigEntry *cep;
 	ConfigEntry *cepp;
 	int errors = 0;
-	char has_ip = 0, has_port = 0, has_options = 0, port_6667 = 0;
+	char has_ip = 0, has_port = 0, has_file = 0, has_options = 0, has_proxy = 0, port_6667 = 0;
 	char *ip = NULL;
 	Hook *h;
 
@@ -5128,6 +5713,8 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 				}
 				if (!strcmp(cepp->ce_varname, "ssl") || !strcmp(cepp->ce_varname, "tls"))
 					have_tls_listeners = 1; /* for ssl config test */
+				if (!strcmp(cepp->ce_varname, "proxy"))
+					has_proxy = 1;
 			}
 		}
 		else
@@ -5164,6 +5751,31 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 				cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
 			errors++;
 		} else
+		if (!strcmp(cep->ce_varname, "file"))
+		{
+			has_file = 1;
+#ifdef _WIN32
+			config_error("%s:%i: listen::file: UNIX sockets are not supported on Windows",
+				cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+			errors++;
+#else
+			struct stat st;
+
+			if (strlen(cep->ce_vardata) >= sizeof(((struct sockaddr_un *)0)->sun_path))
+			{
+				config_error("%s:%i: listen::file: path of the UNIX socket is too long",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+				errors++;
+			}
+			/* A stale socket is removed before binding, anything else is not */
+			if ((lstat(cep->ce_vardata, &st) == 0) && !S_ISSOCK(st.st_mode))
+			{
+				config_error("%s:%i: listen::file: %s exists and is not a UNIX socket",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum, cep->ce_vardata);
+				errors++;
+			}
+#endif
+		} else
 		if (!strcmp(cep->ce_varname, "port"))
 		{
 			int start = 0, end = 0;
@@ -5218,6 +5830,28 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 		}
 	}
 
+	if (has_file)
+	{
+		if (has_ip || has_port)
+		{
+			config_error("%s:%d: listen block has a listen::file and a listen::ip or listen::port. "
+			             "Use either a listen::file (UNIX socket) or a listen::ip and listen::port.",
+				ce->ce_fileptr->cf_filename, ce->ce_varlinenum);
+			errors++;
+		}
+		/* Without a PROXY header all clients on a UNIX socket would
+		 * share one IP for throttling, bans and connection limits.
+		 */
+		if (!has_proxy)
+		{
+			config_error("%s:%d: listen block with a listen::file (UNIX socket) requires listen::options::proxy",
+				ce->ce_fileptr->cf_filename, ce->ce_varlinenum);
+			errors++;
+		}
+		requiredstuff.conf_listen = 1;
+		return errors;
+	}
+
 	if (!has_ip)
 	{
 		config_error("%s:%d: listen block requires an listen::ip",
@@ -6469,9 +7103,18 @@ int	_test_link(ConfigFile *conf, ConfigEntry *ce)
 			{
 				if (!strcmp(cepp->ce_varname, "quarantine"))
 					;
+				else if (!strcmp(cepp->ce_varname, "compression"))
+				{
+#ifndef ZIP_LINKS
+					config_error("%s:%d: link::options::compression: this UnrealIRCd was compiled without "
+					             "zlib support, compressed server links are not available.",
+					             cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+					errors++;
+#endif
+				}
 				else
 				{
-					config_error("%s:%d: link::options only has one possible option ('quarantine', rarely used). "
+					config_error("%s:%d: link::options only has two possible options ('compression' and 'quarantine'). "
 					             "Option '%s' is unrecognized. "
 					             "Perhaps you meant to set an outgoing option in link::outgoing::options instead?",
 					             cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum, cepp->ce_varname);
@@ -7625,6 +8268,14 @@ int	_conf_set(ConfigFile *conf, ConfigEntry *ce)
 				{
 					tempiConf.spamfilter_stop_on_first_match = config_checkval(cepp->ce_vardata, CFG_YESNO);
 				}
+				else if (!strcmp(cepp->ce_varname, "async"))
+				{
+					tempiConf.spamfilter_async = config_checkval(cepp->ce_vardata, CFG_YESNO);
+				}
+				else if (!strcmp(cepp->ce_varname, "async-timeout"))
+				{
+					tempiConf.spamfilter_async_timeout = atol(cepp->ce_vardata);
+				}
 			}
 		}
 		else if (!strcmp(cep->ce_varname, "default-bantime"))
@@ -7713,6 +8364,36 @@ int	_conf_set(ConfigFile *conf, ConfigEntry *ce)
 		{
 			tempiConf.max_unknown_connections_per_ip = atoi(cep->ce_vardata);
 		}
+		else if (!strcmp(cep->ce_varname, "memory-budget"))
+		{
+			for (cepp = cep->ce_entries; cepp; cepp = cepp->ce_next)
+			{
+				if (!strcmp(cepp->ce_varname, "limit"))
+					tempiConf.memory_budget = config_checkval(cepp->ce_vardata, CFG_SIZE);
+				else if (!strcmp(cepp->ce_varname, "shrink-history"))
+					tempiConf.memory_budget_threshold[MEMORY_PRESSURE_SHRINK_HISTORY] = atoi(cepp->ce_vardata);
+				else if (!strcmp(cepp->ce_varname, "drop-notices"))
+					tempiConf.memory_budget_threshold[MEMORY_PRESSURE_DROP_NOTICES] = atoi(cepp->ce_vardata);
+				else if (!strcmp(cepp->ce_varname, "tighten-sendq"))
+					tempiConf.memory_budget_threshold[MEMORY_PRESSURE_TIGHTEN_SENDQ] = atoi(cepp->ce_vardata);
+				else if (!strcmp(cepp->ce_varname, "refuse-connections"))
+					tempiConf.memory_budget_threshold[MEMORY_PRESSURE_REFUSE_CONNECTIONS] = atoi(cepp->ce_vardata);
+			}
+		}
+		else if (!strcmp(cep->ce_varname, "snomask-aggregation"))
+		{
+			for (cepp = cep->ce_entries; cepp; cepp = cepp->ce_next)
+			{
+				if (!strcmp(cepp->ce_varname, "threshold"))
+					tempiConf.snomask_aggregation_threshold = atoi(cepp->ce_vardata);
+				else if (!strcmp(cepp->ce_varname, "interval"))
+					tempiConf.snomask_aggregation_interval = config_checkval(cepp->ce_vardata, CFG_TIME);
+			}
+		}
+		else if (!strcmp(cep->ce_varname, "latency-sample-rate"))
+		{
+			tempiConf.latency_sample_rate = atoi(cep->ce_vardata);
+		}
 		else if (!strcmp(cep->ce_varname, "handshake-timeout"))
 		{
 			tempiConf.handshake_timeout = config_checkval(cep->ce_vardata, CFG_TIME);
@@ -8621,6 +9302,20 @@ int	_test_set(ConfigFile *conf, ConfigEntry *ce)
 				if (!strcmp(cepp->ce_varname, "stop-on-first-match"))
 				{
 				} else
+				if (!strcmp(cepp->ce_varname, "async"))
+				{
+				} else
+				if (!strcmp(cepp->ce_varname, "async-timeout"))
+				{
+					long v = atol(cepp->ce_vardata);
+					if ((v < 1) || (v > 10000))
+					{
+						config_error("%s:%i: set::spamfilter::async-timeout must be between 1 and 10000 (msec)",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+						errors++;
+						continue;
+					}
+				} else
 				{
 					config_error_unknown(cepp->ce_fileptr->cf_filename,
 						cepp->ce_varlinenum, "set::spamfilter",
@@ -8841,6 +9536,74 @@ int	_test_set(ConfigFile *conf, ConfigEntry *ce)
 				errors++;
 			}
 		}
+		else if (!strcmp(cep->ce_varname, "memory-budget")) {
+			for (cepp = cep->ce_entries; cepp; cepp = cepp->ce_next)
+			{
+				CheckNull(cepp);
+				if (!strcmp(cepp->ce_varname, "limit"))
+				{
+				} else
+				if (!strcmp(cepp->ce_varname, "shrink-history") ||
+				    !strcmp(cepp->ce_varname, "drop-notices") ||
+				    !strcmp(cepp->ce_varname, "tighten-sendq") ||
+				    !strcmp(cepp->ce_varname, "refuse-connections"))
+				{
+					int v = atoi(cepp->ce_vardata);
+					if ((v < 1) || (v > 100))
+					{
+						config_error("%s:%i: set::memory-budget::%s must be a percentage between 1 and 100",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum, cepp->ce_varname);
+						errors++;
+					}
+				} else
+				{
+					config_error_unknown(cepp->ce_fileptr->cf_filename,
+						cepp->ce_varlinenum, "set::memory-budget",
+						cepp->ce_varname);
+					errors++;
+				}
+			}
+		}
+		else if (!strcmp(cep->ce_varname, "snomask-aggregation")) {
+			for (cepp = cep->ce_entries; cepp; cepp = cepp->ce_next)
+			{
+				CheckNull(cepp);
+				if (!strcmp(cepp->ce_varname, "threshold"))
+				{
+					if (atoi(cepp->ce_vardata) < 0)
+					{
+						config_error("%s:%i: set::snomask-aggregation::threshold must be 0 (disabled) or higher",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+						errors++;
+					}
+				} else
+				if (!strcmp(cepp->ce_varname, "interval"))
+				{
+					long v = config_checkval(cepp->ce_vardata, CFG_TIME);
+					if ((v < 1) || (v > 3600))
+					{
+						config_error("%s:%i: set::snomask-aggregation::interval must be between 1 second and 1 hour",
+							cepp->ce_fileptr->cf_filename, cepp->ce_varlinenum);
+						errors++;
+					}
+				} else
+				{
+					config_error_unknown(cepp->ce_fileptr->cf_filename,
+						cepp->ce_varlinenum, "set::snomask-aggregation",
+						cepp->ce_varname);
+					errors++;
+				}
+			}
+		}
+		else if (!strcmp(cep->ce_varname, "latency-sample-rate")) {
+			CheckNull(cep);
+			if (atoi(cep->ce_vardata) < 0)
+			{
+				config_error("%s:%i: set::latency-sample-rate must be 0 (disabled) or higher",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+				errors++;
+			}
+		}
 		else if (!strcmp(cep->ce_varname, "handshake-timeout")) {
 			int v;
 			CheckNull(cep);
@@ -9126,9 +9889,9 @@ void start_listeners(void)
 {
 	ConfigItem_listen *listenptr;
 	int failed = 0, ports_bound = 0;
-	char boundmsg_ipv4[512], boundmsg_ipv6[512];
+	char boundmsg_ipv4[512], boundmsg_ipv6[512], boundmsg_unix[512];
 
-	*boundmsg_ipv4 = *boundmsg_ipv6 = '\0';
+	*boundmsg_ipv4 = *boundmsg_ipv6 = *boundmsg_unix = '\0';
 
 	for (listenptr = conf_listen; listenptr; listenptr = listenptr->next)
 	{
@@ -9142,12 +9905,21 @@ void start_listeners(void)
 			} else {
 				if (loop.ircd_booted)
 				{
-					ircd_log(LOG_ERROR, "UnrealIRCd is now also listening on %s:%d (%s)%s",
-						listenptr->ip, listenptr->port,
-						listenptr->ipv6 ? "IPv6" : "IPv4",
-						listenptr->options & LISTENER_TLS ? " (SSL/TLS)" : "");
+					if (listenptr->options & LISTENER_UNIX)
+						ircd_log(LOG_ERROR, "UnrealIRCd is now also listening on UNIX socket %s%s",
+							listenptr->ip,
+							listenptr->options & LISTENER_TLS ? " (SSL/TLS)" : "");
+					else
+						ircd_log(LOG_ERROR, "UnrealIRCd is now also listening on %s:%d (%s)%s",
+							listenptr->ip, listenptr->port,
+							listenptr->ipv6 ? "IPv6" : "IPv4",
+							listenptr->options & LISTENER_TLS ? " (SSL/TLS)" : "");
 				} else {
-					if (listenptr->ipv6)
+					if (listenptr->options & LISTENER_UNIX)
+						snprintf(boundmsg_unix+strlen(boundmsg_unix), sizeof(boundmsg_unix)-strlen(boundmsg_unix),
+							"%s%s, ", listenptr->ip,
+							listenptr->options & LISTENER_TLS ? "(SSL/TLS)" : "");
+					else if (listenptr->ipv6)
 						snprintf(boundmsg_ipv6+strlen(boundmsg_ipv6), sizeof(boundmsg_ipv6)-strlen(boundmsg_ipv6),
 							"%s:%d%s, ", listenptr->ip, listenptr->port,
 							listenptr->options & LISTENER_TLS ? "(SSL/TLS)" : "");
@@ -9189,10 +9961,14 @@ void start_listeners(void)
 			boundmsg_ipv4[strlen(boundmsg_ipv4)-2] = '\0';
 		if (strlen(boundmsg_ipv6) > 2)
 			boundmsg_ipv6[strlen(boundmsg_ipv6)-2] = '\0';
+		if (strlen(boundmsg_unix) > 2)
+			boundmsg_unix[strlen(boundmsg_unix)-2] = '\0';
 
 		ircd_log(LOG_ERROR, "UnrealIRCd is now listening on the following addresses/ports:");
 		ircd_log(LOG_ERROR, "IPv4: %s", *boundmsg_ipv4 ? boundmsg_ipv4 : "<none>");
 		ircd_log(LOG_ERROR, "IPv6: %s", *boundmsg_ipv6 ? boundmsg_ipv6 : "<none>");
+		if (*boundmsg_unix)
+			ircd_log(LOG_ERROR, "UNIX: %s", boundmsg_unix);
 	}
 }
 
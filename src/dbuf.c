@@ -38,6 +38,7 @@ static dbufbuf *dbuf_alloc(dbuf *dbuf_p)
 
 	ptr = mp_pool_get(dbuf_bufpool);
 	memset(ptr, 0, sizeof(dbufbuf));
+	memory_account(MEMORY_ACCOUNT_DBUF, sizeof(dbufbuf));
 
 	INIT_LIST_HEAD(&ptr->dbuf_node);
 	list_add_tail(&ptr->dbuf_node, &dbuf_p->dbuf_list);
@@ -54,6 +55,7 @@ static void dbuf_free(dbufbuf *ptr)
 
 	list_del(&ptr->dbuf_node);
 	mp_pool_release(ptr);
+	memory_account(MEMORY_ACCOUNT_DBUF, -(long)sizeof(dbufbuf));
 }
 
 void dbuf_queue_init(dbuf *dyn)
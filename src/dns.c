@@ -40,9 +40,9 @@ void unrealdns_cb_nametoip_verify(void *arg, int status, int timeouts, struct ho
 void unrealdns_cb_nametoip_link(void *arg, int status, int timeouts, struct hostent *he);
 void unrealdns_delasyncconnects(void);
 static uint64_t unrealdns_hash_ip(const char *ip);
-static void unrealdns_addtocache(char *name, char *ip);
-static char *unrealdns_findcache_ip(char *ip);
-struct hostent *unreal_create_hostent(char *name, char *ip);
+static void unrealdns_addtocache(char *name, const char *ip);
+static char *unrealdns_findcache_ip(const char *ip);
+struct hostent *unreal_create_hostent(char *name, const char *ip);
 static void unrealdns_freeandremovereq(DNSReq *r);
 void unrealdns_removecacherecord(DNSCache *c);
 
@@ -216,17 +216,9 @@ struct hostent *unrealdns_doclient(Client *client)
 
 	/* Execute it */
 	if (r->ipv6)
-	{
-		struct in6_addr addr;
-		memset(&addr, 0, sizeof(addr));
-		inet_pton(AF_INET6, client->ip, &addr);
-		ares_gethostbyaddr(resolver_channel, &addr, 16, AF_INET6, unrealdns_cb_iptoname, r);
-	} else {
-		struct in_addr addr;
-		memset(&addr, 0, sizeof(addr));
-		inet_pton(AF_INET, client->ip, &addr);
-		ares_gethostbyaddr(resolver_channel, &addr, 4, AF_INET, unrealdns_cb_iptoname, r);
-	}
+		ares_gethostbyaddr(resolver_channel, client->rawip, 16, AF_INET6, unrealdns_cb_iptoname, r);
+	else
+		ares_gethostbyaddr(resolver_channel, client->rawip + 12, 4, AF_INET, unrealdns_cb_iptoname, r);
 
 	return NULL;
 }
@@ -327,16 +319,10 @@ void unrealdns_cb_nametoip_verify(void *arg, int status, int timeouts, struct ho
 	{
 		if (r->ipv6)
 		{
-			struct in6_addr addr;
-			if (inet_pton(AF_INET6, client->ip, &addr) != 1)
-				continue; /* something fucked */
-			if (!memcmp(he->h_addr_list[i], &addr, 16))
+			if (!memcmp(he->h_addr_list[i], client->rawip, 16))
 				break; /* MATCH */
 		} else {
-			struct in_addr addr;
-			if (inet_pton(AF_INET, client->ip, &addr) != 1)
-				continue; /* something fucked */
-			if (!memcmp(he->h_addr_list[i], &addr, 4))
+			if (!memcmp(he->h_addr_list[i], client->rawip + 12, 4))
 				break; /* MATCH */
 		}
 	}
@@ -442,7 +428,7 @@ static uint64_t unrealdns_hash_ip(const char *ip)
         return siphash(ip, siphashkey_dns_ip) % DNS_HASH_SIZE;
 }
 
-static void unrealdns_addtocache(char *name, char *ip)
+static void unrealdns_addtocache(char *name, const char *ip)
 {
 	unsigned int hashv;
 	DNSCache *c;
@@ -494,7 +480,7 @@ static void unrealdns_addtocache(char *name, char *ip)
 /** Search the cache for a confirmed ip->name and name->ip match, by address.
  * @returns The resolved hostname, or NULL if not found in cache.
  */
-static char *unrealdns_findcache_ip(char *ip)
+static char *unrealdns_findcache_ip(const char *ip)
 {
 	unsigned int hashv;
 	DNSCache *c;
@@ -572,7 +558,7 @@ DNSCache *c, *next;
 	}
 }
 
-struct hostent *unreal_create_hostent(char *name, char *ip)
+struct hostent *unreal_create_hostent(char *name, const char *ip)
 {
 struct hostent *he;
 
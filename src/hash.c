@@ -267,6 +267,7 @@ static char siphashkey_chan[SIPHASH_KEY_LENGTH];
 static char siphashkey_watch[SIPHASH_KEY_LENGTH];
 static char siphashkey_whowas[SIPHASH_KEY_LENGTH];
 static char siphashkey_throttling[SIPHASH_KEY_LENGTH];
+static char siphashkey_tkl_name[SIPHASH_KEY_LENGTH];
 
 extern char unreallogo[];
 
@@ -280,6 +281,7 @@ void init_hash(void)
 	siphash_generate_key(siphashkey_watch);
 	siphash_generate_key(siphashkey_whowas);
 	siphash_generate_key(siphashkey_throttling);
+	siphash_generate_key(siphashkey_tkl_name);
 
 	for (i = 0; i < NICK_HASH_TABLE_SIZE; i++)
 		INIT_LIST_HEAD(&clientTable[i]);
@@ -320,6 +322,11 @@ uint64_t hash_whowas_name(const char *name)
 	return siphash_nocase(name, siphashkey_whowas) % WHOWAS_HASH_TABLE_SIZE;
 }
 
+uint64_t hash_tkl_name(const char *name)
+{
+	return siphash_nocase(name, siphashkey_tkl_name) % TKLNAMEHASHLEN;
+}
+
 /*
  * add_to_client_hash_table
  */
@@ -506,7 +513,7 @@ Client *hash_find_server(const char *server, Client *def)
  * @note  If 'requester' is a server or NULL, then we also check
  *        the ID table, otherwise not.
  */
-Client *find_client(char *name, Client *requester)
+Client *find_client(const char *name, Client *requester)
 {
 	if (requester == NULL || IsServer(requester))
 	{
@@ -526,7 +533,7 @@ Client *find_client(char *name, Client *requester)
  * @note  If 'requester' is a server or NULL, then we also check
  *        the ID table, otherwise not.
  */
-Client *find_server(char *name, Client *requester)
+Client *find_server(const char *name, Client *requester)
 {
 	if (name)
 	{
@@ -917,20 +924,20 @@ void init_throttling()
 	 */
 }
 
-uint64_t hash_throttling(char *ip)
+uint64_t hash_throttling(unsigned char *rawip)
 {
-	return siphash(ip, siphashkey_throttling) % THROTTLING_HASH_TABLE_SIZE;
+	return hash_raw_ip(rawip, RAWIPLEN * 8, siphashkey_throttling) % THROTTLING_HASH_TABLE_SIZE;
 }
 
 struct ThrottlingBucket *find_throttling_bucket(Client *client)
 {
 	int hash = 0;
 	struct ThrottlingBucket *p;
-	hash = hash_throttling(client->ip);
+	hash = hash_throttling(client->rawip);
 	
 	for (p = ThrottlingHash[hash]; p; p = p->next)
 	{
-		if (!strcmp(p->ip, client->ip))
+		if (!memcmp(p->rawip, client->rawip, RAWIPLEN))
 			return p;
 	}
 	
@@ -951,7 +958,6 @@ EVENT(throttling_check_expire)
 			if ((TStime() - n->since) > (THROTTLING_PERIOD ? THROTTLING_PERIOD : 15))
 			{
 				DelListItem(n, ThrottlingHash[i]);
-				safe_free(n->ip);
 				safe_free(n);
 			}
 		}
@@ -991,10 +997,10 @@ void add_throttling_bucket(Client *client)
 
 	n = safe_alloc(sizeof(struct ThrottlingBucket));	
 	n->next = n->prev = NULL; 
-	safe_strdup(n->ip, client->ip);
+	memcpy(n->rawip, client->rawip, RAWIPLEN);
 	n->since = TStime();
 	n->count = 1;
-	hash = hash_throttling(client->ip);
+	hash = hash_throttling(client->rawip);
 	AddListItem(n, ThrottlingHash[hash]);
 	return;
 }
@@ -41,7 +41,7 @@ gid_t irc_gid = 0;
 
 MODVAR IRCCounts irccounts;
 MODVAR Client me;			/* That's me */
-MODVAR char *me_hash;
+MODVAR const char *me_hash;
 extern char backupbuf[8192];
 #ifdef _WIN32
 extern SERVICE_STATUS_HANDLE IRCDStatusHandle;
@@ -475,6 +475,9 @@ EVENT(check_pings)
 {
 	Client *client, *next;
 
+	/* A new server ban may hit many users at once */
+	exit_client_bulk_start();
+
 	list_for_each_entry_safe(client, next, &lclient_list, lclient_node)
 	{
 		/* Check TKLs for this user */
@@ -489,6 +492,8 @@ EVENT(check_pings)
 		check_ping(client);
 	}
 
+	exit_client_bulk_end();
+
 	loop.do_bancheck = loop.do_bancheck_spamf_user = loop.do_bancheck_spamf_away = 0;
 	/* done */
 }
@@ -1410,11 +1415,16 @@ void SocketLoop(void *dummy)
 			irccounts.me_max = irccounts.me_clients;
 
 		/* Process I/O */
-		fd_select(SOCKETLOOP_MAX_DELAY);
+		fd_select(io_backlog ? 0 : SOCKETLOOP_MAX_DELAY);
 
-		if (minimum_msec_since_last_run(&process_clients_tv, 200))
+		/* Normally only every 200ms (for fake lag), but right away if
+		 * some clients used up their I/O budget and have data left.
+		 */
+		if (io_backlog || minimum_msec_since_last_run(&process_clients_tv, 200))
 			process_clients();
 
+		spamfilter_async_check_timeouts();
+
 		/* Check if there are pending "actions".
 		 * These are actions that should be done outside of
 		 * process_clients() and fd_select() when we are not
@@ -0,0 +1,211 @@
+/************************************************************************
+ * UnrealIRCd - Unreal Internet Relay Chat Daemon - src/latency.c
+ * (c) 2020- Bram Matthys and The UnrealIRCd team
+ *
+ * See file AUTHORS in IRC package for additional names of
+ * the programmers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief Sampled message latency tracing (set::latency-sample-rate).
+ *
+ * One in set::latency-sample-rate incoming lines is traced on its way
+ * through the server: from reading it from the socket, via parsing
+ * and the command handler, to the copies that are added to send
+ * queues and finally written to the sockets. The time spent in each
+ * stage is added to a histogram, shown in /STATS latency.
+ *
+ * Only one message is traced at a time, so the overhead is a handful
+ * of gettimeofday() calls per sample plus one check per send queue
+ * write for clients that have a traced message queued.
+ */
+
+#include "unrealircd.h"
+
+/** Set while a sampled line is being parsed and executed */
+MODVAR int latency_tracing = 0;
+
+/** Histograms per stage, see LatencyHistogram */
+MODVAR LatencyHistogram latency_histogram[LATENCY_STAGES];
+
+/** Number of completed and abandoned traces */
+MODVAR long latency_traces = 0;
+MODVAR long latency_traces_abandoned = 0;
+
+static char *latency_stage_names[LATENCY_STAGES] = {
+	"total",
+	"recvq",
+	"parse",
+	"command",
+	"fanout",
+	"sendq",
+};
+
+/** The message that is currently being traced */
+static struct {
+	int serial;			/**< Serial number, see LocalClient::latency_trace_serial */
+	int waiting;			/**< Command finished, waiting for the copies to be written */
+	int pending;			/**< Number of send queues with a copy that was not written yet */
+	struct timeval tv[LATENCY_STAGES];	/**< When each stage was reached */
+	unsigned char reached[LATENCY_STAGES];	/**< Whether each stage was reached */
+} trace;
+
+static int sample_counter = 0;
+
+/** Get the name of a stage as shown in /STATS latency, eg "parse" */
+char *latency_stage_name(LatencyStage stage)
+{
+	return latency_stage_names[stage];
+}
+
+static void latency_histogram_add(LatencyHistogram *h, struct timeval *tv_alpha, struct timeval *tv_beta)
+{
+	long long usec, limit;
+	int i;
+
+	usec = ((long long)tv_beta->tv_sec - tv_alpha->tv_sec) * 1000000 +
+	       (tv_beta->tv_usec - tv_alpha->tv_usec);
+	if (usec < 0)
+		usec = 0; /* clock went backwards */
+
+	h->count++;
+	h->usec += usec;
+	if (usec > h->max_usec)
+		h->max_usec = usec;
+
+	for (i = 0, limit = 10; (i < LATENCY_BUCKETS - 1) && (usec >= limit); i++, limit *= 10)
+		;
+	h->buckets[i]++;
+}
+
+/** All copies have been written (or there were none): add the trace to the histograms */
+static void latency_trace_finish(void)
+{
+	int i, last = LATENCY_STAGE_RECEIVE;
+
+	/* Each stage gets the time since the previous stage that was reached.
+	 * Eg: a command that does not send anything has no fanout stage.
+	 */
+	for (i = LATENCY_STAGE_PARSE; i < LATENCY_STAGES; i++)
+	{
+		if (!trace.reached[i])
+			continue;
+		latency_histogram_add(&latency_histogram[i], &trace.tv[last], &trace.tv[i]);
+		last = i;
+	}
+	latency_histogram_add(&latency_histogram[LATENCY_STAGE_RECEIVE], &trace.tv[LATENCY_STAGE_RECEIVE], &trace.tv[last]);
+
+	latency_traces++;
+	trace.waiting = 0;
+}
+
+/** Start tracing the line that is about to be parsed, if it is sampled.
+ * Called from parse().
+ */
+void latency_trace_start(Client *client)
+{
+	if (!LATENCY_SAMPLE_RATE || !MyConnect(client))
+		return;
+
+	/* If the previous trace is still busy the next line is sampled instead */
+	if ((++sample_counter < LATENCY_SAMPLE_RATE) || trace.waiting)
+		return;
+	sample_counter = 0;
+
+	trace.serial++;
+	trace.pending = 0;
+	memset(trace.reached, 0, sizeof(trace.reached));
+	trace.tv[LATENCY_STAGE_RECEIVE] = client->local->read_tv;
+	trace.reached[LATENCY_STAGE_RECEIVE] = 1;
+	latency_trace_mark(LATENCY_STAGE_PARSE);
+	latency_tracing = 1;
+}
+
+/** Record that the traced message reached 'stage' */
+void latency_trace_mark(LatencyStage stage)
+{
+	gettimeofday(&trace.tv[stage], NULL);
+	trace.reached[stage] = 1;
+}
+
+/** A copy of the traced message was added to the send queue of 'to'.
+ * Called from sendbufto_one(), only while latency_tracing is set.
+ */
+void latency_trace_enqueue(Client *to)
+{
+	latency_trace_mark(LATENCY_STAGE_ENQUEUE);
+	if (!trace.reached[LATENCY_STAGE_FANOUT])
+	{
+		trace.tv[LATENCY_STAGE_FANOUT] = trace.tv[LATENCY_STAGE_ENQUEUE];
+		trace.reached[LATENCY_STAGE_FANOUT] = 1;
+	}
+
+	if (to->local->latency_trace_serial != trace.serial)
+	{
+		to->local->latency_trace_serial = trace.serial;
+		trace.pending++;
+	}
+	/* (compressed links may not have added anything to the sendQ yet) */
+	to->local->latency_trace_bytes = MAX(DBufLength(&to->local->sendQ), 1);
+}
+
+/** The command of the traced message has finished. Called from parse(). */
+void latency_trace_end(void)
+{
+	if (!latency_tracing)
+		return;
+	latency_tracing = 0;
+
+	if (trace.pending > 0)
+		trace.waiting = 1;
+	else
+		latency_trace_finish();
+}
+
+/** 'bytes' were written from the send queue of 'to', which has
+ * a copy of a traced message in it. Called from send_queued().
+ */
+void latency_trace_written(Client *to, int bytes)
+{
+	to->local->latency_trace_bytes -= bytes;
+	if (to->local->latency_trace_bytes > 0)
+		return;
+	to->local->latency_trace_bytes = 0;
+
+	/* Ignore data queued by an older, abandoned, trace */
+	if ((to->local->latency_trace_serial != trace.serial) || (!latency_tracing && !trace.waiting))
+		return;
+
+	if (--trace.pending > 0)
+		return;
+
+	latency_trace_mark(LATENCY_STAGE_FLUSH);
+	if (trace.waiting)
+		latency_trace_finish();
+}
+
+/** Abandon a trace if not all copies were written in time,
+ * eg because a recipient has a full send queue or disconnected.
+ */
+EVENT(latency_trace_check)
+{
+	if (trace.waiting && (TStime() - trace.tv[LATENCY_STAGE_RECEIVE].tv_sec > LATENCY_TRACE_TIMEOUT))
+	{
+		trace.waiting = 0;
+		latency_traces_abandoned++;
+	}
+}
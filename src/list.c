@@ -38,7 +38,6 @@ MODVAR int  flinks = 0;
 MODVAR int  freelinks = 0;
 MODVAR Link *freelink = NULL;
 MODVAR Member *freemember = NULL;
-MODVAR Membership *freemembership = NULL;
 MODVAR int  numclients = 0;
 
 // TODO: Document whether servers are included or excluded in these lists...
@@ -122,6 +121,7 @@ Client *make_client(Client *from, Client *servr)
 		
 		INIT_LIST_HEAD(&client->lclient_node);
 		INIT_LIST_HEAD(&client->special_node);
+		INIT_LIST_HEAD(&client->runq_node);
 
 		client->local->since = client->local->lasttime =
 		client->lastnick = client->local->firsttime =
@@ -154,12 +154,19 @@ void free_client(Client *client)
 			list_del(&client->lclient_node);
 		if (!list_empty(&client->special_node))
 			list_del(&client->special_node);
+		if (!list_empty(&client->runq_node))
+			list_del(&client->runq_node);
 
 		RunHook(HOOKTYPE_FREE_CLIENT, client);
 		if (client->local)
 		{
+			Auth_CancelAsync(client);
+			spamfilter_async_cancel(client);
 			safe_free(client->local->passwd);
 			safe_free(client->local->error_str);
+			zip_free(client);
+			proxy_free(client);
+			safe_free(client->local->proxy_tls_cipher);
 			if (client->local->hostp)
 				unreal_free_hostent(client->local->hostp);
 			
@@ -175,7 +182,7 @@ void free_client(Client *client)
 		}
 	}
 	
-	safe_free(client->ip);
+	scache_free(client->ip);
 
 	mp_pool_release(client);
 }
@@ -205,16 +212,13 @@ ClientUser *make_user(Client *client)
 		user->channel = NULL;
 		user->invited = NULL;
 		user->server = NULL;
-		strlcpy(user->svid, "0", sizeof(user->svid));
+		user->svid = scache_add("0");
 		user->whowas = NULL;
 		user->snomask = 0;
-		if (client->ip)
-		{
-			/* initially set client->user->realhost to IP */
-			strlcpy(user->realhost, client->ip, sizeof(user->realhost));
-		} else {
-			*user->realhost = '\0';
-		}
+		user->username = scache_add("");
+		/* initially set client->user->realhost to IP */
+		user->realhost = scache_add(client->ip ? client->ip : "");
+		user->cloakedhost = scache_add("");
 		user->virthost = NULL;
 		client->user = user;		
 	}
@@ -273,7 +277,11 @@ void free_user(Client *client)
 		}
 		client->user->swhois = NULL;
 	}
-	safe_free(client->user->virthost);
+	scache_free(client->user->virthost);
+	scache_free(client->user->username);
+	scache_free(client->user->realhost);
+	scache_free(client->user->cloakedhost);
+	scache_free(client->user->svid);
 	safe_free(client->user->operlogin);
 	mp_pool_release(client->user);
 #ifdef	DEBUGMODE
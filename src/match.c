@@ -369,6 +369,16 @@ u_char char_atribs[] = {
 /* f0-ff */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+/** Memory used by a compiled regex, including the JIT code (see memory_account()) */
+static long regex_memory_size(pcre2_code *expr)
+{
+	size_t size = 0, jitsize = 0;
+
+	pcre2_pattern_info(expr, PCRE2_INFO_SIZE, &size);
+	pcre2_pattern_info(expr, PCRE2_INFO_JITSIZE, &jitsize);
+	return (long)(size + jitsize);
+}
+
 /** Free up all resources of an Match entry (including the struct itself).
  * NOTE: this function may (also) be called for Match structs that have only been
  *       setup half-way, so use special care when accessing members (NULL checks!)
@@ -379,7 +389,10 @@ void unreal_delete_match(Match *m)
 	if (m->type == MATCH_PCRE_REGEX)
 	{
 		if (m->ext.pcre2_expr)
+		{
+			memory_account(MEMORY_ACCOUNT_REGEX, -regex_memory_size(m->ext.pcre2_expr));
 			pcre2_code_free(m->ext.pcre2_expr);
+		}
 	}
 	safe_free(m);
 }
@@ -424,6 +437,7 @@ Match *unreal_create_match(MatchType type, char *str, char **error)
 			return NULL;
 		}
 		pcre2_jit_compile(m->ext.pcre2_expr, PCRE2_JIT_COMPLETE);
+		memory_account(MEMORY_ACCOUNT_REGEX, regex_memory_size(m->ext.pcre2_expr));
 		return m;
 	}
 	else {
@@ -831,6 +845,7 @@ int badword_config_process(ConfigItem_badword *ca, char *str)
 			abort();
 		}
 		pcre2_jit_compile(ca->pcre2_expr, PCRE2_JIT_COMPLETE);
+		memory_account(MEMORY_ACCOUNT_REGEX, regex_memory_size(ca->pcre2_expr));
 	}
 	else
 	{
@@ -860,6 +875,9 @@ void badword_config_free(ConfigItem_badword *e)
 	safe_free(e->word);
 	safe_free(e->replace);
 	if (e->pcre2_expr)
+	{
+		memory_account(MEMORY_ACCOUNT_REGEX, -regex_memory_size(e->pcre2_expr));
 		pcre2_code_free(e->pcre2_expr);
+	}
 	safe_free(e);
 }
@@ -0,0 +1,259 @@
+/************************************************************************
+ * UnrealIRCd - Unreal Internet Relay Chat Daemon - src/membudget.c
+ * (c) 2020- Bram Matthys and The UnrealIRCd team
+ *
+ * See file AUTHORS in IRC package for additional names of
+ * the programmers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief Server-wide memory budget (set::memory-budget).
+ *
+ * The sendq and recvq limits of a class only protect against a
+ * single client using too much memory. During a flood on a large
+ * server the sum of many medium sized queues, plus channel history
+ * and server bans, can still grow very large.
+ *
+ * Therefore the big memory users are accounted for here and
+ * compared to set::memory-budget::limit once per second. Depending
+ * on the percentage of the budget that is in use the server is put
+ * at a memory pressure level, at which it sheds load progressively:
+ * it keeps less channel history, drops high volume server notices,
+ * lowers the sendq of unknown and low reputation clients and
+ * finally refuses new client connections.
+ */
+
+#include "unrealircd.h"
+
+/** Current memory pressure level */
+MODVAR MemoryPressure memory_pressure = MEMORY_PRESSURE_NONE;
+
+/** Bytes in use per MemoryAccount, updated via memory_account() */
+MODVAR long long memory_accounted[MEMORY_ACCOUNTS];
+
+/** Number of objects per MemoryAccount, updated via memory_account() */
+MODVAR long memory_objects[MEMORY_ACCOUNTS];
+
+/** Memory accounted for by modules, see module_memory_account() */
+static ModuleMemory *module_memory = NULL;
+
+static char *memory_pressure_names[MEMORY_PRESSURE_LEVELS] = {
+	"none",
+	"shrink-history",
+	"drop-notices",
+	"tighten-sendq",
+	"refuse-connections",
+};
+
+static char *memory_account_names[MEMORY_ACCOUNTS] = {
+	"dbufs",
+	"history",
+	"tkl",
+	"regex",
+};
+
+/** Get the name of a memory pressure level, as used in set::memory-budget */
+char *memory_pressure_name(MemoryPressure level)
+{
+	return memory_pressure_names[level];
+}
+
+/** Get the name of a memory account, eg "dbufs" */
+char *memory_account_name(MemoryAccount type)
+{
+	return memory_account_names[type];
+}
+
+/** Account for an object of 'bytes' bytes being allocated,
+ * or freed if 'bytes' is negative.
+ */
+void memory_account(MemoryAccount type, long long bytes)
+{
+	memory_accounted[type] += bytes;
+	if (bytes > 0)
+		memory_objects[type]++;
+	else if (bytes < 0)
+		memory_objects[type]--;
+}
+
+/** Find the memory accounted for by the module 'name'.
+ * @returns The accounting, or NULL if the module never used module_memory_account().
+ */
+ModuleMemory *module_memory_find(char *name)
+{
+	ModuleMemory *m;
+
+	for (m = module_memory; m; m = m->next)
+		if (!strcmp(m->name, name))
+			return m;
+	return NULL;
+}
+
+/** Account for an object of 'bytes' bytes being allocated by
+ * a module, or freed if 'bytes' is negative. This is shown per
+ * module in /STATS memory. The accounting is kept by module name,
+ * so data that survives a module reload is still accounted for.
+ * @param module	The module, usually modinfo->handle
+ * @param bytes		The size of the object
+ */
+void module_memory_account(Module *module, long long bytes)
+{
+	ModuleMemory *m = module_memory_find(module->header->name);
+
+	if (!m)
+	{
+		m = safe_alloc(sizeof(ModuleMemory));
+		safe_strdup(m->name, module->header->name);
+		AddListItem(m, module_memory);
+	}
+	m->bytes += bytes;
+	if (bytes > 0)
+		m->objects++;
+	else if (bytes < 0)
+		m->objects--;
+}
+
+/** Memory used by clients and channels (estimated, excluding queues) */
+static long long memory_budget_clients(void)
+{
+	return (long long)irccounts.clients * (sizeof(Client) + sizeof(ClientUser)) +
+	       (long long)(irccounts.me_clients + irccounts.unknown + irccounts.me_servers) * sizeof(LocalClient) +
+	       (long long)irccounts.channels * sizeof(Channel);
+}
+
+/** Total memory usage that counts towards the memory budget, in bytes */
+long long memory_budget_usage(void)
+{
+	long long total = 0;
+	u_long whowas_mem = 0;
+	int whowas_cnt = 0;
+	int i;
+
+	for (i = 0; i < MEMORY_ACCOUNTS; i++)
+		total += memory_accounted[i];
+
+	count_whowas_memory(&whowas_cnt, &whowas_mem);
+	total += whowas_mem;
+
+	total += memory_budget_clients();
+
+	return total;
+}
+
+/** Percentage of set::memory-budget::limit that is in use */
+int memory_budget_percentage(void)
+{
+	if (MEMORY_BUDGET <= 0)
+		return 0;
+	return (int)(memory_budget_usage() * 100 / MEMORY_BUDGET);
+}
+
+/** Recalculate the memory pressure level, called every second.
+ * To avoid flapping, a level is only left once the usage
+ * is MEMORY_BUDGET_HYSTERESIS percent below its threshold.
+ */
+EVENT(memory_budget_check)
+{
+	MemoryPressure level = MEMORY_PRESSURE_NONE;
+	MemoryPressure old = memory_pressure;
+	int pct, i;
+
+	if (MEMORY_BUDGET <= 0)
+	{
+		memory_pressure = MEMORY_PRESSURE_NONE;
+		return;
+	}
+
+	pct = memory_budget_percentage();
+
+	for (i = 1; i < MEMORY_PRESSURE_LEVELS; i++)
+	{
+		if ((pct >= iConf.memory_budget_threshold[i]) ||
+		    ((i <= old) && (pct >= iConf.memory_budget_threshold[i] - MEMORY_BUDGET_HYSTERESIS)))
+		{
+			level = i;
+		}
+	}
+
+	if (level == old)
+		return;
+
+	memory_pressure = level;
+	if (level > old)
+	{
+		sendto_ops_and_log("Memory usage is at %d%% of set::memory-budget::limit, "
+		                   "memory pressure level raised to '%s'",
+		                   pct, memory_pressure_name(level));
+	} else {
+		sendto_ops_and_log("Memory usage is at %d%% of set::memory-budget::limit, "
+		                   "memory pressure level lowered to '%s'",
+		                   pct, memory_pressure_name(level));
+	}
+}
+
+/** Number of history lines to keep for an object that is
+ * normally allowed to have 'max_lines' lines.
+ */
+int memory_pressure_history_lines(int max_lines)
+{
+	if (memory_pressure < MEMORY_PRESSURE_SHRINK_HISTORY)
+		return max_lines;
+	return MAX(1, max_lines / MEMORY_PRESSURE_HISTORY_DIVISOR);
+}
+
+/** Should server notices for 'snomask' be dropped? */
+int memory_pressure_drop_snomask(long snomask)
+{
+	if (memory_pressure < MEMORY_PRESSURE_DROP_NOTICES)
+		return 0;
+	/* Only high volume notices, eg: not kills, oper-ups or server bans */
+	if (snomask & ~(SNO_CLIENT|SNO_FCLIENT|SNO_NICKCHANGE|SNO_FNICKCHANGE|SNO_JUNK|SNO_QLINE))
+		return 0;
+	return 1;
+}
+
+/** Has the (tightened) sendq of 'client' been exceeded?
+ * This only applies to unknown connections and users
+ * with a low reputation score.
+ */
+int memory_pressure_sendq_exceeded(Client *client)
+{
+	char *reputation;
+
+	if ((memory_pressure < MEMORY_PRESSURE_TIGHTEN_SENDQ) || IsServer(client) ||
+	    (DBufLength(&client->local->sendQ) <= MEMORY_PRESSURE_SENDQ))
+	{
+		return 0;
+	}
+
+	if (IsUser(client))
+	{
+		if (IsOper(client))
+			return 0;
+		reputation = moddata_client_get(client, "reputation");
+		if (reputation && (atoi(reputation) >= MEMORY_PRESSURE_LOW_REPUTATION))
+			return 0;
+	}
+
+	return 1;
+}
+
+/** Should a new client connection be refused? */
+int memory_pressure_refuse_connection(void)
+{
+	return (memory_pressure >= MEMORY_PRESSURE_REFUSE_CONNECTIONS);
+}
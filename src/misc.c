@@ -371,22 +371,31 @@ char *make_user_host(char *name, char *host)
  * If any of the variables are NULL, it becomes * (asterisk)
  * This is the reentrant safe version.
  */
-char *make_nick_user_host_r(char *namebuf, char *nick, char *name, char *host)
+/* Like strlcpy(dst, check_string(src), len) but without modifying 'src',
+ * returns a pointer to the end of the copied string.
+ */
+static char *nuh_copy(char *dst, const char *src, size_t len)
 {
-	char *s = namebuf;
+	char *p;
 
-	nick = check_string(nick);
-	strlcpy(namebuf, nick, NICKLEN + 1);
-	s += strlen(s);
+	if (BadPtr(src) || isspace(*src))
+		src = "*";
+	strlcpy(dst, src, len);
+	for (p = dst; *p && !isspace(*p); p++)
+		;
+	*p = '\0';
+	return p;
+}
+
+char *make_nick_user_host_r(char *namebuf, const char *nick, const char *name, const char *host)
+{
+	char *s;
+
+	s = nuh_copy(namebuf, nick, NICKLEN + 1);
 	*s++ = '!';
-	name = check_string(name);
-	strlcpy(s, name, USERLEN + 1);
-	s += strlen(s);
+	s = nuh_copy(s, name, USERLEN + 1);
 	*s++ = '@';
-	host = check_string(host);
-	strlcpy(s, host, HOSTLEN + 1);
-	s += strlen(s);
-	*s = '\0';
+	s = nuh_copy(s, host, HOSTLEN + 1);
 	return namebuf;
 }
 
@@ -394,7 +403,7 @@ char *make_nick_user_host_r(char *namebuf, char *nick, char *name, char *host)
  * If any of the variables are NULL, it becomes * (asterisk)
  * This version uses static storage.
  */
-char *make_nick_user_host(char *nick, char *name, char *host)
+char *make_nick_user_host(const char *nick, const char *name, const char *host)
 {
 	static char namebuf[NICKLEN + USERLEN + HOSTLEN + 24];
 
@@ -618,6 +627,157 @@ static void remove_dependents(Client *client, Client *from, MessageTag *mtags, c
 	recurse_remove_clients(client, mtags, splitstr);
 }
 
+/* Bulk exit state, see exit_client_bulk_start() */
+static int bulk_exit_depth = 0;
+static long bulk_exit_serial = 0;
+static long bulk_exit_batch_cap = 0;
+static char bulk_exit_batch[BATCHLEN+1];
+static Link *bulk_exit_recipients = NULL;
+static char bulk_exit_uids[BUFSIZE];
+static char bulk_exit_comment[BUFSIZE];
+static Client *bulk_exit_direction = NULL;
+
+/** Start exiting a group of clients, such as all users that are hit
+ * by a new G-line. Until exit_client_bulk_end() is called, exit_client():
+ * - wraps the QUITs that are sent to each local user in one IRCv3
+ *   batch per user (if the user supports it)
+ * - sends one "BQUIT uid,uid,uid,.. :reason" to servers that support
+ *   it, rather than one QUIT per user.
+ * These calls may be nested, only the outer one has any effect.
+ */
+void exit_client_bulk_start(void)
+{
+	if (bulk_exit_depth++ > 0)
+		return;
+
+	bulk_exit_serial++;
+	bulk_exit_batch_cap = ClientCapabilityBit("batch");
+	generate_batch_id(bulk_exit_batch);
+	*bulk_exit_uids = '\0';
+	bulk_exit_direction = NULL;
+}
+
+/** Send the pending BQUIT (if any) to all servers that support it */
+static void exit_client_bulk_flush(void)
+{
+	if (!*bulk_exit_uids)
+		return;
+
+	sendto_server(bulk_exit_direction, PROTO_BQUIT, 0, NULL, ":%s BQUIT %s :%s",
+		me.id, bulk_exit_uids, bulk_exit_comment);
+	*bulk_exit_uids = '\0';
+}
+
+/** Queue the S2S QUIT of 'client' so it is sent as part of a BQUIT */
+static void exit_client_bulk_queue(Client *client, MessageTag *mtags, const char *comment)
+{
+	Client *direction;
+
+	/* Servers that don't support BQUIT get the QUIT right away */
+	sendto_server(client, 0, PROTO_BQUIT, mtags, ":%s QUIT :%s", client->id, comment);
+
+	/* Only users with the same reason and from the same direction
+	 * can share a BQUIT, and the line must fit in 512 bytes.
+	 * The direction of a local user is the user itself, so all
+	 * local users are grouped under &me instead.
+	 */
+	direction = MyConnect(client) ? &me : client->direction;
+	if (*bulk_exit_uids &&
+	    ((bulk_exit_direction != direction) ||
+	     strcmp(bulk_exit_comment, comment) ||
+	     (strlen(me.id) + strlen(bulk_exit_uids) + strlen(client->id) + strlen(comment) + 12 > 510)))
+	{
+		exit_client_bulk_flush();
+	}
+
+	if (!*bulk_exit_uids)
+	{
+		bulk_exit_direction = direction;
+		strlcpy(bulk_exit_comment, comment, sizeof(bulk_exit_comment));
+	} else {
+		strlcat(bulk_exit_uids, ",", sizeof(bulk_exit_uids));
+	}
+	strlcat(bulk_exit_uids, client->id, sizeof(bulk_exit_uids));
+}
+
+/** Send the QUIT of 'client' to all local users on common channels,
+ * the bulk exit version of sendto_local_common_channels().
+ * The first QUIT that a user receives opens the batch for that user.
+ */
+static void exit_client_bulk_send_quit(Client *client, MessageTag *mtags, const char *comment)
+{
+	MessageTag *m;
+	Membership *channels;
+	Member *users;
+	Client *acptr;
+	Link *lp;
+	char buf[BUFSIZE];
+
+	ircsnprintf(buf, sizeof(buf), ":%s!%s@%s QUIT :%s",
+		client->name, client->user->username, GetHost(client), comment);
+
+	m = safe_alloc(sizeof(MessageTag));
+	m->name = "batch";
+	m->value = bulk_exit_batch;
+	AddListItem(m, mtags);
+
+	++current_serial;
+	for (channels = client->user->channel; channels; channels = channels->next_channel)
+	{
+		for (users = channels->channel->local_members; users; users = users->next_local)
+		{
+			acptr = users->client;
+
+			if (acptr->local->serial == current_serial)
+				continue; /* message already sent to this client */
+
+			if (!user_can_see_member(acptr, client, channels->channel))
+				continue; /* the quit'ing user is 'invisible' -- skip */
+
+			acptr->local->serial = current_serial;
+			if (bulk_exit_batch_cap && HasCapabilityFast(acptr, bulk_exit_batch_cap) &&
+			    (acptr->local->bulk_exit_serial != bulk_exit_serial))
+			{
+				acptr->local->bulk_exit_serial = bulk_exit_serial;
+				sendto_one(acptr, NULL, ":%s BATCH +%s unrealircd.org/bulk-quit", me.name, bulk_exit_batch);
+				lp = make_link();
+				lp->value.client = acptr;
+				lp->next = bulk_exit_recipients;
+				bulk_exit_recipients = lp;
+			}
+			sendto_one(acptr, mtags, "%s", buf);
+		}
+	}
+
+	DelListItem(m, mtags);
+	safe_free(m);
+}
+
+/** Finish exiting a group of clients, see exit_client_bulk_start() */
+void exit_client_bulk_end(void)
+{
+	Link *lp, *lp_next;
+	Client *acptr;
+
+	if (--bulk_exit_depth > 0)
+		return;
+
+	exit_client_bulk_flush();
+
+	for (lp = bulk_exit_recipients; lp; lp = lp_next)
+	{
+		lp_next = lp->next;
+		acptr = lp->value.client;
+		/* Clients that exited in the meantime are still on the
+		 * dead_list, they are only freed in the main loop.
+		 */
+		if (!IsDead(acptr))
+			sendto_one(acptr, NULL, ":%s BATCH -%s", me.name, bulk_exit_batch);
+		free_link(lp);
+	}
+	bulk_exit_recipients = NULL;
+}
+
 /*
 ** Exit one client, local or remote. Assuming all dependants have
 ** been already removed, and socket closed for local client.
@@ -637,7 +797,10 @@ static void exit_one_client(Client *client, MessageTag *mtags_i, const char *com
 			RunHook3(HOOKTYPE_REMOTE_QUIT, client, mtags_i, comment);
 
 		new_message_special(client, mtags_i, &mtags_o, ":%s QUIT", client->name);
-		sendto_local_common_channels(client, NULL, 0, mtags_o, ":%s QUIT :%s", client->name, comment);
+		if (bulk_exit_depth)
+			exit_client_bulk_send_quit(client, mtags_o, comment);
+		else
+			sendto_local_common_channels(client, NULL, 0, mtags_o, ":%s QUIT :%s", client->name, comment);
 		free_message_tags(mtags_o);
 
 		while ((mp = client->user->channel))
@@ -806,7 +969,10 @@ void exit_client(Client *client, MessageTag *recv_mtags, char *comment)
 	}
 	else if (IsUser(client) && !IsKilled(client))
 	{
-		sendto_server(client, 0, 0, recv_mtags, ":%s QUIT :%s", client->id, comment);
+		if (bulk_exit_depth)
+			exit_client_bulk_queue(client, recv_mtags, comment);
+		else
+			sendto_server(client, 0, 0, recv_mtags, ":%s QUIT :%s", client->id, comment);
 	}
 
 	/* Finally, the client/server itself exits.. */
@@ -1346,7 +1512,7 @@ char *mystpcpy(char *dst, const char *src)
  *         so similar to what strlen() would have returned.
  * @note Caller must ensure that the buffer 'buf' is of sufficient size.
  */
-size_t add_sjsby(char *buf, char *setby, time_t seton)
+size_t add_sjsby(char *buf, const char *setby, time_t seton)
 {
 	char tbuf[32];
 	char *p = buf;
@@ -1437,6 +1603,25 @@ MessageTag *duplicate_mtag(MessageTag *mtag)
 	return m;
 }
 
+/** Duplicate an entire linked list of message tags.
+ * @returns The copy, free it with free_message_tags().
+ */
+MessageTag *duplicate_mtags(MessageTag *mtags)
+{
+	MessageTag *m, *m_new, *m_last = NULL, *list = NULL;
+
+	for (m = mtags; m; m = m->next)
+	{
+		m_new = duplicate_mtag(m);
+		if (m_last)
+			m_last->next = m_new;
+		else
+			list = m_new;
+		m_last = m_new;
+	}
+	return list;
+}
+
 /** New message. Either really brand new, or inherited from other servers.
  * This function calls modules so they can add tags, such as:
  * msgid, time and account.
@@ -1712,7 +1897,7 @@ int write_data(FILE *fd, const void *buf, size_t len)
  *        Note that 'x' can safely be NULL.
  * @returns 1 on success, 0 on failure.
  */
-int write_str(FILE *fd, char *x)
+int write_str(FILE *fd, const char *x)
 {
 	uint16_t len;
 
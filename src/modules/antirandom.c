@@ -783,10 +783,10 @@ static int init_triples(void)
  * - sregexes (not used)
  * - triples (three-letter combinations)
  */
-static int internal_getscore(char *str)
+static int internal_getscore(const char *str)
 {
 	Triples *t;
-	register char *s;
+	register const char *s;
 	int score = 0;
 	int highest_vowels=0, highest_consonants=0, highest_digits=0;
 	int vowels=0, consonants=0, digits=0;
@@ -858,7 +858,7 @@ static int internal_getscore(char *str)
 	return score;
 }
 
-void strtolower_safe(char *dst, char *src, int size)
+void strtolower_safe(char *dst, const char *src, int size)
 {
 	if (!size)
 		return; /* size of 0 is unworkable */
@@ -878,7 +878,7 @@ void strtolower_safe(char *dst, char *src, int size)
 static int get_spam_score(Client *client)
 {
 	char *nick = client->name;
-	char *user = client->user->username;
+	const char *user = client->user->username;
 	char *gecos = client->info;
 	char nbuf[NICKLEN+1], ubuf[USERLEN+1], rbuf[REALLEN+1];
 	int nscore, uscore, gscore, score;
@@ -280,7 +280,7 @@ char *make_authbuf(const char *username, const char *password)
 void send_first_auth(Client *client)
 {
 	Client *sasl_server;
-	char *addr = BadPtr(client->ip) ? "0" : client->ip;
+	const char *addr = BadPtr(client->ip) ? "0" : client->ip;
 	char *certfp = moddata_client_get(client, "certfp");
 	sasl_server = find_client(SASL_SERVER, NULL);
 	if (!sasl_server)
@@ -585,46 +585,30 @@ int blacklist_start_check(Client *client)
 int blacklist_dns_request(Client *client, Blacklist *d)
 {
 	char buf[256], wbuf[128];
-	unsigned int e[8];
-	char *ip = GetIP(client);
-	
-	if (!ip)
-		return 0;
+	unsigned char *e = client->rawip;
 
-	memset(&e, 0, sizeof(e));
+	if (!client->ip)
+		return 0;
 
-	if (strchr(ip, '.'))
+	if (raw_ip_is_ipv4(e))
 	{
 		/* IPv4 */
-		if (sscanf(ip, "%u.%u.%u.%u", &e[0], &e[1], &e[2], &e[3]) != 4)
-			return 0;
-	
-		snprintf(buf, sizeof(buf), "%u.%u.%u.%u.%s", e[3], e[2], e[1], e[0], d->backend->dns->name);
+		snprintf(buf, sizeof(buf), "%u.%u.%u.%u.%s", e[15], e[14], e[13], e[12], d->backend->dns->name);
 	} else
-	if (strchr(ip, ':'))
 	{
 		/* IPv6 */
 		int i;
 		BLUSER(client)->is_ipv6 = 1;
-		if (sscanf(ip, "%x:%x:%x:%x:%x:%x:%x:%x",
-		    &e[0], &e[1], &e[2], &e[3], &e[4], &e[5], &e[6], &e[7]) != 8)
-		{
-			return 0;
-		}
 		*buf = '\0';
-		for (i = 7; i >= 0; i--)
+		for (i = 15; i >= 0; i--)
 		{
-			snprintf(wbuf, sizeof(wbuf), "%x.%x.%x.%x.",
+			snprintf(wbuf, sizeof(wbuf), "%x.%x.",
 				(unsigned int)(e[i] & 0xf),
-				(unsigned int)((e[i] >> 4) & 0xf),
-				(unsigned int)((e[i] >> 8) & 0xf),
-				(unsigned int)((e[i] >> 12) & 0xf));
+				(unsigned int)((e[i] >> 4) & 0xf));
 			strlcat(buf, wbuf, sizeof(buf));
 		}
 		strlcat(buf, d->backend->dns->name, sizeof(buf));
 	}
-	else
-		return 0; /* unknown IP format */
 
 	BLUSER(client)->refcnt++; /* one (more) blacklist result remaining */
 	
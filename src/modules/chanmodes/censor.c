@@ -300,7 +300,7 @@ static int IsAnyChannelCensored(Client *client)
 {
 	Membership *lp;
 
-	for (lp = client->user->channel; lp; lp = lp->next)
+	for (lp = client->user->channel; lp; lp = lp->next_channel)
 		if (IsCensored(lp->channel))
 			return 1;
 	return 0;
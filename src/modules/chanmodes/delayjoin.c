@@ -141,7 +141,7 @@ bool moded_user_invisible(Client *client, Channel *channel)
 bool channel_has_invisible_users(Channel *channel)
 {
 	Member* i;
-	for (i = channel->members; i; i = i->next)
+	for (i = channel->members; i; i = i->next_member)
 	{
 		if (moded_member_invisible(i, channel))
 		{
@@ -174,7 +174,7 @@ void clear_user_invisible(Channel *channel, Client *client)
 	md = findmoddata_byname(MOD_DATA_STR, MODDATATYPE_MEMBER);
 	if (!md)
 		return;
-	for (i = channel->members; i; i = i->next)
+	for (i = channel->members; i; i = i->next_member)
 	{
 		if (i->client == client)
 		{
@@ -221,10 +221,10 @@ void clear_user_invisible_announce(Channel *channel, Client *client, MessageTag
 		client->info);
 
 	new_message_special(client, recv_mtags, &mtags, ":%s JOIN %s", client->name, channel->chname);
-	for (i = channel->members; i; i = i->next)
+	for (i = channel->local_members; i; i = i->next_local)
 	{
 		Client *acptr = i->client;
-		if (!is_skochanop(acptr, channel) && acptr != client && MyConnect(acptr))
+		if (!is_skochanop(acptr, channel) && acptr != client)
 		{
 			if (HasCapabilityFast(acptr, CAP_EXTENDED_JOIN))
 				sendto_one(acptr, mtags, "%s", exjoinbuf);
@@ -310,7 +310,7 @@ int moded_chanmode(Client *client, Channel *channel, MessageTag *recv_mtags, cha
 					continue;
 
 				/* Our user 'user' just got ops (oaq) - send the joins for all the users (s)he doesn't know about */
-				for (i = channel->members; i; i = i->next)
+				for (i = channel->members; i; i = i->next_member)
 				{
 					if (i->client == user)
 						continue;
@@ -347,7 +347,7 @@ int moded_chanmode(Client *client, Channel *channel, MessageTag *recv_mtags, cha
 					continue;
 
 				/* Our user 'user' just lost ops (oaq) - send the parts for all users (s)he won't see anymore */
-				for (i = channel->members; i; i = i->next)
+				for (i = channel->members; i; i = i->next_member)
 				{
 					if (i->client == user)
 						continue;
@@ -1094,7 +1094,7 @@ int floodprot_nickchange(Client *client, char *oldnick)
 	if (IsULine(client))
 		return 0;
 
-	for (mp = client->user->channel; mp; mp = mp->next)
+	for (mp = client->user->channel; mp; mp = mp->next_channel)
 	{
 		Channel *channel = mp->channel;
 		if (channel && IsFloodLimit(channel) &&
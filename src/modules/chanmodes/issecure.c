@@ -118,7 +118,7 @@ int channel_has_insecure_users_butone(Channel *channel, Client *skip)
 {
 Member *member;
 
-	for (member = channel->members; member; member = member->next)
+	for (member = channel->members; member; member = member->next_member)
 	{
 		if (member->client == skip)
 			continue;
@@ -227,7 +227,7 @@ int issecure_quit(Client *client, MessageTag *mtags, char *comment)
 Membership *membership;
 Channel *channel;
 
-	for (membership = client->user->channel; membership; membership=membership->next)
+	for (membership = client->user->channel; membership; membership=membership->next_channel)
 	{
 		channel = membership->channel;
 		/* Identical to part */
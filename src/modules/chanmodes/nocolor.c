@@ -124,7 +124,7 @@ static int IsAnyChannelNoColor(Client *client)
 {
 	Membership *lp;
 
-	for (lp = client->user->channel; lp; lp = lp->next)
+	for (lp = client->user->channel; lp; lp = lp->next_channel)
 		if (IsNoColor(lp->channel))
 			return 1;
 	return 0;
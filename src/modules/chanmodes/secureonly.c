@@ -93,7 +93,7 @@ static int secureonly_kick_insecure_users(Channel *channel)
 
 	for (member = channel->members; member; member = mb2)
 	{
-		mb2 = member->next;
+		mb2 = member->next_member;
 		client = member->client;
 		if (MyUser(client) && !IsSecureConnect(client) && !IsULine(client))
 		{
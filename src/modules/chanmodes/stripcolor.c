@@ -111,7 +111,7 @@ static int IsAnyChannelStripColor(Client *client)
 {
 	Membership *lp;
 
-	for (lp = client->user->channel; lp; lp = lp->next)
+	for (lp = client->user->channel; lp; lp = lp->next_channel)
 		if (IsStripColor(lp->channel))
 			return 1;
 	return 0;
@@ -312,8 +312,9 @@ int write_channel_entry(FILE *fd, const char *tmpfname, Channel *channel)
 			if (e) \
 			{ \
 				safe_free(e->banstr); \
-				safe_free(e->who); \
+				scache_free(e->who); \
 				safe_free(e); \
+				safe_free(who); \
 			} \
 			return 0; \
 		} \
@@ -325,6 +326,7 @@ int read_listmode(FILE *fd, Ban **lst)
 	uint64_t when;
 	int i;
 	Ban *e = NULL;
+	char *who = NULL;
 
 	R_SAFE(read_data(fd, &total, sizeof(total)));
 
@@ -332,7 +334,9 @@ int read_listmode(FILE *fd, Ban **lst)
 	{
 		e = safe_alloc(sizeof(Ban));
 		R_SAFE(read_str(fd, &e->banstr));
-		R_SAFE(read_str(fd, &e->who));
+		R_SAFE(read_str(fd, &who));
+		e->who = who ? scache_add(who) : NULL;
+		safe_free(who);
 		R_SAFE(read_data(fd, &when, sizeof(when)));
 		e->when = when;
 		e->next = *lst;
@@ -0,0 +1,209 @@
+/*
+ *   IRC - Internet Relay Chat, src/modules/chantraffic.c
+ *   (C) 2020 Bram Matthys and The UnrealIRCd Team
+ *
+ *   See file AUTHORS in IRC package for additional names of
+ *   the programmers.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "unrealircd.h"
+
+ModuleHeader MOD_HEADER
+  = {
+	"chantraffic",
+	"5.0",
+	"Per-channel traffic statistics (/STATS hotchannels)",
+	"UnrealIRCd Team",
+	"unrealircd-5",
+	};
+
+/** How often the recent rate is calculated (in seconds) */
+#define CHANTRAFFIC_INTERVAL	10
+
+/** Number of channels shown in /STATS hotchannels */
+#define CHANTRAFFIC_TOP		10
+
+/** Traffic counters of a channel, since this server saw it being created */
+typedef struct ChannelTraffic ChannelTraffic;
+struct ChannelTraffic {
+	unsigned long long messages_in;	/**< PRIVMSG/NOTICE's to the channel */
+	unsigned long long lines_out;	/**< Lines sent to local members and server links (fan-out) */
+	unsigned long long bytes_out;	/**< Bytes sent, excluding message tags */
+	int lines_window;		/**< Lines sent in the current interval */
+	int rate;			/**< Lines per minute sent in the previous interval */
+};
+
+/* Forward declarations */
+int chantraffic_chanmsg(Client *client, Channel *channel, int sendflags, int prefix, char *target, MessageTag *mtags, char *text, int notice);
+int chantraffic_channel_traffic(Channel *channel, Client *from, int lines, int bytes);
+int chantraffic_stats(Client *client, char *para);
+int chantraffic_channel_destroy(Channel *channel, int *should_destroy);
+void chantraffic_md_free(ModData *m);
+EVENT(chantraffic_rate);
+
+ModDataInfo *chantraffic_md = NULL;
+Module *chantraffic_module = NULL;
+
+#define CHANTRAFFIC(channel)	((ChannelTraffic *)moddata_channel(channel, chantraffic_md).ptr)
+
+MOD_INIT()
+{
+	ModDataInfo mreq;
+
+	MARK_AS_OFFICIAL_MODULE(modinfo);
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "chantraffic";
+	mreq.type = MODDATATYPE_CHANNEL;
+	mreq.free = chantraffic_md_free;
+	chantraffic_md = ModDataAdd(modinfo->handle, mreq);
+	if (!chantraffic_md)
+	{
+		config_error("could not register chantraffic moddata");
+		return MOD_FAILED;
+	}
+
+	HookAdd(modinfo->handle, HOOKTYPE_CHANMSG, 0, chantraffic_chanmsg);
+	HookAdd(modinfo->handle, HOOKTYPE_CHANNEL_TRAFFIC, 0, chantraffic_channel_traffic);
+	HookAdd(modinfo->handle, HOOKTYPE_STATS, 0, chantraffic_stats);
+	HookAdd(modinfo->handle, HOOKTYPE_CHANNEL_DESTROY, 1000000, chantraffic_channel_destroy);
+	chantraffic_module = modinfo->handle;
+
+	return MOD_SUCCESS;
+}
+
+MOD_LOAD()
+{
+	EventAdd(modinfo->handle, "chantraffic_rate", chantraffic_rate, NULL, CHANTRAFFIC_INTERVAL*1000, 0);
+	return MOD_SUCCESS;
+}
+
+MOD_UNLOAD()
+{
+	return MOD_SUCCESS;
+}
+
+void chantraffic_md_free(ModData *m)
+{
+	if (!m->ptr)
+		return;
+	module_memory_account(chantraffic_module, -(long)sizeof(ChannelTraffic));
+	safe_free(m->ptr);
+}
+
+static ChannelTraffic *chantraffic_get(Channel *channel)
+{
+	if (!CHANTRAFFIC(channel))
+	{
+		moddata_channel(channel, chantraffic_md).ptr = safe_alloc(sizeof(ChannelTraffic));
+		module_memory_account(chantraffic_module, sizeof(ChannelTraffic));
+	}
+	return CHANTRAFFIC(channel);
+}
+
+/* Channel ModData is not freed by the core when a channel is destroyed */
+int chantraffic_channel_destroy(Channel *channel, int *should_destroy)
+{
+	if (*should_destroy == 0)
+		return 0; /* channel will not be destroyed */
+
+	chantraffic_md_free(&moddata_channel(channel, chantraffic_md));
+	return 0;
+}
+
+int chantraffic_chanmsg(Client *client, Channel *channel, int sendflags, int prefix, char *target, MessageTag *mtags, char *text, int notice)
+{
+	chantraffic_get(channel)->messages_in++;
+	return 0;
+}
+
+int chantraffic_channel_traffic(Channel *channel, Client *from, int lines, int bytes)
+{
+	ChannelTraffic *t = chantraffic_get(channel);
+
+	t->lines_out += lines;
+	t->bytes_out += bytes;
+	t->lines_window += lines;
+	return 0;
+}
+
+/** Calculate the recent rate of all channels */
+EVENT(chantraffic_rate)
+{
+	Channel *channel;
+	ChannelTraffic *t;
+
+	for (channel = channels; channel; channel = channel->nextch)
+	{
+		t = CHANTRAFFIC(channel);
+		if (!t)
+			continue;
+		t->rate = t->lines_window * 60 / CHANTRAFFIC_INTERVAL;
+		t->lines_window = 0;
+	}
+}
+
+/** Is channel 'a' hotter than channel 'b'?
+ * The recent rate counts first, the total fan-out after that.
+ */
+static int chantraffic_hotter(ChannelTraffic *a, ChannelTraffic *b)
+{
+	if (a->rate != b->rate)
+		return a->rate > b->rate;
+	return a->lines_out > b->lines_out;
+}
+
+/** /STATS hotchannels: the channels with the highest fan-out cost */
+int chantraffic_stats(Client *client, char *para)
+{
+	Channel *top[CHANTRAFFIC_TOP];
+	Channel *channel;
+	ChannelTraffic *t;
+	int cnt = 0;
+	int i;
+
+	if (strcasecmp(para, "hotchannels"))
+		return 0;
+
+	/* Keep the top N sorted while walking all channels */
+	for (channel = channels; channel; channel = channel->nextch)
+	{
+		t = CHANTRAFFIC(channel);
+		if (!t || !t->lines_out)
+			continue;
+		for (i = cnt; i > 0 && chantraffic_hotter(t, CHANTRAFFIC(top[i-1])); i--)
+		{
+			if (i < CHANTRAFFIC_TOP)
+				top[i] = top[i-1];
+		}
+		if (i < CHANTRAFFIC_TOP)
+		{
+			top[i] = channel;
+			if (cnt < CHANTRAFFIC_TOP)
+				cnt++;
+		}
+	}
+
+	for (i = 0; i < cnt; i++)
+	{
+		t = CHANTRAFFIC(top[i]);
+		sendtxtnumeric(client, "%s users=%d messages-in=%llu lines-out=%llu bytes-out=%llu rate=%d/min",
+			top[i]->chname, top[i]->users, t->messages_in, t->lines_out, t->bytes_out, t->rate);
+	}
+
+	return 1;
+}
@@ -147,7 +147,7 @@ CMD_FUNC(cmd_chgident)
 
 	sendto_server(client, 0, 0, NULL, ":%s CHGIDENT %s %s",
 	    client->id, target->id, parv[2]);
-	ircsnprintf(target->user->username, sizeof(target->user->username), "%s", parv[2]);
+	scache_setn(target->user->username, parv[2], USERLEN);
 
 	userhost_changed(target);
 }
@@ -35,15 +35,15 @@ int CLOAK_IP_ONLY = 0;
 #define KEY2 cloak_key2
 #define KEY3 cloak_key3
 
-char *hidehost(Client *client, char *host);
+char *hidehost(Client *client, const char *host);
 char *cloakcsum();
 int cloak_config_test(ConfigFile *, ConfigEntry *, int, int *);
 int cloak_config_run(ConfigFile *, ConfigEntry *, int);
 int cloak_config_posttest(int *);
 
-static char *hidehost_ipv4(char *host);
-static char *hidehost_ipv6(char *host);
-static char *hidehost_normalhost(char *host);
+static char *hidehost_ipv4(const char *host);
+static char *hidehost_ipv6(const char *host);
+static char *hidehost_normalhost(const char *host);
 static inline unsigned int downsample(char *i);
 
 Callback *cloak = NULL, *cloak_csum = NULL;
@@ -250,9 +250,8 @@ char buf[512], result[16];
 	return 1;
 }
 
-char *hidehost(Client *client, char *host)
+char *hidehost(Client *client, const char *host)
 {
-	char *p;
 	int host_type;
 
 	if (CLOAK_IP_ONLY)
@@ -289,7 +288,7 @@ char r[4];
 	         (unsigned int)r[3]);
 }
 
-static char *hidehost_ipv4(char *host)
+static char *hidehost_ipv4(const char *host)
 {
 unsigned int a, b, c, d;
 static char buf[512], res[512], res2[512], result[128];
@@ -336,7 +335,7 @@ unsigned int alpha, beta, gamma;
 	return result;
 }
 
-static char *hidehost_ipv6(char *host)
+static char *hidehost_ipv6(const char *host)
 {
 unsigned int a, b, c, d, e, f, g, h;
 static char buf[512], res[512], res2[512], result[128];
@@ -384,9 +383,9 @@ unsigned int alpha, beta, gamma;
 	return result;
 }
 
-static char *hidehost_normalhost(char *host)
+static char *hidehost_normalhost(const char *host)
 {
-char *p;
+const char *p;
 static char buf[512], res[512], res2[512], result[HOSTLEN+1];
 unsigned int alpha, n;
 
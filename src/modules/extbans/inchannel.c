@@ -144,7 +144,7 @@ int extban_inchannel_is_banned(Client *client, Channel *channel, char *ban, int
 		p++;
 	}
 
-	for (lp = client->user->channel; lp; lp = lp->next)
+	for (lp = client->user->channel; lp; lp = lp->next_channel)
 	{
 		if (match_esc(p, lp->channel->chname))
 		{
@@ -29,21 +29,11 @@
 /* Maximum length of a ban */
 #define MAX_LENGTH 128
 
-/* Split timeout event in <this> amount of iterations */
-#define TIMEDBAN_TIMER_ITERATION_SPLIT 4
+/* Call timeout event every <this> seconds */
+#define TIMEDBAN_TIMER	1
 
-/* Call timeout event every <this> seconds.
- * NOTE: until all channels are processed it takes
- *       TIMEDBAN_TIMER_ITERATION_SPLIT * TIMEDBAN_TIMER.
- */
-#define TIMEDBAN_TIMER	2
-
-/* We allow a ban to (potentially) expire slightly before the deadline.
- * For example with TIMEDBAN_TIMER_ITERATION_SPLIT=4 and TIMEDBAN_TIMER=2
- * a 1 minute ban would expire at 56-63 seconds, rather than 60-67 seconds.
- * This is usually preferred.
- */
-#define TIMEDBAN_TIMER_DELTA ((TIMEDBAN_TIMER_ITERATION_SPLIT*TIMEDBAN_TIMER)/2)
+/* Initial size of the timed ban heap (it grows when needed) */
+#define TIMEDBAN_HEAP_SIZE	64
 
 ModuleHeader MOD_HEADER
   = {
@@ -61,8 +51,38 @@ int timedban_is_banned(Client *client, Channel *channel, char *ban, int chktype,
 void add_send_mode_param(Channel *channel, Client *from, char what, char mode, char *param);
 char *timedban_chanmsg(Client *, Client *, Channel *, char *, int);
 
+int timedban_listmode_add(Channel *channel, Ban **list, Ban *ban);
+int timedban_listmode_del(Channel *channel, Ban **list, Ban *ban);
 EVENT(timedban_timeout);
 
+/** A timed ban in the expiry heap.
+ * Only the channel name and ban are stored, not pointers.
+ * There is at most one entry per ban: it is replaced when the ban is
+ * set again and removed when the ban is removed (or the channel is
+ * destroyed), see timedban_listmode_add() and timedban_listmode_del().
+ */
+typedef struct TimedBan TimedBan;
+struct TimedBan {
+	time_t expire;		/**< When the ban expires */
+	time_t when;		/**< Ban::when, to recognize the ban (it may have been re-set) */
+	char mode;		/**< 'b', 'e' or 'I' */
+	char *chname;		/**< Channel name */
+	char *banstr;		/**< The ban, eg ~t:5:*!*@host */
+};
+
+/** Binary min-heap of timed bans, ordered by expiry time */
+static TimedBan **timedban_heap = NULL;
+static int timedban_heap_count = 0;
+static int timedban_heap_size = 0;
+
+/** Set until the existing bans have been added to the heap */
+static int timedban_need_scan = 1;
+
+/** Set while timedban_timeout() removes a ban, its entry is already off the heap */
+static int timedban_expiring = 0;
+
+static void timedban_heap_free(void);
+
 MOD_TEST()
 {
 	return MOD_SUCCESS;
@@ -89,6 +109,8 @@ ExtbanInfo extban;
 		return MOD_FAILED;
 	}
                 
+	HookAdd(modinfo->handle, HOOKTYPE_LISTMODE_ADD, 0, timedban_listmode_add);
+	HookAdd(modinfo->handle, HOOKTYPE_LISTMODE_DEL, 0, timedban_listmode_del);
 	EventAdd(modinfo->handle, "timedban_timeout", timedban_timeout, NULL, TIMEDBAN_TIMER*1000, 0);
 
 	return MOD_SUCCESS;
@@ -101,6 +123,7 @@ MOD_LOAD()
 
 MOD_UNLOAD()
 {
+	timedban_heap_free();
 	return MOD_SUCCESS;
 }
 
@@ -353,92 +376,308 @@ int timedban_is_banned(Client *client, Channel *channel, char *ban, int chktype,
 	return ban_check_mask(client, channel, ban, chktype, msg, errmsg, 0);
 }
 
-/** Helper to check if the ban has been expired */
-int timedban_has_ban_expired(Ban *ban)
+/** Get the expiry time of a timed ban.
+ * @returns The time the ban expires, or 0 if this is not a (valid) timed ban.
+ */
+time_t timedban_expire_time(Ban *ban)
 {
 	char *banstr = ban->banstr;
-	char *p;
 	int t;
-	time_t expire_on;
 
 	if (strncmp(banstr, "~t:", 3))
 		return 0; /* not for us */
-	p = strchr(banstr+3, ':'); /* skip time argument */
-	if (!p)
+	if (!strchr(banstr+3, ':'))
 		return 0; /* invalid fmt */
-	*p = '\0'; /* danger.. must restore!! */
-	t = atoi(banstr+3);
-	*p = ':'; /* restored.. */
-	
-	expire_on = ban->when + (t * 60) - TIMEDBAN_TIMER_DELTA;
-	
-	if (expire_on < TStime())
-		return 1;
+	t = atoi(banstr+3); /* stops at the ':' */
+	if (t <= 0)
+		return 0;
+
+	return ban->when + (t * 60);
+}
+
+static int timedban_heap_before(int a, int b)
+{
+	return timedban_heap[a]->expire < timedban_heap[b]->expire;
+}
+
+static void timedban_heap_swap(int a, int b)
+{
+	TimedBan *tmp = timedban_heap[a];
+	timedban_heap[a] = timedban_heap[b];
+	timedban_heap[b] = tmp;
+}
+
+static void timedban_heap_sift_up(int i)
+{
+	while ((i > 0) && timedban_heap_before(i, (i - 1) / 2))
+	{
+		timedban_heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void timedban_heap_sift_down(int i)
+{
+	int child;
+
+	while ((child = i * 2 + 1) < timedban_heap_count)
+	{
+		if ((child + 1 < timedban_heap_count) && timedban_heap_before(child + 1, child))
+			child++;
+		if (!timedban_heap_before(child, i))
+			break;
+		timedban_heap_swap(i, child);
+		i = child;
+	}
+}
+
+/** Add a timed ban to the expiry heap */
+static void timedban_heap_add(Channel *channel, char mode, Ban *ban)
+{
+	TimedBan *e;
+	time_t expire;
+	int i;
+
+	expire = timedban_expire_time(ban);
+	if (!expire)
+		return;
+
+	if (timedban_heap_count == timedban_heap_size)
+	{
+		TimedBan **newheap;
+
+		timedban_heap_size = timedban_heap_size ? timedban_heap_size * 2 : TIMEDBAN_HEAP_SIZE;
+		newheap = safe_alloc(sizeof(TimedBan *) * timedban_heap_size);
+		if (timedban_heap_count)
+			memcpy(newheap, timedban_heap, sizeof(TimedBan *) * timedban_heap_count);
+		safe_free(timedban_heap);
+		timedban_heap = newheap;
+	}
+
+	e = safe_alloc(sizeof(TimedBan));
+	e->expire = expire;
+	e->when = ban->when;
+	e->mode = mode;
+	safe_strdup(e->chname, channel->chname);
+	safe_strdup(e->banstr, ban->banstr);
+
+	i = timedban_heap_count++;
+	timedban_heap[i] = e;
+	timedban_heap_sift_up(i);
+}
+
+/** Remove and return the timed ban at position 'i' in the heap */
+static TimedBan *timedban_heap_remove(int i)
+{
+	TimedBan *e = timedban_heap[i];
+
+	if (i == --timedban_heap_count)
+		return e; /* it was the last one */
+
+	/* Move the last entry into the hole, it may have to go either way */
+	timedban_heap[i] = timedban_heap[timedban_heap_count];
+	if ((i > 0) && timedban_heap_before(i, (i - 1) / 2))
+		timedban_heap_sift_up(i);
+	else
+		timedban_heap_sift_down(i);
+
+	return e;
+}
+
+/** Remove and return the timed ban that expires first */
+static TimedBan *timedban_heap_pop(void)
+{
+	return timedban_heap_remove(0);
+}
+
+/** Find the heap entry of a ban.
+ * This walks the whole heap, but it is only done when a ~t: entry
+ * is set again or removed.
+ * @returns The position in the heap, or -1 if not found.
+ */
+static int timedban_heap_find(Channel *channel, char mode, Ban *ban)
+{
+	int i;
+
+	for (i = 0; i < timedban_heap_count; i++)
+	{
+		TimedBan *e = timedban_heap[i];
+		/* Both start with "~t:", the rest is compared like identical_ban() does */
+		if ((e->mode == mode) && !strcasecmp(e->banstr + 3, ban->banstr + 3) &&
+		    !strcmp(e->chname, channel->chname))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void timedban_free(TimedBan *e)
+{
+	safe_free(e->chname);
+	safe_free(e->banstr);
+	safe_free(e);
+}
+
+static void timedban_heap_free(void)
+{
+	while (timedban_heap_count > 0)
+		timedban_free(timedban_heap_pop());
+	safe_free(timedban_heap);
+	timedban_heap_size = 0;
+}
+
+/** Returns the mode letter of a ban, exempt or invex list */
+static char timedban_list_mode(Channel *channel, Ban **list)
+{
+	if (list == &channel->banlist)
+		return 'b';
+	else if (list == &channel->exlist)
+		return 'e';
+	else if (list == &channel->invexlist)
+		return 'I';
+	return '\0';
+}
+
+/** Remove the heap entry of a ban, if it has one */
+static void timedban_heap_del(Channel *channel, char mode, Ban *ban)
+{
+	int i = timedban_heap_find(channel, mode, ban);
+
+	if (i >= 0)
+		timedban_free(timedban_heap_remove(i));
+}
+
+/** Called for each ban, exempt or invex that is added (or updated) */
+int timedban_listmode_add(Channel *channel, Ban **list, Ban *ban)
+{
+	char mode;
+
+	if (timedban_need_scan || strncmp(ban->banstr, "~t:", 3))
+		return 0; /* not for us (or it will be found by the initial scan) */
+
+	mode = timedban_list_mode(channel, list);
+	if (!mode)
+		return 0;
+
+	/* An updated ban replaces its old entry */
+	timedban_heap_del(channel, mode, ban);
+	timedban_heap_add(channel, mode, ban);
 	return 0;
 }
 
+/** Called for each ban, exempt or invex that is removed,
+ * including when the channel is destroyed.
+ */
+int timedban_listmode_del(Channel *channel, Ban **list, Ban *ban)
+{
+	char mode;
+
+	if (timedban_need_scan || timedban_expiring || strncmp(ban->banstr, "~t:", 3))
+		return 0;
+
+	mode = timedban_list_mode(channel, list);
+	if (mode)
+		timedban_heap_del(channel, mode, ban);
+	return 0;
+}
+
+/** Add all existing timed bans to the heap.
+ * This is done once, after boot or after the module is (re)loaded,
+ * and also picks up bans that were restored from a database.
+ */
+static void timedban_scan(void)
+{
+	Channel *channel;
+	Ban *ban;
+
+	for (channel = channels; channel; channel = channel->nextch)
+	{
+		for (ban = channel->banlist; ban; ban = ban->next)
+			if (!strncmp(ban->banstr, "~t:", 3))
+				timedban_heap_add(channel, 'b', ban);
+		for (ban = channel->exlist; ban; ban = ban->next)
+			if (!strncmp(ban->banstr, "~t:", 3))
+				timedban_heap_add(channel, 'e', ban);
+		for (ban = channel->invexlist; ban; ban = ban->next)
+			if (!strncmp(ban->banstr, "~t:", 3))
+				timedban_heap_add(channel, 'I', ban);
+	}
+	timedban_need_scan = 0;
+}
+
 static char mbuf[512];
 static char pbuf[512];
 
-/** This removes any expired timedbans */
+/** Send out the MODE line that add_send_mode_param() is building, if any */
+static void timedban_send_modes(Channel *channel)
+{
+	if (*pbuf)
+	{
+		MessageTag *mtags = NULL;
+		new_message(&me, NULL, &mtags);
+		sendto_channel(channel, &me, NULL, 0, 0, SEND_LOCAL, mtags, ":%s MODE %s %s %s", me.name, channel->chname, mbuf, pbuf);
+		sendto_server(NULL, 0, 0, mtags, ":%s MODE %s %s %s 0", me.id, channel->chname, mbuf, pbuf);
+		free_message_tags(mtags);
+		*pbuf = 0;
+	}
+	*mbuf = '\0';
+}
+
+/** This removes any expired timedbans.
+ * Only the bans that are due are looked at, thanks to the heap.
+ */
 EVENT(timedban_timeout)
 {
-	Channel *channel;
-	Ban *ban, *nextban;
-	static int current_iteration = 0;
+	Channel *channel, *last_channel = NULL;
+	Ban **list, *ban;
+	TimedBan *e;
 
-	if (++current_iteration >= TIMEDBAN_TIMER_ITERATION_SPLIT)
-		current_iteration = 0;
+	if (timedban_need_scan)
+		timedban_scan();
 
-	for (channel = channels; channel; channel = channel->nextch)
+	*mbuf = *pbuf = '\0';
+	while ((timedban_heap_count > 0) && (timedban_heap[0]->expire <= TStime()))
 	{
-		/* This is a very quick check, at the cost of it being
-		 * biased since there's always a tendency of more channel
-		 * names to start with one specific letter. But hashing
-		 * is too costly. So we stick with this. It should be
-		 * good enough. Alternative would be some channel->id value.
-		 */
-		if (((unsigned int)channel->chname[1] % TIMEDBAN_TIMER_ITERATION_SPLIT) != current_iteration)
-			continue; /* not this time, maybe next */
+		e = timedban_heap_pop();
 
-		*mbuf = *pbuf = '\0';
-		for (ban = channel->banlist; ban; ban=nextban)
+		channel = find_channel(e->chname, NULL);
+		if (!channel)
 		{
-			nextban = ban->next;
-			if (!strncmp(ban->banstr, "~t:", 3) && timedban_has_ban_expired(ban))
-			{
-				add_send_mode_param(channel, &me, '-',  'b', ban->banstr);
-				del_listmode(&channel->banlist, channel, ban->banstr);
-			}
+			timedban_free(e);
+			continue; /* channel is gone */
 		}
-		for (ban = channel->exlist; ban; ban=nextban)
-		{
-			nextban = ban->next;
-			if (!strncmp(ban->banstr, "~t:", 3) && timedban_has_ban_expired(ban))
-			{
-				add_send_mode_param(channel, &me, '-',  'e', ban->banstr);
-				del_listmode(&channel->exlist, channel, ban->banstr);
-			}
-		}
-		for (ban = channel->invexlist; ban; ban=nextban)
+
+		if (e->mode == 'b')
+			list = &channel->banlist;
+		else if (e->mode == 'e')
+			list = &channel->exlist;
+		else
+			list = &channel->invexlist;
+
+		/* Is the ban still there, and not set again in the meantime? */
+		for (ban = *list; ban; ban = ban->next)
+			if (!strcmp(ban->banstr, e->banstr) && (ban->when == e->when))
+				break;
+
+		if (ban)
 		{
-			nextban = ban->next;
-			if (!strncmp(ban->banstr, "~t:", 3) && timedban_has_ban_expired(ban))
+			if (channel != last_channel)
 			{
-				add_send_mode_param(channel, &me, '-',  'I', ban->banstr);
-				del_listmode(&channel->invexlist, channel, ban->banstr);
+				if (last_channel)
+					timedban_send_modes(last_channel);
+				last_channel = channel;
 			}
+			add_send_mode_param(channel, &me, '-', e->mode, e->banstr);
+			timedban_expiring = 1;
+			del_listmode(list, channel, e->banstr);
+			timedban_expiring = 0;
 		}
-		if (*pbuf)
-		{
-			MessageTag *mtags = NULL;
-			new_message(&me, NULL, &mtags);
-			sendto_channel(channel, &me, NULL, 0, 0, SEND_LOCAL, mtags, ":%s MODE %s %s %s", me.name, channel->chname, mbuf, pbuf);
-			sendto_server(NULL, 0, 0, mtags, ":%s MODE %s %s %s 0", me.id, channel->chname, mbuf, pbuf);
-			free_message_tags(mtags);
-			*pbuf = 0;
-		}
+		timedban_free(e);
 	}
+
+	if (last_channel)
+		timedban_send_modes(last_channel);
 }
 
 #if MODEBUFLEN > 512
@@ -170,12 +170,24 @@ void hbm_duplicate_mtags(HistoryLogLine *l, MessageTag *m)
 	l->t = server_time_to_unix_time(n->value);
 }
 
+/** Memory used by a history line, for the memory budget */
+static long hbm_line_size(HistoryLogLine *l)
+{
+	MessageTag *m;
+	long size = sizeof(HistoryLogLine) + strlen(l->line);
+
+	for (m = l->mtags; m; m = m->next)
+		size += sizeof(MessageTag) + strlen(m->name) + (m->value ? strlen(m->value) : 0);
+	return size;
+}
+
 /** Add a line to a history object */
 void hbm_history_add_line(HistoryLogObject *h, MessageTag *mtags, char *line)
 {
 	HistoryLogLine *l = safe_alloc(sizeof(HistoryLogLine) + strlen(line));
 	strcpy(l->line, line); /* safe, see memory allocation above ^ */
 	hbm_duplicate_mtags(l, mtags);
+	memory_account(MEMORY_ACCOUNT_HISTORY, hbm_line_size(l));
 	if (h->tail)
 	{
 		/* append to tail */
@@ -209,6 +221,7 @@ void hbm_history_del_line(HistoryLogObject *h, HistoryLogLine *l)
 		h->tail = l->prev; /* could be NULL now */
 	}
 
+	memory_account(MEMORY_ACCOUNT_HISTORY, -hbm_line_size(l));
 	free_message_tags(l->mtags);
 	safe_free(l);
 
@@ -347,6 +360,7 @@ int hbm_history_destroy(char *object)
 		 * The only danger is that we may forget to free some
 		 * fields that are added later there but not here.
 		 */
+		memory_account(MEMORY_ACCOUNT_HISTORY, -hbm_line_size(l));
 		free_message_tags(l->mtags);
 		safe_free(l);
 	}
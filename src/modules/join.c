@@ -202,7 +202,7 @@ void _send_join_to_local_users(Client *client, Channel *channel, MessageTag *mta
 		!isdigit(*client->user->svid) ? client->user->svid : "*",
 		client->info);
 
-	for (lp = channel->members; lp; lp = lp->next)
+	for (lp = channel->members; lp; lp = lp->next_member)
 	{
 		acptr = lp->client;
 
@@ -693,7 +693,7 @@ void _userhost_changed(Client *client)
 	if (UHOST_ALLOWED == UHALLOW_REJOIN)
 	{
 		/* Walk through all channels of this user.. */
-		for (channels = client->user->channel; channels; channels = channels->next)
+		for (channels = client->user->channel; channels; channels = channels->next_channel)
 		{
 			Channel *channel = channels->channel;
 			int flags = channels->flags;
@@ -728,7 +728,7 @@ void _userhost_changed(Client *client)
 			if (!BadPtr(modes))
 				ircsnprintf(modebuf, sizeof(modebuf), ":%s MODE %s %s", me.name, channel->chname, modes);
 
-			for (lp = channel->members; lp; lp = lp->next)
+			for (lp = channel->members; lp; lp = lp->next_member)
 			{
 				acptr = lp->client;
 
@@ -773,12 +773,12 @@ void _userhost_changed(Client *client)
 	            client->user->username,
 	            GetHost(client));
 	current_serial++;
-	for (channels = client->user->channel; channels; channels = channels->next)
+	for (channels = client->user->channel; channels; channels = channels->next_channel)
 	{
-		for (lp = channels->channel->members; lp; lp = lp->next)
+		for (lp = channels->channel->local_members; lp; lp = lp->next_local)
 		{
 			acptr = lp->client;
-			if (MyUser(acptr) && HasCapabilityFast(acptr, CAP_CHGHOST) &&
+			if (HasCapabilityFast(acptr, CAP_CHGHOST) &&
 			    (acptr->local->serial != current_serial) && (client != acptr))
 			{
 				/* FIXME: send mtag */
@@ -383,7 +383,7 @@ void _send_moddata_members(Client *srv)
 	for (channel = channels; channel; channel = channel->nextch)
 	{
 		Member *m;
-		for (m = channel->members; m; m = m->next)
+		for (m = channel->members; m; m = m->next_member)
 		{
 			client = m->client;
 			if (client->direction == srv)
@@ -410,7 +410,7 @@ void _send_moddata_members(Client *srv)
 		if (client->direction == srv)
 			continue; /* from srv's direction */
 
-		for (m = client->user->channel; m; m = m->next)
+		for (m = client->user->channel; m; m = m->next_channel)
 		{
 			for (mdi = MDInfo; mdi; mdi = mdi->next)
 			{
@@ -187,7 +187,7 @@ CMD_FUNC(cmd_mode)
 			if (!IsMember(client, channel) && !ValidatePermissionsForPath("channel:see:mode:remoteownerlist",client,NULL,channel,NULL))
 				return;
 
-			for (member = channel->members; member; member = member->next)
+			for (member = channel->members; member; member = member->next_member)
 			{
 				if (is_chanowner(member->client, channel))
 					sendnumeric(client, RPL_QLIST, channel->chname, member->client->name);
@@ -203,7 +203,7 @@ CMD_FUNC(cmd_mode)
 			if (!IsMember(client, channel) && !ValidatePermissionsForPath("channel:see:mode:remoteownerlist",client,NULL,channel,NULL))
 				return;
 
-			for (member = channel->members; member; member = member->next)
+			for (member = channel->members; member; member = member->next_member)
 			{
 				if (is_chanadmin(member->client, channel))
 					sendnumeric(client, RPL_ALIST, channel->chname, member->client->name);
@@ -735,7 +735,6 @@ int  do_mode_char(Channel *channel, long modetype, char modechar, char *param,
 	CoreChannelModeTable *tab = &corechannelmodetable[0];
 	int  retval = 0;
 	Member *member = NULL;
-	Membership *membership = NULL;
 	Client *target;
 	unsigned int tmp = 0;
 	char tmpbuf[512], *tmpstr;
@@ -845,18 +844,11 @@ process_listmode:
 				break;
 			if (!target->user)
 				break;
-			if (!(membership = find_membership_link(target->user->channel, channel)))
+			if (!(member = find_membership_link(target->user->channel, channel)))
 			{
 				sendnumeric(client, ERR_USERNOTINCHANNEL, target->name, channel->chname);
 				break;
 			}
-			member = find_member_link(channel->members, target);
-			if (!member)
-			{
-				/* should never happen */
-				sendto_realops("crap! find_membership_link && !find_member_link !!. Report to unreal team");
-				break;
-			}
 			/* we make the rules, we bend the rules */
 			if (IsServer(client) || IsULine(client))
 				goto breaktherules;
@@ -966,6 +958,8 @@ process_listmode:
 			 * Besides, pvar keeps a log of it. */
 			if (bounce)
 				member->flags = tmp;
+			else if (tmp != member->flags)
+				membership_changed(member->client);
 			if (modetype == MODE_CHANOWNER)
 				tc = 'q';
 			if (modetype == MODE_CHANADMIN)
@@ -976,8 +970,6 @@ process_listmode:
 				tc = 'h';
 			if (modetype == MODE_VOICE)
 				tc = 'v';
-			/* Make sure membership->flags and member->flags is the same */
-			membership->flags = member->flags;
 			ircsnprintf(pvar[*pcount], MODEBUFLEN + 3,
 			            "%c%c%s",
 			            (what == MODE_ADD) ? '+' : '-', tc, target->name);
@@ -1031,6 +1023,7 @@ process_listmode:
 					if (!strcmp(channel->mode.key, param))
 					break;
 					strlcpy(channel->mode.key, param, sizeof(channel->mode.key));
+					channel_modes_changed(channel);
 				}
 				tmpstr = param;
 			}
@@ -1041,7 +1034,10 @@ process_listmode:
 				strlcpy(tmpbuf, channel->mode.key, sizeof(tmpbuf));
 				tmpstr = tmpbuf;
 				if (!bounce)
+				{
 					strcpy(channel->mode.key, "");
+					channel_modes_changed(channel);
+				}
 				RunHook2(HOOKTYPE_MODECHAR_DEL, channel, (int)modechar);
 			}
 			retval = 1;
@@ -1550,6 +1546,9 @@ void _set_mode(Channel *channel, Client *client, int parc, char *parv[], u_int *
 
 	make_mode_str(channel, oldm, oldem, oldl, *pcount, pvar, modebuf, parabuf, sizeof(modebuf), sizeof(parabuf), bounce);
 
+	if ((oldm ^ channel->mode.mode) & (MODE_SECRET|MODE_PRIVATE))
+		channel_visibility_version++;
+
 #ifndef NO_OPEROVERRIDE
 	if ((htrig == 1) && IsUser(client))
 	{
@@ -1834,7 +1833,7 @@ CMD_FUNC(_cmd_umode)
 				client->name, client->user->virthost);
 
 		/* Set the vhost */
-		safe_strdup(client->user->virthost, client->user->cloakedhost);
+		scache_set(client->user->virthost, client->user->cloakedhost);
 
 		/* Notify */
 		userhost_changed(client);
@@ -1849,7 +1848,7 @@ CMD_FUNC(_cmd_umode)
 		 * for ban-checking... free+recreate here because it could have
 		 * been a vhost for example. -- Syzop
 		 */
-		safe_strdup(client->user->virthost, client->user->cloakedhost);
+		scache_set(client->user->virthost, client->user->cloakedhost);
 
 		/* Notify */
 		userhost_changed(client);
@@ -129,7 +129,7 @@ CMD_FUNC(cmd_names)
 
 	spos = idx;		/* starting point in buffer for names! */
 
-	for (cm = channel->members; cm; cm = cm->next)
+	for (cm = channel->members; cm; cm = cm->next_member)
 	{
 		acptr = cm->client;
 		if (IsInvisible(acptr) && !member && !ValidatePermissionsForPath("channel:see:names:invisible",client,acptr,channel,NULL))
@@ -36,9 +36,9 @@ CMD_FUNC(cmd_nick);
 CMD_FUNC(cmd_nick_local);
 CMD_FUNC(cmd_nick_remote);
 CMD_FUNC(cmd_uid);
-int _register_user(Client *client, char *nick, char *username, char *umode, char *virthost, char *ip);
+int _register_user(Client *client, char *nick, const char *username, char *umode, char *virthost, char *ip);
 void nick_collision(Client *cptr, char *newnick, char *newid, Client *new, Client *existing, int type);
-int AllowClient(Client *client, char *username);
+int AllowClient(Client *client, const char *username);
 
 MOD_TEST()
 {
@@ -411,7 +411,7 @@ CMD_FUNC(cmd_nick_local)
 		   ** change to occur.
 		   ** Also set 'lastnick' to current time, if changed.
 		 */
-		for (mp = client->user->channel; mp; mp = mp->next)
+		for (mp = client->user->channel; mp; mp = mp->next_channel)
 		{
 			if (!is_skochanop(client, mp->channel) && is_banned(client, mp->channel, BANCHK_NICK, NULL, NULL))
 			{
@@ -668,14 +668,13 @@ nickkill2done:
 	/* Note that cloaked host aka parv[10] is unused */
 
 	client->user->server = find_or_add(client->srvptr->name);
-	strlcpy(client->user->realhost, hostname, sizeof(client->user->realhost));
+	scache_setn(client->user->realhost, hostname, HOSTLEN);
 	// FIXME: some validation would be nice ^
 
 	if (*sstamp != '*')
-		strlcpy(client->user->svid, sstamp, sizeof(client->user->svid));
+		scache_setn(client->user->svid, sstamp, SVIDLEN);
 
 	strlcpy(client->info, realname, sizeof(client->info));
-	strlcpy(client->user->username, username, USERLEN + 1);
 	register_user(client, client->name, username, umodes, virthost, ip);
 	if (IsDead(client))
 		return;
@@ -709,7 +708,7 @@ CMD_FUNC(cmd_nick)
  * @param ip		IP address string (can be NULL)
  * @returns 1 if successfully registered, 0 if not (client might be killed).
  */
-int _register_user(Client *client, char *nick, char *username, char *umode, char *virthost, char *ip)
+int _register_user(Client *client, char *nick, const char *username, char *umode, char *virthost, char *ip)
 {
 	ConfigItem_ban *bconf;
 	char *tmpstr;
@@ -737,10 +736,12 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 
 	if (MyConnect(client))
 	{
-	        char temp[USERLEN + 1];
+	        char temp[USERLEN + 1], newuser[USERLEN + 1];
 
 		if (!AllowClient(client, username))
 		{
+			if (IsAuthPending(client))
+				return 0; /* Password is being verified by an auth thread */
 			ircstats.is_ref++;
 			/* For safety, we have an extra kill here */
 			if (!IsDead(client))
@@ -762,7 +763,7 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 		}
 		if (client->local->sockhost[0])
 		{
-			strlcpy(user->realhost, client->local->sockhost, sizeof(client->local->sockhost)); /* SET HOSTNAME */
+			scache_set(user->realhost, client->local->sockhost); /* SET HOSTNAME */
 		} else {
 			sendto_realops("[HOSTNAME BUG] client->local->sockhost is empty for user %s (%s, %s)",
 				client->name, client->ip ? client->ip : "<null>", user->realhost);
@@ -788,17 +789,17 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 		strlcpy(temp, username, USERLEN + 1);
 
 		if (!IsUseIdent(client))
-			strlcpy(user->username, temp, USERLEN + 1);
+			strlcpy(newuser, temp, USERLEN + 1);
 		else if (IsIdentSuccess(client))
-			strlcpy(user->username, client->ident, USERLEN+1);
+			strlcpy(newuser, client->ident, USERLEN+1);
 		else
 		{
 			if (IDENT_CHECK == 0) {
-				strlcpy(user->username, temp, USERLEN+1);
+				strlcpy(newuser, temp, USERLEN+1);
 			}
 			else {
-				*user->username = '~';
-				strlcpy((user->username + 1), temp, sizeof(user->username)-1);
+				*newuser = '~';
+				strlcpy((newuser + 1), temp, sizeof(newuser)-1);
 				noident = 1;
 			}
 
@@ -819,7 +820,7 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 		 * problems so just ban them. (Using the nick could introduce
 		 * hostile chars) -- codemastr
 		 */
-		for (u2 = user->username + noident; *u2; u2++)
+		for (u2 = newuser + noident; *u2; u2++)
 		{
 			if (isallowed(*u2))
 				*u1++ = *u2;
@@ -837,7 +838,7 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 		}
 		*u1 = '\0';
 		*ubad = '\0';
-		if (strlen(stripuser) != strlen(user->username + noident))
+		if (strlen(stripuser) != strlen(newuser + noident))
 		{
 			if (stripuser[0] == '\0')
 			{
@@ -845,13 +846,14 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 				return 0;
 			}
 
-			strlcpy(olduser, user->username + noident, USERLEN+1);
-			strlcpy(user->username + 1, stripuser, sizeof(user->username)-1);
-			user->username[0] = '~';
-			user->username[USERLEN] = '\0';
+			strlcpy(olduser, newuser + noident, USERLEN+1);
+			strlcpy(newuser + 1, stripuser, sizeof(newuser)-1);
+			newuser[0] = '~';
+			newuser[USERLEN] = '\0';
 		}
 		else
 			u1 = NULL;
+		scache_set(user->username, newuser);
 
 		/* Check ban realname { } blocks */
 		if ((bconf = find_ban(NULL, client->info, CONF_BAN_REALNAME)))
@@ -896,15 +898,15 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 	}
 	else
 	{
-		strlcpy(user->username, username, USERLEN+1);
+		scache_setn(user->username, username, USERLEN);
 	}
 	SetUser(client);
 	irccounts.clients++;
 	if (client->srvptr && client->srvptr->serv)
 		client->srvptr->serv->users++;
 
-	make_cloakedhost(client, user->realhost, user->cloakedhost, sizeof(user->cloakedhost));
-	safe_strdup(user->virthost, user->cloakedhost);
+	update_cloakedhost(client);
+	scache_set(user->virthost, user->cloakedhost);
 
 	if (MyConnect(client))
 	{
@@ -958,10 +960,10 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 
 		if (IsSecureConnect(client))
 		{
-			if (client->local->ssl && !iConf.no_connect_tls_info)
+			if (tls_get_client_cipher(client) && !iConf.no_connect_tls_info)
 			{
 				sendnotice(client, "*** You are connected to %s with %s",
-					me.name, tls_get_cipher(client->local->ssl));
+					me.name, tls_get_client_cipher(client));
 			}
 		}
 
@@ -1046,14 +1048,14 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 				exit_client(client, NULL, "USER with invalid IP");
 				return 0;
 			}
-			safe_strdup(client->ip, ipstring);
+			set_client_ip(client, ipstring);
 		}
 
 		/* For remote clients we recalculate the cloakedhost here because
 		 * it may depend on the IP address (bug #5064).
 		 */
-		make_cloakedhost(client, user->realhost, user->cloakedhost, sizeof(user->cloakedhost));
-		safe_strdup(user->virthost, user->cloakedhost);
+		update_cloakedhost(client);
+		scache_set(user->virthost, user->cloakedhost);
 
 		/* Set the umodes */
 		tkllayer[0] = nick;
@@ -1066,7 +1068,7 @@ int _register_user(Client *client, char *nick, char *username, char *umode, char
 
 		/* Set the vhost */
 		if (virthost && *virthost != '*')
-			safe_strdup(client->user->virthost, virthost);
+			scache_set(client->user->virthost, virthost);
 	}
 
 	hash_check_watch(client, RPL_LOGON);	/* Uglier hack */
@@ -1266,7 +1268,7 @@ int exceeds_maxperip(Client *client, ConfigItem_allow *aconf)
 
 	list_for_each_entry(acptr, &lclient_list, lclient_node)
 	{
-		if (IsUser(acptr) && !strcmp(GetIP(acptr), GetIP(client)))
+		if (IsUser(acptr) && !memcmp(acptr->rawip, client->rawip, RAWIPLEN))
 		{
 			cnt++;
 			if (cnt > aconf->maxperip)
@@ -1281,12 +1283,12 @@ int exceeds_maxperip(Client *client, ConfigItem_allow *aconf)
  * @param username   Username, for some reason...
  * @returns 1 if OK, 0 if client is rejected (likely killed too)
  */
-int AllowClient(Client *client, char *username)
+int AllowClient(Client *client, const char *username)
 {
 	static char sockhost[HOSTLEN + 1];
 	struct hostent *hp = NULL;
 	int i;
-	ConfigItem_allow *aconf;
+	ConfigItem_allow *aconf, **candidates;
 	char *hname;
 	static char uhost[HOSTLEN + USERLEN + 3];
 	static char fullname[HOSTLEN + 1];
@@ -1311,7 +1313,9 @@ int AllowClient(Client *client, char *username)
 		return 0;
 	}
 
-	for (aconf = conf_allow; aconf; aconf = aconf->next)
+	/* Only walk the allow blocks that can possibly match, in config order */
+	candidates = find_allow_candidates(client, username, sockhost);
+	for (i = 0; (aconf = candidates[i]); i++)
 	{
 		if (!aconf->hostname || !aconf->ip)
 			goto attach;
@@ -1390,10 +1394,13 @@ int AllowClient(Client *client, char *username)
 			return 0;
 		}
 
-		if (aconf->auth && !Auth_Check(client, aconf->auth, client->local->passwd))
+		if (aconf->auth)
 		{
-			/* Always continue if password was wrong. */
-			continue;
+			int n = Auth_CheckAsync(client, aconf->auth, client->local->passwd, NULL, NULL, 0, NULL);
+			if (n == AUTH_CHECK_PENDING)
+				return 0; /* register_user() is called again once verified */
+			if (!n)
+				continue; /* Always continue if password was wrong. */
 		}
 
 		if (!((aconf->class->clients + 1) > aconf->class->maxclients))
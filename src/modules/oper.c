@@ -65,7 +65,7 @@ void set_oper_host(Client *client, char *host)
 	if ((p = strchr(uhost, '@')))
 	{
 	        *p++ = '\0';
-		strlcpy(client->user->username, uhost, sizeof(client->user->username));
+		scache_setn(client->user->username, uhost, USERLEN);
 		sendto_server(NULL, 0, 0, NULL, ":%s SETIDENT %s",
 		    client->id, client->user->username);
 	        host = p;
@@ -84,6 +84,7 @@ CMD_FUNC(cmd_oper)
 	ConfigItem_oper *operblock;
 	char *name, *password;
 	long old_umodes = client->umodes & ALL_UMODES;
+	int n;
 
 	if (!MyUser(client))
 		return;
@@ -161,7 +162,10 @@ CMD_FUNC(cmd_oper)
 		return;
 	}
 
-	if (!Auth_Check(client, operblock->auth, password))
+	n = Auth_CheckAsync(client, operblock->auth, password, "OPER", recv_mtags, parc, parv);
+	if (n == AUTH_CHECK_PENDING)
+		return; /* OPER is executed again once the password is verified */
+	if (!n)
 	{
 		sendnumeric(client, ERR_PASSWDMISMATCH);
 		if (FAILOPER_WARN)
@@ -255,7 +259,7 @@ CMD_FUNC(cmd_oper)
 	if (IsHidden(client) && !client->user->virthost)
 	{
 		/* +x has just been set by modes-on-oper and no vhost. cloak the oper! */
-		safe_strdup(client->user->virthost, client->user->cloakedhost);
+		scache_set(client->user->virthost, client->user->cloakedhost);
 	}
 
 	sendto_snomask_global(SNO_OPER,
@@ -276,6 +280,7 @@ CMD_FUNC(cmd_oper)
 	if (client->user->snomask)
 	{
 		client->user->snomask |= SNO_SNOTICE;
+		snomask_subscribed |= SNO_SNOTICE;
 		client->umodes |= UMODE_SERVNOTICE;
 	}
 	
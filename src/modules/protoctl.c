@@ -114,6 +114,16 @@ CMD_FUNC(cmd_protoctl)
 		{
 			SetMTAGS(client);
 		}
+		else if (!strcmp(name, "BQUIT"))
+		{
+			SetBQUIT(client);
+		}
+#ifdef ZIP_LINKS
+		else if (!strcmp(name, "ZIP") && value && (atoi(value) == ZIP_DICTIONARY_VERSION))
+		{
+			SetZIP(client);
+		}
+#endif
 		else if (!strcmp(name, "NICKCHARS") && value)
 		{
 			if (!IsServer(client) && !IsEAuth(client) && !IsHandshake(client))
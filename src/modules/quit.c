@@ -21,8 +21,10 @@
 #include "unrealircd.h"
 
 CMD_FUNC(cmd_quit);
+CMD_FUNC(cmd_bquit);
 
 #define MSG_QUIT        "QUIT"  /* QUIT */
+#define MSG_BQUIT       "BQUIT" /* Bulk QUIT (server to server) */
 
 ModuleHeader MOD_HEADER
   = {
@@ -37,6 +39,7 @@ ModuleHeader MOD_HEADER
 MOD_INIT()
 {
 	CommandAdd(modinfo->handle, MSG_QUIT, cmd_quit, 1, CMD_UNREGISTERED|CMD_USER|CMD_VIRUS);
+	CommandAdd(modinfo->handle, MSG_BQUIT, cmd_bquit, 2, CMD_SERVER);
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 	return MOD_SUCCESS;
 }
@@ -105,7 +108,7 @@ CMD_FUNC(cmd_quit)
 			{
 				channel = lp->channel;
 				newcomment = comment;
-				lp_next = lp->next;
+				lp_next = lp->next_channel;
 
 				for (tmphook = Hooks[HOOKTYPE_PRE_LOCAL_QUIT_CHAN]; tmphook; tmphook = tmphook->next)
 				{
@@ -161,3 +164,29 @@ CMD_FUNC(cmd_quit)
 		exit_client(client, recv_mtags, comment);
 	}
 }
+
+/*
+** cmd_bquit
+**	Many remote users quit with the same comment, eg: after
+**	a G-line was added. Only sent to servers with PROTOCTL BQUIT.
+**	parv[1] = comma separated list of UIDs
+**	parv[2] = comment
+*/
+CMD_FUNC(cmd_bquit)
+{
+	char *uid, *p = NULL;
+	Client *target;
+
+	if (parc < 3)
+		return;
+
+	exit_client_bulk_start();
+	for (uid = strtoken(&p, parv[1], ","); uid; uid = strtoken(&p, NULL, ","))
+	{
+		target = find_client(uid, NULL);
+		if (!target || !IsUser(target) || (target->direction != client->direction))
+			continue; /* race condition or user from a different direction */
+		exit_client(target, NULL, parv[2]);
+	}
+	exit_client_bulk_end();
+}
@@ -120,7 +120,7 @@ int reputation_pre_lconnect(Client *client);
 int reputation_config_test(ConfigFile *cf, ConfigEntry *ce, int type, int *errs);
 int reputation_config_run(ConfigFile *cf, ConfigEntry *ce, int type);
 int reputation_config_posttest(int *errs);
-static uint64_t hash_reputation_entry(char *ip);
+static uint64_t hash_reputation_entry(const char *ip);
 void add_reputation_entry(ReputationEntry *e);
 EVENT(delete_old_records);
 EVENT(add_scores);
@@ -456,7 +456,7 @@ write_fail:
 	return;
 }
 
-static uint64_t hash_reputation_entry(char *ip)
+static uint64_t hash_reputation_entry(const char *ip)
 {
 	return siphash(ip, siphashkey_reputation) % REPUTATION_HASH_TABLE_SIZE;
 }
@@ -468,7 +468,7 @@ void add_reputation_entry(ReputationEntry *e)
 	AddListItem(e, ReputationHashTable[hashv]);
 }
 
-ReputationEntry *find_reputation_entry(char *ip)
+ReputationEntry *find_reputation_entry(const char *ip)
 {
 	ReputationEntry *e;
 	int hashv = hash_reputation_entry(ip);
@@ -487,7 +487,7 @@ ReputationEntry *find_reputation_entry(char *ip)
  */
 int reputation_set_on_connect(Client *client)
 {
-	char *ip = client->ip;
+	const char *ip = client->ip;
 	ReputationEntry *e;
 
 	if (ip)
@@ -517,7 +517,7 @@ int reputation_pre_lconnect(Client *client)
 EVENT(add_scores)
 {
 	static int marker = 0;
-	char *ip;
+	const char *ip;
 	Client *client;
 	ReputationEntry *e;
 
@@ -671,7 +671,7 @@ int count_reputation_records(void)
 CMD_FUNC(reputation_user_cmd)
 {
 	ReputationEntry *e;
-	char *ip;
+	const char *ip;
 
 	if (!IsOper(client))
 	{
@@ -92,7 +92,7 @@ CMD_FUNC(cmd_svslogin)
 		if (target->user == NULL)
 			make_user(target);
 
-		strlcpy(target->user->svid, parv[3], sizeof(target->user->svid));
+		scache_setn(target->user->svid, parv[3], SVIDLEN);
 
 		if (MyConnect(target))
 		{
@@ -216,7 +216,7 @@ CMD_FUNC(cmd_authenticate)
 
 	if (agent_p == NULL)
 	{
-		char *addr = BadPtr(client->ip) ? "0" : client->ip;
+		const char *addr = BadPtr(client->ip) ? "0" : client->ip;
 		char *certfp = moddata_client_get(client, "certfp");
 
 		sendto_server(NULL, 0, 0, NULL, ":%s SASL %s %s H %s %s",
@@ -68,7 +68,6 @@ CMD_FUNC(cmd_sendumode)
 	Client *acptr;
 	char *message;
 	char *p;
-	int i;
 	long umode_s = 0;
 
 	message = (parc > 3) ? parv[3] : parv[2];
@@ -84,18 +83,7 @@ CMD_FUNC(cmd_sendumode)
 	sendto_server(client, 0, 0, mtags, ":%s SENDUMODE %s :%s", client->id, parv[1], message);
 
 	for (p = parv[1]; *p; p++)
-	{
-		for(i = 0; i <= Usermode_highest; i++)
-		{
-			if (!Usermode_Table[i].flag)
-				continue;
-			if (Usermode_Table[i].flag == *p)
-			{
-				umode_s |= Usermode_Table[i].mode;
-				break;
-			}
-		}
-	}
+		umode_s |= find_user_mode(*p);
 
 	list_for_each_entry(acptr, &oper_list, special_node)
 	{
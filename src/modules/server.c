@@ -26,6 +26,7 @@
 void send_channel_modes_sjoin3(Client *to, Channel *channel);
 CMD_FUNC(cmd_server);
 CMD_FUNC(cmd_sid);
+CMD_FUNC(cmd_zip);
 int _verify_link(Client *client, char *servername, ConfigItem_link **link_out);
 void _send_protoctl_servers(Client *client, int response);
 void _send_server_message(Client *client);
@@ -63,6 +64,7 @@ MOD_INIT()
 {
 	CommandAdd(modinfo->handle, MSG_SERVER, cmd_server, MAXPARA, CMD_UNREGISTERED|CMD_SERVER);
 	CommandAdd(modinfo->handle, "SID", cmd_sid, MAXPARA, CMD_SERVER);
+	CommandAdd(modinfo->handle, "ZIP", cmd_zip, MAXPARA, CMD_SERVER);
 
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 
@@ -444,7 +446,7 @@ skip_host_check:
 	if (IsSecure(client) && (iConf.outdated_tls_policy_server == POLICY_DENY) && outdated_tls_client(client))
 	{
 		sendto_one(client, NULL, "ERROR :Server is using an outdated SSL/TLS protocol or cipher (set::outdated-tls-policy::server is 'deny')");
-		sendto_ops_and_log("Rejected server %s using outdated %s. See https://www.unrealircd.org/docs/FAQ#server-outdated-tls", tls_get_cipher(client->local->ssl), client->name);
+		sendto_ops_and_log("Rejected server %s using outdated %s. See https://www.unrealircd.org/docs/FAQ#server-outdated-tls", tls_get_client_cipher(client), client->name);
 		exit_client(client, NULL, "Server using outdates SSL/TLS protocol or cipher (set::outdated-tls-policy::server is 'deny')");
 		return 0;
 	}
@@ -605,6 +607,25 @@ CMD_FUNC(cmd_server)
 	server_sync(client, aconf);
 }
 
+/** ZIP command: the server link starts compressing.
+ * Everything the other side sends after this line is compressed,
+ * see src/zip.c. This is only sent if both sides have
+ * link::options::compression and agreed on PROTOCTL ZIP=.
+ */
+CMD_FUNC(cmd_zip)
+{
+	if (!MyConnect(client))
+		return; /* Only valid directly from the link itself */
+
+	if (!(client->serv->conf->options & CONNECT_ZIP) || !SupportZIP(client))
+	{
+		exit_client(client, NULL, "Compression was not negotiated");
+		return;
+	}
+
+	zip_start_input(client);
+}
+
 /** Remote server command (SID).
  * parv[1] = server name
  * parv[2] = hop count (always >1)
@@ -954,7 +975,7 @@ int	server_sync(Client *cptr, ConfigItem_link *aconf)
 	{
 		sendto_umode_global(UMODE_OPER,
 			"(\2link\2) Secure link %s -> %s established (%s)",
-			me.name, inpath, tls_get_cipher(cptr->local->ssl));
+			me.name, inpath, tls_get_client_cipher(cptr));
 		tls_link_notification_verify(cptr, aconf);
 	}
 	else
@@ -974,7 +995,7 @@ int	server_sync(Client *cptr, ConfigItem_link *aconf)
 		if (IsSecure(cptr) && (iConf.outdated_tls_policy_server == POLICY_WARN) && outdated_tls_client(cptr))
 		{
 			sendto_realops("\002WARNING:\002 This link is using an outdated SSL/TLS protocol or cipher (%s).",
-			               tls_get_cipher(cptr->local->ssl));
+			               tls_get_client_cipher(cptr));
 		}
 	}
 	add_to_client_hash_table(cptr->name, cptr);
@@ -994,6 +1015,14 @@ int	server_sync(Client *cptr, ConfigItem_link *aconf)
 	cptr->local->class = cptr->serv->conf->class;
 	RunHook(HOOKTYPE_SERVER_CONNECT, cptr);
 
+	/* Both sides want compression: everything after this line is compressed */
+	if ((cptr->serv->conf->options & CONNECT_ZIP) && SupportZIP(cptr))
+	{
+		sendto_one(cptr, NULL, "ZIP");
+		if (!zip_start_output(cptr))
+			return 0;
+	}
+
 	/* Broadcast new server to the rest of the network */
 	sendto_server(cptr, 0, 0, NULL, ":%s SID %s 2 %s :%s",
 		    cptr->srvptr->id, cptr->name, cptr->id, cptr->info);
@@ -1177,7 +1206,7 @@ void send_channel_modes_sjoin3(Client *to, Channel *channel)
 	 *      -- Syzop
 	 */
 
-	for (lp = members; lp; lp = lp->next)
+	for (lp = members; lp; lp = lp->next_member)
 	{
 		p = tbuf;
 		if (lp->flags & MODE_CHANOP)
@@ -117,7 +117,7 @@ CMD_FUNC(cmd_setident)
 
 	userhost_save_current(client);
 
-	strlcpy(client->user->username, vident, sizeof(client->user->username));
+	scache_setn(client->user->username, vident, USERLEN);
 
 	sendto_server(client, 0, 0, NULL, ":%s SETIDENT %s", client->id, parv[1]);
 
@@ -217,7 +217,6 @@ CMD_FUNC(cmd_sjoin)
 	if (removeours)
 	{
 		Member *lp;
-		Membership *lp2;
 
 		modebuf[0] = '-';
 
@@ -245,37 +244,34 @@ CMD_FUNC(cmd_sjoin)
 		{
 			Ban *ban = channel->banlist;
 			Addit('b', ban->banstr);
+			RunHook3(HOOKTYPE_LISTMODE_DEL, channel, &channel->banlist, ban);
 			channel->banlist = ban->next;
 			safe_free(ban->banstr);
-			safe_free(ban->who);
+			scache_free(ban->who);
 			free_ban(ban);
 		}
 		while(channel->exlist)
 		{
 			Ban *ban = channel->exlist;
 			Addit('e', ban->banstr);
+			RunHook3(HOOKTYPE_LISTMODE_DEL, channel, &channel->exlist, ban);
 			channel->exlist = ban->next;
 			safe_free(ban->banstr);
-			safe_free(ban->who);
+			scache_free(ban->who);
 			free_ban(ban);
 		}
 		while(channel->invexlist)
 		{
 			Ban *ban = channel->invexlist;
 			Addit('I', ban->banstr);
+			RunHook3(HOOKTYPE_LISTMODE_DEL, channel, &channel->invexlist, ban);
 			channel->invexlist = ban->next;
 			safe_free(ban->banstr);
-			safe_free(ban->who);
+			scache_free(ban->who);
 			free_ban(ban);
 		}
-		for (lp = channel->members; lp; lp = lp->next)
+		for (lp = channel->members; lp; lp = lp->next_member)
 		{
-			lp2 = find_membership_link(lp->client->user->channel, channel);
-			if (!lp2)
-			{
-				sendto_realops("Oops! channel->members && !find_membership_link");
-				continue;
-			}
 			if (lp->flags & MODE_CHANOWNER)
 			{
 				lp->flags &= ~MODE_CHANOWNER;
@@ -301,8 +297,7 @@ CMD_FUNC(cmd_sjoin)
 				lp->flags &= ~MODE_VOICE;
 				Addit('v', lp->client->name);
 			}
-			/* Those should always match anyways  */
-			lp2->flags = lp->flags;
+			membership_changed(lp->client);
 		}
 		if (b > 1)
 		{
@@ -823,6 +818,7 @@ getnick:
 			if (strcmp(oldmode.key, channel->mode.key) > 0)			
 			{
 				strlcpy(channel->mode.key, oldmode.key, sizeof channel->mode.key);
+				channel_modes_changed(channel);
 			}
 			else
 			{
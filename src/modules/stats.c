@@ -35,9 +35,50 @@ ModuleHeader MOD_HEADER
 	"unrealircd-5",
     };
 
+/** A /STATS request that is sent in parts, as the sendq of the client drains */
+typedef struct StatsStream StatsStream;
+struct StatsStream {
+	char flag;		/**< Stats flag, for RPL_ENDOFSTATS */
+	int (*func)(Client *client, StatsStream *stream, int max); /**< Sends the next part (max lines), returns 1 if there is more */
+	char *para;		/**< Search terms (or NULL) */
+	int types[2];		/**< TKL types to send (stats_stream_tkl) */
+	int part;		/**< Current index in types[] */
+	TKLStatsCursor cursor;	/**< Position in the TKL list */
+	void *lr_context;	/**< Labeled response context */
+};
+
+/* Global variables */
+ModDataInfo *stats_md = NULL;
+
+/* Macros */
+#define STATSSTREAM(x)		((StatsStream *)moddata_local_client(x, stats_md).ptr)
+#define free_stats_stream(client)	stats_md_free(&moddata_local_client(client, stats_md))
+
+#define DoStatsStream(x)	(MyUser((x)) && STATSSTREAM((x)))
+#define IsSendable(x)		(DBufLength(&x->local->sendQ) < 2048)
+
+/* Forward declarations */
+static void stats_stream_cancel(Client *client);
+EVENT(send_queued_stats_data);
+void stats_md_free(ModData *md);
+
 MOD_INIT()
 {
+	ModDataInfo mreq;
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "stats";
+	mreq.type = MODDATATYPE_LOCAL_CLIENT;
+	mreq.free = stats_md_free;
+	stats_md = ModDataAdd(modinfo->handle, mreq);
+	if (!stats_md)
+	{
+		config_error("could not register stats moddata");
+		return MOD_FAILED;
+	}
+
 	CommandAdd(modinfo->handle, MSG_STATS, cmd_stats, 3, CMD_USER);
+	EventAdd(modinfo->handle, "send_queued_stats_data", send_queued_stats_data, NULL, 100, 0);
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 	return MOD_SUCCESS;
 }
@@ -86,6 +127,9 @@ int stats_class(Client *, char *);
 int stats_officialchannels(Client *, char *);
 int stats_spamfilter(Client *, char *);
 int stats_fdtable(Client *, char *);
+int stats_ziplinks(Client *, char *);
+int stats_memory(Client *, char *);
+int stats_latency(Client *, char *);
 
 #define SERVER_AS_PARA 0x1
 #define FLAGS_AS_PARA 0x2
@@ -106,7 +150,7 @@ struct statstab StatsTable[] = {
 	{ 'G', "gline",		stats_gline,		FLAGS_AS_PARA	},
 	{ 'H', "link",	 	stats_links,		0 		},
 	{ 'I', "allow",		stats_allow,		0 		},
-	{ 'K', "kline",		stats_kline,		0 		},
+	{ 'K', "kline",		stats_kline,		FLAGS_AS_PARA	},
 	{ 'L', "linkinfoall",	stats_linkinfoall,	SERVER_AS_PARA	},
 	{ 'M', "command",	stats_command,		0 		},
 	{ 'O', "oper",		stats_oper,		0 		},
@@ -119,18 +163,20 @@ struct statstab StatsTable[] = {
 	{ 'W', "fdtable",       stats_fdtable,          0               },
 	{ 'X', "notlink",	stats_notlink,		0 		},
 	{ 'Y', "class",		stats_class,		0 		},
+	{ 'Z', "ziplinks",	stats_ziplinks,		0 		},
 	{ 'c', "link", 		stats_links,		0 		},
 	{ 'd', "denylinkauto",	stats_denylinkauto,	0 		},
-	{ 'e', "except",	stats_except,		0 		},
+	{ 'e', "except",	stats_except,		FLAGS_AS_PARA	},
 	{ 'f', "spamfilter",	stats_spamfilter,	FLAGS_AS_PARA	},
 	{ 'g', "gline",		stats_gline,		FLAGS_AS_PARA	},
 	{ 'h', "link", 		stats_links,		0 		},
 	{ 'j', "officialchans", stats_officialchannels, 0 		},
-	{ 'k', "kline",		stats_kline,		0 		},
+	{ 'k', "kline",		stats_kline,		FLAGS_AS_PARA	},
 	{ 'l', "linkinfo",	stats_linkinfo,		SERVER_AS_PARA 	},
 	{ 'm', "command",	stats_command,		0 		},
 	{ 'n', "banrealname",	stats_banrealname,	0 		},
 	{ 'o', "oper",		stats_oper,		0 		},
+	{ 'p', "latency",	stats_latency,		0 		},
 	{ 'q', "bannick",	stats_bannick,		FLAGS_AS_PARA	},
 	{ 'r', "chanrestrict",	stats_chanrestrict,	0 		},
 	{ 's', "shun",		stats_shun,		FLAGS_AS_PARA	},
@@ -139,6 +185,7 @@ struct statstab StatsTable[] = {
 	{ 'v', "denyver",	stats_denyver,		0 		},
 	{ 'x', "notlink",	stats_notlink,		0 		},
 	{ 'y', "class",		stats_class,		0 		},
+	{ 'z', "memory",	stats_memory,		0 		},
 	{ 0, 	NULL, 		NULL, 			0		}
 };
 
@@ -195,6 +242,7 @@ static inline void stats_help(Client *client)
 	sendnumeric(client, RPL_STATSHELP, "d - denylinkauto - Send the deny link (auto) block list");
 	sendnumeric(client, RPL_STATSHELP, "D - denylinkall - Send the deny link (all) block list");
 	sendnumeric(client, RPL_STATSHELP, "e - except - Send the ban exception list (ELINEs and in config))");
+	sendnumeric(client, RPL_STATSHELP, "  Extended flags: see G, they also work for e, K, q, Q and s");
 	sendnumeric(client, RPL_STATSHELP, "f - spamfilter - Send the spamfilter list");
 	sendnumeric(client, RPL_STATSHELP, "F - denydcc - Send the deny dcc and allow dcc block lists");
 	sendnumeric(client, RPL_STATSHELP, "G - gline - Send the gline and gzline list");
@@ -211,6 +259,7 @@ static inline void stats_help(Client *client)
 	sendnumeric(client, RPL_STATSHELP, "n - banrealname - Send the ban realname block list");
 	sendnumeric(client, RPL_STATSHELP, "O - oper - Send the oper block list");
 	sendnumeric(client, RPL_STATSHELP, "P - port - Send information about ports");
+	sendnumeric(client, RPL_STATSHELP, "p - latency - Send message latency histograms (set::latency-sample-rate)");
 	sendnumeric(client, RPL_STATSHELP, "q - bannick - Send the ban nick block list");
 	sendnumeric(client, RPL_STATSHELP, "Q - sqline - Send the global qline list");
 	sendnumeric(client, RPL_STATSHELP, "r - chanrestrict - Send the channel deny/allow block list");
@@ -229,6 +278,8 @@ static inline void stats_help(Client *client)
 	sendnumeric(client, RPL_STATSHELP, "W - fdtable - Send the FD table listing");
 	sendnumeric(client, RPL_STATSHELP, "X - notlink - Send the list of servers that are not current linked");
 	sendnumeric(client, RPL_STATSHELP, "Y - class - Send the class block list");
+	sendnumeric(client, RPL_STATSHELP, "z - memory - Send memory usage per subsystem and module, and the set::memory-budget status");
+	sendnumeric(client, RPL_STATSHELP, "Z - ziplinks - Send compression statistics of server links");
 }
 
 static inline int allow_user_stats_short(char c)
@@ -303,6 +354,10 @@ CMD_FUNC(cmd_stats)
 		if (hunt_server(client, recv_mtags, ":%s STATS %s %s %s", 2, parc, parv) != HUNTED_ISME)
 			return;
 	}
+	/* If a /STATS is still being sent then a new one will cancel it */
+	if (DoStatsStream(client))
+		stats_stream_cancel(client);
+
 	if (parc < 2 || !*parv[1])
 	{
 		stats_help(client);
@@ -379,7 +434,15 @@ CMD_FUNC(cmd_stats)
 	/* Modules can append data: */
 	RunHook2(HOOKTYPE_STATS, client, flags);
 
-	sendnumeric(client, RPL_ENDOFSTATS, stat->flag);
+	if (DoStatsStream(client))
+	{
+		/* The rest will be sent by send_queued_stats_data() */
+		STATSSTREAM(client)->flag = stat->flag;
+		STATSSTREAM(client)->lr_context = labeled_response_save_context();
+		labeled_response_inhibit_end = 1;
+	} else {
+		sendnumeric(client, RPL_ENDOFSTATS, stat->flag);
+	}
 
 	if (!IsULine(client))
 		sendto_snomask(SNO_EYES, "Stats \'%c\' requested by %s (%s@%s)",
@@ -460,10 +523,110 @@ int stats_denylinkall(Client *client, char *para)
 	return 0;
 }
 
+/** Number of lines that we send to 'client' in one go */
+static int stats_stream_lines(Client *client)
+{
+	return (get_sendq(client) / 768) + 1; /* same as in /LIST */
+}
+
+/** Send the first part of a large /STATS listing.
+ * For local users only what fits in the sendq is sent right away,
+ * the rest is sent by send_queued_stats_data() later.
+ * Remote users get everything at once (it's the server link that buffers).
+ * @param client	The client
+ * @param func		The function that sends the next part (see StatsStream)
+ * @param para		The search terms (or NULL)
+ * @param type1		First TKL type, for stats_stream_tkl()
+ * @param type2		Second TKL type (or 0)
+ */
+static void stats_stream_start(Client *client, int (*func)(Client *, StatsStream *, int), char *para, int type1, int type2)
+{
+	StatsStream *stream = safe_alloc(sizeof(StatsStream));
+
+	stream->func = func;
+	safe_strdup(stream->para, para);
+	stream->types[0] = type1;
+	stream->types[1] = type2;
+
+	if (!MyUser(client))
+	{
+		stream->func(client, stream, 0);
+		safe_free(stream->para);
+		safe_free(stream);
+		return;
+	}
+
+	moddata_local_client(client, stats_md).ptr = stream;
+	if (!stream->func(client, stream, stats_stream_lines(client)))
+		free_stats_stream(client); /* Everything fit in one go */
+}
+
+/** Stop a /STATS that is still being sent, and end its labeled response */
+static void stats_stream_cancel(Client *client)
+{
+	StatsStream *stream = STATSSTREAM(client);
+	void *current = labeled_response_save_context();
+
+	labeled_response_set_context(stream->lr_context);
+	sendnumeric(client, RPL_ENDOFSTATS, stream->flag);
+	labeled_response_force_end();
+	labeled_response_set_context(current);
+	safe_free(current);
+	free_stats_stream(client);
+}
+
+/** Send the next part of a TKL listing */
+static int stats_stream_tkl(Client *client, StatsStream *stream, int max)
+{
+	for (; (stream->part < 2) && stream->types[stream->part]; stream->part++)
+	{
+		if (tkl_stats_ex(client, stream->types[stream->part], stream->para, &stream->cursor, max))
+			return 1;
+		memset(&stream->cursor, 0, sizeof(stream->cursor));
+	}
+	return 0;
+}
+
+EVENT(send_queued_stats_data)
+{
+	Client *client, *saved;
+	StatsStream *stream;
+
+	list_for_each_entry_safe(client, saved, &lclient_list, lclient_node)
+	{
+		if (DoStatsStream(client) && IsSendable(client))
+		{
+			stream = STATSSTREAM(client);
+			labeled_response_set_context(stream->lr_context);
+			if (!stream->func(client, stream, stats_stream_lines(client)))
+			{
+				/* We are done! */
+				sendnumeric(client, RPL_ENDOFSTATS, stream->flag);
+				free_stats_stream(client);
+				labeled_response_force_end();
+			}
+			labeled_response_set_context(NULL);
+		}
+	}
+}
+
+/** Called on client exit: free the /STATS that was in progress */
+void stats_md_free(ModData *md)
+{
+	StatsStream *stream = (StatsStream *)md->ptr;
+
+	if (!stream)
+		return;
+
+	tkl_stats_cursor_end(&stream->cursor);
+	safe_free(stream->para);
+	safe_free(stream->lr_context);
+	safe_free(md->ptr);
+}
+
 int stats_gline(Client *client, char *para)
 {
-	tkl_stats(client, TKL_GLOBAL|TKL_KILL, para);
-	tkl_stats(client, TKL_GLOBAL|TKL_ZAP, para);
+	stats_stream_start(client, stats_stream_tkl, para, TKL_GLOBAL|TKL_KILL, TKL_GLOBAL|TKL_ZAP);
 	return 0;
 }
 
@@ -476,8 +639,7 @@ int stats_spamfilter(Client *client, char *para)
 
 int stats_except(Client *client, char *para)
 {
-	tkl_stats(client, TKL_EXCEPTION, para);
-	tkl_stats(client, TKL_EXCEPTION|TKL_GLOBAL, para);
+	stats_stream_start(client, stats_stream_tkl, para, TKL_EXCEPTION, TKL_EXCEPTION|TKL_GLOBAL);
 	return 0;
 }
 
@@ -533,9 +695,10 @@ static char *stats_port_helper(ConfigItem_listen *listener)
 {
 	static char buf[256];
 
-	ircsnprintf(buf, sizeof(buf), "%s%s%s%s",
+	ircsnprintf(buf, sizeof(buf), "%s%s%s%s%s",
 	    (listener->options & LISTENER_CLIENTSONLY)? "clientsonly ": "",
 	    (listener->options & LISTENER_SERVERSONLY)? "serversonly ": "",
+	    (listener->options & LISTENER_PROXY)?       "proxy ": "",
 	    (listener->options & LISTENER_TLS)?         "tls ": "",
 	    !(listener->options & LISTENER_TLS)?        "plaintext ": "");
 	return buf;
@@ -551,6 +714,15 @@ int stats_port(Client *client, char *para)
 			continue;
 		if ((listener->options & LISTENER_SERVERSONLY) && !ValidatePermissionsForPath("server:info:stats",client,NULL,NULL,NULL))
 			continue;
+		if (listener->options & LISTENER_UNIX)
+		{
+			sendnotice(client, "*** Listener on UNIX socket %s: has %i client(s), options: %s %s",
+			           listener->ip,
+			           listener->clients,
+			           stats_port_helper(listener),
+			           listener->flag.temporary ? "[TEMPORARY]" : "");
+			continue;
+		}
 		sendnotice(client, "*** Listener on %s:%i (%s): has %i client(s), options: %s %s",
 		           listener->ip,
 		           listener->port,
@@ -564,8 +736,7 @@ int stats_port(Client *client, char *para)
 
 int stats_bannick(Client *client, char *para)
 {
-	tkl_stats(client, TKL_NAME, para);
-	tkl_stats(client, TKL_GLOBAL|TKL_NAME, para);
+	stats_stream_start(client, stats_stream_tkl, para, TKL_NAME, TKL_GLOBAL|TKL_NAME);
 	return 0;
 }
 
@@ -630,6 +801,7 @@ int stats_traffic(Client *client, char *para)
 	sendnumericfmt(client, RPL_STATSDEBUG, "numerics seen %u mode fakes %u", sp->is_num, sp->is_fake);
 	sendnumericfmt(client, RPL_STATSDEBUG, "auth successes %u fails %u", sp->is_asuc, sp->is_abad);
 	sendnumericfmt(client, RPL_STATSDEBUG, "local connections %u udp packets %u", sp->is_loc, sp->is_udp);
+	sendnumericfmt(client, RPL_STATSDEBUG, "lossy drops %u", sp->is_lossy);
 	sendnumericfmt(client, RPL_STATSDEBUG, "Client Server");
 	sendnumericfmt(client, RPL_STATSDEBUG, "connected %u %u", sp->is_cl, sp->is_sv);
 	sendnumericfmt(client, RPL_STATSDEBUG, "bytes sent %ld.%huK %ld.%huK",
@@ -661,6 +833,29 @@ int stats_fdtable(Client *client, char *para)
 	return 0;
 }
 
+int stats_ziplinks(Client *client, char *para)
+{
+	Client *acptr;
+	ZipStats *zs;
+
+	list_for_each_entry(acptr, &server_list, special_node)
+	{
+		if (!(zs = zip_get_stats(acptr)))
+			continue;
+
+		sendtxtnumeric(client, "%s: out %llu -> %llu bytes (%.1f%%, %lld ms cpu), in %llu -> %llu bytes (%.1f%%, %lld ms cpu)",
+			acptr->name,
+			zs->out_bytes, zs->out_zipped,
+			zs->out_bytes ? (double)zs->out_zipped * 100.0 / zs->out_bytes : 100.0,
+			zs->out_usec / 1000,
+			zs->in_zipped, zs->in_bytes,
+			zs->in_bytes ? (double)zs->in_zipped * 100.0 / zs->in_bytes : 100.0,
+			zs->in_usec / 1000);
+	}
+
+	return 0;
+}
+
 int stats_uline(Client *client, char *para)
 {
 	ConfigItem_ulines *ulines;
@@ -699,8 +894,7 @@ int stats_denylinkauto(Client *client, char *para)
 
 int stats_kline(Client *client, char *para)
 {
-	tkl_stats(client, TKL_KILL, NULL);
-	tkl_stats(client, TKL_ZAP, NULL);
+	stats_stream_start(client, stats_stream_tkl, para, TKL_KILL, TKL_ZAP);
 	return 0;
 }
 
@@ -720,7 +914,7 @@ int stats_banrealname(Client *client, char *para)
 
 int stats_sqline(Client *client, char *para)
 {
-	tkl_stats(client, TKL_NAME|TKL_GLOBAL, para);
+	stats_stream_start(client, stats_stream_tkl, para, TKL_NAME|TKL_GLOBAL, 0);
 	return 0;
 }
 
@@ -741,7 +935,7 @@ int stats_chanrestrict(Client *client, char *para)
 
 int stats_shun(Client *client, char *para)
 {
-	tkl_stats(client, TKL_GLOBAL|TKL_SHUN, para);
+	stats_stream_start(client, stats_stream_tkl, para, TKL_GLOBAL|TKL_SHUN, 0);
 	return 0;
 }
 
@@ -1074,3 +1268,81 @@ int stats_linkinfoint(Client *client, char *para, int all)
 #endif
 	return 0;
 }
+
+int stats_memory(Client *client, char *para)
+{
+	Module *mod;
+	ModuleMemory *mm;
+	long long moddata, moddata_total = 0;
+	int i, count;
+	u_long mem;
+
+	for (i = 0; i < MEMORY_ACCOUNTS; i++)
+	{
+		sendtxtnumeric(client, "%s: %lld bytes in %ld objects",
+			memory_account_name(i), memory_accounted[i], memory_objects[i]);
+	}
+
+	count = 0;
+	mem = 0;
+	count_whowas_memory(&count, &mem);
+	sendtxtnumeric(client, "whowas: %lu bytes in %d objects", mem, count);
+
+	count = 0;
+	mem = 0;
+	count_watch_memory(&count, &mem);
+	sendtxtnumeric(client, "watch: %lu bytes in %d objects", mem, count);
+
+	for (mod = Modules; mod; mod = mod->next)
+	{
+		mm = module_memory_find(mod->header->name);
+		moddata = moddata_memory_usage(mod);
+		moddata_total += moddata;
+		if (!mm && !moddata)
+			continue;
+		sendtxtnumeric(client, "module %s: %lld bytes in %ld objects, moddata %lld bytes (estimated)",
+			mod->header->name, mm ? mm->bytes : 0, mm ? mm->objects : 0, moddata);
+	}
+	sendtxtnumeric(client, "moddata: %lld bytes (estimated)", moddata_total);
+
+	sendtxtnumeric(client, "total: %lld bytes", memory_budget_usage());
+
+	if (MEMORY_BUDGET > 0)
+	{
+		sendtxtnumeric(client, "memory-budget: %lld bytes, %d%% in use, pressure level '%s'",
+			MEMORY_BUDGET, memory_budget_percentage(), memory_pressure_name(memory_pressure));
+	} else {
+		sendtxtnumeric(client, "memory-budget: not set");
+	}
+
+	return 0;
+}
+
+int stats_latency(Client *client, char *para)
+{
+	LatencyHistogram *h;
+	int i;
+
+	if (!LATENCY_SAMPLE_RATE)
+	{
+		sendtxtnumeric(client, "Latency tracing is disabled (set::latency-sample-rate)");
+		return 0;
+	}
+
+	sendtxtnumeric(client, "Sampling 1 in %d lines, %ld traced, %ld abandoned",
+		LATENCY_SAMPLE_RATE, latency_traces, latency_traces_abandoned);
+
+	/* The stages in order, with the total last */
+	for (i = 1; i <= LATENCY_STAGES; i++)
+	{
+		h = &latency_histogram[i % LATENCY_STAGES];
+		sendtxtnumeric(client, "%s: n=%ld avg=%lldus max=%lldus "
+		                       "<10us=%ld <100us=%ld <1ms=%ld <10ms=%ld <100ms=%ld <1s=%ld >=1s=%ld",
+			latency_stage_name(i % LATENCY_STAGES), h->count,
+			h->count ? h->usec / h->count : 0, h->max_usec,
+			h->buckets[0], h->buckets[1], h->buckets[2], h->buckets[3],
+			h->buckets[4], h->buckets[5], h->buckets[6]);
+	}
+
+	return 0;
+}
@@ -235,16 +235,13 @@ void channel_svsmode(Client *client, int parc, char *parv[])
 					continue;
 				}
 				channel_flags = char_to_channelflag(*m);
-				for (cm = channel->members; cm; cm = cm->next)
+				for (cm = channel->members; cm; cm = cm->next_member)
 				{
 					if (cm->flags & channel_flags)
 					{
-						Membership *mb;
-						mb = find_membership_link(cm->client->user->channel, channel);
 						add_send_mode_param(channel, client, '-', *m, cm->client->name);
 						cm->flags &= ~channel_flags;
-						if (mb)
-							mb->flags = cm->flags;
+						membership_changed(cm->client);
 					}
 				}
 				break;
@@ -406,7 +403,7 @@ void do_svsmode(Client *client, MessageTag *recv_mtags, int parc, char *parv[],
 			case 'd':
 				if (parv[3])
 				{
-					strlcpy(target->user->svid, parv[3], sizeof(target->user->svid));
+					scache_setn(target->user->svid, parv[3], SVIDLEN);
 					user_account_login(recv_mtags, target);
 				}
 				else
@@ -422,7 +419,7 @@ void do_svsmode(Client *client, MessageTag *recv_mtags, int parc, char *parv[],
 					if (target->user->virthost)
 					{
 						/* Removing mode +x and virthost set... recalculate host then (but don't activate it!) */
-						safe_strdup(target->user->virthost, target->user->cloakedhost);
+						scache_set(target->user->virthost, target->user->cloakedhost);
 					}
 				} else
 				{
@@ -432,7 +429,7 @@ void do_svsmode(Client *client, MessageTag *recv_mtags, int parc, char *parv[],
 						/* Hmm... +x but no virthost set, that's bad... use cloakedhost.
 						 * Not sure if this could ever happen, but just in case... -- Syzop
 						 */
-						safe_strdup(target->user->virthost, target->user->cloakedhost);
+						scache_set(target->user->virthost, target->user->cloakedhost);
 					}
 					/* Announce the new host to VHP servers if we're setting the virthost to the cloakedhost.
 					 * In other cases, we can assume that the host has been broadcasted already (after all,
@@ -461,7 +458,7 @@ void do_svsmode(Client *client, MessageTag *recv_mtags, int parc, char *parv[],
 					if (target->user->virthost && *target->user->cloakedhost && strcasecmp(target->user->cloakedhost, GetHost(target)))
 					{
 						/* Make the change effective: */
-						safe_strdup(target->user->virthost, target->user->cloakedhost);
+						scache_set(target->user->virthost, target->user->cloakedhost);
 						/* And broadcast the change to VHP servers */
 						if (MyUser(target))
 							sendto_server(NULL, PROTO_VHP, 0, NULL, ":%s SETHOST :%s", target->id,
@@ -108,7 +108,10 @@ void do_svssno(Client *client, int parc, char *parv[], int show_change)
 		 	 			if (*p == Snomask_Table[i].flag)
 				 	 	{
 				 	 		if (what == MODE_ADD)
+				 	 		{
 					 	 		target->user->snomask |= Snomask_Table[i].mode;
+					 	 		snomask_subscribed |= Snomask_Table[i].mode;
+				 	 		}
 			 			 	else
 			 	 				target->user->snomask &= ~Snomask_Table[i].mode;
 				 	 	}
@@ -77,6 +77,7 @@ int _find_spamfilter_user(Client *client, int flags);
 TKL *_find_qline(Client *client, char *nick, int *ishold);
 TKL *_find_tkline_match_zap(Client *client);
 void _tkl_stats(Client *client, int type, char *para);
+int _tkl_stats_ex(Client *client, int type, char *para, TKLStatsCursor *cursor, int max);
 void _tkl_sync(Client *client);
 CMD_FUNC(_cmd_tkl);
 int _place_host_ban(Client *client, BanAction action, char *reason, long duration);
@@ -86,7 +87,7 @@ void _spamfilter_build_user_string(char *buf, char *nick, Client *client);
 int _match_user(char *rmask, Client *client, int options);
 int _match_user_extended_server_ban(char *banstr, Client *client);
 void ban_target_to_tkl_layer(BanTarget ban_target, BanAction action, Client *client, char **tkl_username, char **tkl_hostname);
-int _tkl_ip_hash(char *ip);
+int _tkl_ip_hash(const char *ip);
 int _tkl_ip_hash_type(int type);
 TKL *_find_tkl_serverban(int type, char *usermask, char *hostmask, int softban);
 TKL *_find_tkl_banexception(int type, char *usermask, char *hostmask, int softban);
@@ -168,6 +169,7 @@ MOD_TEST()
 	EfunctionAddPVoid(modinfo->handle, EFUNC_FIND_TKL_NAMEBAN, TO_PVOIDFUNC(_find_tkl_nameban));
 	EfunctionAddPVoid(modinfo->handle, EFUNC_FIND_TKL_SPAMFILTER, TO_PVOIDFUNC(_find_tkl_spamfilter));
 	EfunctionAddVoid(modinfo->handle, EFUNC_TKL_STATS, _tkl_stats);
+	EfunctionAdd(modinfo->handle, EFUNC_TKL_STATS_EX, _tkl_stats_ex);
 	EfunctionAddVoid(modinfo->handle, EFUNC_TKL_SYNCH, _tkl_sync);
 	EfunctionAddVoid(modinfo->handle, EFUNC_CMD_TKL, _cmd_tkl);
 	EfunctionAdd(modinfo->handle, EFUNC_PLACE_HOST_BAN, _place_host_ban);
@@ -2161,41 +2163,56 @@ int tkl_banexception_matches_type(TKL *except, int bantype)
 	return 0;
 }
 
-/** Used for finding out which element of the tkl_ip hash table is used (primary element) */
-int _tkl_ip_hash(char *ip)
+/** Used for finding out which element of the tkl_ip hash table is used,
+ * for an IP address in binary form (see ip_to_raw()).
+ */
+static int tkl_ip_hash_raw(unsigned char *raw)
 {
-	char ipbuf[64], *p;
-
-	for (p = ip; *p; p++)
-	{
-		if ((*p == '?') || (*p == '*') || (*p == '/'))
-			return -1; /* not an entry suitable for the ip hash table */
-	}
-	if (inet_pton(AF_INET, ip, &ipbuf) == 1)
+	if (raw_ip_is_ipv4(raw))
 	{
 		/* IPv4 */
-		unsigned int v = (ipbuf[0] << 24) +
-		                 (ipbuf[1] << 16) +
-		                 (ipbuf[2] << 8)  +
-		                 ipbuf[3];
+		unsigned int v = (raw[12] << 24) +
+		                 (raw[13] << 16) +
+		                 (raw[14] << 8)  +
+		                 raw[15];
 		return v % TKLIPHASHLEN2;
 	} else
-	if (inet_pton(AF_INET6, ip, &ipbuf) == 1)
 	{
 		/* IPv6 (only upper 64 bits) */
-		unsigned int v1 = (ipbuf[0] << 24) +
-		                 (ipbuf[1] << 16) +
-		                 (ipbuf[2] << 8)  +
-		                 ipbuf[3];
-		unsigned int v2 = (ipbuf[4] << 24) +
-		                 (ipbuf[5] << 16) +
-		                 (ipbuf[6] << 8)  +
-		                 ipbuf[7];
+		unsigned int v1 = (raw[0] << 24) +
+		                 (raw[1] << 16) +
+		                 (raw[2] << 8)  +
+		                 raw[3];
+		unsigned int v2 = (raw[4] << 24) +
+		                 (raw[5] << 16) +
+		                 (raw[6] << 8)  +
+		                 raw[7];
 		return (v1 ^ v2) % TKLIPHASHLEN2;
-	} else
+	}
+}
+
+/** Used for finding out which element of the tkl_ip hash table is used (primary element) */
+int _tkl_ip_hash(const char *ip)
+{
+	unsigned char raw[RAWIPLEN];
+	const char *p;
+
+	for (p = ip; *p; p++)
 	{
-		return -1;
+		if ((*p == '?') || (*p == '*') || (*p == '/'))
+			return -1; /* not an entry suitable for the ip hash table */
 	}
+	if (!ip_to_raw(ip, raw))
+		return -1;
+	return tkl_ip_hash_raw(raw);
+}
+
+/** Same as tkl_ip_hash() but for a client, this uses client->rawip */
+static int tkl_ip_hash_client(Client *client)
+{
+	if (!client->ip)
+		return tkl_ip_hash(GetIP(client));
+	return tkl_ip_hash_raw(client->rawip);
 }
 
 // TODO: consider efunc
@@ -2249,6 +2266,25 @@ TKL *tkl_find_head(char type, char *hostmask, TKL *def)
 	return def;
 }
 
+/** Memory used by a TKL entry, for the memory budget (see memory_account()).
+ * Only fields that never change after the entry is added are counted,
+ * so the same size is subtracted again in tkl_del_line().
+ */
+static long tkl_memory_size(TKL *tkl)
+{
+	long size = sizeof(TKL);
+
+	if (TKLIsServerBan(tkl))
+		size += sizeof(ServerBan) + strlen(tkl->ptr.serverban->usermask) + strlen(tkl->ptr.serverban->hostmask);
+	else if (TKLIsBanException(tkl))
+		size += sizeof(BanException) + strlen(tkl->ptr.banexception->usermask) + strlen(tkl->ptr.banexception->hostmask);
+	else if (TKLIsNameBan(tkl))
+		size += sizeof(NameBan) + strlen(tkl->ptr.nameban->name);
+	else if (TKLIsSpamfilter(tkl))
+		size += sizeof(Spamfilter) + sizeof(Match) + strlen(tkl->ptr.spamfilter->match->str);
+	return size;
+}
+
 /** Add a spamfilter entry to the list.
  * @param type                TKL_SPAMF or TKL_SPAMF|TKL_GLOBAL.
  * @param target              The spamfilter target (SPAMF_*)
@@ -2288,6 +2324,7 @@ TKL *_tkl_add_spamfilter(int type, unsigned short target, BanAction action, Matc
 	tkl->ptr.spamfilter->match = match;
 	safe_strdup(tkl->ptr.spamfilter->tkl_reason, tkl_reason);
 	tkl->ptr.spamfilter->tkl_duration = tkl_duration;
+	memory_account(MEMORY_ACCOUNT_TKL, tkl_memory_size(tkl));
 
 	if (tkl->ptr.spamfilter->target & SPAMF_USER)
 		loop.do_bancheck_spamf_user = 1;
@@ -2297,6 +2334,7 @@ TKL *_tkl_add_spamfilter(int type, unsigned short target, BanAction action, Matc
 	/* Spamfilters go via the normal TKL list... */
 	index = tkl_hash(tkl_typetochar(type));
 	AddListItem(tkl, tklines[index]);
+	spamfilter_async_invalidate();
 
 	return tkl;
 }
@@ -2341,6 +2379,7 @@ TKL *_tkl_add_serverban(int type, char *usermask, char *hostmask, char *reason,
 	if (soft)
 		tkl->ptr.serverban->subtype = TKL_SUBTYPE_SOFT;
 	safe_strdup(tkl->ptr.serverban->reason, reason);
+	memory_account(MEMORY_ACCOUNT_TKL, tkl_memory_size(tkl));
 
 	/* For ip hash table TKL's... */
 	index = tkl_ip_hash_type(tkl_typetochar(type));
@@ -2402,6 +2441,7 @@ TKL *_tkl_add_banexception(int type, char *usermask, char *hostmask, char *reaso
 		tkl->ptr.banexception->subtype = TKL_SUBTYPE_SOFT;
 	safe_strdup(tkl->ptr.banexception->bantypes, bantypes);
 	safe_strdup(tkl->ptr.banexception->reason, reason);
+	memory_account(MEMORY_ACCOUNT_TKL, tkl_memory_size(tkl));
 
 	/* For ip hash table TKL's... */
 	index = tkl_ip_hash_type(tkl_typetochar(type));
@@ -2422,6 +2462,17 @@ TKL *_tkl_add_banexception(int type, char *usermask, char *hostmask, char *reaso
 	return tkl;
 }
 
+/** Get the name ban index list that a name ban with this name belongs to.
+ * Names without wildcards go in the tklines_name_hash[] table,
+ * the others in tklines_name_wild[] (separate for nicks and channels).
+ */
+static TKL **tkl_name_index(char *name)
+{
+	if (strchr(name, '*') || strchr(name, '?'))
+		return &tklines_name_wild[*name == '#' ? 1 : 0];
+	return &tklines_name_hash[hash_tkl_name(name)];
+}
+
 /** Add a name ban TKL entry (Q-Line), used for banning nicks and channels.
  * @param type                The TKL type, one of TKL_*,
  *                            optionally OR'ed with TKL_GLOBAL.
@@ -2442,6 +2493,7 @@ TKL *_tkl_add_nameban(int type, char *name, int hold, char *reason, char *set_by
                           time_t expire_at, time_t set_at, int flags)
 {
 	TKL *tkl;
+	TKL **head;
 	int index;
 
 	if (!TKLIsNameBanType(type))
@@ -2459,11 +2511,17 @@ TKL *_tkl_add_nameban(int type, char *name, int hold, char *reason, char *set_by
 	safe_strdup(tkl->ptr.nameban->name, name);
 	tkl->ptr.nameban->hold = hold;
 	safe_strdup(tkl->ptr.nameban->reason, reason);
+	memory_account(MEMORY_ACCOUNT_TKL, tkl_memory_size(tkl));
 
 	/* Name bans go via the normal TKL list.. */
 	index = tkl_hash(tkl_typetochar(type));
 	AddListItem(tkl, tklines[index]);
 
+	/* ..and are indexed by name for find_qline() and find_tkl_nameban() */
+	head = tkl_name_index(name);
+	tkl->hnext = *head;
+	*head = tkl;
+
 	return tkl;
 }
 
@@ -2494,6 +2552,7 @@ void _free_tkl(TKL *tkl)
 	if (TKLIsSpamfilter(tkl) && tkl->ptr.spamfilter)
 	{
 		/* Spamfilter */
+		spamfilter_async_invalidate();
 		safe_free(tkl->ptr.spamfilter->tkl_reason);
 		if (tkl->ptr.spamfilter->match)
 			unreal_delete_match(tkl->ptr.spamfilter->match);
@@ -2517,6 +2576,32 @@ void _tkl_del_line(TKL *tkl)
 {
 	int index, index2;
 	int found = 0;
+	TKL **t;
+	TKLStatsCursor *cursor;
+
+	/* Move TKL listings that are in progress past this entry */
+	for (cursor = tkl_stats_cursors; cursor; cursor = cursor->next)
+	{
+		if (cursor->tkl == tkl)
+		{
+			cursor->tkl = tkl->next;
+			if (!cursor->tkl)
+				cursor->bucket++; /* it was the last one in this bucket */
+		}
+	}
+
+	/* Remove name bans from the name index */
+	if (TKLIsNameBan(tkl) && tkl->ptr.nameban)
+	{
+		for (t = tkl_name_index(tkl->ptr.nameban->name); *t; t = &(*t)->hnext)
+		{
+			if (*t == tkl)
+			{
+				*t = tkl->hnext;
+				break;
+			}
+		}
+	}
 
 	/* Try to find it in the ip TKL hash table first
 	 * (this only applies to server bans)
@@ -2567,6 +2652,7 @@ void _tkl_del_line(TKL *tkl)
 	}
 
 	/* Finally, free the entry */
+	memory_account(MEMORY_ACCOUNT_TKL, -tkl_memory_size(tkl));
 	free_tkl(tkl);
 }
 
@@ -2578,7 +2664,9 @@ void _tkl_del_line(TKL *tkl)
 void _tkl_check_local_remove_shun(TKL *tmp)
 {
 	long i;
-	char *chost, *cname, *cip;
+	char *chost;
+	const char *cname;
+	const char *cip;
 	int is_ip;
 	Client *client;
 
@@ -2820,7 +2908,7 @@ int _find_tkl_exception(int ban_type, Client *client)
 
 	/* First, the TKL ip hash table entries.. */
 	index = tkl_ip_hash_type('e');
-	index2 = tkl_ip_hash(GetIP(client));
+	index2 = tkl_ip_hash_client(client);
 	if (index2 >= 0)
 	{
 		for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = tkl->next)
@@ -2889,7 +2977,7 @@ int _find_tkline_match(Client *client, int skip_soft)
 		return 0;
 
 	/* First, the TKL ip hash table entries.. */
-	index2 = tkl_ip_hash(GetIP(client));
+	index2 = tkl_ip_hash_client(client);
 	if (index2 >= 0)
 	{
 		for (index = 0; index < TKLIPHASHLEN1; index++)
@@ -2994,7 +3082,7 @@ int _find_shun(Client *client)
 /** Helper function for spamfilter_build_user_string().
  * This ensures IPv6 hosts are in brackets.
  */
-char *SpamfilterMagicHost(char *i)
+const char *SpamfilterMagicHost(const char *i)
 {
 	static char buf[256];
 
@@ -3109,32 +3197,31 @@ int spamfilter_check_all_users(Client *from, TKL *tkl)
  * @note Special handling:
  * #*ble* will match with #bbleh
  * *ble* will NOT match with #bbleh, will with bbleh
+ *
+ * Q-Lines without wildcards are found via tklines_name_hash[],
+ * only the ones with wildcards need to be matched one by one.
+ * An exact Q-Line is preferred over a wildcard one.
  */
 TKL *_find_qline(Client *client, char *name, int *ishold)
 {
 	TKL *tkl;
-	int	points = 0;
 	*ishold = 0;
 
 	if (IsServer(client) || IsMe(client))
 		return NULL;
 
-	for (tkl = tklines[tkl_hash('q')]; tkl; tkl = tkl->next)
-	{
-		points = 0;
-
-		if (!TKLIsNameBan(tkl))
-			continue;
-
-		if (((*tkl->ptr.nameban->name == '#' && *name == '#') || (*tkl->ptr.nameban->name != '#' && *name != '#'))
-		    && match_simple(tkl->ptr.nameban->name, name))
-		{
-			points = 1;
+	for (tkl = tklines_name_hash[hash_tkl_name(name)]; tkl; tkl = tkl->hnext)
+		if (!mycmp(tkl->ptr.nameban->name, name))
 			break;
-		}
+
+	if (!tkl)
+	{
+		for (tkl = tklines_name_wild[*name == '#' ? 1 : 0]; tkl; tkl = tkl->hnext)
+			if (match_simple(tkl->ptr.nameban->name, name))
+				break;
 	}
 
-	if (points != 1)
+	if (!tkl)
 		return NULL;
 
 	/* It's a services hold (except bans don't override this) */
@@ -3180,7 +3267,7 @@ TKL *_find_tkline_match_zap(Client *client)
 
 	/* First, the TKL ip hash table entries.. */
 	index = tkl_ip_hash_type('z');
-	index2 = tkl_ip_hash(GetIP(client));
+	index2 = tkl_ip_hash_client(client);
 	if (index2 >= 0)
 	{
 		for (tkl = tklines_ip_hash[index][index2]; tkl; tkl = tkl->next)
@@ -3274,8 +3361,9 @@ static void parse_stats_params(char *para, TKLFlag *flag)
 
 /** Does this TKL entry match the search terms?
  * This is a helper function for tkl_stats().
+ * @returns 1 if the entry was sent, 0 if it did not match.
  */
-void tkl_stats_matcher(Client *client, int type, char *para, TKLFlag *tklflags, TKL *tkl)
+int tkl_stats_matcher(Client *client, int type, char *para, TKLFlag *tklflags, TKL *tkl)
 {
 	/***** First, handle the selection ******/
 
@@ -3283,66 +3371,66 @@ void tkl_stats_matcher(Client *client, int type, char *para, TKLFlag *tklflags,
 	{
 		if (tklflags->flags & BY_SETBY)
 			if (!match_simple(tklflags->set_by, tkl->set_by))
-				return;
+				return 0;
 		if (tklflags->flags & NOT_BY_SETBY)
 			if (match_simple(tklflags->set_by, tkl->set_by))
-				return;
+				return 0;
 		if (TKLIsServerBan(tkl))
 		{
 			if (tklflags->flags & BY_MASK)
 			{
 				if (!match_simple(tklflags->mask, make_user_host(tkl->ptr.serverban->usermask, tkl->ptr.serverban->hostmask)))
-					return;
+					return 0;
 			}
 			if (tklflags->flags & NOT_BY_MASK)
 			{
 				if (match_simple(tklflags->mask, make_user_host(tkl->ptr.serverban->usermask, tkl->ptr.serverban->hostmask)))
-					return;
+					return 0;
 			}
 			if (tklflags->flags & BY_REASON)
 				if (!match_simple(tklflags->reason, tkl->ptr.serverban->reason))
-					return;
+					return 0;
 			if (tklflags->flags & NOT_BY_REASON)
 				if (match_simple(tklflags->reason, tkl->ptr.serverban->reason))
-					return;
+					return 0;
 		} else
 		if (TKLIsNameBan(tkl))
 		{
 			if (tklflags->flags & BY_MASK)
 			{
 				if (!match_simple(tklflags->mask, tkl->ptr.nameban->name))
-					return;
+					return 0;
 			}
 			if (tklflags->flags & NOT_BY_MASK)
 			{
 				if (match_simple(tklflags->mask, tkl->ptr.nameban->name))
-					return;
+					return 0;
 			}
 			if (tklflags->flags & BY_REASON)
 				if (!match_simple(tklflags->reason, tkl->ptr.nameban->reason))
-					return;
+					return 0;
 			if (tklflags->flags & NOT_BY_REASON)
 				if (match_simple(tklflags->reason, tkl->ptr.nameban->reason))
-					return;
+					return 0;
 		} else
 		if (TKLIsBanException(tkl))
 		{
 			if (tklflags->flags & BY_MASK)
 			{
 				if (!match_simple(tklflags->mask, make_user_host(tkl->ptr.banexception->usermask, tkl->ptr.banexception->hostmask)))
-					return;
+					return 0;
 			}
 			if (tklflags->flags & NOT_BY_MASK)
 			{
 				if (match_simple(tklflags->mask, make_user_host(tkl->ptr.banexception->usermask, tkl->ptr.banexception->hostmask)))
-					return;
+					return 0;
 			}
 			if (tklflags->flags & BY_REASON)
 				if (!match_simple(tklflags->reason, tkl->ptr.banexception->reason))
-					return;
+					return 0;
 			if (tklflags->flags & NOT_BY_REASON)
 				if (match_simple(tklflags->reason, tkl->ptr.banexception->reason))
-					return;
+					return 0;
 		}
 	}
 
@@ -3422,49 +3510,101 @@ void tkl_stats_matcher(Client *client, int type, char *para, TKLFlag *tklflags,
 			   (tkl->expire_at != 0) ? (tkl->expire_at - TStime()) : 0,
 			   (TStime() - tkl->set_at), tkl->set_by, tkl->ptr.banexception->reason);
 	}
+
+	return 1;
 }
 
 /* TKL Stats. This is used by /STATS gline and all the others */
 void _tkl_stats(Client *client, int type, char *para)
+{
+	TKLStatsCursor cursor;
+
+	memset(&cursor, 0, sizeof(cursor));
+	_tkl_stats_ex(client, type, para, &cursor, 0);
+
+	if ((type == (TKL_SPAMF|TKL_GLOBAL)) && (!para || strcasecmp(para, "del")))
+	{
+		/* If requesting spamfilter stats and not spamfilter del, then suggest it. */
+		sendnotice(client, "Tip: if you are looking for an easy way to remove a spamfilter, run '/SPAMFILTER del'.");
+	}
+}
+
+/** TKL Stats, sent in parts. This is used by /STATS to send
+ * large lists as the sendq of the client drains.
+ * @param client	The client to send the entries to
+ * @param type		The TKL type, eg TKL_KILL|TKL_GLOBAL
+ * @param para		The search terms (or NULL)
+ * @param cursor	Where to continue, must be zeroed before the first call
+ * @param max		Send at most this number of entries now, or 0 for all
+ * @returns 1 if there is more to send, 0 if done.
+ * @note If there is more to send, the cursor is put on the
+ *       tkl_stats_cursors list. If the caller stops before the end,
+ *       it must call tkl_stats_cursor_end().
+ *       Entries that are added in between two calls may be skipped.
+ */
+int _tkl_stats_ex(Client *client, int type, char *para, TKLStatsCursor *cursor, int max)
 {
 	TKL *tk;
 	TKLFlag tklflags;
-	int index, index2;
+	int index;
+	int sent = 0, examined = 0;
 
 	if (!BadPtr(para))
 		parse_stats_params(para, &tklflags);
 
 	/* First the IP hashed entries (if applicable).. */
-	index = tkl_ip_hash_type(tkl_typetochar(type));
-	if (index >= 0)
+	if (cursor->phase == 0)
 	{
-		for (index2 = 0; index2 < TKLIPHASHLEN2; index2++)
+		index = tkl_ip_hash_type(tkl_typetochar(type));
+		if (index >= 0)
 		{
-			for (tk = tklines_ip_hash[index][index2]; tk; tk = tk->next)
+			for (; cursor->bucket < TKLIPHASHLEN2; cursor->bucket++, cursor->tkl = NULL)
 			{
-				if (type && tk->type != type)
-					continue;
-				tkl_stats_matcher(client, type, para, &tklflags, tk);
+				tk = cursor->tkl ? cursor->tkl : tklines_ip_hash[index][cursor->bucket];
+				for (; tk; tk = tk->next)
+				{
+					/* Also stop after looking at many entries that don't match */
+					if (max && ((sent >= max) || (examined >= max * 10)))
+						goto more;
+					examined++;
+					if (type && tk->type != type)
+						continue;
+					sent += tkl_stats_matcher(client, type, para, &tklflags, tk);
+				}
 			}
 		}
+		cursor->phase = 1;
+		cursor->bucket = 0;
+		cursor->tkl = NULL;
 	}
 
 	/* Then the normal entries... */
-	for (index = 0; index < TKLISTLEN; index++)
+	for (; cursor->bucket < TKLISTLEN; cursor->bucket++, cursor->tkl = NULL)
 	{
-		for (tk = tklines[index]; tk; tk = tk->next)
+		tk = cursor->tkl ? cursor->tkl : tklines[cursor->bucket];
+		for (; tk; tk = tk->next)
 		{
+			if (max && ((sent >= max) || (examined >= max * 10)))
+				goto more;
+			examined++;
 			if (type && tk->type != type)
 				continue;
-			tkl_stats_matcher(client, type, para, &tklflags, tk);
+			sent += tkl_stats_matcher(client, type, para, &tklflags, tk);
 		}
 	}
 
-	if ((type == (TKL_SPAMF|TKL_GLOBAL)) && (!para || strcasecmp(para, "del")))
+	tkl_stats_cursor_end(cursor);
+	return 0;
+
+more:
+	/* Continue at this entry next time */
+	cursor->tkl = tk;
+	if (!cursor->active)
 	{
-		/* If requesting spamfilter stats and not spamfilter del, then suggest it. */
-		sendnotice(client, "Tip: if you are looking for an easy way to remove a spamfilter, run '/SPAMFILTER del'.");
+		AddListItem(cursor, tkl_stats_cursors);
+		cursor->active = 1;
 	}
+	return 1;
 }
 
 /** Synchronize a TKL entry with the other server.
@@ -3638,13 +3778,12 @@ TKL *_find_tkl_banexception(int type, char *usermask, char *hostmask, int softba
 /** Find a name ban TKL (qline) - only used to prevent duplicates and for deletion */
 TKL *_find_tkl_nameban(int type, char *name, int hold)
 {
-	char tpe = tkl_typetochar(type);
 	TKL *tkl;
 
 	if (!TKLIsNameBanType(type))
 		abort();
 
-	for (tkl = tklines[tkl_hash(tpe)]; tkl; tkl = tkl->next)
+	for (tkl = *tkl_name_index(name); tkl; tkl = tkl->hnext)
 	{
 		if ((tkl->type == type) && !strcasecmp(tkl->ptr.nameban->name, name))
 			return tkl;
@@ -4558,6 +4697,8 @@ int _match_spamfilter(Client *client, char *str_in, int target, char *destinatio
 	char *str;
 	int ret = -1;
 	char *reason = NULL;
+	char *verdict;
+	int regex_index = 0;
 #ifdef SPAMFILTER_DETECTSLOW
 	struct rusage rnow, rprev;
 	long ms_past;
@@ -4577,8 +4718,16 @@ int _match_spamfilter(Client *client, char *str_in, int target, char *destinatio
 	if (!client->user || ValidatePermissionsForPath("immune:server-ban:spamfilter",client,NULL,NULL,NULL) || IsULine(client))
 		return 0;
 
+	/* Regexes may already have been run by a spamfilter thread */
+	verdict = spamfilter_async_verdict(client, str);
+
 	for (tkl = tklines[tkl_hash('F')]; tkl; tkl = tkl->next)
 	{
+		int is_regex = (tkl->ptr.spamfilter->match->type == MATCH_PCRE_REGEX);
+
+		if (is_regex)
+			regex_index++;
+
 		if (!(tkl->ptr.spamfilter->target & target))
 			continue;
 
@@ -4591,34 +4740,40 @@ int _match_spamfilter(Client *client, char *str_in, int target, char *destinatio
 		if (IsSoftBanAction(tkl->ptr.spamfilter->action) && IsLoggedIn(client))
 			continue;
 
+		if (verdict && is_regex)
+		{
+			ret = verdict[regex_index - 1];
+		} else
+		{
 #ifdef SPAMFILTER_DETECTSLOW
-		memset(&rnow, 0, sizeof(rnow));
-		memset(&rprev, 0, sizeof(rnow));
+			memset(&rnow, 0, sizeof(rnow));
+			memset(&rprev, 0, sizeof(rnow));
 
-		getrusage(RUSAGE_SELF, &rprev);
+			getrusage(RUSAGE_SELF, &rprev);
 #endif
 
-		ret = unreal_match(tkl->ptr.spamfilter->match, str);
+			ret = unreal_match(tkl->ptr.spamfilter->match, str);
 
 #ifdef SPAMFILTER_DETECTSLOW
-		getrusage(RUSAGE_SELF, &rnow);
+			getrusage(RUSAGE_SELF, &rnow);
 
-		ms_past = ((rnow.ru_utime.tv_sec - rprev.ru_utime.tv_sec) * 1000) +
-		          ((rnow.ru_utime.tv_usec - rprev.ru_utime.tv_usec) / 1000);
+			ms_past = ((rnow.ru_utime.tv_sec - rprev.ru_utime.tv_sec) * 1000) +
+			          ((rnow.ru_utime.tv_usec - rprev.ru_utime.tv_usec) / 1000);
 
-		if ((SPAMFILTER_DETECTSLOW_FATAL > 0) && (ms_past > SPAMFILTER_DETECTSLOW_FATAL))
-		{
-			sendto_realops("[Spamfilter] WARNING: Too slow spamfilter detected (took %ld msec to execute) "
-			               "-- spamfilter will be \002REMOVED!\002: %s", ms_past, tkl->ptr.spamfilter->match->str);
-			tkl_del_line(tkl);
-			return 0; /* Act as if it didn't match, even if it did.. it's gone now anyway.. */
-		} else
-		if ((SPAMFILTER_DETECTSLOW_WARN > 0) && (ms_past > SPAMFILTER_DETECTSLOW_WARN))
-		{
-			sendto_realops("[Spamfilter] WARNING: SLOW Spamfilter detected (took %ld msec to execute): %s",
-				ms_past, tkl->ptr.spamfilter->match->str);
-		}
+			if ((SPAMFILTER_DETECTSLOW_FATAL > 0) && (ms_past > SPAMFILTER_DETECTSLOW_FATAL))
+			{
+				sendto_realops("[Spamfilter] WARNING: Too slow spamfilter detected (took %ld msec to execute) "
+				               "-- spamfilter will be \002REMOVED!\002: %s", ms_past, tkl->ptr.spamfilter->match->str);
+				tkl_del_line(tkl);
+				return 0; /* Act as if it didn't match, even if it did.. it's gone now anyway.. */
+			} else
+			if ((SPAMFILTER_DETECTSLOW_WARN > 0) && (ms_past > SPAMFILTER_DETECTSLOW_WARN))
+			{
+				sendto_realops("[Spamfilter] WARNING: SLOW Spamfilter detected (took %ld msec to execute): %s",
+					ms_past, tkl->ptr.spamfilter->match->str);
+			}
 #endif
+		}
 
 		if (ret)
 		{
@@ -4788,7 +4943,7 @@ static int comp_with_mask(void *addr, void *dest, u_int mask)
 int _match_user(char *rmask, Client *client, int options)
 {
 	char mask[NICKLEN+USERLEN+HOSTLEN+8];
-	char clientip[IPSZ], maskip[IPSZ];
+	char maskip[IPSZ];
 	char *p = NULL;
 	char *nmask = NULL, *umask = NULL, *hmask = NULL;
 	int cidr = -1; /* CIDR length, -1 for no CIDR */
@@ -4825,7 +4980,7 @@ int _match_user(char *rmask, Client *client, int options)
 		p = strchr(p ? p : mask, '@');
 		if (p)
 		{
-			char *client_username = (client->user && *client->user->username) ? client->user->username : client->ident;
+			const char *client_username = (client->user && *client->user->username) ? client->user->username : client->ident;
 
 			*p++ = '\0';
 			if (!*p || !*mask)
@@ -4853,7 +5008,7 @@ int _match_user(char *rmask, Client *client, int options)
 	/**** Check visible host ****/
 	if (options & MATCH_CHECK_VISIBLE_HOST)
 	{
-		char *hostname = client->user ? GetHost(client) : (MyUser(client) ? client->local->sockhost : NULL);
+		const char *hostname = client->user ? GetHost(client) : (MyUser(client) ? client->local->sockhost : NULL);
 		if (hostname && match_simple(hmask, hostname))
 			return 1; /* MATCH: visible host */
 	}
@@ -4892,18 +5047,16 @@ int _match_user(char *rmask, Client *client, int options)
 			 */
 			if (!client->ip || !strchr(client->ip, ':'))
 				return 0; /* NOMATCH: hmask is IPv6 address and client is not IPv6 */
-			if (!inet_pton(AF_INET6, client->ip, clientip))
-				return 0; /* NOMATCH: unusual failure */
 			if (!inet_pton(AF_INET6, hmask, maskip))
 				return 0; /* NOMATCH: invalid IPv6 IP in hostmask */
 
 			if (cidr < 0)
-				return comp_with_mask(clientip, maskip, 128); /* MATCH/NOMATCH by exact IP */
+				return comp_with_mask(client->rawip, maskip, 128); /* MATCH/NOMATCH by exact IP */
 
 			if (cidr > 128)
 				return 0; /* NOMATCH: invalid CIDR */
 
-			return comp_with_mask(clientip, maskip, cidr);
+			return comp_with_mask(client->rawip, maskip, cidr);
 		} else
 		{
 			/* Host is not IPv6 and does not contain wildcards.
@@ -4913,17 +5066,18 @@ int _match_user(char *rmask, Client *client, int options)
 			 * The exception is CIDR. If we have CIDR mask then don't bother checking for
 			 * virtual hosts and things like that since '/' can never be in a hostname.
 			 */
-			if (client->ip && inet_pton(AF_INET, client->ip, clientip) && inet_pton(AF_INET, hmask, maskip))
+			if (client->ip && !strchr(client->ip, ':') && raw_ip_is_ipv4(client->rawip) &&
+			    inet_pton(AF_INET, hmask, maskip))
 			{
 				if (cidr < 0)
 				{
-					if (comp_with_mask(clientip, maskip, 32))
+					if (comp_with_mask(client->rawip + 12, maskip, 32))
 						return 1; /* MATCH: exact IP */
 				}
 				else if (cidr > 32)
 					return 0; /* NOMATCH: invalid CIDR */
 				else
-					return comp_with_mask(clientip, maskip, cidr); /* MATCH/NOMATCH by CIDR */
+					return comp_with_mask(client->rawip + 12, maskip, cidr); /* MATCH/NOMATCH by CIDR */
 			}
 		}
 	}
@@ -4931,7 +5085,7 @@ int _match_user(char *rmask, Client *client, int options)
 	/**** Check real host ****/
 	if (options & MATCH_CHECK_REAL_HOST)
 	{
-		char *hostname = client->user ? client->user->realhost : (MyUser(client) ? client->local->sockhost : NULL);
+		const char *hostname = client->user ? client->user->realhost : (MyUser(client) ? client->local->sockhost : NULL);
 		if (hostname && match_simple(hmask, hostname))
 			return 1; /* MATCH: hostname match */
 	}
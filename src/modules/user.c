@@ -99,7 +99,7 @@ CMD_FUNC(cmd_user)
 	client->umodes |= CONN_MODES;
 	client->user->server = me_hash;
 	strlcpy(client->info, realname, sizeof(client->info));
-	strlcpy(client->user->username, username, USERLEN + 1);
+	scache_setn(client->user->username, username, USERLEN);
 
 	if (*client->name && is_handshake_finished(client))
 	{
@@ -67,7 +67,8 @@ CMD_FUNC(cmd_userip)
 
 	char *p;		/* scratch end pointer */
 	char *cn;		/* current name */
-	char *ip, ipbuf[HOSTLEN+1];
+	const char *ip;
+	char ipbuf[HOSTLEN+1];
 	Client *acptr;
 	char response[MAXUSERHOSTREPLIES][NICKLEN * 2 + CHANNELLEN + USERLEN + HOSTLEN + 30];
 	int  i;			/* loop counter */
@@ -59,6 +59,7 @@ CMD_FUNC(cmd_vhost)
 	ConfigItem_vhost *vhost;
 	char *login, *password;
 	char olduser[USERLEN+1];
+	int n;
 
 	if (!MyUser(client))
 		return;
@@ -99,7 +100,10 @@ CMD_FUNC(cmd_vhost)
 		return;
 	}
 
-	if (!Auth_Check(client, vhost->auth, password))
+	n = Auth_CheckAsync(client, vhost->auth, password, "VHOST", recv_mtags, parc, parv);
+	if (n == AUTH_CHECK_PENDING)
+		return; /* VHOST is executed again once the password is verified */
+	if (!n)
 	{
 		sendto_snomask(SNO_VHOST,
 		    "[\2vhost\2] Failed login for vhost %s by %s!%s@%s - incorrect password",
@@ -138,11 +142,11 @@ CMD_FUNC(cmd_vhost)
 
 	userhost_save_current(client);
 
-	safe_strdup(client->user->virthost, vhost->virthost);
+	scache_set(client->user->virthost, vhost->virthost);
 	if (vhost->virtuser)
 	{
 		strcpy(olduser, client->user->username);
-		strlcpy(client->user->username, vhost->virtuser, USERLEN);
+		scache_setn(client->user->username, vhost->virtuser, USERLEN - 1);
 		sendto_server(client, 0, 0, NULL, ":%s SETIDENT %s", client->id,
 		    client->user->username);
 	}
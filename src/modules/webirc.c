@@ -303,10 +303,16 @@ void webirc_md_free(ModData *md)
 	md->l = 0;
 }
 
-ConfigItem_webirc *find_webirc(Client *client, char *password, WEBIRCType type, char **errorstr)
+/** Find the matching webirc block.
+ * For WEBIRC_WEBIRC the password is checked as well, this can be done
+ * asynchronously: if NULL is returned and IsAuthPending(client) is true
+ * then the WEBIRC command ('mtags', 'parc' and 'parv') is re-run later.
+ */
+ConfigItem_webirc *find_webirc(Client *client, char *password, WEBIRCType type, char **errorstr, MessageTag *mtags, int parc, char *parv[])
 {
 	ConfigItem_webirc *e;
 	char *error = NULL;
+	int n;
 
 	for (e = conf_webirc; e; e = e->next)
 	{
@@ -315,7 +321,10 @@ ConfigItem_webirc *find_webirc(Client *client, char *password, WEBIRCType type,
 			if (type == WEBIRC_WEBIRC)
 			{
 				/* Check password */
-				if (!Auth_Check(client, e->auth, password))
+				n = Auth_CheckAsync(client, e->auth, password, "WEBIRC", mtags, parc, parv);
+				if (n == AUTH_CHECK_PENDING)
+					return NULL;
+				if (!n)
 					error = "CGI:IRC -- Invalid password";
 				else
 					return e; /* Found matching block, return straight away */
@@ -361,7 +370,7 @@ void dowebirc(Client *client, char *ip, char *host, char *options)
 	}
 
 	/* STEP 2: Update GetIP() */
-	safe_strdup(client->ip, ip);
+	set_client_ip(client, ip);
 		
 	/* STEP 3: Update client->local->hostp */
 	/* (free old) */
@@ -429,9 +438,11 @@ CMD_FUNC(cmd_webirc)
 	options = parv[5]; /* can be NULL */
 
 	/* Check if allowed host */
-	e = find_webirc(client, password, WEBIRC_WEBIRC, &error);
+	e = find_webirc(client, password, WEBIRC_WEBIRC, &error, recv_mtags, parc, parv);
 	if (!e)
 	{
+		if (IsAuthPending(client))
+			return; /* WEBIRC is executed again once the password is verified */
 		exit_client(client, NULL, error);
 		return;
 	}
@@ -459,7 +470,7 @@ int webirc_local_pass(Client *client, char *password)
 		ConfigItem_webirc *e;
 		char *error = NULL;
 
-		e = find_webirc(client, NULL, WEBIRC_PASS, &error);
+		e = find_webirc(client, NULL, WEBIRC_PASS, &error, NULL, 0, NULL);
 		if (e)
 		{
 			/* Ok now we got that sorted out, proceed:
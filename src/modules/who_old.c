@@ -329,14 +329,8 @@ int i = 1;
 
 					while (*s)
 					{
-					int i;
-						for (i = 0; i <= Usermode_highest; i++)
-							if (*s == Usermode_Table[i].flag)
-							{
-								*umodes |= Usermode_Table[i].mode;
-								break;
-							}
-					s++;
+						*umodes |= find_user_mode(*s);
+						s++;
 					}
 
 					if (!IsOper(client))
@@ -450,7 +444,7 @@ static int can_see(Client *requester, Client *target, Channel *channel)
 		/* if they only want people with a certain host */
 		if (wfl.want_host != WHO_DONTCARE)
 		{
-			char *host;
+			const char *host;
 
 			if (IsOper(requester))
 				host = target->user->realhost;
@@ -467,7 +461,7 @@ static int can_see(Client *requester, Client *target, Channel *channel)
 		/* if they only want people with a certain IP */
 		if (wfl.want_ip != WHO_DONTCARE)
 		{
-			char *ip;
+			const char *ip;
 
 			ip = target->ip;
 			if (!ip)
@@ -593,7 +587,7 @@ static void do_channel_who(Client *client, Channel *channel, char *mask)
 	if (IsMember(client, channel) || ValidatePermissionsForPath("channel:see:who:onchannel",client,NULL,channel,NULL))
 		who_flags |= WF_ONCHANNEL;
 
-	for (cm = channel->members; cm; cm = cm->next)
+	for (cm = channel->members; cm; cm = cm->next_member)
 	{
 		Client *acptr = cm->client;
 		char status[32];
@@ -752,7 +746,7 @@ static void send_who_reply(Client *client, Client *acptr,
 			   char *channel, char *status, char *xstat)
 {
 	char *stat;
-	char *host;
+	const char *host;
 	int flat = (FLAT_MAP && !IsOper(client)) ? 1 : 0;
 
 	stat = safe_alloc(strlen(status) + strlen(xstat) + 1);
@@ -805,7 +799,7 @@ static char *first_visible_channel(Client *client, Client *acptr, int *flg)
 
 	*flg = 0;
 
-	for (lp = acptr->user->channel; lp; lp = lp->next)
+	for (lp = acptr->user->channel; lp; lp = lp->next_channel)
 	{
 		Channel *channel = lp->channel;
 		Hook *h;
@@ -23,9 +23,33 @@
 static char buf[BUFSIZE];
 
 CMD_FUNC(cmd_whois);
+void whois_channels_md_free(ModData *m);
+static void whois_channels_full(Client *client, Client *target, char *name, int mlen, int *len);
+static void whois_channels_cached(Client *client, Client *target, char *name, int mlen, int *len);
 
 #define MSG_WHOIS       "WHOIS"
 
+/** Cached rendering of the public channels (not +s or +p) of a user.
+ * Only the channels that the viewer shares with the user need
+ * to be checked on each /WHOIS, see whois_channels_cached().
+ * The HOOKTYPE_SEE_CHANNEL_IN_WHOIS hooks depend on the viewer,
+ * so these are not cached but still called for each /WHOIS.
+ */
+typedef struct WhoisChannels WhoisChannels;
+struct WhoisChannels {
+	unsigned int channels_version;		/**< User::channels_version at the time of rendering */
+	unsigned int visibility_version;	/**< channel_visibility_version at the time of rendering */
+	int size;				/**< Size of each of the buffers below */
+	char *single;				/**< Channels with the highest prefix, eg: "@#a +#b " */
+	char *multi;				/**< Channels with all prefixes (multi-prefix), eg: "@+#a +#b " */
+	Channel **channels;			/**< The channels in the same order as in the buffers above */
+};
+
+ModDataInfo *whois_channels_md = NULL;
+Module *whois_module = NULL;
+
+#define WHOIS_CHANNELS(client)	((WhoisChannels *)moddata_client(client, whois_channels_md).ptr)
+
 ModuleHeader MOD_HEADER
   = {
 	"whois",	/* Name of module */
@@ -38,8 +62,23 @@ ModuleHeader MOD_HEADER
 /* This is called on module init, before Server Ready */
 MOD_INIT()
 {
+	ModDataInfo mreq;
+
 	CommandAdd(modinfo->handle, MSG_WHOIS, cmd_whois, MAXPARA, CMD_USER);
 	MARK_AS_OFFICIAL_MODULE(modinfo);
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.name = "whois_channels";
+	mreq.type = MODDATATYPE_CLIENT;
+	mreq.free = whois_channels_md_free;
+	whois_channels_md = ModDataAdd(modinfo->handle, mreq);
+	if (!whois_channels_md)
+	{
+		config_error("could not register whois_channels moddata");
+		return MOD_FAILED;
+	}
+	whois_module = modinfo->handle;
+
 	return MOD_SUCCESS;
 }
 
@@ -62,9 +101,7 @@ MOD_UNLOAD()
 */
 CMD_FUNC(cmd_whois)
 {
-	Membership *lp;
 	Client *target;
-	Channel *channel;
 	char *nick, *tmp, *name;
 	char *p = NULL;
 	int  found, len, mlen;
@@ -89,7 +126,7 @@ CMD_FUNC(cmd_whois)
 
 	for (tmp = canonize(parv[1]); (nick = strtoken(&p, tmp, ",")); tmp = NULL)
 	{
-		unsigned char showchannel, wilds, hideoper; /* <- these are all boolean-alike */
+		unsigned char wilds, hideoper; /* <- these are all boolean-alike */
 
 		if (MyUser(client) && (++ntargets > maxtargets))
 		{
@@ -153,124 +190,12 @@ CMD_FUNC(cmd_whois)
 			
 			found = 1;
 			mlen = strlen(me.name) + strlen(client->name) + 10 + strlen(name);
-			for (len = 0, *buf = '\0', lp = target->user->channel; lp; lp = lp->next)
-			{
-				Hook *h;
-				int ret = EX_ALLOW;
-				int operoverride = 0;
-				
-				channel = lp->channel;
-				showchannel = 0;
-
-				if (ShowChannel(client, channel))
-					showchannel = 1;
-
-				for (h = Hooks[HOOKTYPE_SEE_CHANNEL_IN_WHOIS]; h; h = h->next)
-				{
-					int n = (*(h->func.intfunc))(client, target, channel);
-					/* Hook return values:
-					 * EX_ALLOW means 'yes is ok, as far as modules are concerned'
-					 * EX_DENY means 'hide this channel, unless oper overriding'
-					 * EX_ALWAYS_DENY means 'hide this channel, always'
-					 * ... with the exception that we always show the channel if you /WHOIS yourself
-					 */
-					if (n == EX_DENY)
-					{
-						ret = EX_DENY;
-					}
-					else if (n == EX_ALWAYS_DENY)
-					{
-						ret = EX_ALWAYS_DENY;
-						break;
-					}
-				}
-				
-				if (ret == EX_DENY)
-					showchannel = 0;
-				
-				if (!showchannel && (ValidatePermissionsForPath("channel:see:whois",client,NULL,channel,NULL)))
-				{
-					showchannel = 1; /* OperOverride */
-					operoverride = 1;
-				}
-				
-				if ((ret == EX_ALWAYS_DENY) && (target != client))
-					continue; /* a module asked us to really not expose this channel, so we don't (except target==ourselves). */
-
-				if (target == client)
-					showchannel = 1;
-
-				if (showchannel)
-				{
-					long access;
-					if (len + strlen(channel->chname) > (size_t)BUFSIZE - 4 - mlen)
-					{
-						sendto_one(client, NULL,
-						    ":%s %d %s %s :%s",
-						    me.name,
-						    RPL_WHOISCHANNELS,
-						    client->name, name, buf);
-						*buf = '\0';
-						len = 0;
-					}
-
-					if (operoverride)
-					{
-						/* '?' and '!' both mean we can see the channel in /WHOIS and normally wouldn't,
-						 * but there's still a slight difference between the two...
-						 */
-						if (!PubChannel(channel))
-						{
-							/* '?' means it's a secret/private channel (too) */
-							*(buf + len++) = '?';
-						}
-						else
-						{
-							/* public channel but hidden in WHOIS (umode +p, service bot, etc) */
-							*(buf + len++) = '!';
-						}
-					}
-
-					access = get_access(target, channel);
-					if (!MyUser(client) || !HasCapability(client, "multi-prefix"))
-					{
-#ifdef PREFIX_AQ
-						if (access & CHFL_CHANOWNER)
-							*(buf + len++) = '~';
-						else if (access & CHFL_CHANADMIN)
-							*(buf + len++) = '&';
-						else
-#endif
-						if (access & CHFL_CHANOP)
-							*(buf + len++) = '@';
-						else if (access & CHFL_HALFOP)
-							*(buf + len++) = '%';
-						else if (access & CHFL_VOICE)
-							*(buf + len++) = '+';
-					}
-					else
-					{
-#ifdef PREFIX_AQ
-						if (access & CHFL_CHANOWNER)
-							*(buf + len++) = '~';
-						if (access & CHFL_CHANADMIN)
-							*(buf + len++) = '&';
-#endif
-						if (access & CHFL_CHANOP)
-							*(buf + len++) = '@';
-						if (access & CHFL_HALFOP)
-							*(buf + len++) = '%';
-						if (access & CHFL_VOICE)
-							*(buf + len++) = '+';
-					}
-					if (len)
-						*(buf + len) = '\0';
-					strcpy(buf + len, channel->chname);
-					len += strlen(channel->chname);
-					strcat(buf + len, " ");
-					len++;
-				}
-			}
+			len = 0;
+			*buf = '\0';
+			if ((target == client) || IsOper(client) || IsULine(client))
+				whois_channels_full(client, target, name, mlen, &len);
+			else
+				whois_channels_cached(client, target, name, mlen, &len);
 
 			if (buf[0] != '\0')
 				sendnumeric(client, RPL_WHOISCHANNELS, name, buf); 
@@ -313,6 +238,10 @@ CMD_FUNC(cmd_whois)
 				sendnumeric(client, RPL_WHOISSECURE, name,
 					"is using a Secure Connection");
 			
+			if (IsOper(client) && MyConnect(target) && target->local->lossy_drops)
+				sendnumericfmt(client, RPL_WHOISSPECIAL, "%s :had %ld low priority messages dropped (lossy class)",
+				    name, target->local->lossy_drops);
+
 			RunHook2(HOOKTYPE_WHOIS, client, target);
 
 			if (target->user->swhois && !hideoper)
@@ -347,3 +276,284 @@ CMD_FUNC(cmd_whois)
 	}
 	sendnumeric(client, RPL_ENDOFWHOIS, querybuf);
 }
+
+void whois_channels_md_free(ModData *m)
+{
+	WhoisChannels *wc = m->ptr;
+
+	if (!wc)
+		return;
+	module_memory_account(whois_module, -(long)(sizeof(WhoisChannels) + wc->size * 2 + wc->size * sizeof(Channel *)));
+	safe_free(wc->single);
+	safe_free(wc->multi);
+	safe_free(wc->channels);
+	safe_free(m->ptr);
+}
+
+/** Can 'client' see 'channel' in the /WHOIS of 'target'?
+ * @param client	The user doing the /WHOIS
+ * @param target	The user being /WHOIS'ed
+ * @param channel	The channel
+ * @param operoverride	Set to 1 if the channel is only shown due to oper privileges
+ * @returns 1 if the channel should be shown, 0 if not.
+ */
+static int whois_see_channel(Client *client, Client *target, Channel *channel, int *operoverride)
+{
+	Hook *h;
+	int ret = EX_ALLOW;
+	int showchannel = 0;
+
+	*operoverride = 0;
+
+	if (ShowChannel(client, channel))
+		showchannel = 1;
+
+	for (h = Hooks[HOOKTYPE_SEE_CHANNEL_IN_WHOIS]; h; h = h->next)
+	{
+		int n = (*(h->func.intfunc))(client, target, channel);
+		/* Hook return values:
+		 * EX_ALLOW means 'yes is ok, as far as modules are concerned'
+		 * EX_DENY means 'hide this channel, unless oper overriding'
+		 * EX_ALWAYS_DENY means 'hide this channel, always'
+		 * ... with the exception that we always show the channel if you /WHOIS yourself
+		 */
+		if (n == EX_DENY)
+		{
+			ret = EX_DENY;
+		}
+		else if (n == EX_ALWAYS_DENY)
+		{
+			ret = EX_ALWAYS_DENY;
+			break;
+		}
+	}
+
+	if (ret == EX_DENY)
+		showchannel = 0;
+
+	if (!showchannel && (ValidatePermissionsForPath("channel:see:whois",client,NULL,channel,NULL)))
+	{
+		showchannel = 1; /* OperOverride */
+		*operoverride = 1;
+	}
+
+	if ((ret == EX_ALWAYS_DENY) && (target != client))
+		return 0; /* a module asked us to really not expose this channel, so we don't (except target==ourselves). */
+
+	if (target == client)
+		showchannel = 1;
+
+	return showchannel;
+}
+
+/** Do all HOOKTYPE_SEE_CHANNEL_IN_WHOIS hooks allow 'client' to see
+ * 'channel' in the /WHOIS of 'target'? This is the same as
+ * whois_see_channel() for a public channel and a 'client' that has
+ * no oper privileges and that is not 'target'.
+ */
+static int whois_hooks_allow(Client *client, Client *target, Channel *channel)
+{
+	Hook *h;
+
+	for (h = Hooks[HOOKTYPE_SEE_CHANNEL_IN_WHOIS]; h; h = h->next)
+		if ((*(h->func.intfunc))(client, target, channel) != EX_ALLOW)
+			return 0;
+	return 1;
+}
+
+/** Write the channel prefix for 'access' (eg: '@') to 'p'.
+ * @param multi		Write all prefixes instead of only the highest (multi-prefix)
+ * @returns The position after the prefix
+ */
+static char *whois_channel_prefix(char *p, long access, int multi)
+{
+	if (!multi)
+	{
+#ifdef PREFIX_AQ
+		if (access & CHFL_CHANOWNER)
+			*p++ = '~';
+		else if (access & CHFL_CHANADMIN)
+			*p++ = '&';
+		else
+#endif
+		if (access & CHFL_CHANOP)
+			*p++ = '@';
+		else if (access & CHFL_HALFOP)
+			*p++ = '%';
+		else if (access & CHFL_VOICE)
+			*p++ = '+';
+	}
+	else
+	{
+#ifdef PREFIX_AQ
+		if (access & CHFL_CHANOWNER)
+			*p++ = '~';
+		if (access & CHFL_CHANADMIN)
+			*p++ = '&';
+#endif
+		if (access & CHFL_CHANOP)
+			*p++ = '@';
+		if (access & CHFL_HALFOP)
+			*p++ = '%';
+		if (access & CHFL_VOICE)
+			*p++ = '+';
+	}
+	return p;
+}
+
+/** Add a channel (with prefix, eg "@#test") to the RPL_WHOISCHANNELS
+ * reply in 'buf', sending the reply first if the line would get too long.
+ */
+static void whois_add_channel(Client *client, char *name, int mlen, int *len, char *entry, int entrylen)
+{
+	if (*len + entrylen > BUFSIZE - 4 - mlen)
+	{
+		sendto_one(client, NULL,
+		    ":%s %d %s %s :%s",
+		    me.name,
+		    RPL_WHOISCHANNELS,
+		    client->name, name, buf);
+		*buf = '\0';
+		*len = 0;
+	}
+	memcpy(buf + *len, entry, entrylen);
+	*len += entrylen;
+	buf[(*len)++] = ' ';
+	buf[*len] = '\0';
+}
+
+/** Add a channel of 'target' to the reply, with the prefix
+ * of 'target' in that channel and the oper override marker.
+ */
+static void whois_add_membership(Client *client, Client *target, char *name, int mlen, int *len, Membership *lp, int operoverride)
+{
+	Channel *channel = lp->channel;
+	char entry[CHANNELLEN + 16];
+	char *p = entry;
+
+	if (operoverride)
+	{
+		/* '?' and '!' both mean we can see the channel in /WHOIS and normally wouldn't,
+		 * but there's still a slight difference between the two...
+		 */
+		if (!PubChannel(channel))
+		{
+			/* '?' means it's a secret/private channel (too) */
+			*p++ = '?';
+		}
+		else
+		{
+			/* public channel but hidden in WHOIS (umode +p, service bot, etc) */
+			*p++ = '!';
+		}
+	}
+
+	p = whois_channel_prefix(p, lp->flags, MyUser(client) && HasCapability(client, "multi-prefix"));
+	strlcpy(p, channel->chname, sizeof(entry) - (p - entry));
+	whois_add_channel(client, name, mlen, len, entry, strlen(entry));
+}
+
+/** The channel list of 'target' for opers (who may see hidden
+ * channels) and for users doing a /WHOIS on themselves.
+ * Every channel is checked individually.
+ */
+static void whois_channels_full(Client *client, Client *target, char *name, int mlen, int *len)
+{
+	Membership *lp;
+	int operoverride;
+
+	for (lp = target->user->channel; lp; lp = lp->next_channel)
+	{
+		if (whois_see_channel(client, target, lp->channel, &operoverride))
+			whois_add_membership(client, target, name, mlen, len, lp, operoverride);
+	}
+}
+
+/** Get the cached list of public channels of 'target',
+ * rendering it if needed.
+ */
+static WhoisChannels *whois_channels_public(Client *target)
+{
+	WhoisChannels *wc = WHOIS_CHANNELS(target);
+	Membership *lp;
+	char *single, *multi;
+	int n = 0;
+	int size = 1;
+
+	if (wc &&
+	    (wc->channels_version == target->user->channels_version) &&
+	    (wc->visibility_version == channel_visibility_version))
+	{
+		return wc;
+	}
+
+	whois_channels_md_free(&moddata_client(target, whois_channels_md));
+
+	/* Room for each channel name, prefixes and a space */
+	for (lp = target->user->channel; lp; lp = lp->next_channel)
+		size += strlen(lp->channel->chname) + 6;
+
+	wc = safe_alloc(sizeof(WhoisChannels));
+	wc->channels_version = target->user->channels_version;
+	wc->visibility_version = channel_visibility_version;
+	wc->size = size;
+	single = wc->single = safe_alloc(size);
+	multi = wc->multi = safe_alloc(size);
+	wc->channels = safe_alloc(size * sizeof(Channel *));
+	module_memory_account(whois_module, sizeof(WhoisChannels) + size * 2 + size * sizeof(Channel *));
+
+	for (lp = target->user->channel; lp; lp = lp->next_channel)
+	{
+		if (!PubChannel(lp->channel))
+			continue;
+		wc->channels[n++] = lp->channel;
+		single = whois_channel_prefix(single, lp->flags, 0);
+		strcpy(single, lp->channel->chname);
+		single += strlen(single);
+		*single++ = ' ';
+		multi = whois_channel_prefix(multi, lp->flags, 1);
+		strcpy(multi, lp->channel->chname);
+		multi += strlen(multi);
+		*multi++ = ' ';
+	}
+
+	moddata_client(target, whois_channels_md).ptr = wc;
+	return wc;
+}
+
+/** The channel list of 'target' for a regular user.
+ * The public channels come from the cache, only the other
+ * channels that 'client' shares with 'target' are checked.
+ */
+static void whois_channels_cached(Client *client, Client *target, char *name, int mlen, int *len)
+{
+	WhoisChannels *wc = whois_channels_public(target);
+	int hooks = Hooks[HOOKTYPE_SEE_CHANNEL_IN_WHOIS] ? 1 : 0;
+	Membership *lp, *tlp;
+	char *p, *e;
+	int operoverride;
+	int n = 0;
+
+	for (p = (MyUser(client) && HasCapability(client, "multi-prefix")) ? wc->multi : wc->single;
+	     (e = strchr(p, ' '));
+	     p = e + 1, n++)
+	{
+		if (!hooks || whois_hooks_allow(client, target, wc->channels[n]))
+			whois_add_channel(client, name, mlen, len, p, e - p);
+	}
+
+	/* Channels that are not in the cache but that 'client'
+	 * can see because it is on them, eg: secret channels.
+	 */
+	for (lp = client->user->channel; lp; lp = lp->next_channel)
+	{
+		if (PubChannel(lp->channel))
+			continue; /* already handled above */
+		if (lp->channel->users < target->user->joined)
+			tlp = find_member_link(lp->channel->members, target);
+		else
+			tlp = find_membership_link(target->user->channel, lp->channel);
+		if (tlp && whois_see_channel(client, target, lp->channel, &operoverride))
+			whois_add_membership(client, target, name, mlen, len, tlp, operoverride);
+	}
+}
@@ -244,8 +244,6 @@ CMD_FUNC(cmd_whox)
 	
 		while (*s)
 		{
-			int i;
-
 			switch (*s)
 			{
 				case '+':
@@ -266,14 +264,7 @@ CMD_FUNC(cmd_whox)
 			else
 				umodes = &fmt.noumodes;
 
-			for (i = 0; i <= Usermode_highest; i++)
-			{
-				if (*s == Usermode_Table[i].flag)
-				{
-					*umodes |= Usermode_Table[i].mode;
-					break;
-				}
-			}
+			*umodes |= find_user_mode(*s);
 			s++;
 		}
 
@@ -313,7 +304,7 @@ CMD_FUNC(cmd_whox)
 		Hook *h;
 
 		isinvis = IsInvisible(acptr);
-		for (lp = acptr->user->channel; lp; lp = lp->next)
+		for (lp = acptr->user->channel; lp; lp = lp->next_channel)
 		{
 			member = IsMember(client, lp->channel);
 
@@ -461,7 +452,7 @@ static void who_common_channel(Client *client, Channel *channel,
 	Hook *h;
 	int i = 0;
 
-	for (cm = channel->members; cm; cm = cm->next)
+	for (cm = channel->members; cm; cm = cm->next_member)
 	{
 		acptr = cm->client;
 
@@ -521,7 +512,7 @@ static void who_global(Client *client, char *mask, int operspy, struct who_forma
 	{
 		Membership *lp;
 
-		for (lp = client->user->channel; lp; lp = lp->next)
+		for (lp = client->user->channel; lp; lp = lp->next_channel)
 			who_common_channel(client, lp->channel, mask, &maxmatches, fmt);
 	}
 
@@ -578,7 +569,7 @@ static void do_who_on_channel(Client *client, Channel *channel,
 	Hook *h;
 	int i = 0;
 
-	for (cm = channel->members; cm; cm = cm->next)
+	for (cm = channel->members; cm; cm = cm->next_member)
 	{
 		Client *acptr = cm->client;
 
@@ -737,7 +728,7 @@ static void do_who(Client *client, Client *acptr, Channel *channel, struct who_f
  
 	if (fmt->fields == 0)
 	{
-		char *host;
+		const char *host;
 		if (fmt->show_realhost)
 			host = acptr->user->realhost;
 		else if (fmt->show_ip)
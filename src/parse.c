@@ -35,6 +35,7 @@ static void remove_unknown(Client *, char *);
 static void parse2(Client *client, Client **fromptr, MessageTag *mtags, char *ch);
 static void parse_addlag(Client *client, int cmdbytes);
 static int client_lagged_up(Client *client);
+static void parse_client_queued_budget(Client *client);
 
 /** Put a packet in the client receive queue and process the data (if
  * the 'fake lag' rules permit doing so).
@@ -50,7 +51,12 @@ static int client_lagged_up(Client *client);
  */
 int process_packet(Client *client, char *readbuf, int length, int killsafely)
 {
-	dbuf_put(&client->local->recvQ, readbuf, length);
+	if (IsZipIn(client))
+	{
+		if (!zip_input(client, readbuf, length))
+			return 0;
+	} else
+		dbuf_put(&client->local->recvQ, readbuf, length);
 
 	/* parse some of what we have (inducing fakelag, etc) */
 	parse_client_queued(client);
@@ -91,11 +97,25 @@ int process_packet(Client *client, char *readbuf, int length, int killsafely)
 }
 
 /** Parse any queued data for 'client', if permitted.
+ * At most get_io_line_budget() lines are parsed, anything
+ * that is left is handled later from process_clients().
  * @param client	The client.
  */
 void parse_client_queued(Client *client)
+{
+	parse_client_queued_budget(client);
+
+	if (!IsDead(client) && !IsAuthPending(client) && !client->local->spamfilter_request &&
+	    DBufLength(&client->local->recvQ))
+	{
+		io_runqueue_add(client);
+	}
+}
+
+static void parse_client_queued_budget(Client *client)
 {
 	int dolen = 0;
+	int budget;
 	char buf[READBUFSIZE];
 
 	if (IsDNSLookup(client))
@@ -104,14 +124,27 @@ void parse_client_queued(Client *client)
 	if (IsIdentLookup(client))
 		return; /* we delay processing of data until identd has replied */
 
+	if (IsAuthPending(client))
+		return; /* we delay processing of data until the auth thread has verified the password */
+
+	if (client->local->spamfilter_request)
+		return; /* we delay processing of data until the spamfilter thread has a verdict */
+
 	if (!IsUser(client) && !IsServer(client) && (iConf.handshake_delay > 0) &&
 	    (TStime() - client->local->firsttime < iConf.handshake_delay))
 	{
 		return; /* we delay processing of data until set::handshake-delay is reached */
 	}
 
+	budget = get_io_line_budget(client);
 	while (DBufLength(&client->local->recvQ) && !client_lagged_up(client))
 	{
+		if (budget-- <= 0)
+		{
+			io_backlog = 1;
+			return;
+		}
+
 		dolen = dbuf_getmsg(&client->local->recvQ, buf);
 
 		if (dolen == 0)
@@ -119,7 +152,8 @@ void parse_client_queued(Client *client)
 
 		dopacket(client, buf, dolen);
 		
-		if (IsDead(client))
+		/* Stop if the command is waiting for an auth or spamfilter thread */
+		if (IsDead(client) || IsAuthPending(client) || client->local->spamfilter_request)
 			return;
 	}
 }
@@ -212,6 +246,8 @@ void parse(Client *cptr, char *buffer, int length)
 	for (i = 0; i < MAXPARA+2; i++)
 		para[i] = (char *)DEADBEEF_ADDR;
 
+	latency_trace_start(cptr);
+
 	/* First, skip any whitespace */
 	for (ch = buffer; *ch == ' '; ch++)
 		;
@@ -227,6 +263,8 @@ void parse(Client *cptr, char *buffer, int length)
 
 	parse2(cptr, &from, mtags, ch);
 
+	latency_trace_end();
+
 	if (IsDead(cptr))
 		RunHook3(HOOKTYPE_POST_COMMAND, NULL, mtags, ch);
 	else
@@ -357,23 +395,11 @@ static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, char *ch)
 	else
 	{
 		/* Command (eg: PRIVMSG) */
-		int flags = 0;
+		int flags;
 		if (s)
 			*s++ = '\0';
 
-		/* Set the appropriate flags for the command lookup */
-		if (!IsRegistered(from))
-			flags |= CMD_UNREGISTERED;
-		if (IsUser(from))
-			flags |= CMD_USER;
-		if (IsServer(from))
-			flags |= CMD_SERVER;
-		if (IsShunned(from))
-			flags |= CMD_SHUN;
-		if (IsVirus(from))
-			flags |= CMD_VIRUS;
-		if (IsOper(from))
-			flags |= CMD_OPER;
+		flags = command_lookup_flags(from);
 		cmptr = find_command(ch, flags);
 		if (!cmptr || !(cmptr->flags & CMD_NOLAG))
 		{
@@ -492,6 +518,19 @@ static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, char *ch)
 	if (IsUser(cptr) && (cmptr->flags & CMD_RESETIDLE))
 		cptr->local->last = TStime();
 
+	/* With set::spamfilter::async this may be executed later.
+	 * This is done after all the checks above, the fake lag has
+	 * already been added. Once resumed, the command is looked up
+	 * again and executed via do_cmd_resume(). The labeled-response
+	 * context goes with it, so the POST_COMMAND hook that runs when
+	 * we return does not ACK the label.
+	 */
+	if (SPAMFILTER_ASYNC && (from == cptr) && spamfilter_async_park(from, cmptr->cmd, mtags, i, para))
+		return;
+
+	if (latency_tracing)
+		latency_trace_mark(LATENCY_STAGE_DISPATCH);
+
 #ifndef DEBUGMODE
 	if (cmptr->flags & CMD_ALIAS)
 	{
@@ -525,6 +564,26 @@ static void parse2(Client *cptr, Client **fromptr, MessageTag *mtags, char *ch)
 #endif
 }
 
+/** The CMD_* flags to use in find_command() for a command from 'client' */
+int command_lookup_flags(Client *client)
+{
+	int flags = 0;
+
+	if (!IsRegistered(client))
+		flags |= CMD_UNREGISTERED;
+	if (IsUser(client))
+		flags |= CMD_USER;
+	if (IsServer(client))
+		flags |= CMD_SERVER;
+	if (IsShunned(client))
+		flags |= CMD_SHUN;
+	if (IsVirus(client))
+		flags |= CMD_VIRUS;
+	if (IsOper(client))
+		flags |= CMD_OPER;
+	return flags;
+}
+
 /** Ban user that is "flooding from an unknown connection".
  * This is basically a client sending lots of data but not registering.
  * Note that "lots" in terms of IRC is a few KB's, since more is rather unusual.
@@ -0,0 +1,364 @@
+/************************************************************************
+ * UnrealIRCd - Unreal Internet Relay Chat Daemon - src/proxy.c
+ * (c) 2020- Bram Matthys and The UnrealIRCd team
+ *
+ * See file AUTHORS in IRC package for additional names of
+ * the programmers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief PROXY protocol version 2 (listen::options::proxy).
+ *
+ * A load balancer or TLS-terminating front end, such as HAProxy,
+ * nginx or stunnel, connects to a listen block with this option and
+ * sends a binary header before anything else. The header contains
+ * the real IP and port of the client and, in TLV's (type-length-value
+ * fields), whether the client used TLS, with which protocol, cipher
+ * and server name (SNI) and, optionally, the certificate fingerprint.
+ *
+ * The header is read exactly up to its end, so whatever follows (a TLS
+ * handshake or plain IRC traffic) is left in the socket for the normal
+ * handshake code. The IP based checks that are normally done right
+ * after accept() are delayed until the header has been read.
+ *
+ * The header is trusted blindly, so such a listener must only be
+ * reachable by the proxy, eg: on 127.0.0.1 or a UNIX socket.
+ */
+
+#include "unrealircd.h"
+
+/** Fixed part of the header: signature, version/command, family, length */
+#define PP2_SIGNATURE		"\r\n\r\n\0\r\nQUIT\n"
+#define PP2_SIGNATURE_LEN	12
+#define PP2_HEADER_LEN		16
+
+#define PP2_VERSION		0x20
+#define PP2_CMD_LOCAL		0x00
+#define PP2_CMD_PROXY		0x01
+
+#define PP2_FAM_UNSPEC		0x00
+#define PP2_FAM_INET		0x10
+#define PP2_FAM_INET6		0x20
+#define PP2_FAM_UNIX		0x30
+
+/** Size of the address block per family (source and destination address and port) */
+#define PP2_ADDR_INET_LEN	12
+#define PP2_ADDR_INET6_LEN	36
+#define PP2_ADDR_UNIX_LEN	216
+
+#define PP2_TYPE_AUTHORITY	0x02
+#define PP2_TYPE_SSL		0x20
+#define PP2_SUBTYPE_SSL_VERSION	0x21
+#define PP2_SUBTYPE_SSL_CIPHER	0x23
+/** Our own type (from the range reserved for custom use):
+ * the SHA256 fingerprint of the client certificate in hex,
+ * the same format as the "certfp" moddata.
+ */
+#define PP2_TYPE_CERTFP		0xE0
+
+/** Bit in the client field of PP2_TYPE_SSL: the client connected over TLS */
+#define PP2_CLIENT_SSL		0x01
+
+struct ProxyHeader {
+	unsigned char buf[PROXY_HEADER_MAX];	/**< The header, as far as it was read */
+	int len;				/**< Number of bytes in buf */
+};
+
+/** Information from the TLV's of a header */
+typedef struct ProxyInfo {
+	int tls;			/**< Client connected to the proxy over TLS */
+	char tls_version[32];		/**< TLS protocol, eg "TLSv1.3" */
+	char tls_cipher[128];		/**< TLS cipher, eg "TLS_AES_256_GCM_SHA384" */
+	char sni[HOSTLEN+1];		/**< Server name (SNI) the client asked for */
+	char certfp[SHA256_DIGEST_LENGTH*2+1];	/**< Fingerprint of the client certificate */
+} ProxyInfo;
+
+static void proxy_header_read(int fd, int revents, void *data);
+
+/** Start reading the PROXY protocol header of a new connection.
+ * Called from add_connection() instead of starting the handshake.
+ */
+void proxy_start(Client *client)
+{
+	client->local->proxy = safe_alloc(sizeof(ProxyHeader));
+	fd_setselect(client->local->fd, FD_SELECT_READ, proxy_header_read, client);
+}
+
+/** Free the PROXY protocol header of 'client', if any */
+void proxy_free(Client *client)
+{
+	safe_free(client->local->proxy);
+}
+
+static void proxy_error(Client *client, char *reason)
+{
+	fd_setselect(client->local->fd, FD_SELECT_READ, NULL, client);
+	dead_socket(client, reason);
+}
+
+/** Length of the header after the fixed part (address and TLV's) */
+static int proxy_header_length(ProxyHeader *proxy)
+{
+	return (proxy->buf[14] << 8) | proxy->buf[15];
+}
+
+/** Copy a TLV value to a nul-terminated string, truncating it if needed */
+static void proxy_tlv_string(char *buf, size_t bufsize, unsigned char *value, int len)
+{
+	if (len > (int)bufsize - 1)
+		len = bufsize - 1;
+	memcpy(buf, value, len);
+	buf[len] = '\0';
+}
+
+/** Parse the TLV's between 'p' and 'end'.
+ * @returns 1 on success, 0 if the TLV's are malformed.
+ */
+static int proxy_parse_tlvs(unsigned char *p, unsigned char *end, ProxyInfo *info)
+{
+	unsigned char *value;
+	int type, len;
+	char *s;
+
+	while (p < end)
+	{
+		if (p + 3 > end)
+			return 0;
+		type = p[0];
+		len = (p[1] << 8) | p[2];
+		value = p + 3;
+		if (value + len > end)
+			return 0;
+
+		switch (type)
+		{
+			case PP2_TYPE_AUTHORITY:
+				proxy_tlv_string(info->sni, sizeof(info->sni), value, len);
+				break;
+			case PP2_TYPE_SSL:
+				/* 1 byte client flags, 4 bytes verify result, then sub-TLV's */
+				if (len < 5)
+					return 0;
+				if (value[0] & PP2_CLIENT_SSL)
+					info->tls = 1;
+				if (!proxy_parse_tlvs(value + 5, value + len, info))
+					return 0;
+				break;
+			case PP2_SUBTYPE_SSL_VERSION:
+				proxy_tlv_string(info->tls_version, sizeof(info->tls_version), value, len);
+				break;
+			case PP2_SUBTYPE_SSL_CIPHER:
+				proxy_tlv_string(info->tls_cipher, sizeof(info->tls_cipher), value, len);
+				break;
+			case PP2_TYPE_CERTFP:
+				if (len != SHA256_DIGEST_LENGTH*2)
+					break;
+				proxy_tlv_string(info->certfp, sizeof(info->certfp), value, len);
+				for (s = info->certfp; *s; s++)
+				{
+					if (!isxdigit((unsigned char)*s))
+						break;
+					*s = tolower(*s);
+				}
+				if (*s)
+					*info->certfp = '\0'; /* not hex, ignore */
+				break;
+			default:
+				/* ALPN, CRC32C, NOOP, UNIQUE_ID, etc. are ignored */
+				break;
+		}
+		p = value + len;
+	}
+	return 1;
+}
+
+/** The complete header has been read: use the addresses and TLS
+ * information in it and continue with the handshake.
+ */
+static void proxy_header_done(Client *client)
+{
+	unsigned char *buf = client->local->proxy->buf;
+	int len = proxy_header_length(client->local->proxy);
+	unsigned char *addr = buf + PP2_HEADER_LEN;
+	char ipbuf[HOSTLEN+1];
+	char *ip = NULL;
+	int port = 0;
+	int addrlen = -1;
+	int family = buf[13] & 0xF0;
+	ProxyInfo info;
+
+	memset(&info, 0, sizeof(info));
+
+	/* A LOCAL command is sent by the proxy for its own health checks.
+	 * For that one, and for unknown families, we keep the address
+	 * of the proxy and ignore the rest of the header.
+	 */
+	if ((buf[12] & 0x0F) == PP2_CMD_PROXY)
+	{
+		switch (family)
+		{
+			case PP2_FAM_INET:
+				addrlen = PP2_ADDR_INET_LEN;
+				if (len < addrlen)
+					break;
+				ip = inetntop(AF_INET, addr, ipbuf, sizeof(ipbuf));
+				port = (addr[8] << 8) | addr[9];
+				break;
+			case PP2_FAM_INET6:
+				addrlen = PP2_ADDR_INET6_LEN;
+				if (len < addrlen)
+					break;
+				ip = inetntop(AF_INET6, addr, ipbuf, sizeof(ipbuf));
+				port = (addr[32] << 8) | addr[33];
+				break;
+			case PP2_FAM_UNIX:
+				/* Client is on the same machine as the proxy */
+				addrlen = PP2_ADDR_UNIX_LEN;
+				break;
+		}
+	}
+	else if ((buf[12] & 0x0F) != PP2_CMD_LOCAL)
+	{
+		proxy_error(client, "Invalid PROXY protocol header (unknown command)");
+		return;
+	}
+
+	if (addrlen > len)
+	{
+		proxy_error(client, "Invalid PROXY protocol header (address too short)");
+		return;
+	}
+
+	if ((addrlen >= 0) && !proxy_parse_tlvs(addr + addrlen, addr + len, &info))
+	{
+		proxy_error(client, "Invalid PROXY protocol header (malformed TLV)");
+		return;
+	}
+
+	/* The header is complete: stop reading it, the handshake
+	 * below installs its own read handler.
+	 */
+	fd_setselect(client->local->fd, FD_SELECT_READ, NULL, client);
+	proxy_free(client);
+
+	if (ip)
+	{
+		if (family == PP2_FAM_INET6)
+			SetIPV6(client);
+		else
+			ClearIPV6(client);
+		set_sockhost(client, ip);
+		set_client_ip(client, ip);
+		client->local->port = port;
+	}
+
+	if (info.tls)
+	{
+		char cipher[256];
+
+		if (*info.tls_version && *info.tls_cipher)
+			snprintf(cipher, sizeof(cipher), "%s-%s", info.tls_version, info.tls_cipher);
+		else if (*info.tls_version || *info.tls_cipher)
+			strlcpy(cipher, *info.tls_version ? info.tls_version : info.tls_cipher, sizeof(cipher));
+		else
+			strlcpy(cipher, "unknown", sizeof(cipher));
+		safe_strdup(client->local->proxy_tls_cipher, cipher);
+
+		if (*info.sni)
+			safe_strdup(client->local->sni_servername, info.sni);
+		if (*info.certfp)
+			moddata_client_set(client, "certfp", info.certfp);
+	}
+
+	/* These are normally done in add_connection(), but we only know the IP now */
+
+	/* Tag loopback connections */
+	if (is_loopback_ip(client->ip))
+	{
+		ircstats.is_loc++;
+		SetLocalhost(client);
+	}
+
+	/* Check set::max-unknown-connections-per-ip */
+	if (check_too_many_unknown_connections(client))
+	{
+		exit_client(client, NULL, "Too many unknown connections from your IP");
+		return;
+	}
+
+	/* Check (G)Z-Lines and set::anti-flood::connect-flood */
+	if (check_banned(client, 0))
+		return;
+
+	if (!start_of_client_handshake(client))
+		dead_socket(client, "Could not start TLS handshake");
+}
+
+/** Read (the rest of) the PROXY protocol header.
+ * We never read beyond the end of the header, so this is done in
+ * two steps: first the fixed part, which contains the length, and
+ * then the rest of the header.
+ */
+static void proxy_header_read(int fd, int revents, void *data)
+{
+	Client *client = data;
+	ProxyHeader *proxy = client->local->proxy;
+	int want, n;
+
+	if (proxy->len < PP2_HEADER_LEN)
+		want = PP2_HEADER_LEN;
+	else
+		want = PP2_HEADER_LEN + proxy_header_length(proxy);
+
+	n = READ_SOCK(fd, proxy->buf + proxy->len, want - proxy->len);
+	if (n == 0)
+	{
+		proxy_error(client, "Connection closed while reading the PROXY protocol header");
+		return;
+	}
+	if (n < 0)
+	{
+		if ((ERRNO == P_EWOULDBLOCK) || (ERRNO == P_EAGAIN) || (ERRNO == P_EINTR))
+			return; /* try again later */
+		proxy_error(client, "Read error while reading the PROXY protocol header");
+		return;
+	}
+	proxy->len += n;
+
+	if (proxy->len < PP2_HEADER_LEN)
+		return; /* need more */
+
+	if (proxy->len == PP2_HEADER_LEN)
+	{
+		if (memcmp(proxy->buf, PP2_SIGNATURE, PP2_SIGNATURE_LEN) ||
+		    ((proxy->buf[12] & 0xF0) != PP2_VERSION))
+		{
+			proxy_error(client, "Invalid PROXY protocol header (expected version 2)");
+			return;
+		}
+		if (PP2_HEADER_LEN + proxy_header_length(proxy) > PROXY_HEADER_MAX)
+		{
+			proxy_error(client, "PROXY protocol header too big");
+			return;
+		}
+	}
+
+	if (proxy->len < PP2_HEADER_LEN + proxy_header_length(proxy))
+		return; /* need more */
+
+	proxy_header_done(client);
+}
@@ -1,7 +1,7 @@
 /* License: GPLv1 */
 
 /** @file
- * @brief String cache - only used for server names.
+ * @brief String cache - shared, reference counted strings.
  */
 
 #include "unrealircd.h"
@@ -18,82 +18,144 @@
  * I could have tucked this code into hash.c I suppose but lets keep it
  * separate for now -Dianora
  */
+/*
+ * The same is true for a lot of other strings: IP addresses of users
+ * behind the same gateway, vhosts and cloaked hosts, the setter of
+ * thousands of channel bans (often just "ChanServ"), etc.
+ * So nowadays this is a generic cache of reference counted strings:
+ * scache_add() returns a shared copy of a string and scache_del()
+ * releases it again. Because all equal strings share one pointer,
+ * callers may compare cached strings by pointer.
+ */
 
-#define SCACHE_HASH_SIZE 257
+#define SCACHE_HASH_SIZE 16384
+#define SERVERNAME_HASH_SIZE 256
 
 typedef struct SCACHE SCACHE;
 struct SCACHE {
-	char name[HOSTLEN + 1];
 	SCACHE *next;
+	int refcnt;		/**< Number of users of this string (not used for server names) */
+	char name[1];
 };
 
+/** Strings from scache_add(), case sensitive and reference counted */
 static SCACHE *scache_hash[SCACHE_HASH_SIZE];
+/** Server names from find_or_add(), case insensitive and permanent.
+ * These are kept separate so a server name never ends up sharing an
+ * entry with, say, a vhost that only differs in case.
+ */
+static SCACHE *servername_hash[SERVERNAME_HASH_SIZE];
+static char siphashkey_scache[SIPHASH_KEY_LENGTH];
 
 /*
- * renamed to keep it consistent with the other hash functions -Dianora 
+ * renamed to keep it consistent with the other hash functions -Dianora
  */
 /*
- * orabidoo had named it init_scache_hash(); 
+ * orabidoo had named it init_scache_hash();
  */
 
 void clear_scache_hash_table(void)
 {
 	memset((char *)scache_hash, '\0', sizeof(scache_hash));
+	memset((char *)servername_hash, '\0', sizeof(servername_hash));
+	siphash_generate_key(siphashkey_scache);
 }
 
-static int hash(char *string)
+static int hash(const char *string)
 {
-	int  hash_value;
+	return siphash(string, siphashkey_scache) % SCACHE_HASH_SIZE;
+}
 
-	hash_value = 0;
-	while (*string)
-		hash_value += (*string++ & 0xDF);
+static SCACHE *scache_create(SCACHE **bucket, const char *str)
+{
+	SCACHE *ptr;
+	size_t len = strlen(str);
 
-	return hash_value % SCACHE_HASH_SIZE;
+	ptr = safe_alloc(sizeof(SCACHE) + len);
+	memcpy(ptr->name, str, len + 1);
+	ptr->next = *bucket;
+	*bucket = ptr;
+	return ptr;
 }
 
-/** Add a string to the string cache.
- * this takes a server name, and returns a pointer to the same string
- * (up to case) in the server name token list, adding it to the list if
- * it's not there.  care must be taken not to call this with
- * user-supplied arguments that haven't been verified to be a valid,
- * existing, servername.  use the hash in list.c for those.  -orabidoo
- * @param name	A valid server name
- * @returns Pointer to the server name
+/** Get a shared copy of a string from the string cache.
+ * The string is added to the cache if it is not there yet.
+ * Release it with scache_del() (or the scache_free() macro) when done,
+ * never free() it directly. Also never modify the returned string.
+ * @param str	The string (case sensitive)
+ * @returns Pointer to the cached string
  */
-char *find_or_add(char *name)
+const char *scache_add(const char *str)
 {
-	int  hash_index;
-	SCACHE *ptr, *newptr;
+	int hash_index = hash(str);
+	SCACHE *ptr;
 
-	ptr = scache_hash[hash_index = hash(name)];
-	while (ptr)
+	for (ptr = scache_hash[hash_index]; ptr; ptr = ptr->next)
 	{
-		if (!mycmp(ptr->name, name))
+		if (!strcmp(ptr->name, str))
 		{
-			return (ptr->name);
-		}
-		else
-		{
-			ptr = ptr->next;
+			ptr->refcnt++;
+			return ptr->name;
 		}
 	}
+	ptr = scache_create(&scache_hash[hash_index], str);
+	ptr->refcnt = 1;
+	return ptr->name;
+}
 
-	/*
-	 * not found -- add it 
-	 */
-	if ((ptr = scache_hash[hash_index]))
-	{
-		newptr = scache_hash[hash_index] = safe_alloc(sizeof(SCACHE));
-		strlcpy(newptr->name, name, sizeof(newptr->name));
-		newptr->next = ptr;
-		return (newptr->name);
-	}
-	else
+/** Same as scache_add() but only use the first 'len' characters of 'str'.
+ * This is for strings with a maximum length, such as USERLEN or HOSTLEN.
+ */
+const char *scache_addn(const char *str, size_t len)
+{
+	char buf[512];
+
+	strlcpy(buf, str, MIN(len + 1, sizeof(buf)));
+	return scache_add(buf);
+}
+
+/** Release a string that was returned by scache_add().
+ * The string is freed when nobody uses it anymore.
+ */
+void scache_del(const char *str)
+{
+	int hash_index = hash(str);
+	SCACHE **pptr, *ptr;
+
+	for (pptr = &scache_hash[hash_index]; *pptr; pptr = &(*pptr)->next)
 	{
-		ptr = scache_hash[hash_index] = safe_alloc(sizeof(SCACHE));
-		strlcpy(ptr->name, name, sizeof(newptr->name));
-		ptr->next = (SCACHE *) NULL;
-		return (ptr->name);
+		if ((*pptr)->name == str)
+		{
+			ptr = *pptr;
+			if (--ptr->refcnt > 0)
+				return;
+			*pptr = ptr->next;
+			safe_free(ptr);
+			return;
+		}
 	}
+#ifdef DEBUGMODE
+	abort(); /* Not a string from scache_add() */
+#endif
+}
+
+/** Add a server name to the string cache.
+ * this takes a server name, and returns a pointer to the same string
+ * in the server name token list, adding it to the list if
+ * it's not there.  care must be taken not to call this with
+ * user-supplied arguments that haven't been verified to be a valid,
+ * existing, servername.  use the hash in list.c for those.  -orabidoo
+ * Server names are looked up case insensitive and are never freed.
+ * @param name	A valid server name
+ * @returns Pointer to the server name
+ */
+const char *find_or_add(const char *name)
+{
+	int hash_index = siphash_nocase(name, siphashkey_scache) % SERVERNAME_HASH_SIZE;
+	SCACHE *ptr;
+
+	for (ptr = servername_hash[hash_index]; ptr; ptr = ptr->next)
+		if (!mycmp(ptr->name, name))
+			return ptr->name;
+	return scache_create(&servername_hash[hash_index], name)->name;
 }
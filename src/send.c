@@ -38,6 +38,17 @@ static int vmakebuf_local_withprefix(char *buf, size_t buflen, Client *from, con
 static char sendbuf[2048];
 static char sendbuf2[4096];
 
+/* And these are used for messages to multiple server links, see server_message_format() */
+static char serverbuf[2048];
+static char serverbuf2[4096];
+
+/** A message that is sent to multiple server links */
+typedef struct ServerMessage {
+	MessageTag *mtags;	/**< Message tags, if any */
+	int len;		/**< Length of the message in serverbuf, 0 if not formatted yet */
+	int taglen;		/**< Length of the message in serverbuf2, 0 if not built yet, -1 if no tags, -2 if it can't be sent */
+} ServerMessage;
+
 /** This is used to ensure no duplicate messages are sent
  * to the same server uplink/direction. In send functions
  * that deliver to multiple users or servers the value is
@@ -110,6 +121,10 @@ int send_queued(Client *to)
 	if (IsDeadSocket(to))
 		return -1;
 
+	/* Compressed link: first flush whatever is still in the compressor */
+	if (IsZipOut(to))
+		zip_flush(to);
+
 	while (DBufLength(&to->local->sendQ) > 0)
 	{
 		block = container_of(to->local->sendQ.dbuf_list.next, dbufbuf, dbuf_node);
@@ -124,6 +139,8 @@ int send_queued(Client *to)
 		}
 		dbuf_delete(&to->local->sendQ, rlen);
 		to->local->lastsq = DBufLength(&to->local->sendQ) / 1024;
+		if (to->local->latency_trace_bytes)
+			latency_trace_written(to, rlen);
 		if (want_read)
 		{
 			/* SSL_write indicated that it cannot write data at this
@@ -158,12 +175,71 @@ int send_queued(Client *to)
 /** Mark "to" with "there is data to be send" */
 void mark_data_to_send(Client *to)
 {
-	if (!IsDeadSocket(to) && (to->local->fd >= 0) && (DBufLength(&to->local->sendQ) > 0))
+	if (!IsDeadSocket(to) && (to->local->fd >= 0) && ((DBufLength(&to->local->sendQ) > 0) || IsZipOut(to)))
 	{
 		fd_setselect(to->local->fd, FD_SELECT_WRITE, send_queued_cb, to);
 	}
 }
 
+/** Prepare a message that is sent to multiple server links.
+ * The message is formatted only once into 'serverbuf', and the
+ * variant with message tags is built on first use into 'serverbuf2'.
+ * All links with the same MTAGS support then share these bytes,
+ * see server_message_send().
+ */
+static void server_message_format(ServerMessage *sm, MessageTag *mtags, const char *pattern, va_list vl)
+{
+	int len;
+
+	ircvsnprintf(serverbuf, sizeof(serverbuf), pattern, vl);
+	len = strlen(serverbuf);
+	if (!len || (serverbuf[len - 1] != '\n'))
+		ADD_CRLF(serverbuf, len);
+	sm->mtags = mtags;
+	sm->len = len;
+	sm->taglen = 0;
+}
+
+/** Build the message tag variant of a message prepared by server_message_format() */
+static void server_message_add_tags(ServerMessage *sm, Client *to)
+{
+	char *mtags_str = mtags_to_string(sm->mtags, to);
+
+	if (BadPtr(mtags_str))
+	{
+		sm->taglen = -1;
+		return;
+	}
+	if (strlen(mtags_str) + 1 > 500)
+	{
+		/* Same limit as in sendbufto_one() */
+		ircd_log(LOG_ERROR, "[BUG] server_message_add_tags(): Spec-wise legal, but massively oversized message-tag (len %d)",
+		         (int)strlen(mtags_str) + 1);
+		sm->taglen = -2;
+		return;
+	}
+	snprintf(serverbuf2, sizeof(serverbuf2), "@%s %s", mtags_str, serverbuf);
+	sm->taglen = strlen(serverbuf2);
+}
+
+/** Send a message prepared by server_message_format() to a server link */
+static void server_message_send(ServerMessage *sm, Client *to)
+{
+	if (sm->mtags && SupportMTAGS(to->direction))
+	{
+		if (sm->taglen == 0)
+			server_message_add_tags(sm, to);
+		if (sm->taglen == -2)
+			return;
+		if (sm->taglen > 0)
+		{
+			sendbufto_one(to, serverbuf2, sm->taglen);
+			return;
+		}
+	}
+	sendbufto_one(to, serverbuf, sm->len);
+}
+
 /** Send a message to a single client.
  * @param to		The client to send to
  * @param mtags		Any message tags associated with this message (can be NULL)
@@ -204,6 +280,69 @@ void vsendto_one(Client *to, MessageTag *mtags, const char *pattern, va_list vl)
 	}
 }
 
+/** Commands that may be dropped for clients in a lossy class */
+static char *lossy_commands[] = {
+	"JOIN", "PART", "QUIT", "AWAY", "TAGMSG", "CHGHOST", "SETNAME", "ACCOUNT", NULL
+};
+
+/** Is 'msg' low priority traffic that may be dropped for 'to'
+ * when its sendq is above class::soft-sendq (class::options::lossy)?
+ * This is JOIN/PART/QUIT/MODE noise, away-notify and the like,
+ * never anything that was caused by the client itself.
+ * A MODE is only dropped if it is a channel mode that does not
+ * mention the client, so user modes and eg. +o/+b on the client
+ * itself always get through.
+ */
+static int lossy_droppable(Client *to, char *msg)
+{
+	char *p = msg;
+	int i, n;
+
+	/* Skip message tags */
+	if (*p == '@')
+	{
+		p = strchr(p, ' ');
+		if (!p)
+			return 0;
+		p++;
+	}
+
+	/* Never drop anything without a prefix or with the client as source */
+	if (*p != ':')
+		return 0;
+	p++;
+	n = strlen(to->name);
+	if (!strncasecmp(p, to->name, n) && ((p[n] == '!') || (p[n] == ' ')))
+		return 0;
+	p = strchr(p, ' ');
+	if (!p)
+		return 0;
+	p++;
+
+	if (!strncmp(p, "MODE ", 5))
+	{
+		p += 5;
+		if (!IsChannelName(p))
+			return 0;
+		while ((p = strchr(p, ' ')))
+		{
+			p++;
+			if (*p == ':')
+				p++;
+			if (!strncasecmp(p, to->name, n) && ((p[n] == ' ') || (p[n] == '\r') || (p[n] == '\n') || (p[n] == '\0')))
+				return 0;
+		}
+		return 1;
+	}
+
+	for (i = 0; lossy_commands[i]; i++)
+	{
+		n = strlen(lossy_commands[i]);
+		if (!strncmp(p, lossy_commands[i], n) && (p[n] == ' '))
+			return 1;
+	}
+	return 0;
+}
 
 /** Send a line buffer to the client.
  * This function is used (usually indirectly) for pretty much all
@@ -334,6 +473,18 @@ void sendbufto_one(Client *to, char *msg, unsigned int quick)
 	}
 #endif
 
+	/* Lossy class: above the soft limit we drop low priority traffic,
+	 * so only the hard limit (class::sendq) disconnects the client.
+	 */
+	if (IsLossyClass(to) && !IsServer(to) &&
+	    (DBufLength(&to->local->sendQ) > get_soft_sendq(to)) &&
+	    lossy_droppable(to, msg))
+	{
+		to->local->lossy_drops++;
+		ircstats.is_lossy++;
+		return;
+	}
+
 	if (DBufLength(&to->local->sendQ) > get_sendq(to))
 	{
 		if (IsServer(to))
@@ -344,7 +495,19 @@ void sendbufto_one(Client *to, char *msg, unsigned int quick)
 		return;
 	}
 
-	dbuf_put(&to->local->sendQ, msg, len);
+	if (memory_pressure_sendq_exceeded(to))
+	{
+		dead_socket(to, "Max SendQ exceeded (server is low on memory)");
+		return;
+	}
+
+	if (IsZipOut(to))
+		zip_output(to, msg, len);
+	else
+		dbuf_put(&to->local->sendQ, msg, len);
+
+	if (latency_tracing)
+		latency_trace_enqueue(to);
 
 	/*
 	 * Update statistics. The following is slightly incorrect
@@ -362,6 +525,37 @@ void sendbufto_one(Client *to, char *msg, unsigned int quick)
 	mark_data_to_send(to);
 }
 
+/** Returns 1 if the channel member should get a channel message
+ * with the specified 'prefix' and 'sendflags' (see sendto_channel).
+ */
+static int member_wants_channel_message(Member *lp, int prefix, int sendflags)
+{
+	Client *acptr = lp->client;
+
+	/* Don't send to deaf clients (unless 'senddeaf' is set) */
+	if (IsDeaf(acptr) && (sendflags & SKIP_DEAF))
+		return 0;
+	/* Don't send to NOCTCP clients */
+	if ((sendflags & SKIP_CTCP) && HasUserMode(acptr, 'T'))
+		return 0;
+	/* Now deal with 'prefix' (if non-zero) */
+	if (!prefix)
+		return 1;
+	if ((prefix & PREFIX_HALFOP) && (lp->flags & CHFL_HALFOP))
+		return 1;
+	if ((prefix & PREFIX_VOICE) && (lp->flags & CHFL_VOICE))
+		return 1;
+	if ((prefix & PREFIX_OP) && (lp->flags & CHFL_CHANOP))
+		return 1;
+#ifdef PREFIX_AQ
+	if ((prefix & PREFIX_ADMIN) && (lp->flags & CHFL_CHANADMIN))
+		return 1;
+	if ((prefix & PREFIX_OWNER) && (lp->flags & CHFL_CHANOWNER))
+		return 1;
+#endif
+	return 0;
+}
+
 /** A single function to send data to a channel.
  * Previously there were 6, now there is 1. This means there
  * are likely some parameters that you will pass as NULL or 0
@@ -388,67 +582,97 @@ void sendto_channel(Channel *channel, Client *from, Client *skip,
 {
 	va_list vl;
 	Member *lp;
+	Link *dir;
 	Client *acptr;
+	ServerMessage sm;
+	int count_traffic = Hooks[HOOKTYPE_CHANNEL_TRAFFIC] ? 1 : 0;
+	int lines = 0, bytes = 0;
 
+	sm.len = 0;
 	++current_serial;
-	for (lp = channel->members; lp; lp = lp->next)
+
+	if (sendflags & SEND_LOCAL)
 	{
-		acptr = lp->client;
+		/* Local members */
+		for (lp = channel->local_members; lp; lp = lp->next_local)
+		{
+			acptr = lp->client;
 
-		/* Skip sending to 'skip' */
-		if ((acptr == skip) || (acptr->direction == skip))
-			continue;
-		/* Don't send to deaf clients (unless 'senddeaf' is set) */
-		if (IsDeaf(acptr) && (sendflags & SKIP_DEAF))
-			continue;
-		/* Don't send to NOCTCP clients */
-		if (has_user_mode(acptr, 'T') && (sendflags & SKIP_CTCP))
-			continue;
-		/* Now deal with 'prefix' (if non-zero) */
-		if (!prefix)
-			goto good;
-		if ((prefix & PREFIX_HALFOP) && (lp->flags & CHFL_HALFOP))
-			goto good;
-		if ((prefix & PREFIX_VOICE) && (lp->flags & CHFL_VOICE))
-			goto good;
-		if ((prefix & PREFIX_OP) && (lp->flags & CHFL_CHANOP))
-			goto good;
-#ifdef PREFIX_AQ
-		if ((prefix & PREFIX_ADMIN) && (lp->flags & CHFL_CHANADMIN))
-			goto good;
-		if ((prefix & PREFIX_OWNER) && (lp->flags & CHFL_CHANOWNER))
-			goto good;
-#endif
-		continue;
-good:
-		/* Now deal with 'clicap' (if non-zero) */
-		if (clicap && MyUser(acptr) && !HasCapabilityFast(acptr, clicap))
-			continue;
+			/* Skip sending to 'skip' */
+			if (acptr == skip)
+				continue;
+			if (!member_wants_channel_message(lp, prefix, sendflags))
+				continue;
+			/* Now deal with 'clicap' (if non-zero) */
+			if (clicap && !HasCapabilityFast(acptr, clicap))
+				continue;
 
-		if (MyUser(acptr))
-		{
-			/* Local client */
-			if (sendflags & SEND_LOCAL)
+			va_start(vl, pattern);
+			vsendto_prefix_one(acptr, from, mtags, pattern, vl);
+			va_end(vl);
+			if (count_traffic)
 			{
-				va_start(vl, pattern);
-				vsendto_prefix_one(acptr, from, mtags, pattern, vl);
-				va_end(vl);
+				lines++;
+				bytes += strlen(sendbuf);
 			}
 		}
-		else
+	}
+
+	if (sendflags & SEND_REMOTE)
+	{
+		if (prefix)
 		{
-			/* Remote client */
-			if (sendflags & SEND_REMOTE)
+			/* Only send to the server links that have a member with this prefix */
+			for (lp = channel->members; lp; lp = lp->next_member)
 			{
+				acptr = lp->client;
+
+				if (MyConnect(acptr))
+					continue; /* local members are dealt with above */
+				if ((acptr == skip) || (acptr->direction == skip))
+					continue;
+				if (!member_wants_channel_message(lp, prefix, sendflags))
+					continue;
 				/* Message already sent to remote link? */
-				if (acptr->direction->local->serial != current_serial)
+				if (acptr->direction->local->serial == current_serial)
+					continue;
+
+				if (!sm.len)
 				{
 					va_start(vl, pattern);
-					vsendto_prefix_one(acptr, from, mtags, pattern, vl);
+					server_message_format(&sm, mtags, pattern, vl);
 					va_end(vl);
+				}
+				server_message_send(&sm, acptr->direction);
 
-					acptr->direction->local->serial = current_serial;
+				acptr->direction->local->serial = current_serial;
+				lines++;
+				bytes += sm.len;
+			}
+		} else {
+			/* Send once to each server link that has members in the channel.
+			 * Deaf and +T users are filtered by their own server.
+			 */
+			for (dir = channel->member_directions; dir; dir = dir->next)
+			{
+				acptr = dir->value.client;
+
+				if (acptr == skip)
+					continue;
+				if (acptr->local->serial == current_serial)
+					continue;
+
+				if (!sm.len)
+				{
+					va_start(vl, pattern);
+					server_message_format(&sm, mtags, pattern, vl);
+					va_end(vl);
 				}
+				server_message_send(&sm, acptr);
+
+				acptr->local->serial = current_serial;
+				lines++;
+				bytes += sm.len;
 			}
 		}
 	}
@@ -470,15 +694,27 @@ good:
 					continue; /* still obey this rule.. */
 				if (acptr->direction->local->serial != current_serial)
 				{
-					va_start(vl, pattern);
-					vsendto_prefix_one(acptr, from, mtags, pattern, vl);
-					va_end(vl);
+					if (!sm.len)
+					{
+						va_start(vl, pattern);
+						server_message_format(&sm, mtags, pattern, vl);
+						va_end(vl);
+					}
+					server_message_send(&sm, acptr->direction);
 
 					acptr->direction->local->serial = current_serial;
+					lines++;
+					bytes += sm.len;
 				}
 			}
 		}
 	}
+
+	/* Fan-out cost, for channel traffic statistics.
+	 * Bytes are counted without message tags.
+	 */
+	if (lines)
+		RunHook4(HOOKTYPE_CHANNEL_TRAFFIC, channel, from, lines, bytes);
 }
 
 /** Send a message to a server, taking into account server options if needed.
@@ -492,15 +728,15 @@ good:
 void sendto_server(Client *one, unsigned long servercaps, unsigned long noservercaps, MessageTag *mtags, FORMAT_STRING(const char *format), ...)
 {
 	Client *acptr;
+	ServerMessage sm;
 
 	/* noone to send to.. */
 	if (list_empty(&server_list))
 		return;
 
+	sm.len = 0;
 	list_for_each_entry(acptr, &server_list, special_node)
 	{
-		va_list vl;
-
 		if (one && acptr == one->direction)
 			continue;
 
@@ -510,9 +746,14 @@ void sendto_server(Client *one, unsigned long servercaps, unsigned long noserver
 		if (noservercaps && CHECKSERVERPROTO(acptr, noservercaps))
 			continue;
 
-		va_start(vl, format);
-		vsendto_one(acptr, mtags, format, vl);
-		va_end(vl);
+		if (!sm.len)
+		{
+			va_list vl;
+			va_start(vl, format);
+			server_message_format(&sm, mtags, format, vl);
+			va_end(vl);
+		}
+		server_message_send(&sm, acptr);
 	}
 }
 
@@ -546,15 +787,12 @@ void sendto_local_common_channels(Client *user, Client *skip, long clicap, Messa
 
 	if (user->user)
 	{
-		for (channels = user->user->channel; channels; channels = channels->next)
+		for (channels = user->user->channel; channels; channels = channels->next_channel)
 		{
-			for (users = channels->channel->members; users; users = users->next)
+			for (users = channels->channel->local_members; users; users = users->next_local)
 			{
 				acptr = users->client;
 
-				if (!MyConnect(acptr))
-					continue; /* only process local clients */
-
 				if (acptr->local->serial == current_serial)
 					continue; /* message already sent to this client */
 
@@ -734,6 +972,196 @@ void sendto_umode_global(int umodes, FORMAT_STRING(const char *pattern), ...)
 	}
 }
 
+/* Snomask subscribers and notice aggregation (set::snomask-aggregation).
+ * During a connect flood or mass kill the 'c', 'F' and 'k' snomasks
+ * can produce thousands of notices per second. Once more than
+ * set::snomask-aggregation::threshold notices per second are sent for
+ * a snomask, the individual notices are replaced by a summary that is
+ * sent every set::snomask-aggregation::interval seconds.
+ */
+
+/** Snomasks that one or more local opers have set.
+ * Bits are added right away by set_snomask() and friends and are only
+ * cleared once per second in snomask_aggregation_check(), so this may
+ * contain snomasks that nobody has anymore, but it never misses one.
+ */
+MODVAR long snomask_subscribed = 0;
+
+typedef struct SnomaskNetwork SnomaskNetwork;
+struct SnomaskNetwork {
+	char name[64];		/**< Network, eg "10.1.0.0/16" */
+	int count;		/**< Number of notices about this network */
+};
+
+typedef struct SnomaskFlood SnomaskFlood;
+struct SnomaskFlood {
+	int rate;		/**< Notices in the current second */
+	int aggregating;	/**< Notices are being replaced by summaries */
+	time_t since;		/**< Start of the current summary interval */
+	int total;		/**< Notices in the current summary interval */
+	SnomaskNetwork networks[SNOMASK_AGGREGATION_NETWORKS];
+	int other;		/**< Notices about other networks (or without an IP) */
+};
+
+static SnomaskFlood snomask_flood[UMODETABLESZ];
+
+/** Send a notice to all local opers that have snomask 'i' (index in Snomask_Table) */
+static void snomask_aggregation_notice(int i, FORMAT_STRING(const char *pattern), ...)
+{
+	va_list vl;
+	Client *acptr;
+	char nbuf[2048];
+
+	va_start(vl, pattern);
+	ircvsnprintf(nbuf, sizeof(nbuf), pattern, vl);
+	va_end(vl);
+
+	list_for_each_entry(acptr, &oper_list, special_node)
+	{
+		if (acptr->user->snomask & Snomask_Table[i].mode)
+			sendnotice(acptr, "%s", nbuf);
+	}
+}
+
+/** Count a notice in the summary, per network of 'ip' */
+static void snomask_aggregation_count(SnomaskFlood *f, const char *ip)
+{
+	unsigned char addr[16];
+	char name[64];
+	int i;
+
+	f->total++;
+
+	if (!ip)
+	{
+		f->other++;
+		return;
+	}
+
+	if (inet_pton(AF_INET, ip, addr) == 1)
+		snprintf(name, sizeof(name), "%d.%d.0.0/16", addr[0], addr[1]);
+	else if (inet_pton(AF_INET6, ip, addr) == 1)
+		snprintf(name, sizeof(name), "%x:%x::/32", (addr[0] << 8) | addr[1], (addr[2] << 8) | addr[3]);
+	else
+	{
+		f->other++;
+		return;
+	}
+
+	for (i = 0; i < SNOMASK_AGGREGATION_NETWORKS; i++)
+	{
+		if (!*f->networks[i].name)
+		{
+			strlcpy(f->networks[i].name, name, sizeof(f->networks[i].name));
+			f->networks[i].count = 1;
+			return;
+		}
+		if (!strcmp(f->networks[i].name, name))
+		{
+			f->networks[i].count++;
+			return;
+		}
+	}
+	f->other++;
+}
+
+/** Start a new summary interval */
+static void snomask_aggregation_reset(SnomaskFlood *f)
+{
+	f->since = TStime();
+	f->total = 0;
+	f->other = 0;
+	memset(f->networks, 0, sizeof(f->networks));
+}
+
+/** Count a server notice and check if it should be aggregated.
+ * @param snomask	The snomask(s) the notice is for
+ * @param ip		The IP address the notice is about (or NULL)
+ * @returns 1 if the notice should not be sent, because it will be
+ *          included in the next summary. 0 if it should be sent.
+ */
+int snomask_aggregate(long snomask, const char *ip)
+{
+	SnomaskFlood *f;
+	int i;
+
+	if (!SNOMASK_AGGREGATION_THRESHOLD)
+		return 0;
+
+	for (i = 0; i <= Snomask_highest; i++)
+		if (Snomask_Table[i].flag && (snomask & Snomask_Table[i].mode))
+			break;
+	if (i > Snomask_highest)
+		return 0;
+
+	f = &snomask_flood[i];
+	f->rate++;
+	if (!f->aggregating)
+	{
+		if (f->rate <= SNOMASK_AGGREGATION_THRESHOLD)
+			return 0;
+		f->aggregating = 1;
+		snomask_aggregation_reset(f);
+		snomask_aggregation_notice(i, "*** Notice flood on snomask %c (more than %d per second), "
+		                              "summarizing these notices every %lds",
+		                              Snomask_Table[i].flag, SNOMASK_AGGREGATION_THRESHOLD,
+		                              SNOMASK_AGGREGATION_INTERVAL);
+	}
+	snomask_aggregation_count(f, ip);
+	return 1;
+}
+
+/** Send the summaries and update the snomask subscribers, every second */
+EVENT(snomask_aggregation_check)
+{
+	Client *acptr;
+	SnomaskFlood *f;
+	char buf[512], tmp[128];
+	long elapsed;
+	int i, n;
+
+	snomask_subscribed = 0;
+	list_for_each_entry(acptr, &oper_list, special_node)
+		snomask_subscribed |= acptr->user->snomask;
+
+	for (i = 0; i <= Snomask_highest; i++)
+	{
+		f = &snomask_flood[i];
+		f->rate = 0;
+		if (!f->aggregating)
+			continue;
+
+		elapsed = TStime() - f->since;
+		if (elapsed < SNOMASK_AGGREGATION_INTERVAL)
+			continue;
+
+		if (f->total > 0)
+		{
+			*buf = '\0';
+			for (n = 0; (n < SNOMASK_AGGREGATION_NETWORKS) && *f->networks[n].name; n++)
+			{
+				snprintf(tmp, sizeof(tmp), "%s%d from %s", *buf ? ", " : "",
+				         f->networks[n].count, f->networks[n].name);
+				strlcat(buf, tmp, sizeof(buf));
+			}
+			if (f->other)
+			{
+				snprintf(tmp, sizeof(tmp), "%s%d other", *buf ? ", " : "", f->other);
+				strlcat(buf, tmp, sizeof(buf));
+			}
+			snomask_aggregation_notice(i, "*** %d notices on snomask %c in the last %lds (%s)",
+			                           f->total, Snomask_Table[i].flag, elapsed, buf);
+		}
+
+		if (f->total / elapsed < SNOMASK_AGGREGATION_THRESHOLD)
+		{
+			f->aggregating = 0;
+			snomask_aggregation_notice(i, "*** Notice flood on snomask %c has ended", Snomask_Table[i].flag);
+		}
+		snomask_aggregation_reset(f);
+	}
+}
+
 /** Send to specified snomask - local / operonly.
  * @param snomask Snomask to send to (can be a bitmask [AND])
  * @param pattern printf-style pattern, followed by parameters.
@@ -745,6 +1173,13 @@ void sendto_snomask(int snomask, FORMAT_STRING(const char *pattern), ...)
 	Client *acptr;
 	char nbuf[2048];
 
+	if (memory_pressure_drop_snomask(snomask))
+		return;
+
+	/* Nobody to send to, or part of a summary? Then don't even format it */
+	if (!(snomask & snomask_subscribed) || snomask_aggregate(snomask, NULL))
+		return;
+
 	va_start(vl, pattern);
 	ircvsnprintf(nbuf, sizeof(nbuf), pattern, vl);
 	va_end(vl);
@@ -768,14 +1203,20 @@ void sendto_snomask_global(int snomask, FORMAT_STRING(const char *pattern), ...)
 	int  i;
 	char nbuf[2048], snobuf[32], *p;
 
+	if (memory_pressure_drop_snomask(snomask))
+		return;
+
 	va_start(vl, pattern);
 	ircvsnprintf(nbuf, sizeof(nbuf), pattern, vl);
 	va_end(vl);
 
-	list_for_each_entry(acptr, &oper_list, special_node)
+	if ((snomask & snomask_subscribed) && !snomask_aggregate(snomask, NULL))
 	{
-		if (acptr->user->snomask & snomask)
-			sendnotice(acptr, "%s", nbuf);
+		list_for_each_entry(acptr, &oper_list, special_node)
+		{
+			if (acptr->user->snomask & snomask)
+				sendnotice(acptr, "%s", nbuf);
+		}
 	}
 
 	/* Build snomasks-to-send-to buffer */
@@ -881,8 +1322,8 @@ static int vmakebuf_local_withprefix(char *buf, size_t buflen, Client *from, con
 
 		if (IsUser(from))
 		{
-			char *username = from->user->username;
-			char *host = GetHost(from);
+			const char *username = from->user->username;
+			const char *host = GetHost(from);
 
 			if (*username)
 			{
@@ -988,12 +1429,19 @@ void sendto_connectnotice(Client *newuser, int disconnect, char *comment)
 	char connect[512], secure[256];
 
 	if (!disconnect)
-	{
 		RunHook(HOOKTYPE_LOCAL_CONNECT, newuser);
 
+	if (memory_pressure_drop_snomask(SNO_CLIENT))
+		return;
+
+	if (!(SNO_CLIENT & snomask_subscribed) || snomask_aggregate(SNO_CLIENT, newuser->ip))
+		return;
+
+	if (!disconnect)
+	{
 		*secure = '\0';
 		if (IsSecure(newuser))
-			snprintf(secure, sizeof(secure), " [secure %s]", SSL_get_cipher(newuser->local->ssl));
+			snprintf(secure, sizeof(secure), " [secure %s]", tls_get_client_cipher(newuser));
 
 		ircsnprintf(connect, sizeof(connect),
 		    "*** Client connecting: %s (%s@%s) [%s] {%s}%s", newuser->name,
@@ -1019,6 +1467,12 @@ void sendto_fconnectnotice(Client *newuser, int disconnect, char *comment)
 	Client *acptr;
 	char connect[512], secure[256];
 
+	if (memory_pressure_drop_snomask(SNO_FCLIENT))
+		return;
+
+	if (!(SNO_FCLIENT & snomask_subscribed) || snomask_aggregate(SNO_FCLIENT, newuser->ip))
+		return;
+
 	if (!disconnect)
 	{
 		*secure = '\0';
@@ -1069,7 +1523,7 @@ void sendto_serv_butone_nickcmd(Client *one, Client *client, char *umodes)
  */
 void sendto_one_nickcmd(Client *server, Client *client, char *umodes)
 {
-	char *vhost;
+	const char *vhost;
 
 	if (!*umodes)
 		umodes = "+";
@@ -49,6 +49,14 @@ MOTDFile smotd;
 MODVAR TKL *tklines[TKLISTLEN];
 /** 2D hash list of TKL entries + IP address */
 MODVAR TKL *tklines_ip_hash[TKLIPHASHLEN1][TKLIPHASHLEN2];
+/** Index of name bans (Q-Lines) without wildcards, by name.
+ * The name bans are also in tklines[], this is linked via tkl->hnext.
+ */
+MODVAR TKL *tklines_name_hash[TKLNAMEHASHLEN];
+/** Name bans (Q-Lines) with wildcards: [0] for nicks and [1] for channels */
+MODVAR TKL *tklines_name_wild[2];
+/** TKL listings that are sent in parts and are still in progress, see tkl_stats_ex() */
+MODVAR TKLStatsCursor *tkl_stats_cursors = NULL;
 int MODVAR spamf_ugly_vchanoverride = 0;
 
 void read_motd(const char *filename, MOTDFile *motd);
@@ -215,9 +223,15 @@ void send_proto(Client *client, ConfigItem_link *aconf)
 		me.id, (long long)TStime());
 
 	/* Third line */
-	sendto_one(client, NULL, "PROTOCTL NICKCHARS=%s CHANNELCHARS=%s",
+	sendto_one(client, NULL, "PROTOCTL NICKCHARS=%s CHANNELCHARS=%s BQUIT",
 		charsys_get_current_languages(),
 		allowed_channelchars_valtostr(iConf.allowed_channelchars));
+
+#ifdef ZIP_LINKS
+	/* Only offer compression if the link block asks for it */
+	if (aconf && (aconf->options & CONNECT_ZIP))
+		sendto_one(client, NULL, "PROTOCTL ZIP=%d", ZIP_DICTIONARY_VERSION);
+#endif
 }
 
 #ifndef IRCDTOTALVERSION
@@ -1278,4 +1292,18 @@ void tkl_init(void)
 {
 	memset(tklines, 0, sizeof(tklines));
 	memset(tklines_ip_hash, 0, sizeof(tklines_ip_hash));
+	memset(tklines_name_hash, 0, sizeof(tklines_name_hash));
+	memset(tklines_name_wild, 0, sizeof(tklines_name_wild));
+}
+
+/** Take a cursor off the tkl_stats_cursors list. This is done by
+ * tkl_stats_ex() when the listing is done, and must be done by the
+ * caller if it stops a listing halfway.
+ */
+void tkl_stats_cursor_end(TKLStatsCursor *cursor)
+{
+	if (!cursor->active)
+		return;
+	DelListItem(cursor, tkl_stats_cursors);
+	cursor->active = 0;
 }
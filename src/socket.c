@@ -36,6 +36,33 @@ void set_sock_opts(int, Client *, int);
 void set_ipv6_opts(int);
 void close_listener(ConfigItem_listen *listener);
 static char readbuf[BUFSIZE];
+
+/** I/O scheduling classes, in order of priority. See process_clients(). */
+typedef enum IOClass {
+	IOCLASS_SERVER = 0,
+	IOCLASS_OPER = 1,
+	IOCLASS_USER = 2,
+	IOCLASS_UNKNOWN = 3,
+} IOClass;
+#define IOCLASS_COUNT	4
+
+static int io_read_budget[IOCLASS_COUNT] = {
+	IO_READ_BUDGET_SERVER, IO_READ_BUDGET_OPER, IO_READ_BUDGET_USER, IO_READ_BUDGET_UNKNOWN
+};
+static int io_line_budget[IOCLASS_COUNT] = {
+	IO_LINE_BUDGET_SERVER, IO_LINE_BUDGET_OPER, IO_LINE_BUDGET_USER, IO_LINE_BUDGET_UNKNOWN
+};
+
+/** Clients with unprocessed data in their recvQ, one queue per IOClass */
+static struct list_head io_runqueue[IOCLASS_COUNT] = {
+	LIST_HEAD_INIT(io_runqueue[0]), LIST_HEAD_INIT(io_runqueue[1]),
+	LIST_HEAD_INIT(io_runqueue[2]), LIST_HEAD_INIT(io_runqueue[3])
+};
+
+/** Set when a client used up its read or line budget, so there is
+ * more work to do right away (see SocketLoop()).
+ */
+MODVAR int io_backlog = 0;
 char zlinebuf[BUFSIZE];
 extern char *version;
 MODVAR time_t last_allinuse = 0;
@@ -218,6 +245,17 @@ static void listener_accept(int listener_fd, int revents, void *data)
 		return;
 	}
 
+	/* set::memory-budget: refuse clients, but still allow servers to link */
+	if (memory_pressure_refuse_connection() && !IsServersOnlyListener(listener))
+	{
+		ircstats.is_ref++;
+		(void)send(cli_fd, "ERROR :Server is low on memory, try again later\r\n", 49, 0);
+
+		fd_close(cli_fd);
+		--OpenFiles;
+		return;
+	}
+
 	/* add_connection() may fail. we just don't care. */
 	add_connection(listener, cli_fd);
 }
@@ -313,10 +351,104 @@ int unreal_listen(ConfigItem_listen *listener, char *ip, int port, int ipv6)
 	return 0;
 }
 
+/** Create a listener on a UNIX socket (listen::file).
+ * @param listener	The listen { } block configuration, listener->ip is the path
+ * @returns 0 on success and <0 on error, just like unreal_listen().
+ */
+int unreal_listen_unix(ConfigItem_listen *listener)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	struct sockaddr_un addr;
+	struct stat st;
+
+	if (listener->fd >= 0)
+		abort(); /* Socket already exists but we are asked to create and listen on one. Bad! */
+
+	if (strlen(listener->ip) >= sizeof(addr.sun_path))
+	{
+		sendto_ops_and_log("Path of UNIX socket %s is too long", listener->ip);
+		return -1;
+	}
+
+	listener->fd = fd_socket(AF_UNIX, SOCK_STREAM, 0, "Listener socket (UNIX)");
+	if (listener->fd < 0)
+	{
+		report_baderror("Cannot open stream socket() %s:%s", NULL);
+		return -1;
+	}
+
+	if (++OpenFiles >= maxclients)
+	{
+		sendto_ops_and_log("No more connections allowed (%s)", listener->ip);
+		fd_close(listener->fd);
+		listener->fd = -1;
+		--OpenFiles;
+		return -1;
+	}
+
+	set_sock_opts(listener->fd, NULL, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, listener->ip, sizeof(addr.sun_path));
+
+	/* Remove the socket file left behind by a previous run,
+	 * but never anything else that happens to be at that path.
+	 */
+	if (lstat(addr.sun_path, &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode))
+		{
+			config_error("listen::file: %s exists and is not a UNIX socket, refusing to remove it",
+				listener->ip);
+			fd_close(listener->fd);
+			listener->fd = -1;
+			--OpenFiles;
+			return -1;
+		}
+		unlink(addr.sun_path);
+	}
+
+	if (bind(listener->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		char buf[512];
+		ircsnprintf(buf, sizeof(buf), "Error binding stream socket to UNIX socket %s", listener->ip);
+		strlcat(buf, " - %s:%s", sizeof(buf));
+		report_baderror(buf, NULL);
+		fd_close(listener->fd);
+		listener->fd = -1;
+		--OpenFiles;
+		return -1;
+	}
+
+	if (listen(listener->fd, LISTEN_SIZE) < 0)
+	{
+		report_error("listen failed for %s:%s", NULL);
+		fd_close(listener->fd);
+		listener->fd = -1;
+		--OpenFiles;
+		return -1;
+	}
+
+	fd_setselect(listener->fd, FD_SELECT_READ, listener_accept, listener);
+
+	return 0;
+#endif
+}
+
 /** Activate a listen { } block */
 int add_listener(ConfigItem_listen *conf)
 {
-	if (unreal_listen(conf, conf->ip, conf->port, conf->ipv6))
+	int ret;
+
+	if (conf->options & LISTENER_UNIX)
+		ret = unreal_listen_unix(conf);
+	else
+		ret = unreal_listen(conf, conf->ip, conf->port, conf->ipv6);
+
+	if (ret)
 	{
 		/* Error is already handled upstream */
 		conf->fd = -2;
@@ -344,10 +476,17 @@ void close_listener(ConfigItem_listen *listener)
 {
 	if (listener->fd >= 0)
 	{
-		ircd_log(LOG_ERROR, "IRCd no longer listening on %s:%d (%s)%s",
-			listener->ip, listener->port,
-			listener->ipv6 ? "IPv6" : "IPv4",
-			listener->options & LISTENER_TLS ? " (SSL/TLS)" : "");
+		if (listener->options & LISTENER_UNIX)
+		{
+			ircd_log(LOG_ERROR, "IRCd no longer listening on UNIX socket %s%s",
+				listener->ip,
+				listener->options & LISTENER_TLS ? " (SSL/TLS)" : "");
+		} else {
+			ircd_log(LOG_ERROR, "IRCd no longer listening on %s:%d (%s)%s",
+				listener->ip, listener->port,
+				listener->ipv6 ? "IPv6" : "IPv4",
+				listener->options & LISTENER_TLS ? " (SSL/TLS)" : "");
+		}
 		fd_close(listener->fd);
 		--OpenFiles;
 	}
@@ -562,8 +701,12 @@ void consider_ident_lookup(Client *client)
 {
 	char buf[BUFSIZE];
 
-	/* If ident checking is disabled or it's an outgoing connect, then no ident check */
-	if ((IDENT_CHECK == 0) || (client->serv && IsHandshake(client)))
+	/* If ident checking is disabled or it's an outgoing connect, then no ident check.
+	 * Also not for UNIX sockets and proxied connections, where we cannot
+	 * reach the ident server of the user.
+	 */
+	if ((IDENT_CHECK == 0) || (client->serv && IsHandshake(client)) ||
+	    (client->local->listener && (client->local->listener->options & (LISTENER_UNIX|LISTENER_PROXY))))
 	{
 		ClearIdentLookupSent(client);
 		ClearIdentLookup(client);
@@ -770,7 +913,7 @@ void set_sock_opts(int fd, Client *client, int ipv6)
  * @param ip	The IP address to check
  * @returns 1 if loopback, 0 if not.
  */
-int is_loopback_ip(char *ip)
+int is_loopback_ip(const char *ip)
 {
 	ConfigItem_listen *e;
 
@@ -819,7 +962,7 @@ char *getpeerip(Client *client, int fd, int *port)
 /** This checks set::max-unknown-connections-per-ip,
  * which is an important safety feature.
  */
-static int check_too_many_unknown_connections(Client *client)
+int check_too_many_unknown_connections(Client *client)
 {
 	int cnt = 1;
 	Client *c;
@@ -828,7 +971,11 @@ static int check_too_many_unknown_connections(Client *client)
 	{
 		list_for_each_entry(c, &unknown_list, lclient_node)
 		{
-			if (!strcmp(client->ip,GetIP(c)))
+			/* A proxied client is already in the list when this is checked.
+			 * Clients that are still waiting for their PROXY header only
+			 * have the IP of the proxy (or none at all), so don't count those.
+			 */
+			if ((c != client) && !c->local->proxy && !memcmp(client->rawip, c->rawip, RAWIPLEN))
 			{
 				cnt++;
 				if (cnt > iConf.max_unknown_connections_per_ip)
@@ -863,7 +1010,10 @@ Client *add_connection(ConfigItem_listen *listener, int fd)
 	if (listener->ipv6)
 		SetIPV6(client);
 
-	ip = getpeerip(client, fd, &port);
+	if (listener->options & LISTENER_UNIX)
+		ip = "127.0.0.1"; /* placeholder, the real IP comes from the PROXY header */
+	else
+		ip = getpeerip(client, fd, &port);
 	
 	if (!ip)
 	{
@@ -885,30 +1035,37 @@ refuse_client:
 
 	/* Fill in sockhost & ip ASAP */
 	set_sockhost(client, ip);
-	safe_strdup(client->ip, ip);
+	set_client_ip(client, ip);
 	client->local->port = port;
 	client->local->fd = fd;
 
-	/* Tag loopback connections */
-	if (is_loopback_ip(client->ip))
+	/* With the PROXY protocol, the IP of the client is only known
+	 * once the header has been read. The tagging and checks below
+	 * are done at that point instead, see proxy_header_done().
+	 */
+	if (!(listener->options & LISTENER_PROXY))
 	{
-		ircstats.is_loc++;
-		SetLocalhost(client);
-	}
+		/* Tag loopback connections */
+		if (is_loopback_ip(client->ip))
+		{
+			ircstats.is_loc++;
+			SetLocalhost(client);
+		}
 
-	/* Check set::max-unknown-connections-per-ip */
-	if (check_too_many_unknown_connections(client))
-	{
-		ircsnprintf(zlinebuf, sizeof(zlinebuf),
-		            "ERROR :Closing Link: [%s] (Too many unknown connections from your IP)\r\n",
-		            client->ip);
-		(void)send(fd, zlinebuf, strlen(zlinebuf), 0);
-		goto refuse_client;
-	}
+		/* Check set::max-unknown-connections-per-ip */
+		if (check_too_many_unknown_connections(client))
+		{
+			ircsnprintf(zlinebuf, sizeof(zlinebuf),
+			            "ERROR :Closing Link: [%s] (Too many unknown connections from your IP)\r\n",
+			            client->ip);
+			(void)send(fd, zlinebuf, strlen(zlinebuf), 0);
+			goto refuse_client;
+		}
 
-	/* Check (G)Z-Lines and set::anti-flood::connect-flood */
-	if (check_banned(client, NO_EXIT_CLIENT))
-		goto refuse_client;
+		/* Check (G)Z-Lines and set::anti-flood::connect-flood */
+		if (check_banned(client, NO_EXIT_CLIENT))
+			goto refuse_client;
+	}
 
 	client->local->listener = listener;
 	if (client->local->listener != NULL)
@@ -920,6 +1077,27 @@ refuse_client:
 
 	list_add(&client->lclient_node, &unknown_list);
 
+	if (listener->options & LISTENER_PROXY)
+	{
+		proxy_start(client);
+		return client;
+	}
+
+	if (!start_of_client_handshake(client))
+		goto refuse_client;
+	return client;
+}
+
+/** Start the handshake of a new incoming connection: the TLS handshake
+ * for listen::options::tls, otherwise the normal client handshake.
+ * @param client	The client
+ * @returns 1 on success, 0 if the client should be refused.
+ */
+int start_of_client_handshake(Client *client)
+{
+	ConfigItem_listen *listener = client->local->listener;
+	int fd = client->local->fd;
+
 	if ((listener->options & LISTENER_TLS) && ctx_server)
 	{
 		SSL_CTX *ctx = listener->ssl_ctx ? listener->ssl_ctx : ctx_server;
@@ -930,7 +1108,7 @@ refuse_client:
 			Debug((DEBUG_DEBUG, "Starting TLS accept handshake for %s", client->local->sockhost));
 			if ((client->local->ssl = SSL_new(ctx)) == NULL)
 			{
-				goto refuse_client;
+				return 0;
 			}
 			SetTLS(client);
 			SSL_set_fd(client->local->ssl, fd);
@@ -942,13 +1120,14 @@ refuse_client:
 				SSL_set_shutdown(client->local->ssl, SSL_RECEIVED_SHUTDOWN);
 				SSL_smart_shutdown(client->local->ssl);
 				SSL_free(client->local->ssl);
-				goto refuse_client;
+				client->local->ssl = NULL;
+				return 0;
 			}
 		}
 	}
 	else
 		start_of_normal_client_handshake(client);
-	return client;
+	return 1;
 }
 
 static int dns_special_flag = 0; /* This is for an "interesting" race condition  very ugly. */
@@ -1010,6 +1189,34 @@ void proceed_normal_client_handshake(Client *client, struct hostent *he)
 	}
 }
 
+static IOClass get_io_class(Client *client)
+{
+	if (IsServer(client) || client->serv)
+		return IOCLASS_SERVER;
+	if (IsUser(client))
+		return IsOper(client) ? IOCLASS_OPER : IOCLASS_USER;
+	return IOCLASS_UNKNOWN;
+}
+
+/** Returns the maximum number of lines that may be parsed for
+ * 'client' in one go, see parse_client_queued().
+ */
+int get_io_line_budget(Client *client)
+{
+	return io_line_budget[get_io_class(client)];
+}
+
+/** Schedule 'client' for processing in the next process_clients() run.
+ * This is called when the recvQ of the client is not empty after
+ * parsing, eg due to fake lag or because the line budget was used up.
+ */
+void io_runqueue_add(Client *client)
+{
+	if (!list_empty(&client->runq_node))
+		return; /* already queued */
+	list_add_tail(&client->runq_node, &io_runqueue[get_io_class(client)]);
+}
+
 /** Read a packet from a client.
  * @param fd		File descriptor
  * @param revents	Read events (ignored)
@@ -1022,6 +1229,7 @@ void read_packet(int fd, int revents, void *data)
 	time_t now = TStime();
 	Hook *h;
 	int processdata;
+	int budget = io_read_budget[get_io_class(client)];
 
 	/* Don't read from dead sockets */
 	if (IsDeadSocket(client))
@@ -1098,6 +1306,7 @@ void read_packet(int fd, int revents, void *data)
 		}
 
 		client->local->lasttime = now;
+		client->local->read_tv = timeofday_tv;
 		if (client->local->lasttime > client->local->since)
 			client->local->since = client->local->lasttime;
 		/* FIXME: Is this correct? I have my doubts. */
@@ -1119,64 +1328,67 @@ void read_packet(int fd, int revents, void *data)
 		/* bail on short read! */
 		if (length < sizeof(readbuf))
 			return;
+
+		/* Read budget used up: leave the rest for the next round.
+		 * The socket is still readable so fd_select() will come back
+		 * to us, but decrypted data buffered by OpenSSL would not
+		 * trigger that, so queue the client to read it from there.
+		 */
+		budget -= length;
+		if (budget <= 0)
+		{
+			io_backlog = 1;
+			if (IsTLS(client) && client->local->ssl && SSL_pending(client->local->ssl))
+				io_runqueue_add(client);
+			return;
+		}
 	}
 }
 
-/** Process input from clients that may have been deliberately delayed due to fake lag */
+/** Process input from clients that may have been deliberately delayed due to fake lag,
+ * or that used up their read or line budget.
+ * Only clients in the run queues are visited, servers first, then opers,
+ * users and finally unknown connections.
+ */
 void process_clients(void)
 {
+	struct list_head queue;
 	Client *client;
-        
-	/* Problem:
-	 * When processing a client, that current client may exit due to eg QUIT.
-	 * Similarly, current->next may be killed due to /KILL.
-	 * When a client is killed, in the past we were not allowed to touch it anymore
-	 * so that was a bit problematic. Now we can touch current->next, but it may
-	 * have been removed from the lclient_list or unknown_list.
-	 * In other words, current->next->next may be NULL even though there are more
-	 * clients on the list.
-	 * This is why the whole thing is wrapped in an additional do { } while() loop
-	 * to make sure we re-run the list if we ended prematurely.
-	 * We could use some kind of 'tagging' to mark already processed clients.
-	 * However, parse_client_queued() already takes care not to read (fake) lagged
-	 * clients, and we don't actually read/recv anything in the meantime, so clients
-	 * in the beginning of the list won't benefit, they won't get higher prio.
-	 * Another alternative is not to run the loop again, but that WOULD be
-	 * unfair to clients later in the list which wouldn't be processed then
-	 * under a heavy (kill) load scenario.
-	 * I think the chosen solution is best, though it remains silly. -- Syzop
-	 */
+	int i;
 
-	do {
-		list_for_each_entry(client, &lclient_list, lclient_node)
-		{
-			if ((client->local->fd >= 0) && DBufLength(&client->local->recvQ) && !IsDead(client))
-			{
-				parse_client_queued(client);
-				if (IsDead(client))
-					break;
-			}
-		}
-	} while(&client->lclient_node != &lclient_list);
+	io_backlog = 0;
 
-	do {
-		list_for_each_entry(client, &unknown_list, lclient_node)
+	for (i = 0; i < IOCLASS_COUNT; i++)
+	{
+		/* Take the whole queue. Clients that still have data left
+		 * afterwards are queued again by parse_client_queued().
+		 * We always take the first entry, so it is no problem if
+		 * a client is removed from the list while we are busy.
+		 */
+		INIT_LIST_HEAD(&queue);
+		list_splice_init(&io_runqueue[i], &queue);
+		while (!list_empty(&queue))
 		{
-			if ((client->local->fd >= 0) && DBufLength(&client->local->recvQ) && !IsDead(client))
-			{
+			client = list_first_entry(&queue, Client, runq_node);
+			list_del_init(&client->runq_node);
+
+			if ((client->local->fd < 0) || IsDead(client) || IsDeadSocket(client))
+				continue;
+
+			/* More data may be waiting in OpenSSL, see read_packet() */
+			if (IsTLS(client) && client->local->ssl && SSL_pending(client->local->ssl))
+				read_packet(client->local->fd, FD_SELECT_READ, client);
+			else if (DBufLength(&client->local->recvQ))
 				parse_client_queued(client);
-				if (IsDead(client) || (client->status > CLIENT_STATUS_UNKNOWN))
-					break;
-			}
 		}
-	} while(&client->lclient_node != &unknown_list);
+	}
 }
 
 /** Returns 4 if 'str' is a valid IPv4 address
  * and 6 if 'str' is a valid IPv6 IP address.
  * Zero (0) is returned in any other case (eg: hostname).
  */
-int is_valid_ip(char *str)
+int is_valid_ip(const char *str)
 {
 	char scratch[64];
 	
@@ -1314,7 +1526,7 @@ static int connect_server_helper(ConfigItem_link *aconf, Client *client)
 	if (strchr(aconf->connect_ip, ':'))
 		SetIPV6(client);
 	
-	safe_strdup(client->ip, aconf->connect_ip);
+	set_client_ip(client, aconf->connect_ip);
 	
 	snprintf(buf, sizeof buf, "Outgoing connection: %s", get_client_name(client, TRUE));
 	client->local->fd = fd_socket(IsIPV6(client) ? AF_INET6 : AF_INET, SOCK_STREAM, 0, buf);
@@ -1475,7 +1687,7 @@ int deliver_it(Client *client, char *str, int len, int *want_read)
 }
 
 /** Initiate an outgoing connection, the actual connect() call. */
-int unreal_connect(int fd, char *ip, int port, int ipv6)
+int unreal_connect(int fd, const char *ip, int port, int ipv6)
 {
 	int n;
 	
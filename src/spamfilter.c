@@ -0,0 +1,472 @@
+/************************************************************************
+ * UnrealIRCd - Unreal Internet Relay Chat Daemon - src/spamfilter.c
+ * (c) 2020- Bram Matthys and The UnrealIRCd team
+ *
+ * See file AUTHORS in IRC package for additional names of
+ * the programmers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief Asynchronous spamfilter evaluation (set::spamfilter::async).
+ *
+ * With many regex spamfilters, running them for every PRIVMSG, NOTICE,
+ * PART, QUIT, AWAY and TOPIC takes a lot of CPU time in the main thread.
+ * When set::spamfilter::async is enabled, such a command from a local
+ * user is parked before it is executed: the stripped text is handed
+ * to a pool of spamfilter threads together with a snapshot of the
+ * regex spamfilters. No further data from the client is processed
+ * in the meantime. Once the verdict is in, the command is executed
+ * again and match_spamfilter() uses the verdict instead of running
+ * the regexes itself. Any action is still taken in the main thread.
+ * If the verdict does not arrive within set::spamfilter::async-timeout
+ * msec, the command is executed anyway and evaluated inline.
+ */
+
+#include "unrealircd.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/** A copy of all regex spamfilters, in the order of the spamfilter list */
+typedef struct SpamfilterSnapshot {
+	int refcnt;		/**< Current snapshot + requests using it (main thread only) */
+	int version;		/**< Value of spamfilter_version when it was created */
+	int targets;		/**< All SPAMF_* targets of the regex spamfilters */
+	int count;		/**< Number of entries in 'match' */
+	Match **match;		/**< Own copies of the regexes, so they can be used by threads */
+} SpamfilterSnapshot;
+
+/** A parked command, waiting for a verdict of a spamfilter thread */
+struct SpamfilterRequest {
+	SpamfilterRequest *next;	/**< For the thread queues */
+	struct list_head parked_node;	/**< For the list of parked requests, until resumed */
+	Client *client;		/**< The client, or NULL if freed or already resumed */
+	SpamfilterSnapshot *snapshot;	/**< The snapshot used by the thread */
+	char *text;		/**< Stripped text to evaluate */
+	char *result;		/**< Result per snapshot entry, filled in by the thread */
+	struct timeval deadline;	/**< Execute inline if no verdict by then */
+	char *cmd;		/**< Command to re-run */
+	MessageTag *mtags;	/**< Message tags of the command (copies) */
+	void *lr_context;	/**< Labeled response context of the command */
+	int parc;		/**< Parameter count for 'cmd' */
+	char *para[MAXPARA+2];	/**< Parameters for 'cmd' (copies) */
+};
+
+/** Commands that are parked, and which parameter holds the text */
+static struct {
+	char *cmd;
+	int para;
+	int targets;
+} spamfilter_async_commands[] = {
+	{ "PRIVMSG",	2, SPAMF_CHANMSG|SPAMF_USERMSG|SPAMF_DCC },
+	{ "NOTICE",	2, SPAMF_CHANNOTICE|SPAMF_USERNOTICE },
+	{ "PART",	2, SPAMF_PART },
+	{ "QUIT",	1, SPAMF_QUIT },
+	{ "AWAY",	1, SPAMF_AWAY },
+	{ "TOPIC",	2, SPAMF_TOPIC },
+	{ NULL,		0, 0 }
+};
+
+/** Bumped whenever a spamfilter is added or removed */
+static int spamfilter_version = 1;
+static SpamfilterSnapshot *spamfilter_snapshot = NULL;
+
+/** The request that is currently being resumed, see spamfilter_async_resume() */
+static SpamfilterRequest *spamfilter_resumed = NULL;
+
+/** Parked requests, oldest first */
+static struct list_head spamfilter_parked = LIST_HEAD_INIT(spamfilter_parked);
+
+/** Must be called when spamfilters are added or removed, so a new
+ * snapshot is created and verdicts of the old one are ignored.
+ */
+void spamfilter_async_invalidate(void)
+{
+	spamfilter_version++;
+}
+
+static void spamfilter_snapshot_release(SpamfilterSnapshot *s)
+{
+	int i;
+
+	if (--s->refcnt > 0)
+		return;
+	for (i = 0; i < s->count; i++)
+		unreal_delete_match(s->match[i]);
+	safe_free(s->match);
+	safe_free(s);
+}
+
+/** Get the current snapshot, creating a new one if spamfilters changed */
+static SpamfilterSnapshot *spamfilter_snapshot_get(void)
+{
+	SpamfilterSnapshot *s;
+	TKL *tkl;
+	int n = 0;
+
+	if (spamfilter_snapshot && (spamfilter_snapshot->version == spamfilter_version))
+		return spamfilter_snapshot;
+
+	if (spamfilter_snapshot)
+		spamfilter_snapshot_release(spamfilter_snapshot);
+
+	s = safe_alloc(sizeof(SpamfilterSnapshot));
+	s->refcnt = 1;
+	s->version = spamfilter_version;
+	for (tkl = tklines[tkl_hash('F')]; tkl; tkl = tkl->next)
+		if (tkl->ptr.spamfilter->match->type == MATCH_PCRE_REGEX)
+			n++;
+	if (n)
+		s->match = safe_alloc(sizeof(Match *) * n);
+	for (tkl = tklines[tkl_hash('F')]; tkl; tkl = tkl->next)
+	{
+		if (tkl->ptr.spamfilter->match->type != MATCH_PCRE_REGEX)
+			continue;
+		/* This compiles the same regex that was compiled before, so it cannot fail */
+		s->match[s->count] = unreal_create_match(MATCH_PCRE_REGEX, tkl->ptr.spamfilter->match->str, NULL);
+		if (!s->match[s->count])
+			s->match[s->count] = unreal_create_match(MATCH_SIMPLE, "", NULL); /* keep the indexes in sync */
+		s->targets |= tkl->ptr.spamfilter->target;
+		s->count++;
+	}
+
+	spamfilter_snapshot = s;
+	return s;
+}
+
+#ifdef HAVE_PTHREAD
+static int spamfilter_threads_started = 0;
+static int spamfilter_wakeup_pipe[2] = { -1, -1 };
+static pthread_mutex_t spamfilter_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spamfilter_queue_cond = PTHREAD_COND_INITIALIZER;
+static SpamfilterRequest *spamfilter_queue = NULL, *spamfilter_queue_tail = NULL; /**< Waiting for a thread */
+static SpamfilterRequest *spamfilter_done = NULL, *spamfilter_done_tail = NULL; /**< Finished, waiting for the main thread */
+
+/** Append a request to a queue. Caller must hold spamfilter_queue_lock. */
+static void spamfilter_queue_append(SpamfilterRequest **head, SpamfilterRequest **tail, SpamfilterRequest *r)
+{
+	r->next = NULL;
+	if (*tail)
+		(*tail)->next = r;
+	else
+		*head = r;
+	*tail = r;
+}
+
+/** Main function of each spamfilter thread: run regexes, forever.
+ * Only the request text and the snapshot are touched here,
+ * the snapshot is never freed while a request refers to it.
+ */
+static void *spamfilter_thread(void *arg)
+{
+	SpamfilterRequest *r;
+	int i;
+
+	while (1)
+	{
+		pthread_mutex_lock(&spamfilter_queue_lock);
+		while (!spamfilter_queue)
+			pthread_cond_wait(&spamfilter_queue_cond, &spamfilter_queue_lock);
+		r = spamfilter_queue;
+		spamfilter_queue = r->next;
+		if (!spamfilter_queue)
+			spamfilter_queue_tail = NULL;
+		pthread_mutex_unlock(&spamfilter_queue_lock);
+
+		for (i = 0; i < r->snapshot->count; i++)
+			r->result[i] = unreal_match(r->snapshot->match[i], r->text);
+
+		pthread_mutex_lock(&spamfilter_queue_lock);
+		spamfilter_queue_append(&spamfilter_done, &spamfilter_done_tail, r);
+		pthread_mutex_unlock(&spamfilter_queue_lock);
+
+		/* Wake up the main loop. If the pipe is full then a wakeup
+		 * is already pending anyway, so the result can be ignored.
+		 */
+		if (write(spamfilter_wakeup_pipe[1], "x", 1) < 0)
+			;
+	}
+	return NULL;
+}
+#endif
+
+static void spamfilter_async_free(SpamfilterRequest *r)
+{
+	int i;
+
+	spamfilter_snapshot_release(r->snapshot);
+	safe_free(r->text);
+	safe_free(r->result);
+	safe_free(r->cmd);
+	free_message_tags(r->mtags);
+	safe_free(r->lr_context);
+	for (i = 1; i < r->parc; i++)
+		safe_free(r->para[i]);
+	safe_free(r);
+}
+
+/** Execute the parked command, with or without a verdict.
+ * Afterwards any data that was queued for the client in the
+ * meantime is processed.
+ */
+static void spamfilter_async_resume(SpamfilterRequest *r, int have_verdict)
+{
+	Client *client = r->client;
+	char *parv[MAXPARA+2];
+	void *current;
+
+	list_del_init(&r->parked_node);
+	r->client = NULL;
+	client->local->spamfilter_request = NULL;
+
+	if (IsDead(client))
+		return;
+
+	if (have_verdict)
+		spamfilter_resumed = r;
+	r->client = client; /* only for spamfilter_async_verdict() */
+	/* Commands may change parv[], so pass a copy of the array */
+	memcpy(parv, r->para, sizeof(parv));
+	/* Reply with the label of the original command, see spamfilter_async_park() */
+	current = labeled_response_save_context();
+	labeled_response_set_context(r->lr_context);
+	do_cmd_resume(client, r->mtags, r->cmd, r->parc, parv);
+	if (!IsDead(client))
+		labeled_response_force_end();
+	labeled_response_set_context(current);
+	safe_free(current);
+	r->client = NULL;
+	spamfilter_resumed = NULL;
+
+	if (!IsDead(client))
+		parse_client_queued(client);
+}
+
+#ifdef HAVE_PTHREAD
+/** Called from the main loop when one or more spamfilter threads have finished */
+static void spamfilter_async_wakeup(int fd, int revents, void *data)
+{
+	char buf[128];
+	SpamfilterRequest *r, *r_next;
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&spamfilter_queue_lock);
+	r = spamfilter_done;
+	spamfilter_done = spamfilter_done_tail = NULL;
+	pthread_mutex_unlock(&spamfilter_queue_lock);
+
+	for (; r; r = r_next)
+	{
+		r_next = r->next;
+		if (r->client)
+			spamfilter_async_resume(r, 1);
+		spamfilter_async_free(r);
+	}
+}
+
+/** Start the spamfilter threads, if not done already.
+ * This is done on first use rather than on boot, since threads
+ * do not survive the fork() to the background.
+ * @returns 1 if the spamfilter threads are running, 0 on failure.
+ */
+static int spamfilter_threads_start(void)
+{
+	pthread_t thread;
+	sigset_t newset, oldset;
+	int i, started = 0;
+
+	if (spamfilter_threads_started)
+		return 1;
+
+	if (pipe(spamfilter_wakeup_pipe) < 0)
+	{
+		ircd_log(LOG_ERROR, "Could not create pipe for spamfilter threads: %s", strerror(errno));
+		return 0;
+	}
+	fcntl(spamfilter_wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(spamfilter_wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+	if (fd_open(spamfilter_wakeup_pipe[0], "Spamfilter threads wakeup pipe") < 0)
+	{
+		close(spamfilter_wakeup_pipe[0]);
+		close(spamfilter_wakeup_pipe[1]);
+		return 0;
+	}
+	fd_setselect(spamfilter_wakeup_pipe[0], FD_SELECT_READ, spamfilter_async_wakeup, NULL);
+
+	/* Signals should only ever be delivered to the main thread */
+	sigfillset(&newset);
+	pthread_sigmask(SIG_BLOCK, &newset, &oldset);
+	for (i = 0; i < SPAMFILTER_THREADS; i++)
+	{
+		if (pthread_create(&thread, NULL, spamfilter_thread, NULL) == 0)
+		{
+			pthread_detach(thread);
+			started++;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (!started)
+	{
+		ircd_log(LOG_ERROR, "Could not create any spamfilter threads, spamfilters will be run in the main thread.");
+		fd_close(spamfilter_wakeup_pipe[0]);
+		close(spamfilter_wakeup_pipe[1]);
+		return 0;
+	}
+
+	spamfilter_threads_started = 1;
+	return 1;
+}
+#endif
+
+/** Park a command from a local user until the regex spamfilters
+ * have been run on its text by a spamfilter thread.
+ * This is called from parse() right before a command is executed.
+ * @param client  The client (a local user).
+ * @param cmd     The command, eg "PRIVMSG".
+ * @param mtags   Message tags received with the command.
+ * @param parc    Parameter count.
+ * @param parv    Parameters.
+ * @returns 1 if the command was parked (the caller should not execute
+ *          it, this happens later), 0 if it should be executed now.
+ * @note When parked, the labeled-response context is moved to the
+ *       request, so the label is not answered when parse() returns.
+ */
+int spamfilter_async_park(Client *client, char *cmd, MessageTag *mtags, int parc, char *parv[])
+{
+#ifdef HAVE_PTHREAD
+	SpamfilterRequest *r;
+	SpamfilterSnapshot *s;
+	int i;
+
+	if (!SPAMFILTER_ASYNC || !MyUser(client) || client->local->spamfilter_request ||
+	    IsAuthPending(client) || !loop.ircd_booted)
+	{
+		return 0;
+	}
+
+	for (i = 0; spamfilter_async_commands[i].cmd; i++)
+		if (!strcmp(spamfilter_async_commands[i].cmd, cmd))
+			break;
+	if (!spamfilter_async_commands[i].cmd || (parc <= spamfilter_async_commands[i].para) ||
+	    BadPtr(parv[spamfilter_async_commands[i].para]))
+	{
+		return 0;
+	}
+
+	s = spamfilter_snapshot_get();
+	if (!(s->targets & spamfilter_async_commands[i].targets))
+		return 0; /* no regex spamfilters for this command */
+
+	if (IsULine(client) || ValidatePermissionsForPath("immune:server-ban:spamfilter",client,NULL,NULL,NULL))
+		return 0;
+
+	if (!spamfilter_threads_start())
+		return 0;
+
+	r = safe_alloc(sizeof(SpamfilterRequest));
+	r->client = client;
+	r->snapshot = s;
+	s->refcnt++;
+	safe_strdup(r->text, StripControlCodes(parv[spamfilter_async_commands[i].para]));
+	r->result = safe_alloc(s->count);
+	r->deadline = timeofday_tv;
+	r->deadline.tv_sec += SPAMFILTER_ASYNC_TIMEOUT / 1000;
+	r->deadline.tv_usec += (SPAMFILTER_ASYNC_TIMEOUT % 1000) * 1000;
+	if (r->deadline.tv_usec >= 1000000)
+	{
+		r->deadline.tv_sec++;
+		r->deadline.tv_usec -= 1000000;
+	}
+	safe_strdup(r->cmd, cmd);
+	r->mtags = duplicate_mtags(mtags);
+	r->lr_context = labeled_response_save_context();
+	labeled_response_set_context(NULL);
+	r->parc = MIN(parc, MAXPARA);
+	/* parv[0] is never used (and may be poisoned), start at 1 */
+	for (i = 1; i < r->parc; i++)
+		safe_strdup(r->para[i], parv[i]);
+
+	client->local->spamfilter_request = r;
+	list_add_tail(&r->parked_node, &spamfilter_parked);
+
+	pthread_mutex_lock(&spamfilter_queue_lock);
+	spamfilter_queue_append(&spamfilter_queue, &spamfilter_queue_tail, r);
+	pthread_cond_signal(&spamfilter_queue_cond);
+	pthread_mutex_unlock(&spamfilter_queue_lock);
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/** Get the verdict for 'str', if we are executing a command that was
+ * parked and the spamfilter thread evaluated exactly this text with
+ * the current set of spamfilters.
+ * @returns An array with a match result (1/0) for each regex spamfilter,
+ *          in the order of the spamfilter list, or NULL if the regexes
+ *          should be run inline.
+ */
+char *spamfilter_async_verdict(Client *client, char *str)
+{
+	if (!spamfilter_resumed || (spamfilter_resumed->client != client) ||
+	    (spamfilter_resumed->snapshot->version != spamfilter_version) ||
+	    strcmp(spamfilter_resumed->text, str))
+	{
+		return NULL;
+	}
+	return spamfilter_resumed->result;
+}
+
+/** Execute parked commands that have waited longer than
+ * set::spamfilter::async-timeout. Their text is evaluated inline.
+ * The request itself is freed once the thread is done with it.
+ */
+void spamfilter_async_check_timeouts(void)
+{
+	SpamfilterRequest *r;
+
+	while (!list_empty(&spamfilter_parked))
+	{
+		r = list_first_entry(&spamfilter_parked, SpamfilterRequest, parked_node);
+		if ((r->deadline.tv_sec > timeofday_tv.tv_sec) ||
+		    ((r->deadline.tv_sec == timeofday_tv.tv_sec) && (r->deadline.tv_usec > timeofday_tv.tv_usec)))
+		{
+			break; /* the rest is younger */
+		}
+		spamfilter_async_resume(r, 0);
+	}
+}
+
+/** The client is being freed, forget about any parked command.
+ * The request is still finished by the thread and freed afterwards.
+ */
+void spamfilter_async_cancel(Client *client)
+{
+	SpamfilterRequest *r = client->local->spamfilter_request;
+
+	if (r)
+	{
+		list_del_init(&r->parked_node);
+		r->client = NULL;
+		safe_free(r->lr_context);
+		client->local->spamfilter_request = NULL;
+	}
+}
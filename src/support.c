@@ -1017,7 +1017,7 @@ time_t unreal_getfilemodtime(const char *filename)
 #endif
 
 /** Encode an IP string (eg: "1.2.3.4") to a BASE64 encoded value for S2S traffic */
-char *encode_ip(char *ip)
+char *encode_ip(const char *ip)
 {
 	static char retbuf[25]; /* returned string */
 	char addrbuf[16];
@@ -1065,6 +1065,93 @@ char *decode_ip(char *buf)
 		return NULL;
 }
 
+/** Convert an IP address string to binary form.
+ * IPv4 addresses are stored as IPv4-mapped IPv6 addresses (::ffff:a.b.c.d)
+ * so that all code can deal with one format of RAWIPLEN bytes.
+ * @param ip   The IP address string, eg "1.2.3.4" or "2001:db8::1"
+ * @param raw  The buffer to store the result in (RAWIPLEN bytes)
+ * @returns 1 on success, 0 if it is not a valid IP (raw is zeroed then).
+ */
+int ip_to_raw(const char *ip, unsigned char *raw)
+{
+	memset(raw, 0, RAWIPLEN);
+	if (strchr(ip, ':'))
+	{
+		if (inet_pton(AF_INET6, ip, raw) == 1)
+			return 1;
+	} else {
+		raw[10] = raw[11] = 0xff;
+		if (inet_pton(AF_INET, ip, raw + 12) == 1)
+			return 1;
+	}
+	memset(raw, 0, RAWIPLEN);
+	return 0;
+}
+
+/** Returns 1 if the binary IP address is an IPv4 address, 0 if IPv6. */
+int raw_ip_is_ipv4(const unsigned char *raw)
+{
+	static const unsigned char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+	return !memcmp(raw, v4mapped, sizeof(v4mapped));
+}
+
+/** Copy the first 'bits' bits of a binary IP address, zeroing the rest.
+ * @note 'bits' counts from the start of the RAWIPLEN bytes, so for
+ *       an IPv4 /24 you need to pass 96+24.
+ */
+void raw_ip_prefix(unsigned char *dst, const unsigned char *raw, int bits)
+{
+	int n;
+
+	if (bits < 0)
+		bits = 0;
+	if (bits > RAWIPLEN * 8)
+		bits = RAWIPLEN * 8;
+	n = bits / 8;
+	memcpy(dst, raw, n);
+	memset(dst + n, 0, RAWIPLEN - n);
+	if (bits % 8)
+		dst[n] = raw[n] & (0xff << (8 - (bits % 8)));
+}
+
+/** Returns 1 if the first 'bits' bits of both binary IP addresses are equal.
+ * @note See raw_ip_prefix() on how 'bits' is counted.
+ */
+int raw_ip_match(const unsigned char *a, const unsigned char *b, int bits)
+{
+	unsigned char pa[RAWIPLEN], pb[RAWIPLEN];
+
+	raw_ip_prefix(pa, a, bits);
+	raw_ip_prefix(pb, b, bits);
+	return !memcmp(pa, pb, RAWIPLEN);
+}
+
+/** Hash the first 'bits' bits of a binary IP address.
+ * @param raw   The binary IP address
+ * @param bits  Number of bits to use, see raw_ip_prefix()
+ * @param key   The siphash key (SIPHASH_KEY_LENGTH bytes)
+ * @returns The hash value, the caller still needs to apply the modulo.
+ */
+uint64_t hash_raw_ip(const unsigned char *raw, int bits, const char *key)
+{
+	unsigned char prefix[RAWIPLEN];
+
+	raw_ip_prefix(prefix, raw, bits);
+	return siphash_raw((const char *)prefix, RAWIPLEN, key);
+}
+
+/** Set the IP address of a client, both client->ip and client->rawip.
+ * Always use this instead of setting client->ip directly.
+ * @note client->ip is a shared string, see scache_add().
+ */
+void set_client_ip(Client *client, const char *ip)
+{
+	scache_set(client->ip, ip);
+	if (!ip || !ip_to_raw(ip, client->rawip))
+		memset(client->rawip, 0, RAWIPLEN);
+}
+
 /* IPv6 stuff */
 
 #ifndef IN6ADDRSZ
@@ -641,6 +641,20 @@ char *tls_get_cipher(SSL *ssl)
 	return buf;
 }
 
+/** Get the TLS protocol and cipher of a secure client, eg "TLSv1.3-TLS_AES_256_GCM_SHA384".
+ * This also works for clients of which a proxy terminated the TLS
+ * connection (listen::options::proxy), as reported by the proxy.
+ * @returns The protocol and cipher, or NULL if the client is not using TLS.
+ */
+char *tls_get_client_cipher(Client *client)
+{
+	if (!MyConnect(client))
+		return NULL;
+	if (client->local->ssl)
+		return tls_get_cipher(client->local->ssl);
+	return client->local->proxy_tls_cipher;
+}
+
 /** Get the applicable ::tls-options block for this local client,
  * which may be defined in the link block, listen block, or set block.
  */
@@ -1309,12 +1323,19 @@ int outdated_tls_client(Client *client)
 {
 	TLSOptions *tlsoptions = get_tls_options_for_client(client);
 	char buf[1024], *name, *p;
-	const char *client_protocol = SSL_get_version(client->local->ssl);
-	const char *client_ciphersuite = SSL_get_cipher(client->local->ssl);
+	const char *client_protocol;
+	const char *client_ciphersuite;
 
 	if (!tlsoptions)
 		return 0; /* odd.. */
 
+	/* TLS terminated by a proxy: that one is responsible for the protocols and ciphers */
+	if (!client->local->ssl)
+		return 0;
+
+	client_protocol = SSL_get_version(client->local->ssl);
+	client_ciphersuite = SSL_get_cipher(client->local->ssl);
+
 	strlcpy(buf, tlsoptions->outdated_protocols, sizeof(buf));
 	for (name = strtoken(&p, buf, ","); name; name = strtoken(&p, NULL, ","))
 	{
@@ -66,7 +66,7 @@ void iNAH_host(Client *client, char *host)
 
 	userhost_save_current(client);
 
-	safe_strdup(client->user->virthost, host);
+	scache_set(client->user->virthost, host);
 	if (MyConnect(client))
 		sendto_server(NULL, 0, 0, NULL, ":%s SETHOST :%s", client->id, client->user->virthost);
 	client->umodes |= UMODE_SETHOST;
@@ -347,7 +347,10 @@ void set_snomask(Client *client, char *snomask)
 					if (Snomask_Table[i].allowed && !Snomask_Table[i].allowed(client,what))
 						continue;
 		 	 		if (what == MODE_ADD)
+		 	 		{
 			 	 		client->user->snomask |= Snomask_Table[i].mode;
+			 	 		snomask_subscribed |= Snomask_Table[i].mode;
+		 	 		}
 			 	 	else
 			 	 		client->user->snomask &= ~Snomask_Table[i].mode;
 		 	 	}
@@ -588,6 +591,9 @@ int is_handshake_finished(Client *client)
 	Hook *h;
 	int n;
 
+	if (IsAuthPending(client))
+		return 0; /* Still waiting for an auth thread */
+
 	for (h = Hooks[HOOKTYPE_IS_HANDSHAKE_FINISHED]; h; h = h->next)
 	{
 		n = (*(h->func.intfunc))(client);
@@ -657,26 +663,38 @@ const char *uid_get(void)
 }
 
 /** Get cloaked host for user */
-char *getcloak(Client *client)
+const char *getcloak(Client *client)
 {
 	if (!*client->user->cloakedhost)
 	{
 		/* need to calculate (first-time) */
-		make_cloakedhost(client, client->user->realhost, client->user->cloakedhost, sizeof(client->user->cloakedhost));
+		update_cloakedhost(client);
 	}
 
 	return client->user->cloakedhost;
 }
 
+/** (Re)calculate the cloaked host of a user from its real host,
+ * see make_cloakedhost().
+ */
+void update_cloakedhost(Client *client)
+{
+	char buf[HOSTLEN + 1];
+
+	make_cloakedhost(client, client->user->realhost, buf, sizeof(buf));
+	scache_set(client->user->cloakedhost, buf);
+}
+
 /** Calculate the cloaked host for a client.
  * @param client	The client
  * @param curr		The real host or real IP
  * @param buf		Buffer to store the new cloaked host in
  * @param buflen	Length of the buffer (should be HOSTLEN+1)
  */
-void make_cloakedhost(Client *client, char *curr, char *buf, size_t buflen)
+void make_cloakedhost(Client *client, const char *curr, char *buf, size_t buflen)
 {
-	char host[256], *mask, *p, *q;
+	char host[256], *q;
+	const char *mask, *p;
 
 	/* Convert host to lowercase and cut off at 255 bytes just to be sure */
 	for (p = curr, q = host; *p && (q < host+sizeof(host)-1); p++, q++)
@@ -44,7 +44,7 @@ void add_history(Client *client, int online)
 	{
 		safe_free(new->name);
 		safe_free(new->hostname);
-		safe_free(new->virthost);
+		scache_free(new->virthost);
 		safe_free(new->realname);
 		safe_free(new->username);
 		new->servername = NULL;
@@ -60,9 +60,9 @@ void add_history(Client *client, int online)
 	safe_strdup(new->username, client->user->username);
 	safe_strdup(new->hostname, client->user->realhost);
 	if (client->user->virthost)
-		safe_strdup(new->virthost, client->user->virthost);
+		scache_set(new->virthost, client->user->virthost);
 	else
-		safe_strdup(new->virthost, "");
+		scache_set(new->virthost, "");
 	new->servername = client->user->server;
 	safe_strdup(new->realname, client->info);
 
@@ -0,0 +1,354 @@
+/************************************************************************
+ * UnrealIRCd - Unreal Internet Relay Chat Daemon - src/zip.c
+ * (c) 2020- Bram Matthys and The UnrealIRCd team
+ *
+ * See file AUTHORS in IRC package for additional names of
+ * the programmers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** @file
+ * @brief Compressed server links (link::options::compression).
+ *
+ * Server to server traffic consists of many short, very similar
+ * lines (message tags, UIDs, PRIVMSG, MODE, SJOIN, ..). Compressing
+ * these one by one does not work well, so we keep one zlib stream per
+ * direction for the lifetime of the link and use a preset dictionary
+ * with typical server traffic, so even the first lines compress well.
+ *
+ * Compression is negotiated via PROTOCTL ZIP=<dictionary version>.
+ * Once both sides agree, each side sends a "ZIP" command and
+ * everything it sends after that line is compressed.
+ */
+
+#include "unrealircd.h"
+
+#ifdef ZIP_LINKS
+#include <zlib.h>
+
+/** Compression level, higher costs more CPU for little gain on IRC traffic */
+#define ZIP_LEVEL	6
+
+/** Size of the temporary buffer for (de)compressed data */
+#define ZIP_BUFFER_SIZE	16384
+
+struct ZipLink {
+	z_stream in;		/**< Decompression stream (incoming data) */
+	z_stream out;		/**< Compression stream (outgoing data) */
+	unsigned char in_active;	/**< 'in' is initialized */
+	unsigned char out_active;	/**< 'out' is initialized */
+	unsigned char out_pending;	/**< Data was deflated but not flushed yet */
+	ZipStats stats;		/**< Statistics for STATS Z */
+};
+
+/** The preset dictionary, shared by both sides of the link.
+ * zlib favors strings near the end of the dictionary, so the most
+ * frequently seen strings are listed last.
+ * Never change this without also bumping ZIP_DICTIONARY_VERSION.
+ */
+static char zip_dictionary[] =
+	"PROTOCTL NOQUIT NICKv2 SJOIN SJOIN2 UMODE2 VL SJ3 TKLEXT TKLEXT2 NICKIP ESVID MTAGS "
+	"SERVER NETINFO SINFO EOS SQUIT SID PASS ERROR :Closing Link: "
+	"TKL + G * :Banned SVSMODE SVS2MODE SVSNICK SVSJOIN SVSPART SWHOIS SETHOST CHGHOST CHGIDENT CHGNAME "
+	"WHOIS INVITE KNOCK KILL AWAY TOPIC UMODE2 +iwx +oiwsx SETNAME "
+	"MD client certfp reputation operinfo creationtime tls_cipher TLSv1.3-TLS_CHACHA20_POLY1305_SHA256 "
+	"MLOCK :Quit: Ping timeout: 240 seconds Connection reset by peer Read error: Remote host closed the connection "
+	"PING PONG :irc. .net .com .org users.undernet.IP Clk- cloaked "
+	"UID 0 * 0 :realname 001AAAAAA 002AAAAAA "
+	"SJOIN :@+ MODE +nt +o +v +b +ntr +b *!*@* "
+	"KICK PART QUIT JOIN NICK "
+	"@s2s-md/ @unrealircd.org/userhost=;unrealircd.org/userip=;account=;"
+	"@time=2020-01-01T00:00:00.000Z;msgid= PRIVMSG NOTICE #"
+	;
+
+static void zip_error(Client *client, char *what, z_stream *zs, int ret)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), "Compression error (%s): %s",
+		what, zs->msg ? zs->msg : zError(ret));
+	dead_socket(client, buf);
+}
+
+/** Microseconds elapsed between two timevals */
+static long long zip_usec(struct timeval *tv_alpha, struct timeval *tv_beta)
+{
+	return ((long long)tv_beta->tv_sec - tv_alpha->tv_sec) * 1000000 +
+	       (tv_beta->tv_usec - tv_alpha->tv_usec);
+}
+
+static ZipLink *zip_get(Client *client)
+{
+	if (!client->local->zip)
+		client->local->zip = safe_alloc(sizeof(ZipLink));
+	return client->local->zip;
+}
+
+/** Start compressing everything sent to 'client' from now on.
+ * @param client	The server link
+ * @returns 1 on success, 0 on failure (the link is marked dead).
+ */
+int zip_start_output(Client *client)
+{
+	ZipLink *zip = zip_get(client);
+	int ret;
+
+	if (zip->out_active)
+		return 1;
+
+	if ((ret = deflateInit(&zip->out, ZIP_LEVEL)) != Z_OK)
+	{
+		zip_error(client, "deflateInit", &zip->out, ret);
+		return 0;
+	}
+	zip->out_active = 1;
+	if ((ret = deflateSetDictionary(&zip->out, (Bytef *)zip_dictionary, sizeof(zip_dictionary)-1)) != Z_OK)
+	{
+		zip_error(client, "deflateSetDictionary", &zip->out, ret);
+		return 0;
+	}
+	SetZipOut(client);
+	return 1;
+}
+
+/** Start decompressing everything received from 'client' from now on.
+ * This is called right after parsing the "ZIP" line, so any data
+ * that is still in the receive queue is already compressed.
+ * @param client	The server link
+ * @returns 1 on success, 0 on failure (the link is marked dead).
+ */
+int zip_start_input(Client *client)
+{
+	ZipLink *zip = zip_get(client);
+	dbufbuf *block;
+	char *buf;
+	int len, ret, n;
+
+	if (zip->in_active)
+		return 1;
+
+	if ((ret = inflateInit(&zip->in)) != Z_OK)
+	{
+		zip_error(client, "inflateInit", &zip->in, ret);
+		return 0;
+	}
+	zip->in_active = 1;
+	SetZipIn(client);
+
+	len = DBufLength(&client->local->recvQ);
+	if (len == 0)
+		return 1;
+
+	/* Take the (compressed) rest of the receive queue out and
+	 * put it back in decompressed form.
+	 */
+	buf = safe_alloc(len);
+	n = 0;
+	while (DBufLength(&client->local->recvQ) > 0)
+	{
+		block = container_of(client->local->recvQ.dbuf_list.next, dbufbuf, dbuf_node);
+		memcpy(buf + n, block->data, block->size);
+		n += block->size;
+		dbuf_delete(&client->local->recvQ, block->size);
+	}
+	ret = zip_input(client, buf, n);
+	safe_free(buf);
+	return ret;
+}
+
+/** Compress a message and add it to the send queue of 'client'.
+ * The data is not flushed yet, this happens in zip_flush()
+ * from send_queued(), so many messages share one flush.
+ */
+void zip_output(Client *client, char *msg, int len)
+{
+	ZipLink *zip = client->local->zip;
+	unsigned char buf[ZIP_BUFFER_SIZE];
+	struct timeval tv_alpha, tv_beta;
+	int ret;
+
+	gettimeofday(&tv_alpha, NULL);
+	zip->out.next_in = (Bytef *)msg;
+	zip->out.avail_in = len;
+	do {
+		zip->out.next_out = buf;
+		zip->out.avail_out = sizeof(buf);
+		ret = deflate(&zip->out, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			zip_error(client, "deflate", &zip->out, ret);
+			return;
+		}
+		if (zip->out.avail_out < sizeof(buf))
+		{
+			dbuf_put(&client->local->sendQ, (char *)buf, sizeof(buf) - zip->out.avail_out);
+			zip->stats.out_zipped += sizeof(buf) - zip->out.avail_out;
+		}
+	} while (zip->out.avail_in > 0 || zip->out.avail_out == 0);
+	gettimeofday(&tv_beta, NULL);
+
+	zip->out_pending = 1;
+	zip->stats.out_bytes += len;
+	zip->stats.out_usec += zip_usec(&tv_alpha, &tv_beta);
+}
+
+/** Flush all compressed data to the send queue of 'client',
+ * so the other side can decompress everything we sent so far.
+ */
+void zip_flush(Client *client)
+{
+	ZipLink *zip = client->local->zip;
+	unsigned char buf[ZIP_BUFFER_SIZE];
+	struct timeval tv_alpha, tv_beta;
+	int ret;
+
+	if (!zip || !zip->out_pending)
+		return;
+
+	gettimeofday(&tv_alpha, NULL);
+	zip->out.next_in = NULL;
+	zip->out.avail_in = 0;
+	do {
+		zip->out.next_out = buf;
+		zip->out.avail_out = sizeof(buf);
+		ret = deflate(&zip->out, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			zip_error(client, "deflate", &zip->out, ret);
+			return;
+		}
+		if (zip->out.avail_out < sizeof(buf))
+		{
+			dbuf_put(&client->local->sendQ, (char *)buf, sizeof(buf) - zip->out.avail_out);
+			zip->stats.out_zipped += sizeof(buf) - zip->out.avail_out;
+		}
+	} while (zip->out.avail_out == 0);
+	gettimeofday(&tv_beta, NULL);
+
+	zip->out_pending = 0;
+	zip->stats.out_usec += zip_usec(&tv_alpha, &tv_beta);
+}
+
+/** Decompress data read from 'client' and add it to the receive queue.
+ * @returns 1 on success, 0 on failure (the link is marked dead).
+ */
+int zip_input(Client *client, char *data, int len)
+{
+	ZipLink *zip = client->local->zip;
+	unsigned char buf[ZIP_BUFFER_SIZE];
+	struct timeval tv_alpha, tv_beta;
+	int ret;
+
+	gettimeofday(&tv_alpha, NULL);
+	zip->in.next_in = (Bytef *)data;
+	zip->in.avail_in = len;
+	do {
+		zip->in.next_out = buf;
+		zip->in.avail_out = sizeof(buf);
+		ret = inflate(&zip->in, Z_SYNC_FLUSH);
+		if (ret == Z_NEED_DICT)
+		{
+			ret = inflateSetDictionary(&zip->in, (Bytef *)zip_dictionary, sizeof(zip_dictionary)-1);
+			if (ret != Z_OK)
+			{
+				zip_error(client, "inflateSetDictionary", &zip->in, ret);
+				return 0;
+			}
+			continue;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			zip_error(client, "inflate", &zip->in, ret);
+			return 0;
+		}
+		if (zip->in.avail_out < sizeof(buf))
+		{
+			dbuf_put(&client->local->recvQ, (char *)buf, sizeof(buf) - zip->in.avail_out);
+			zip->stats.in_bytes += sizeof(buf) - zip->in.avail_out;
+		}
+	} while (zip->in.avail_in > 0 || zip->in.avail_out == 0);
+	gettimeofday(&tv_beta, NULL);
+
+	zip->stats.in_zipped += len;
+	zip->stats.in_usec += zip_usec(&tv_alpha, &tv_beta);
+	return 1;
+}
+
+/** Free the compression state of 'client', if any */
+void zip_free(Client *client)
+{
+	ZipLink *zip = client->local->zip;
+
+	if (!zip)
+		return;
+
+	if (zip->in_active)
+		inflateEnd(&zip->in);
+	if (zip->out_active)
+		deflateEnd(&zip->out);
+	safe_free(zip);
+	client->local->zip = NULL;
+	ClearZipIn(client);
+	ClearZipOut(client);
+}
+
+/** Get the compression statistics of 'client'.
+ * @returns The statistics, or NULL if the link is not compressed.
+ */
+ZipStats *zip_get_stats(Client *client)
+{
+	if (!MyConnect(client) || !client->local->zip)
+		return NULL;
+	return &client->local->zip->stats;
+}
+
+#else
+/* Compiled without zlib: compression is never negotiated,
+ * see also the config test for link::options::compression.
+ */
+int zip_start_output(Client *client)
+{
+	return 0;
+}
+
+int zip_start_input(Client *client)
+{
+	dead_socket(client, "Compressed link requested but compression is not available");
+	return 0;
+}
+
+void zip_output(Client *client, char *msg, int len)
+{
+}
+
+void zip_flush(Client *client)
+{
+}
+
+int zip_input(Client *client, char *data, int len)
+{
+	return 0;
+}
+
+void zip_free(Client *client)
+{
+}
+
+ZipStats *zip_get_stats(Client *client)
+{
+	return NULL;
+}
+#endif